@@ -1,4 +1,5 @@
 #include <nc_event.h>
+#include <nc_util.h>
 
 #ifdef NC_HAVE_EPOLL
 #include <sys/epoll.h>
@@ -63,18 +64,24 @@ NcEventBase::~NcEventBase()
     ::free(m_event_);
 }
 
-int NcEventBase::addInput(NcConnBase *c)
+/*
+ * epoll keeps one mask per fd, so every change of one direction has to
+ * carry the other one along
+ */
+static int epollMod(int ep, NcConnBase *c, int recv, int send)
 {
     int status;
     struct epoll_event event;
-    int ep = m_event_->ep;
 
-    if (c->m_recv_active_) 
+    event.events = (uint32_t)EPOLLET;
+    if (recv)
     {
-        return 0;
+        event.events |= EPOLLIN;
+    }
+    if (send)
+    {
+        event.events |= EPOLLOUT;
     }
-
-    event.events = (uint32_t)(EPOLLIN | EPOLLET);
     event.data.ptr = c;
 
     status = epoll_ctl(ep, EPOLL_CTL_MOD, c->m_sd_, &event);
@@ -84,70 +91,51 @@ int NcEventBase::addInput(NcConnBase *c)
     } 
     else 
     {
-        c->m_recv_active_ = 1;
+        c->m_recv_active_ = recv;
+        c->m_send_active_ = send;
     }
 
     return status;
 }
 
-int NcEventBase::delInput(NcConnBase *c)
+int NcEventBase::addInput(NcConnBase *c)
 {
-    LOG_DEBUG("c : %p", c);
-    return 0;
+    if (c->m_recv_active_) 
+    {
+        return 0;
+    }
+
+    return epollMod(m_event_->ep, c, 1, c->m_send_active_);
 }
 
-int NcEventBase::addOutput(NcConnBase *c)
+int NcEventBase::delInput(NcConnBase *c)
 {
-    int status;
-    struct epoll_event event;
-    int ep = m_event_->ep;
-
-    if (c->m_send_active_) 
+    if (!c->m_recv_active_) 
     {
         return 0;
     }
 
-    event.events = (uint32_t)(EPOLLIN | EPOLLOUT | EPOLLET);
-    event.data.ptr = c;
+    return epollMod(m_event_->ep, c, 0, c->m_send_active_);
+}
 
-    status = epoll_ctl(ep, EPOLL_CTL_MOD, c->m_sd_, &event);
-    if (status < 0) 
-    {
-        LOG_ERROR("epoll_ctl error, status:%d", status);
-    } 
-    else 
+int NcEventBase::addOutput(NcConnBase *c)
+{
+    if (c->m_send_active_) 
     {
-        c->m_send_active_ = 1;
+        return 0;
     }
 
-    return status;
+    return epollMod(m_event_->ep, c, c->m_recv_active_, 1);
 }
 
 int NcEventBase::delOutput(NcConnBase *c)
 {
-    int status;
-    struct epoll_event event;
-    int ep = m_event_->ep;
-
     if (!c->m_send_active_) 
     {
         return 0;
     }
 
-    event.events = (uint32_t)(EPOLLIN | EPOLLET);
-    event.data.ptr = c;
-
-    status = epoll_ctl(ep, EPOLL_CTL_MOD, c->m_sd_, &event);
-    if (status < 0) 
-    {
-        LOG_ERROR("epoll_ctl error, status:%d", status);
-    } 
-    else 
-    {
-        c->m_send_active_ = 0;
-    }
-
-    return status;
+    return epollMod(m_event_->ep, c, c->m_recv_active_, 0);
 }
 
 int NcEventBase::addConn(NcConnBase *c, uint32_t events)
@@ -177,8 +165,8 @@ int NcEventBase::addConn(NcConnBase *c, uint32_t events)
     } 
     else 
     {
-        c->m_send_active_ = 1;
-        c->m_recv_active_ = 1;
+        c->m_recv_active_ = (events & EVENT_READ) ? 1 : 0;
+        c->m_send_active_ = (events & EVENT_WRITE) ? 1 : 0;
     }
 
     return status;
@@ -214,6 +202,7 @@ int NcEventBase::wait(int timeout)
         int i, nsd;
 
         nsd = epoll_wait(ep, event, nevent, timeout);
+        NcUtil::ncTimeUpdate();
         LOG_DEBUG("nsd : %d", nsd);
 
         if (nsd > 0) 
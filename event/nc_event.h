@@ -21,6 +21,7 @@
 #include <netinet/tcp.h>
 
 #include <nc_log.h>
+#include <nc_queue.h>
 
 #define EVENT_SIZE  1024
 
@@ -74,6 +75,9 @@ typedef enum
 class NcConnBase
 {
 public:
+    virtual ~NcConnBase()
+    { }
+
     virtual int callback(uint32_t events) = 0;
 
     ssize_t recv(void *buf, size_t size)
@@ -230,7 +234,7 @@ public:
         return NC_EVENT_ERROR;
     }
 
-    inline void reset()
+    virtual void reset()
     {
         m_sd_ = -1;
         m_events_ = 0;
@@ -249,6 +253,9 @@ public:
 
         m_send_bytes_ = 0;
         m_recv_bytes_ = 0;
+
+        m_conn_tqe_.reset();
+        m_throttle_tqe_.reset();
     }
 
     inline void setSd(int sd)
@@ -285,6 +292,8 @@ public:
     int         m_sd_;            /* socket descriptor */
     uint32_t    m_events_;        /* connection io events */
     int         m_err_;           /* connection errno */
+    NcQueueEntry<NcConnBase> m_conn_tqe_;  /* link in server_pool / server q */
+    NcQueueEntry<NcConnBase> m_throttle_tqe_;  /* link in throttled client q */
     int         m_family_;          /* socket address family */
     socklen_t   m_addrlen_;         /* socket length */
     struct sockaddr     *m_addr_;           /* socket address (ref in server or server_pool) */
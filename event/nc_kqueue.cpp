@@ -1,4 +1,5 @@
 #include <nc_event.h>
+#include <nc_util.h>
 
 #ifdef NC_HAVE_KQUEUE
 #include <sys/event.h>
@@ -221,6 +222,7 @@ int NcEventBase::wait(int timeout)
         m_event_->nreturned = kevent(kq, m_event_->change, 
             m_event_->nchange, m_event_->event, m_event_->nevent, tsp);
         m_event_->nchange = 0;
+        NcUtil::ncTimeUpdate();
         if (m_event_->nreturned > 0) 
         {
             for (m_event_->nprocessed = 0; 
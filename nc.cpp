@@ -33,6 +33,14 @@
 #define NC_MBUF_MIN_SIZE    MBUF_MIN_SIZE
 #define NC_MBUF_MAX_SIZE    MBUF_MAX_SIZE
 
+#define NC_ARENA_SIZE       0           /* in MB, off */
+#define NC_ARENA_MAX_SIZE   (1024 * 1024)
+
+#define NC_BUDGET_SIZE      0           /* in MB, unlimited */
+#define NC_BUDGET_MAX_SIZE  (1024 * 1024)
+
+#define NC_POOL_PREALLOC    NC_POOL_LOW /* objects, 0 is off */
+
 static int s_show_help;
 static int s_show_version;
 static int s_test_conf;
@@ -53,10 +61,13 @@ static struct option s_long_options[] = {
     { "stats-addr",     required_argument,  NULL,   'a' },
     { "pid-file",       required_argument,  NULL,   'p' },
     { "mbuf-size",      required_argument,  NULL,   'm' },
+    { "arena-size",     required_argument,  NULL,   'M' },
+    { "memory-budget",  required_argument,  NULL,   'B' },
+    { "pool-prealloc",  required_argument,  NULL,   'P' },
     { NULL,             0,                  NULL,    0  },
 };
 
-static char s_short_options[] = "hVtdDv:o:c:s:i:a:p:m:";
+static char s_short_options[] = "hVtdDv:o:c:s:i:a:p:m:M:B:P:";
 
 static void ncShowUsage(void)
 {
@@ -64,6 +75,7 @@ static void ncShowUsage(void)
         "Usage: nutcracker [-?hVdDt] [-v verbosity level] [-o output file]" CRLF
         "                  [-c conf file] [-s stats port] [-a stats addr]" CRLF
         "                  [-i stats interval] [-p pid file] [-m mbuf size]" CRLF
+        "                  [-M arena size] [-B memory budget] [-P pool prealloc]" CRLF
         "");
     LOGA(
         "Options:" CRLF
@@ -81,13 +93,16 @@ static void ncShowUsage(void)
         "  -i, --stats-interval=N : set stats aggregation interval in msec (default: %d msec)" CRLF
         "  -p, --pid-file=S       : set pid file (default: %s)" CRLF
         "  -m, --mbuf-size=N      : set size of mbuf chunk in bytes (default: %d bytes)" CRLF
+        "  -M, --arena-size=N     : reserve N MB of hugepage backed memory for mbufs and messages (default: %d, off)" CRLF
+        "  -B, --memory-budget=N  : throttle client reads once mbufs and messages use N MB (default: %d, unlimited)" CRLF
+        "  -P, --pool-prealloc=N  : preallocate N messages and client connections at startup, 0 for none (default: %d)" CRLF
         "",
         NC_LOG_DEFAULT, NC_LOG_MIN, NC_LOG_MAX,
         NC_LOG_PATH != NULL ? NC_LOG_PATH : "stderr",
         NC_CONF_PATH,
         NC_STATS_PORT, NC_STATS_ADDR, NC_STATS_INTERVAL,
         NC_PID_FILE != NULL ? NC_PID_FILE : "off",
-        NC_MBUF_SIZE);
+        NC_MBUF_SIZE, NC_ARENA_SIZE, NC_BUDGET_SIZE, NC_POOL_PREALLOC);
 }
 
 static rstatus_t ncGetOptions(int argc, char **argv, NcInstance *nci)
@@ -180,6 +195,36 @@ static rstatus_t ncGetOptions(int argc, char **argv, NcInstance *nci)
             }
             nci->mbuf_chunk_size = (size_t)value;
             break;
+        case 'M':
+            value = nc_atoi(optarg, strlen(optarg));
+            if (value < 0 || value > NC_ARENA_MAX_SIZE) 
+            {
+                LOG_ERROR("nutcracker: option -M requires a number of MB between 0"
+                           " and %d", NC_ARENA_MAX_SIZE);
+                return NC_ERROR;
+            }
+            nci->arena_size = (size_t)value * 1024 * 1024;
+            break;
+        case 'B':
+            value = nc_atoi(optarg, strlen(optarg));
+            if (value < 0 || value > NC_BUDGET_MAX_SIZE) 
+            {
+                LOG_ERROR("nutcracker: option -B requires a number of MB between 0"
+                           " and %d", NC_BUDGET_MAX_SIZE);
+                return NC_ERROR;
+            }
+            nci->memory_budget = (size_t)value * 1024 * 1024;
+            break;
+        case 'P':
+            value = nc_atoi(optarg, strlen(optarg));
+            if (value < 0 || value > NC_POOL_HIGH) 
+            {
+                LOG_ERROR("nutcracker: option -P requires a number of objects between 0"
+                           " and %d", NC_POOL_HIGH);
+                return NC_ERROR;
+            }
+            nci->pool_prealloc = (uint32_t)value;
+            break;
         case '?':
             switch (optopt) {
             case 'o':
@@ -189,6 +234,9 @@ static rstatus_t ncGetOptions(int argc, char **argv, NcInstance *nci)
                            optopt);
                 break;
             case 'm':
+            case 'M':
+            case 'B':
+            case 'P':
             case 'v':
             case 's':
             case 'i':
@@ -228,6 +276,8 @@ static void ncSetDefaultOptions(NcInstance *nci)
     nci->stats_port = NC_STATS_PORT;
     nci->stats_addr = NC_STATS_ADDR;
     nci->stats_interval = NC_STATS_INTERVAL;
+    nci->stats_next = 0;
+    nci->trim_next = 0;
 
     nci->hostname[NC_MAXHOSTNAMELEN - 1] = '\0';
     int status = nc_gethostname(nci->hostname, NC_MAXHOSTNAMELEN);
@@ -238,6 +288,9 @@ static void ncSetDefaultOptions(NcInstance *nci)
     }
 
     nci->mbuf_chunk_size = NC_MBUF_SIZE;
+    nci->pool_prealloc = NC_POOL_PREALLOC;
+    nci->arena_size = NC_ARENA_SIZE;
+    nci->memory_budget = NC_BUDGET_SIZE;
 
     nci->pid = (pid_t)-1;
     nci->pid_filename = NULL;
@@ -325,6 +378,29 @@ static rstatus_t ncInit(NcInstance *nci)
              NC_VERSION_STRING, name.sysname, name.release, name.machine,
              nci->pid);
     }
+    // 预留mbuf和msg的内存, 并报告实际拿到的页类型
+    if (nci->arena_size > 0)
+    {
+        status = (nci->arena).init(nci->arena_size);
+        if (status != NC_OK)
+        {
+            return status;
+        }
+        LOGA("buffer arena of %zu MB backed by %s", (nci->arena).size() >> 20,
+             (nci->arena).backingName());
+    }
+    else
+    {
+        LOGA("buffer arena off, mbufs backed by normal pages");
+    }
+
+    (nci->budget).init(nci->memory_budget);
+    if (nci->memory_budget > 0)
+    {
+        LOGA("memory budget %zu MB, client reads throttled above it",
+             nci->memory_budget >> 20);
+    }
+
     LOGA("run, rabbit run / dig that hole, forget the sun / "
          "and when at last the work is done / don't sit down / "
          "it's time to dig another one");
@@ -0,0 +1,184 @@
+#ifndef _NC_ARENA_H_
+#define _NC_ARENA_H_
+
+#include <stddef.h>
+#include <stdint.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <nc_util.h>
+#include <nc_log.h>
+
+#define NC_ARENA_HUGEPAGE   (2 * 1024 * 1024)   /* huge page size we align to */
+#define NC_ARENA_THP_PATH   "/sys/kernel/mm/transparent_hugepage/enabled"
+
+#ifndef MAP_HUGETLB
+# define MAP_HUGETLB        0x40000
+#endif
+
+typedef enum
+{
+    kARENA_NONE,            /* arena disabled */
+    kARENA_HUGETLB,         /* explicit hugepages, mmap(MAP_HUGETLB) */
+    kARENA_THP,             /* transparent hugepages, madvise(MADV_HUGEPAGE) */
+    kARENA_PAGES,           /* normal pages */
+} NcArenaBacking;
+
+/*
+ * Buffer arena. The memory for mbuf slabs and messages is reserved up
+ * front in one mapping and handed out with a bump pointer, so the hot
+ * buffers of recvChain / sendChain sit on as few TLB entries as possible.
+ * The mapping is tried with explicit hugepages first, then with normal
+ * pages advised for transparent hugepages, then with plain pages.
+ * Memory is never returned to the arena; once it is used up callers fall
+ * back to their own allocation.
+ */
+class NcArena
+{
+public:
+    NcArena() : m_base_(NULL), m_map_(NULL), m_map_size_(0), m_size_(0),
+        m_used_(0), m_backing_(kARENA_NONE)
+    { }
+
+    ~NcArena()
+    {
+        if (m_map_ != NULL)
+        {
+            ::munmap(m_map_, m_map_size_);
+        }
+    }
+
+    rstatus_t init(size_t size)
+    {
+        ASSERT(m_map_ == NULL);
+
+        size = NC_ALIGN(size, NC_ARENA_HUGEPAGE);
+
+        void *p = ::mmap(NULL, size, PROT_READ | PROT_WRITE,
+            MAP_PRIVATE | MAP_ANONYMOUS | MAP_HUGETLB, -1, 0);
+        if (p != MAP_FAILED)
+        {
+            m_map_ = m_base_ = (uint8_t *)p;
+            m_map_size_ = m_size_ = size;
+            m_backing_ = kARENA_HUGETLB;
+            return NC_OK;
+        }
+        LOG_DEBUG("mmap hugetlb arena of %zu bytes failed: %s", size, strerror(errno));
+
+        /* over-map by one huge page so the arena can start on a 2M boundary */
+        p = ::mmap(NULL, size + NC_ARENA_HUGEPAGE, PROT_READ | PROT_WRITE,
+            MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+        if (p == MAP_FAILED)
+        {
+            LOG_ERROR("mmap arena of %zu bytes failed: %s", size, strerror(errno));
+            return NC_ENOMEM;
+        }
+
+        m_map_ = (uint8_t *)p;
+        m_map_size_ = size + NC_ARENA_HUGEPAGE;
+        m_base_ = (uint8_t *)NC_ALIGN_PTR(m_map_, NC_ARENA_HUGEPAGE);
+        m_size_ = size;
+        m_backing_ = kARENA_PAGES;
+
+#ifdef MADV_HUGEPAGE
+        if (thpEnabled() && ::madvise(m_base_, m_size_, MADV_HUGEPAGE) == 0)
+        {
+            m_backing_ = kARENA_THP;
+        }
+#endif
+
+        return NC_OK;
+    }
+
+    /* carve size bytes aligned to align (power of 2), NULL once exhausted */
+    inline void* alloc(size_t size, size_t align = NC_ALIGNMENT)
+    {
+        if (m_base_ == NULL)
+        {
+            return NULL;
+        }
+
+        size_t off = NC_ALIGN(m_used_, align);
+        if (off + size > m_size_)
+        {
+            return NULL;
+        }
+
+        m_used_ = off + size;
+        return m_base_ + off;
+    }
+
+    inline bool contains(const void *p)
+    {
+        return (const uint8_t *)p >= m_base_ && (const uint8_t *)p < m_base_ + m_size_;
+    }
+
+    inline bool enabled()
+    {
+        return m_base_ != NULL;
+    }
+
+    inline size_t size()
+    {
+        return m_size_;
+    }
+
+    inline size_t used()
+    {
+        return m_used_;
+    }
+
+    inline NcArenaBacking backing()
+    {
+        return m_backing_;
+    }
+
+    const char* backingName()
+    {
+        switch (m_backing_)
+        {
+        case kARENA_HUGETLB:
+            return "explicit hugepages";
+        case kARENA_THP:
+            return "transparent hugepages";
+        case kARENA_PAGES:
+            return "normal pages";
+        default:
+            return "off";
+        }
+    }
+
+private:
+    // THP设置为never时madvise仍然成功, 需要读sysfs确认
+    static bool thpEnabled()
+    {
+        char buf[128];
+        int fd = ::open(NC_ARENA_THP_PATH, O_RDONLY);
+        if (fd < 0)
+        {
+            return false;
+        }
+
+        ssize_t n = ::read(fd, buf, sizeof(buf) - 1);
+        ::close(fd);
+        if (n <= 0)
+        {
+            return false;
+        }
+        buf[n] = '\0';
+
+        return strstr(buf, "[never]") == NULL;
+    }
+
+private:
+    uint8_t         *m_base_;       /* arena start, 2M aligned */
+    uint8_t         *m_map_;        /* mapping start */
+    size_t          m_map_size_;    /* mapping size */
+    size_t          m_size_;        /* arena size */
+    size_t          m_used_;        /* bytes handed out */
+    NcArenaBacking  m_backing_;     /* backing actually obtained */
+};
+
+#endif
@@ -0,0 +1,98 @@
+#ifndef _NC_BUDGET_H_
+#define _NC_BUDGET_H_
+
+#include <stddef.h>
+#include <stdint.h>
+#include <inttypes.h>
+#include <nc_util.h>
+#include <nc_log.h>
+
+#define NC_BUDGET_LOW_PCT   80      /* low watermark, in percent of the limit */
+
+/*
+ * Byte budget for buffer memory. The mbuf and message allocators charge
+ * what they hand out and uncharge what comes back. A pool budget has the
+ * process-wide one as parent, so every charge is seen by both. Once over
+ * the limit (high watermark) client reads are throttled until usage falls
+ * below NC_BUDGET_LOW_PCT of it (low watermark). A limit of 0 is
+ * unlimited.
+ */
+class NcBudget
+{
+public:
+    NcBudget() : m_parent_(NULL), m_limit_(0), m_low_(0), m_used_(0), m_used_max_(0)
+    { }
+
+    void init(size_t limit, NcBudget *parent = NULL)
+    {
+        m_parent_ = parent;
+        m_limit_ = limit;
+        m_low_ = limit / 100 * NC_BUDGET_LOW_PCT;
+    }
+
+    inline void charge(size_t n)
+    {
+        m_used_ += n;
+        m_used_max_ = MAX(m_used_max_, m_used_);
+        if (m_parent_ != NULL)
+        {
+            m_parent_->charge(n);
+        }
+    }
+
+    inline void uncharge(size_t n)
+    {
+        ASSERT(m_used_ >= n);
+        m_used_ -= n;
+        if (m_parent_ != NULL)
+        {
+            m_parent_->uncharge(n);
+        }
+    }
+
+    /* at or above the high watermark, here or in the parent? */
+    inline bool over()
+    {
+        if (m_limit_ != 0 && m_used_ >= m_limit_)
+        {
+            return true;
+        }
+
+        return m_parent_ != NULL && m_parent_->over();
+    }
+
+    /* below the low watermark, here and in the parent? */
+    inline bool under()
+    {
+        if (m_limit_ != 0 && m_used_ >= m_low_)
+        {
+            return false;
+        }
+
+        return m_parent_ == NULL || m_parent_->under();
+    }
+
+    inline size_t limit()
+    {
+        return m_limit_;
+    }
+
+    inline size_t used()
+    {
+        return m_used_;
+    }
+
+    inline size_t usedMax()
+    {
+        return m_used_max_;
+    }
+
+private:
+    NcBudget    *m_parent_;     /* process-wide budget, NULL if this is it */
+    size_t      m_limit_;       /* high watermark in bytes, 0 if unlimited */
+    size_t      m_low_;         /* low watermark in bytes */
+    size_t      m_used_;        /* bytes charged */
+    size_t      m_used_max_;    /* max bytes charged */
+};
+
+#endif
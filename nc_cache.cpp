@@ -0,0 +1,204 @@
+#include <nc_cache.h>
+#include <nc_message.h>
+
+void NcCache::init(NcContext *ctx, size_t limit, int64_t ttl)
+{
+    m_ctx_ = ctx;
+    m_limit_ = limit;
+    m_ttl_ = ttl;
+}
+
+uint64_t NcCache::hash(const uint8_t *key, uint32_t keylen)
+{
+    uint64_t hash = 0xcbf29ce484222325ULL;
+    for (uint32_t i = 0; i < keylen; i++)
+    {
+        hash ^= key[i];
+        hash *= 0x100000001b3ULL;
+    }
+
+    return hash;
+}
+
+NcMsg* NcCache::lookup(const uint8_t *key, uint32_t keylen)
+{
+    std::unordered_map<uint64_t, NcCacheEntry*>::iterator it =
+        m_entries_.find(hash(key, keylen));
+    if (it == m_entries_.end() || !(it->second->key == NcStringView(key, keylen)))
+    {
+        m_nmiss_++;
+        return NULL;
+    }
+
+    NcCacheEntry *entry = it->second;
+    if (entry->expire <= NcUtil::ncCachedUsec())
+    {
+        remove(entry);
+        m_nevict_++;
+        m_nmiss_++;
+        return NULL;
+    }
+
+    NcMsg *rsp = (NcMsg*)(m_ctx_->msg_pool).alloc<NcMsg>();
+    if (rsp == NULL)
+    {
+        return NULL;
+    }
+
+    NcMbufQueue *queue = entry->rsp->getMbufQueue();
+    for (NcMbuf *mbuf = queue->front(); mbuf != NULL; mbuf = queue->next(mbuf))
+    {
+        NcMbuf *nbuf = (m_ctx_->mbuf_pool).slice(mbuf, mbuf->getPos(), mbuf->getLast());
+        if (nbuf == NULL)
+        {
+            rsp->freeMbuf(m_ctx_);
+            (m_ctx_->msg_pool).free(rsp);
+            return NULL;
+        }
+        rsp->getMbufQueue()->push(nbuf);
+    }
+    rsp->setLength(entry->rsp->m_mlen_);
+    rsp->m_type_ = entry->rsp->m_type_;
+
+    m_lru_q_.remove(entry);
+    m_lru_q_.push(entry);
+    m_nhit_++;
+
+    return rsp;
+}
+
+uint64_t NcCache::generation(const uint8_t *key, uint32_t keylen)
+{
+    return m_gen_[hash(key, keylen) & (NC_CACHE_NGEN - 1)];
+}
+
+void NcCache::insert(const uint8_t *key, uint32_t keylen, uint64_t gen, NcMsg *rsp)
+{
+    uint64_t h = hash(key, keylen);
+    if (m_gen_[h & (NC_CACHE_NGEN - 1)] != gen)
+    {
+        LOG_DEBUG("cache skip '%.*s', written while in flight", keylen, key);
+        return ;
+    }
+
+    /* the chunks cannot be smaller than the reply, skip what would not fit anyway */
+    size_t size = sizeof(NcCacheEntry) + sizeof(NcMsg) + keylen;
+    if (size + rsp->m_mlen_ > m_limit_)
+    {
+        return ;
+    }
+
+    NcMsg *copy = (NcMsg*)(m_ctx_->msg_pool).alloc<NcMsg>();
+    if (copy == NULL)
+    {
+        return ;
+    }
+
+    // 拷贝到大小合适的mbuf里, 不占着server连接收数据的chunk
+    uint32_t left = rsp->m_mlen_;
+    NcMbuf *dst = NULL;
+    NcMbufQueue *queue = rsp->getMbufQueue();
+    for (NcMbuf *mbuf = queue->front(); mbuf != NULL; mbuf = queue->next(mbuf))
+    {
+        for (uint8_t *p = mbuf->getPos(); p < mbuf->getLast(); )
+        {
+            if (dst == NULL || dst->full())
+            {
+                dst = (m_ctx_->mbuf_pool).alloc(left);
+                if (dst == NULL)
+                {
+                    copy->freeMbuf(m_ctx_);
+                    (m_ctx_->msg_pool).free(copy);
+                    return ;
+                }
+                copy->getMbufQueue()->push(dst);
+                size += dst->chunkSize();
+            }
+
+            uint32_t n = MIN((uint32_t)(mbuf->getLast() - p), (uint32_t)dst->size());
+            dst->copy(p, n);
+            p += n;
+            left -= n;
+        }
+    }
+    copy->setLength(rsp->m_mlen_);
+    copy->m_type_ = rsp->m_type_;
+
+    // 按实际分配的chunk计, 一个size class可能比reply大不少
+    if (size > m_limit_)
+    {
+        copy->freeMbuf(m_ctx_);
+        (m_ctx_->msg_pool).free(copy);
+        return ;
+    }
+
+    std::unordered_map<uint64_t, NcCacheEntry*>::iterator it = m_entries_.find(h);
+    if (it != m_entries_.end())
+    {
+        remove(it->second);
+    }
+
+    NcCacheEntry *entry = new NcCacheEntry();
+    entry->hash = h;
+    entry->key = NcString(key, keylen);
+    entry->rsp = copy;
+    entry->expire = NcUtil::ncCachedUsec() + m_ttl_;
+    entry->size = size;
+
+    m_entries_[h] = entry;
+    m_lru_q_.push(entry);
+    m_used_ += size;
+    m_data_ += copy->m_mlen_;
+    m_nfill_++;
+
+    while (m_used_ > m_limit_)
+    {
+        remove(m_lru_q_.front());
+        m_nevict_++;
+    }
+}
+
+void NcCache::invalidate(const uint8_t *key, uint32_t keylen)
+{
+    uint64_t h = hash(key, keylen);
+    m_gen_[h & (NC_CACHE_NGEN - 1)]++;
+
+    std::unordered_map<uint64_t, NcCacheEntry*>::iterator it = m_entries_.find(h);
+    if (it != m_entries_.end())
+    {
+        LOG_DEBUG("cache drop '%.*s'", keylen, key);
+        remove(it->second);
+        m_ninvalidate_++;
+    }
+}
+
+void NcCache::remove(NcCacheEntry *entry)
+{
+    m_entries_.erase(entry->hash);
+    m_lru_q_.remove(entry);
+    m_used_ -= entry->size;
+    m_data_ -= entry->rsp->m_mlen_;
+
+    /* hits still being sent hold the chunks until they are done */
+    entry->rsp->freeMbuf(m_ctx_);
+    (m_ctx_->msg_pool).free(entry->rsp);
+    delete entry;
+}
+
+void NcCache::clear()
+{
+    while (!m_lru_q_.empty())
+    {
+        remove(m_lru_q_.front());
+    }
+}
+
+void NcCache::dump()
+{
+    uint64_t nlookup = m_nhit_ + m_nmiss_;
+    LOG_VERBOSE("cache %" PRIu64 " hits, %" PRIu64 " misses (%.1f%% hit), %" PRIu64
+        " fills, %" PRIu64 " evictions, %" PRIu64 " invalidations, %" PRIu32
+        " entries, used %zu (replies %zu) limit %zu", m_nhit_, m_nmiss_,
+        nlookup != 0 ? 100.0 * m_nhit_ / nlookup : 0.0, m_nfill_, m_nevict_,
+        m_ninvalidate_, size(), m_used_, m_data_, m_limit_);
+}
@@ -0,0 +1,112 @@
+#ifndef _NC_CACHE_H_
+#define _NC_CACHE_H_
+
+#include <nc_core.h>
+#include <unordered_map>
+
+class NcMsg;
+
+#define NC_CACHE_NGEN       4096    /* invalidation generations, power of 2 */
+
+class NcCacheEntry
+{
+public:
+    NcCacheEntry() : hash(0), rsp(NULL), expire(0), size(0)
+    { }
+
+public:
+    NcQueueEntry<NcCacheEntry>  m_tqe_;  /* link in lru q */
+    uint64_t            hash;           /* hash of key */
+    NcString            key;
+    NcMsg               *rsp;           /* cached reply, its mbufs are never inline */
+    int64_t             expire;         /* expiry time in usec */
+    size_t              size;           /* bytes charged: entry, key and reply chunks */
+};
+
+/*
+ * Near cache of a pool (cache_size, cache_ttl): replies to gets of a
+ * single key are kept by key in the proxy and served from there for at
+ * most cache_ttl, without a trip to the server. Entries are evicted least
+ * recently used first once the cache holds more than cache_size bytes,
+ * counting the whole chunks a reply is copied into.
+ *
+ * A write passing through the proxy drops its keys from the cache. As a
+ * reply may come back after a write to its key was sent, each key maps to
+ * one of NC_CACHE_NGEN generations, bumped by every write to a key there:
+ * a get takes the generation of its key when it is forwarded, and its
+ * reply is only kept if the generation has not moved since.
+ *
+ * A reply is copied once, into mbufs of its own size, when it is kept; a
+ * hit is a new reply made of slices of those mbufs.
+ */
+class NcCache
+{
+public:
+    NcCache() : m_ctx_(NULL), m_limit_(0), m_ttl_(0), m_used_(0), m_data_(0),
+        m_lru_q_(&NcCacheEntry::m_tqe_), m_gen_(NC_CACHE_NGEN, 1),
+        m_nhit_(0), m_nmiss_(0), m_nfill_(0), m_nevict_(0), m_ninvalidate_(0)
+    { }
+
+    /* cache of limit bytes, entries live for ttl usec; a limit of 0 is off */
+    void init(NcContext *ctx, size_t limit, int64_t ttl);
+
+    inline bool enabled()
+    {
+        return m_limit_ != 0;
+    }
+
+    /* a new reply sharing the one cached for key, NULL on a miss */
+    NcMsg* lookup(const uint8_t *key, uint32_t keylen);
+
+    /* generation of key, to be passed to insert() with its reply */
+    uint64_t generation(const uint8_t *key, uint32_t keylen);
+
+    /* keep a copy of rsp for key, unless key has been written since gen */
+    void insert(const uint8_t *key, uint32_t keylen, uint64_t gen, NcMsg *rsp);
+
+    /* key may have been modified */
+    void invalidate(const uint8_t *key, uint32_t keylen);
+
+    void clear();
+
+    inline size_t used()
+    {
+        return m_used_;
+    }
+
+    inline size_t limit()
+    {
+        return m_limit_;
+    }
+
+    inline uint32_t size()
+    {
+        return (uint32_t)m_entries_.size();
+    }
+
+    void dump();
+
+private:
+    static uint64_t hash(const uint8_t *key, uint32_t keylen);
+
+    void remove(NcCacheEntry *entry);
+
+private:
+    NcContext           *m_ctx_;
+    size_t              m_limit_;       /* in bytes, 0 if off */
+    int64_t             m_ttl_;         /* in usec */
+    size_t              m_used_;        /* bytes charged to the entries */
+    size_t              m_data_;        /* bytes of the replies in there */
+
+    std::unordered_map<uint64_t, NcCacheEntry*> m_entries_;     /* by hash of key */
+    NcTailQueue<NcCacheEntry>   m_lru_q_;   /* least recently used first */
+    std::vector<uint64_t>       m_gen_;     /* generations, by hash of key */
+
+    uint64_t            m_nhit_;
+    uint64_t            m_nmiss_;
+    uint64_t            m_nfill_;       /* # replies kept */
+    uint64_t            m_nevict_;      /* # entries evicted for room or expired */
+    uint64_t            m_ninvalidate_; /* # entries dropped by a write */
+};
+
+#endif
@@ -2,6 +2,7 @@
 #include <nc_message.h>
 #include <nc_client.h>
 #include <nc_server.h>
+#include <nc_mysql.h>
 
 void NcClientConn::ref(void *owner)
 {
@@ -66,6 +67,43 @@ bool NcClientConn::active()
     return false;
 }
 
+/*
+ * 和NcConn::recvMsg一样读完socket, 但每读一个请求前检查budget,
+ * 超过high watermark就暂停这个client的读事件, 剩下的数据留在内核缓冲区,
+ * 由NcContext::rearmThrottled在低于low watermark后恢复
+ */
+rstatus_t NcClientConn::recvMsg()
+{
+    FUNCTION_INTO(NcClientConn);
+
+    NcContext *ctx = (NcContext*)getContext();
+    ASSERT(ctx != NULL);
+
+    m_recv_ready_ = 1;
+    do 
+    {
+        if (ctx->budget.over())
+        {
+            ctx->throttle(this);
+            return NC_OK;
+        }
+
+        NcMsg *msg = (NcMsg*)(this->recvNext(true));
+        if (msg == NULL) 
+        {
+            return NC_OK;
+        }
+
+        rstatus_t status = this->recvChain(msg);
+        if (status != NC_OK) 
+        {
+            return status;
+        }
+    } while (m_recv_ready_);
+
+    return NC_OK;
+}
+
 void NcClientConn::close()
 {
     FUNCTION_INTO(NcClientConn);
@@ -73,6 +111,8 @@ void NcClientConn::close()
     NcContext *ctx = (NcContext*)getContext();
     ASSERT(ctx != NULL);
 
+    ctx->unthrottle(this);
+
     if (m_sd_ < 0)
     {
         this->unref();
@@ -90,10 +130,13 @@ void NcClientConn::close()
         freeMsg(msg);
     }
 
-    for (NcQueue<NcMsgBase*>::ConstIterator iter = m_omsg_q_.begin(); 
-        iter != m_omsg_q_.end(); iter++)
+    NcMsgBase *nmsg = NULL;
+    for (msg = m_omsg_q_.front(); msg != NULL; msg = nmsg)
     {
-        msg = *iter;
+        nmsg = m_omsg_q_.next(msg);
+
+        /* dequeue the message (request) from client outq */
+        dequeueOutput(msg);
 
         LOG_DEBUG("close c %d discarding pending req %" PRIu64 " len "
             "%" PRIu32 " type %d", m_sd_, msg->m_id_, msg->m_mlen_,
@@ -116,6 +159,11 @@ void NcClientConn::close()
         }
     }
 
+    if (m_pinned_ != NULL)
+    {
+        NcMysql::unpin(this);
+    }
+
     this->unref();
     
     rstatus_t status = ::close(m_sd_);
@@ -184,6 +232,8 @@ NcMsgBase* NcClientConn::recvNext(bool alloc)
     m_rmsg_ = (NcMsg*)msg;
     // 设置所属数据
     msg->setData(this);
+    msg->m_request_ = 1;
+    msg->setProtocolType(ctx->protocol_type);
     return (NcMsgBase*)msg;
 }
 
@@ -213,7 +263,7 @@ void NcClientConn::recvDone(NcMsgBase *cmsg, NcMsgBase *rmsg)
             return;
         }
 
-        status = ((NcMsg*)cmsg)->reply();
+        status = ((NcMsg*)cmsg)->reply(this);
         if (status != NC_OK) 
         {
             m_err_ = errno;
@@ -229,20 +279,53 @@ void NcClientConn::recvDone(NcMsgBase *cmsg, NcMsgBase *rmsg)
         return;
     }
 
+    // 多key请求按key所在的server拆分
+    status = ((NcMsg*)cmsg)->fragment(this, frag_msgq);
+    if (status != NC_OK)
+    {
+        if (!cmsg->m_noreply_) 
+        {
+            this->enqueueOutput(cmsg);
+        }
+        ((NcMsg*)cmsg)->requestForwardError(this);
+        return;
+    }
+
     if (frag_msgq.empty())
     {
         ((NcMsg*)cmsg)->requestForward(this);
         return ;
     }
 
+    /*
+     * The owner takes the client's place in the queue and gets the merged
+     * reply once all fragments are done; the fragments follow it.
+     */
     status = ((NcMsg*)cmsg)->requestMakeReply(this);
     if (status != NC_OK) 
     {
+        while (!frag_msgq.empty())
+        {
+            NcMsg *sub = frag_msgq.front();
+            frag_msgq.pop();
+            freeMsg(sub);
+        }
+        cmsg->m_frag_id_ = 0;
+        cmsg->m_nfrag_ = 0;
+
         if (!cmsg->m_noreply_) 
         {
             this->enqueueOutput(cmsg);
         }
         ((NcMsg*)cmsg)->requestForwardError(this);
+        return;
+    }
+
+    while (!frag_msgq.empty())
+    {
+        NcMsg *sub = frag_msgq.front();
+        frag_msgq.pop();
+        sub->requestForward(this);
     }
 
     return;
@@ -261,10 +344,26 @@ NcMsgBase* NcClientConn::sendNext()
 
     rstatus_t status;
     NcMsg *pmsg = (NcMsg*)(m_omsg_q_.front());
+    NcMsg *msg = (NcMsg*)m_smsg_;
+    LOG_DEBUG("msg : %p", msg);
+    if (msg != NULL)
+    {
+        ASSERT(msg->m_peer_ != NULL);
+        pmsg = (NcMsg*)(m_omsg_q_.next(msg->m_peer_));
+    }
 
-    // TODO : 需要特殊处理
-    if (pmsg == NULL)
+    // 没有响应的请求(例如miss的quiet get)已经完成, 直接释放
+    while (pmsg != NULL && pmsg->m_done_ && pmsg->m_noreply_)
     {
+        NcMsg *nmsg = (NcMsg*)(m_omsg_q_.next(pmsg));
+        dequeueOutput(pmsg);
+        freeMsg(pmsg);
+        pmsg = nmsg;
+    }
+
+    if (msg == NULL && (pmsg == NULL || !pmsg->requestDone(this)))
+    {
+        /* nothing is outstanding, initiate close? */
         if (pmsg == NULL && m_eof_)
         {
             m_done_ = 1;
@@ -280,22 +379,25 @@ NcMsgBase* NcClientConn::sendNext()
         return NULL;
     }
 
-    NcMsg *msg = (NcMsg*)m_smsg_;
-    LOG_DEBUG("msg : %p", msg);
-    if (msg != NULL)
-    {
-        pmsg = NULL;
-        // TODO : 需要特殊处理
-    }
-
-    if (pmsg == NULL)
+    /* responses go out in request order, the next one follows the one in flight */
+    if (pmsg == NULL || !pmsg->requestDone(this))
     {
         m_smsg_ = NULL;
         return NULL;
     }
 
-    // TODO : 需要特殊处理
     msg = (NcMsg*)(pmsg->m_peer_);
+    if (msg == NULL)
+    {
+        /* failed before it got a reply: no server, or the server went away */
+        msg = pmsg->makeError(this);
+        if (msg == NULL)
+        {
+            m_err_ = errno;
+            m_smsg_ = NULL;
+            return NULL;
+        }
+    }
     m_smsg_ = msg;
 
     LOG_DEBUG("send next rsp on c %d", m_sd_);
@@ -6,6 +6,12 @@
 class NcClientConn : public NcConn
 {
 public:
+    // client的omsg_q和server的队列同时持有请求, 使用c_tqe
+    NcClientConn()
+    {
+        m_omsg_q_.setLink(&NcMsgBase::m_c_tqe_);
+    }
+
     virtual void ref(void *owner = NULL);
     virtual void unref();
     virtual bool active();
@@ -23,6 +29,8 @@ public:
         m_omsg_q_.remove(msg);
     }
 
+    virtual rstatus_t recvMsg();
+
     virtual NcMsgBase* recvNext(bool alloc);
 
     virtual void recvDone(NcMsgBase *cmsg, NcMsgBase *rmsg);
@@ -1,4 +1,5 @@
 #include <nc_conf.h>
+#include <nc_hashkit.h>
 
 rstatus_t NcConfListen::parse(NcString &value)
 {
@@ -72,7 +73,7 @@ rstatus_t NcConfListen::parse(NcString &value)
     pname = value;
     name = NcString(_name, _namelen);
     LOG_DEBUG("name : %s, port : %d", name.c_str(), port);
-    rstatus_t status = NcUtil::ncResolve(&name, port, &info);
+    rstatus_t status = NcUtil::ncResolve(name, port, &info);
     if (status != NC_OK) 
     {
         return NC_ERROR;
@@ -184,7 +185,7 @@ rstatus_t NcConfServer::parse(NcString &value)
     pname = value;
     name = NcString(_name, _namelen);
     LOG_DEBUG("name : %s, port : %d", name.c_str(), port);
-    rstatus_t status = NcUtil::ncResolve(&name, port, &info);
+    rstatus_t status = NcUtil::ncResolve(name, port, &info);
     if (status != NC_OK) 
     {
         return NC_ERROR;
@@ -194,6 +195,44 @@ rstatus_t NcConfServer::parse(NcString &value)
     return NC_OK;
 }
 
+rstatus_t NcConfHttpKey::parse(NcString &value)
+{
+    FUNCTION_INTO(NcConfHttpKey);
+
+    LOG_DEBUG("value : %s, length : %d", value.c_str(), value.length());
+
+    /* "path", "path:<n>" or "header:<name>" */
+    const char *v = (const char *)value.c_str();
+    uint32_t len = value.length();
+    if (value == "path")
+    {
+        type = kHTTP_KEY_PATH;
+    }
+    else if (len > 5 && memcmp(v, "path:", 5) == 0)
+    {
+        int n = nc_atoi(v + 5, len - 5);
+        if (n <= 0)
+        {
+            LOG_ERROR("http_key has an invalid path segment in \"path:<n>\"");
+            return NC_ERROR;
+        }
+        type = kHTTP_KEY_SEGMENT;
+        segment = (uint32_t)n;
+    }
+    else if (len > 7 && memcmp(v, "header:", 7) == 0)
+    {
+        type = kHTTP_KEY_HEADER;
+        header = NcString(v + 7, len - 7);
+    }
+    else
+    {
+        LOG_ERROR("http_key '%s' is not one of path, path:<n>, header:<name>", v);
+        return NC_ERROR;
+    }
+
+    return NC_OK;
+}
+
 rstatus_t NcConf::openFile(const char *_fname)
 {
     rstatus_t status;
@@ -231,6 +270,7 @@ void NcConf::dump()
         LOG_DEBUG("  listen: %.*s", cp->listen.pname.length(), cp->listen.pname.c_str());
         LOG_DEBUG("  timeout: %d", cp->timeout);
         LOG_DEBUG("  backlog: %d", cp->backlog);
+        LOG_DEBUG("  hash: %d", cp->hash);
         LOG_DEBUG("  hash_tag: \"%.*s\"", cp->hash_tag.length(),
                   cp->hash_tag.c_str());
         LOG_DEBUG("  distribution: %d", cp->distribution);
@@ -239,8 +279,21 @@ void NcConf::dump()
         LOG_DEBUG("  preconnect: %d", cp->preconnect);
         LOG_DEBUG("  auto_eject_hosts: %d", cp->auto_eject_hosts);
         LOG_DEBUG("  server_connections: %d", cp->server_connections);
+        LOG_DEBUG("  server_max_connections: %d", cp->server_max_connections);
         LOG_DEBUG("  server_retry_timeout: %d", cp->server_retry_timeout);
         LOG_DEBUG("  server_failure_limit: %d", cp->server_failure_limit);
+        LOG_DEBUG("  memory_budget: %zu", cp->memory_budget);
+        LOG_DEBUG("  protocol: %d", cp->protocol);
+        LOG_DEBUG("  http_key: %d %" PRIu32 " %.*s", cp->http_key.type,
+                  cp->http_key.segment, cp->http_key.header.length(),
+                  cp->http_key.header.c_str());
+        LOG_DEBUG("  mysql_user: %.*s", cp->mysql_user.length(), cp->mysql_user.c_str());
+        LOG_DEBUG("  mysql_password: %s", cp->mysql_password.length() > 0 ? "****" : "");
+        LOG_DEBUG("  mysql_db: %.*s", cp->mysql_db.length(), cp->mysql_db.c_str());
+        LOG_DEBUG("  collapse: %d", cp->collapse);
+        LOG_DEBUG("  cache_size: %zu", cp->cache_size);
+        LOG_DEBUG("  cache_ttl: %d", cp->cache_ttl);
+        LOG_DEBUG("  maglev_size: %d", cp->maglev_size);
 
         uint32_t nserver = cp->server.size();
         LOG_DEBUG("  servers: %" PRIu32 "", nserver);
@@ -422,8 +475,7 @@ rstatus_t NcConf::yamlPushScalar()
 
     LOG_DEBUG("push '%.*s'", scalar_len, scalar);
 
-    NcString value(scalar, scalar_len);
-    args.push_back(value);
+    args.push_back(NcString(scalar, scalar_len));
 
     return NC_OK;
 }
@@ -541,8 +593,8 @@ rstatus_t NcConf::handler(NcConf *cf, NcConfPool *data)
         return NC_OK;
     }
 
-    NcString value = (cf->args)[narg - 1];
-    NcString key = (cf->args)[narg - 2];
+    NcString &value = (cf->args)[narg - 1];
+    NcString &key = (cf->args)[narg - 2];
 
     LOG_DEBUG("key : %s, value : %s", key.c_str(), value.c_str());
 
@@ -568,6 +620,238 @@ rstatus_t NcConf::handler(NcConf *cf, NcConfPool *data)
             data->server.push_back(cs);
         }
     }
+    else if (key == (const uint8_t*)"server_connections")
+    {
+        int n = nc_atoi(value.c_str(), value.length());
+        if (n <= 0)
+        {
+            LOG_ERROR("server_connections requires a positive number, got '%s'", 
+                value.c_str());
+            return NC_ERROR;
+        }
+        data->server_connections = n;
+    }
+    else if (key == (const uint8_t*)"server_max_connections")
+    {
+        int n = nc_atoi(value.c_str(), value.length());
+        if (n <= 0)
+        {
+            LOG_ERROR("server_max_connections requires a positive number, got '%s'", 
+                value.c_str());
+            return NC_ERROR;
+        }
+        data->server_max_connections = n;
+    }
+    else if (key == (const uint8_t*)"memory_budget")
+    {
+        // 以MB为单位
+        int mb = nc_atoi(value.c_str(), value.length());
+        if (mb < 0)
+        {
+            LOG_ERROR("memory_budget requires a number of MB, got '%s'", 
+                value.c_str());
+            return NC_ERROR;
+        }
+        data->memory_budget = (size_t)mb << 20;
+    }
+    else if (key == (const uint8_t*)"protocol")
+    {
+        if (value == (const uint8_t*)"redis")
+        {
+            data->protocol = kPROTOCOL_REDIS;
+        }
+        else if (value == (const uint8_t*)"memcache")
+        {
+            data->protocol = kPROTOCOL_MEMCACHED;
+        }
+        else if (value == (const uint8_t*)"memcache_binary")
+        {
+            data->protocol = kPROTOCOL_MEMCACHED_BINARY;
+        }
+        else if (value == (const uint8_t*)"http")
+        {
+            data->protocol = kPROTOCOL_HTTP;
+        }
+        else if (value == (const uint8_t*)"mysql")
+        {
+            data->protocol = kPROTOCOL_MYSQL;
+        }
+        else
+        {
+            LOG_ERROR("protocol '%s' is not one of redis, memcache, "
+                "memcache_binary, http, mysql",
+                value.c_str());
+            return NC_ERROR;
+        }
+    }
+    else if (key == (const uint8_t*)"distribution")
+    {
+        if (value == (const uint8_t*)"ketama")
+        {
+            data->distribution = kDIST_KETAMA;
+        }
+        else if (value == (const uint8_t*)"modula")
+        {
+            data->distribution = kDIST_MODULA;
+        }
+        else if (value == (const uint8_t*)"random")
+        {
+            data->distribution = kDIST_RANDOM;
+        }
+        else if (value == (const uint8_t*)"redis_cluster")
+        {
+            data->distribution = kDIST_REDIS_CLUSTER;
+        }
+        else if (value == (const uint8_t*)"jump")
+        {
+            data->distribution = kDIST_JUMP;
+        }
+        else if (value == (const uint8_t*)"maglev")
+        {
+            data->distribution = kDIST_MAGLEV;
+        }
+        else if (value == (const uint8_t*)"hrw")
+        {
+            data->distribution = kDIST_HRW;
+        }
+        else
+        {
+            LOG_ERROR("distribution '%s' is not one of ketama, modula, random, "
+                "redis_cluster, jump, maglev, hrw", value.c_str());
+            return NC_ERROR;
+        }
+    }
+    else if (key == (const uint8_t*)"hash")
+    {
+        static const char *names[] = {
+            "one_at_a_time", "md5", "crc16", "crc32", "crc32a", "fnv1_64",
+            "fnv1a_64", "fnv1_32", "fnv1a_32", "hsieh", "murmur", "jenkins",
+            "crc32c", "xxh3_64", "wyhash"
+        };
+        for (int type = kHASH_ONE_AT_A_TIME; type <= kHASH_WYHASH; type++)
+        {
+            if (value == (const uint8_t*)names[type - kHASH_ONE_AT_A_TIME])
+            {
+                data->hash = type;
+            }
+        }
+        if (data->hash == CONF_UNSET_NUM)
+        {
+            LOG_ERROR("hash '%s' is not one of one_at_a_time, md5, crc16, crc32, "
+                "crc32a, fnv1_64, fnv1a_64, fnv1_32, fnv1a_32, hsieh, murmur, "
+                "jenkins, crc32c, xxh3_64, wyhash", value.c_str());
+            return NC_ERROR;
+        }
+    }
+    else if (key == (const uint8_t*)"hash_tag")
+    {
+        // 两个字符, 例如"{}"
+        if (value.length() != 2)
+        {
+            LOG_ERROR("hash_tag requires two characters, got '%s'", value.c_str());
+            return NC_ERROR;
+        }
+        data->hash_tag = value;
+    }
+    else if (key == (const uint8_t*)"auto_eject_hosts")
+    {
+        if (value == (const uint8_t*)"true")
+        {
+            data->auto_eject_hosts = true;
+        }
+        else if (value == (const uint8_t*)"false")
+        {
+            data->auto_eject_hosts = false;
+        }
+        else
+        {
+            LOG_ERROR("auto_eject_hosts requires true or false, got '%s'", value.c_str());
+            return NC_ERROR;
+        }
+    }
+    else if (key == (const uint8_t*)"http_key")
+    {
+        status = data->http_key.parse(value);
+        if (status != NC_OK)
+        {
+            return status;
+        }
+    }
+    else if (key == (const uint8_t*)"mysql_user")
+    {
+        data->mysql_user = value;
+    }
+    else if (key == (const uint8_t*)"mysql_password")
+    {
+        data->mysql_password = value;
+    }
+    else if (key == (const uint8_t*)"mysql_db")
+    {
+        data->mysql_db = value;
+    }
+    else if (key == (const uint8_t*)"collapse")
+    {
+        if (value == (const uint8_t*)"true")
+        {
+            data->collapse = true;
+        }
+        else if (value == (const uint8_t*)"false")
+        {
+            data->collapse = false;
+        }
+        else
+        {
+            LOG_ERROR("collapse requires true or false, got '%s'", value.c_str());
+            return NC_ERROR;
+        }
+    }
+    else if (key == (const uint8_t*)"cache_size")
+    {
+        // 以MB为单位, 0为不开启
+        int mb = nc_atoi(value.c_str(), value.length());
+        if (mb < 0)
+        {
+            LOG_ERROR("cache_size requires a number of MB, got '%s'", value.c_str());
+            return NC_ERROR;
+        }
+        data->cache_size = (size_t)mb << 20;
+    }
+    else if (key == (const uint8_t*)"cache_ttl")
+    {
+        int ttl = nc_atoi(value.c_str(), value.length());
+        if (ttl <= 0)
+        {
+            LOG_ERROR("cache_ttl requires a positive number of msec, got '%s'", 
+                value.c_str());
+            return NC_ERROR;
+        }
+        data->cache_ttl = ttl;
+    }
+    else if (key == (const uint8_t*)"maglev_size")
+    {
+        // 必须是质数, 每个server的槽位序列才能走遍整个表
+        int n = nc_atoi(value.c_str(), value.length());
+        bool prime = n > 2;
+        for (int d = 2; prime && d * d <= n; d++)
+        {
+            prime = n % d != 0;
+        }
+        if (!prime)
+        {
+            LOG_ERROR("maglev_size requires a prime number greater than 2, got '%s'",
+                value.c_str());
+            return NC_ERROR;
+        }
+        data->maglev_size = n;
+    }
+    else if (key == (const uint8_t*)"redis")
+    {
+        // 兼容twemproxy的"redis: true"
+        if (value == (const uint8_t*)"true")
+        {
+            data->protocol = kPROTOCOL_REDIS;
+        }
+    }
     else
     {
         // pass
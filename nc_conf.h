@@ -25,8 +25,8 @@
 #define CONF_UNSET_HASH         (hash_type_t) -1
 #define CONF_UNSET_DIST         (dist_type_t) -1
 
-#define CONF_DEFAULT_HASH                    HASH_FNV1A_64
-#define CONF_DEFAULT_DIST                    DIST_KETAMA
+#define CONF_DEFAULT_HASH                    kHASH_FNV1A_64
+#define CONF_DEFAULT_DIST                    kDIST_KETAMA
 #define CONF_DEFAULT_TIMEOUT                 -1
 #define CONF_DEFAULT_LISTEN_BACKLOG          512
 #define CONF_DEFAULT_CLIENT_CONNECTIONS      0
@@ -35,8 +35,24 @@
 #define CONF_DEFAULT_SERVER_RETRY_TIMEOUT    30 * 1000      /* in msec */
 #define CONF_DEFAULT_SERVER_FAILURE_LIMIT    2
 #define CONF_DEFAULT_SERVER_CONNECTIONS      1
+#define CONF_DEFAULT_SERVER_MAX_CONNECTIONS  64             /* pinned ones included */
 #define CONF_DEFAULT_KETAMA_PORT             11211
 #define CONF_DEFAULT_TCPKEEPALIVE            false
+#define CONF_DEFAULT_MEMORY_BUDGET           0              /* in MB, unlimited */
+#define CONF_DEFAULT_PROTOCOL                kPROTOCOL_HTTP
+#define CONF_DEFAULT_COLLAPSE                false
+#define CONF_DEFAULT_CACHE_SIZE              0              /* in MB, no near cache */
+#define CONF_DEFAULT_CACHE_TTL               1000           /* in msec */
+#define CONF_DEFAULT_MAGLEV_SIZE             65537          /* prime */
+
+typedef enum
+{
+    kPROTOCOL_HTTP,
+    kPROTOCOL_REDIS,
+    kPROTOCOL_MEMCACHED,
+    kPROTOCOL_MYSQL,
+    kPROTOCOL_MEMCACHED_BINARY,
+} NcProtocolType;
 
 class NcConfListen 
 {
@@ -68,6 +84,30 @@ public:
     NcString        addrstr;    /* hostname */
 };
 
+typedef enum
+{
+    kHTTP_KEY_PATH,         /* path: the whole path */
+    kHTTP_KEY_SEGMENT,      /* path:<n>, the n-th segment of the path */
+    kHTTP_KEY_HEADER,       /* header:<name>, the value of a header */
+} NcHttpKeyType;
+
+/*
+ * What an http request is routed on, the path if the header is missing.
+ */
+class NcConfHttpKey
+{
+public:
+    NcConfHttpKey() : type(kHTTP_KEY_PATH), segment(0)
+    { }
+
+    rstatus_t parse(NcString &value);
+
+public:
+    NcHttpKeyType   type;
+    uint32_t        segment;    /* 1-based segment index */
+    NcString        header;     /* header name */
+};
+
 class NcConfPool 
 {
 public:
@@ -80,8 +120,17 @@ public:
         preconnect = CONF_DEFAULT_PRECONNECT;
         auto_eject_hosts = CONF_DEFAULT_AUTO_EJECT_HOSTS;
         server_connections = CONF_DEFAULT_SERVER_CONNECTIONS;
+        server_max_connections = CONF_DEFAULT_SERVER_MAX_CONNECTIONS;
         server_retry_timeout = CONF_DEFAULT_SERVER_RETRY_TIMEOUT;
         server_failure_limit = CONF_DEFAULT_SERVER_FAILURE_LIMIT;
+        memory_budget = CONF_DEFAULT_MEMORY_BUDGET;
+        protocol = CONF_DEFAULT_PROTOCOL;
+        collapse = CONF_DEFAULT_COLLAPSE;
+        cache_size = CONF_DEFAULT_CACHE_SIZE;
+        cache_ttl = CONF_DEFAULT_CACHE_TTL;
+        maglev_size = CONF_DEFAULT_MAGLEV_SIZE;
+        distribution = CONF_UNSET_NUM;
+        hash = CONF_UNSET_NUM;
     }
 
     ~NcConfPool()
@@ -95,8 +144,9 @@ public:
 public:
     NcString        name;                  /* pool name (root node) */
     NcConfListen    listen;                /* listen: */
+    int             hash;                  /* hash: */
     NcString        hash_tag;              /* hash_tag: */
-    int             distribution;
+    int             distribution;          /* distribution: */
     int             timeout;               /* timeout: */
     int             backlog;               /* backlog: */
     int             client_connections;    /* client_connections: */
@@ -104,8 +154,19 @@ public:
     int             preconnect;            /* preconnect: */
     int             auto_eject_hosts;      /* auto_eject_hosts: */
     int             server_connections;    /* server_connections: */
+    int             server_max_connections; /* server_max_connections: */
     int             server_retry_timeout;  /* server_retry_timeout: in msec */
     int             server_failure_limit;  /* server_failure_limit: */
+    size_t          memory_budget;         /* memory_budget: in bytes */
+    NcProtocolType  protocol;              /* protocol: */
+    NcConfHttpKey   http_key;              /* http_key: */
+    NcString        mysql_user;            /* mysql_user: */
+    NcString        mysql_password;        /* mysql_password: */
+    NcString        mysql_db;              /* mysql_db: */
+    int             collapse;              /* collapse: */
+    size_t          cache_size;            /* cache_size: in bytes */
+    int             cache_ttl;             /* cache_ttl: in msec */
+    int             maglev_size;           /* maglev_size: # slots */
     std::vector<NcConfServer*>       server;                /* servers: conf_server[] */
     unsigned        valid;                 /* valid? */
 };
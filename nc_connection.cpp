@@ -164,11 +164,24 @@ rstatus_t NcConn::recvChain(NcMsgBase *_msg)
     ASSERT(ctx != NULL);
 
     NcMsg *msg = (NcMsg*)_msg;
-    NcQueue<NcMbuf*> *mbuf_queue = msg->getMbufQueue();
+    NcMbufQueue *mbuf_queue = msg->getMbufQueue();
     NcMbuf *mbuf = mbuf_queue->back();
+    bool fresh = false;
     if (mbuf == NULL || mbuf->full()) 
     {
-        mbuf = (ctx->mbuf_pool).alloc<NcMbuf>();
+        /*
+         * Pick the size class from the bytes known to be pending: what the
+         * parser still expects for this message or, when that is unknown,
+         * twice the mbuf that just filled up. A new message starts in its
+         * inline buffer, so small requests never touch the pool.
+         */
+        size_t hint = msg->getPending();
+        if (hint == 0 && mbuf != NULL)
+        {
+            hint = 2 * mbuf->dataSize();
+        }
+
+        mbuf = msg->allocMbuf(ctx, hint);
         if (mbuf == NULL) 
         {
             LOG_ERROR("mbuf is NULL");
@@ -177,6 +190,7 @@ rstatus_t NcConn::recvChain(NcMsgBase *_msg)
 
         mbuf_queue->push(mbuf);
         msg->setPos(mbuf->getPos());
+        fresh = true;
 
         LOG_DEBUG("push mbuf, pos : %p, size : %d", mbuf->getPos(), mbuf_queue->size());
     }
@@ -188,6 +202,12 @@ rstatus_t NcConn::recvChain(NcMsgBase *_msg)
     {
         if (n == NC_EAGAIN) 
         {
+            // 空闲连接不占用mbuf
+            if (fresh && mbuf->empty())
+            {
+                mbuf_queue->remove(mbuf);
+                (ctx->mbuf_pool).free(mbuf);
+            }
             return NC_OK;
         }
 
@@ -195,7 +215,7 @@ rstatus_t NcConn::recvChain(NcMsgBase *_msg)
     }
 
     mbuf->setLast(n);
-    msg->setLength(n);
+    msg->setLength(msg->m_mlen_ + (uint32_t)n);
 
     NcMsg *nmsg = NULL;
     for (;;) 
@@ -223,7 +243,7 @@ rstatus_t NcConn::sendChain(NcMsgBase *msg)
 {
     FUNCTION_INTO(NcConn);
 
-    NcQueue<NcMsg*> send_msgq;
+    NcTailQueue<NcMsgBase> send_msgq(&NcMsgBase::m_m_tqe_);
     struct iovec iov[NC_IOV_MAX];
     size_t nsend = 0, nsent = 0, limit = SSIZE_MAX; /* bytes to send; bytes sent */
     size_t mlen = 0, iov_n = 0;
@@ -235,14 +255,14 @@ rstatus_t NcConn::sendChain(NcMsgBase *msg)
     LOG_DEBUG("msg : %p", msg);
 
     NcMsg *cmsg = (NcMsg*)msg;
-    NcQueue<NcMbuf*> *mbuf_queue = cmsg->getMbufQueue();
     for (;;)
     {
         send_msgq.push(cmsg);
 
-        NcMbuf *mbuf = mbuf_queue->front();
-        NcQueue<NcMbuf*>::ConstIterator iter = mbuf_queue->find(mbuf);
-        while (iter != mbuf_queue->end() && nsend < limit)
+        NcMbufQueue *mbuf_queue = cmsg->getMbufQueue();
+        NcMbufQueue::ConstIterator iter = mbuf_queue->begin();
+        // 一个消息的mbuf可能很多(例如合并的多key响应), iov满了剩下的下次再发
+        while (iter != mbuf_queue->end() && nsend < limit && iov_n < NC_IOV_MAX)
         {
             LOG_DEBUG("mbuf_queue size : %d", mbuf_queue->size());
             if ((*iter)->empty())
@@ -296,13 +316,11 @@ rstatus_t NcConn::sendChain(NcMsgBase *msg)
     LOG_DEBUG("n : %d", n);
 
     nsent = n > 0 ? (size_t)n : 0;
-    NcMsg *nmsg = send_msgq.front();
-    NcQueue<NcMsg*>::ConstIterator iter = send_msgq.find(nmsg);
-    while (!send_msgq.empty() && iter != send_msgq.end())
+    NcMsg *nmsg = NULL;
+    while (!send_msgq.empty())
     {
-        LOG_DEBUG("send_msgq size : %d, *iter : %p", send_msgq.size(), *iter);
-        nmsg = *iter;
-        send_msgq.remove(*iter++);
+        nmsg = (NcMsg*)(send_msgq.pop());
+        LOG_DEBUG("send_msgq size : %d, nmsg : %p", send_msgq.size(), nmsg);
 
         if (nsent == 0)
         {
@@ -313,9 +331,9 @@ rstatus_t NcConn::sendChain(NcMsgBase *msg)
             continue;
         }
 
-        NcQueue<NcMbuf*> *_mbuf_queue = nmsg->getMbufQueue();
+        NcMbufQueue *_mbuf_queue = nmsg->getMbufQueue();
         NcMbuf *mbuf = NULL;
-        NcQueue<NcMbuf*>::ConstIterator iter1 = _mbuf_queue->begin();
+        NcMbufQueue::ConstIterator iter1 = _mbuf_queue->begin();
         while (iter1 != _mbuf_queue->end())
         {
             mbuf = *iter1;
@@ -64,7 +64,7 @@
 class NcConn : public NcConnBase
 {
 public:
-    NcConn()
+    NcConn() : m_imsg_q_(&NcMsgBase::m_s_tqe_), m_omsg_q_(&NcMsgBase::m_s_tqe_)
     {
         reset();
         LOG_DEBUG("NcConn reset");
@@ -78,6 +78,9 @@ public:
         m_connecting_ = 0;
         m_connected_ = 0;
         m_authenticated_ = 0;
+        m_stage_ = 0;
+        m_pin_ = 0;
+        m_pinned_ = NULL;
 
         m_rmsg_ = NULL;
         m_smsg_ = NULL;
@@ -165,8 +168,18 @@ public:
     unsigned            m_authenticated_;   /* authenticated? */
     int                 m_timeout_;
 
-    NcQueue<NcMsgBase*> m_imsg_q_;       /* incoming request queue */
-    NcQueue<NcMsgBase*> m_omsg_q_;       /* outstanding request queue */
+    /*
+     * Login and pinning of protocols with session state (mysql): a client
+     * pinned to a server connection sends all its requests there, the
+     * server connection serves that client only.
+     */
+    uint32_t            m_stage_;           /* handshake stage */
+    uint32_t            m_pin_;             /* why it is pinned, protocol specific */
+    NcConn              *m_pinned_;         /* peer connection it is pinned to */
+    uint8_t             m_salt_[20];        /* salt of the handshake */
+
+    NcTailQueue<NcMsgBase> m_imsg_q_;    /* incoming request queue */
+    NcTailQueue<NcMsgBase> m_omsg_q_;    /* outstanding request queue */
 
     NcMsgBase*          m_rmsg_;         /* current message being rcvd */
     NcMsgBase*          m_smsg_;         /* current message being sent */
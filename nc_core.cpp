@@ -35,14 +35,14 @@ rstatus_t NcContext::createServerConn()
 
     for (int i = 0; i < pool->server.size(); i++)
     {
-        NcServerConn *conn = (NcServerConn*)p_pool.alloc<NcServerConn>();
+        NcServerConn *conn = (NcServerConn*)s_pool.alloc<NcServerConn>();
         conn->ref((pool->server)[i]);
 
         rstatus_t status = conn->connect();
         if (status != NC_OK) 
         {
+            // close()把conn还给s_pool
             conn->close();
-            nc_delete(conn);
             return status;
         }
     }
@@ -50,6 +50,87 @@ rstatus_t NcContext::createServerConn()
     return NC_OK;
 }
 
+void NcContext::dumpStats()
+{
+    NcServerPool *pool = (NcServerPool*)server_pool;
+    ASSERT(pool != NULL);
+
+    LOG_VERBOSE("stats for pool '%.*s'", pool->name.length(), pool->name.c_str());
+    mbuf_pool.dump();
+    msg_pool.dump();
+    c_pool.dump();
+    s_pool.dump();
+    p_pool.dump();
+
+    LOG_VERBOSE("budget used %zu max %zu limit %zu, throttled %" PRIu32 
+        " clients, %" PRIu64 " throttles", budget.used(), budget.usedMax(), 
+        budget.limit(), (uint32_t)throttled_q.size(), nthrottle);
+
+    if (pool->collapse)
+    {
+        LOG_VERBOSE("collapse %" PRIu64 " reads led, %" PRIu64 " hits, %" PRIu32 
+            " in flight", pool->ncollapse_lead, pool->ncollapse_hit, 
+            (uint32_t)pool->collapsing.size());
+    }
+
+    if (pool->cache.enabled())
+    {
+        pool->cache.dump();
+    }
+}
+
+void NcContext::trimPools()
+{
+    uint32_t n = mbuf_pool.trim(NC_POOL_LOW);
+    n += msg_pool.trim();
+    n += c_pool.trim();
+    n += s_pool.trim();
+    n += p_pool.trim();
+
+    if (n > 0)
+    {
+        LOG_DEBUG("ctx %" PRIu32 " trimmed %" PRIu32 " free objects", id, n);
+    }
+}
+
+void NcContext::throttle(NcConnBase *conn)
+{
+    if (throttled_q.contains(conn))
+    {
+        return ;
+    }
+
+    rstatus_t status = getEvb().delInput(conn);
+    if (status != NC_OK)
+    {
+        return ;
+    }
+
+    throttled_q.push(conn);
+    nthrottle++;
+    LOG_DEBUG("throttle c %d, budget used %zu", conn->m_sd_, budget.used());
+}
+
+void NcContext::unthrottle(NcConnBase *conn)
+{
+    throttled_q.remove(conn);
+}
+
+void NcContext::rearmThrottled()
+{
+    if (throttled_q.size() == 0 || !budget.under())
+    {
+        return ;
+    }
+
+    NcConnBase *conn;
+    while ((conn = throttled_q.pop()) != NULL)
+    {
+        LOG_DEBUG("unthrottle c %d, budget used %zu", conn->m_sd_, budget.used());
+        getEvb().addInput(conn);
+    }
+}
+
 rstatus_t NcContext::calcConnections()
 {
     int status;
@@ -86,6 +167,27 @@ NcContext* NcInstance::createContext(NcConfPool *_pool)
     _ctx->server_pool = new NcServerPool(_ctx);
     _ctx->instance = this;
     NcUtil::ncMbufChunkSize(mbuf_chunk_size);
+    _ctx->mbuf_pool.init(mbuf_chunk_size);
+    _ctx->msg_pool.init("msg", NC_POOL_LOW, NC_POOL_HIGH);
+    _ctx->c_pool.init("client", NC_POOL_LOW, NC_POOL_HIGH);
+    _ctx->s_pool.init("server", NC_POOL_LOW, NC_POOL_HIGH);
+    _ctx->p_pool.init("proxy", 0, NC_POOL_LOW);
+
+    if (arena.enabled())
+    {
+        _ctx->mbuf_pool.setArena(&arena);
+        _ctx->msg_pool.setArena(&arena);
+    }
+
+    // pool的budget挂在进程的budget下, 两者任一超限都会限流
+    _ctx->protocol_type = _pool->protocol;
+    _ctx->budget.init(_pool->memory_budget, &budget);
+    _ctx->mbuf_pool.setBudget(&_ctx->budget);
+    _ctx->msg_pool.setBudget(&_ctx->budget);
+
+    // 预分配对象, pool_prealloc为0时不预分配
+    _ctx->msg_pool.prealloc<NcMsg>(pool_prealloc);
+    _ctx->c_pool.prealloc<NcClientConn>(pool_prealloc);
     
     ((NcServerPool*)(_ctx->server_pool))->setConf(_pool);
 
@@ -124,7 +226,7 @@ rstatus_t NcInstance::loop()
     FUNCTION_INTO(NcInstance);
 
     // TODO : 
-    timeout = -1;
+    timeout = MIN(stats_interval, NC_POOL_TRIM_INTERVAL);
     int nsd = evb.wait(timeout);
     LOG_DEBUG("nsd : %d", nsd);
     if (nsd < 0) 
@@ -132,6 +234,33 @@ rstatus_t NcInstance::loop()
         return nsd;
     }
 
+    // budget回落到low watermark以下, 恢复被限流的client
+    for (uint32_t i = 0; i < ctx.size(); i++)
+    {
+        ctx[i]->rearmThrottled();
+    }
+
+    // 定期打印统计信息
+    int64_t stats_now = NcUtil::ncCachedMsec();
+    if (stats_now >= stats_next)
+    {
+        for (uint32_t i = 0; i < ctx.size(); i++)
+        {
+            ctx[i]->dumpStats();
+        }
+        stats_next = stats_now + stats_interval;
+    }
+
+    // 定期回收空闲对象
+    if (stats_now >= trim_next)
+    {
+        for (uint32_t i = 0; i < ctx.size(); i++)
+        {
+            ctx[i]->trimPools();
+        }
+        trim_next = stats_now + NC_POOL_TRIM_INTERVAL;
+    }
+
     // 提取超时的节点，并处理
     for (;;) 
     {
@@ -154,7 +283,7 @@ rstatus_t NcInstance::loop()
         NcConn *conn = (NcConn*)(msg->data);
         int64_t then = msg->key;
 
-        int64_t now = NcUtil::ncMsecNow();
+        int64_t now = NcUtil::ncCachedMsec();
         if (now < then) 
         {
             int delta = (int)(then - now);
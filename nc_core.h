@@ -61,11 +61,17 @@
 #include <sys/resource.h>
 #include <netinet/in.h>
 #include <queue>
+#include <vector>
+#include <deque>
+#include <new>
+#include <type_traits>
 #include <nc_event.h>
 #include <nc_log.h>
 #include <nc_string.h>
 #include <nc_rbtree.h>
 #include <nc_util.h>
+#include <nc_arena.h>
+#include <nc_budget.h>
 #include <nc_mbuf.h>
 #include <nc_queue.h>
 #include <nc_signal.h>
@@ -75,51 +81,97 @@ class NcInstance;
 class NcContext;
 class NcMsgBase;
 
-typedef enum
-{
-    kPROTOCOL_HTTP,
-    kPROTOCOL_REDIS,
-    kPROTOCOL_MEMCACHED,
-    kPROTOCOL_MYSQL,
-} NcProtocolType;
-
+#define NC_POOL_LOW             64      /* free objects kept by the trim */
+#define NC_POOL_HIGH            4096    /* free objects kept at most */
+#define NC_POOL_TRIM_BATCH      1024    /* max objects released per trim */
+#define NC_POOL_TRIM_INTERVAL   1000    /* trim interval in msec */
+
+/*
+ * Free list of reusable objects. Objects are handed out LIFO so the one
+ * freed last, still warm in cache, is reused first. At most high free
+ * objects are kept; anything freed beyond that is deleted right away.
+ * trim() is called periodically from the event loop and releases the
+ * objects that stayed unused for the whole interval, down to low, so the
+ * memory grabbed by a connection storm is given back once it is over.
+ * With an arena set, new objects are placed in it while it lasts; those
+ * are never deleted, only kept on the free list.
+ */
 template<class T>
 class NcObjectPool
 {
 public:
-    typedef std::queue<T> NcObjectQueue;
+    typedef std::deque<T> NcObjectStack;
+    typedef typename std::remove_pointer<T>::type NcObjectType;
 
-    NcObjectPool() : m_free_(0)
+    NcObjectPool() : m_name_("pool"), m_low_(NC_POOL_LOW), m_high_(NC_POOL_HIGH),
+        m_min_free_(0), m_nused_(0), m_hit_(0), m_miss_(0), m_ntrim_(0), 
+        m_current_(NULL), m_arena_(NULL), m_budget_(NULL), m_osize_(0)
     { }
 
     ~NcObjectPool()
     {
-        T o = NULL;
-        while (!m_queue_.empty())
+        for (uint32_t i = 0; i < m_stack_.size(); i++)
         {
-            o = m_queue_.front();
-            m_queue_.pop();
-            if (o != NULL)
-            {
-                delete o;
-            }
+            destroy(m_stack_[i]);
+        }
+    }
+
+    inline void setArena(NcArena *arena)
+    {
+        m_arena_ = arena;
+    }
+
+    // 使用中的对象计入budget
+    inline void setBudget(NcBudget *budget)
+    {
+        m_budget_ = budget;
+    }
+
+    void init(const char *name, uint32_t low, uint32_t high)
+    {
+        ASSERT(low <= high);
+
+        m_name_ = name;
+        m_low_ = low;
+        m_high_ = high;
+    }
+
+    // 预先分配n个对象, 避免启动后的第一波连接走到new
+    template<class RT>
+    void prealloc(uint32_t n)
+    {
+        n = MIN(n, m_high_);
+        while (m_stack_.size() < n)
+        {
+            m_stack_.push_front(create<RT>());
         }
+        m_min_free_ = (uint32_t)m_stack_.size();
     }
 
     template<class RT>
     inline T alloc(void *args = NULL)
     {
         T o = NULL;
-        if (!m_queue_.empty())
+        if (!m_stack_.empty())
         {
-            o = m_queue_.front();
-            m_queue_.pop();
+            o = m_stack_.front();
+            m_stack_.pop_front();
+            m_min_free_ = MIN(m_min_free_, (uint32_t)m_stack_.size());
+            m_hit_++;
         }
         else
         {
-            o = new RT();
+            o = create<RT>();
+            m_min_free_ = 0;
+            m_miss_++;
         }
 
+        m_nused_++;
+        if (m_budget_ != NULL)
+        {
+            m_osize_ = sizeof(RT);
+            m_budget_->charge(m_osize_);
+        }
         m_current_ = o;
         return o;
     }
@@ -130,10 +182,57 @@ public:
         {
             return ;
         }
+
+        m_nused_--;
+        if (m_budget_ != NULL)
+        {
+            m_budget_->uncharge(m_osize_);
+        }
+        if (m_stack_.size() >= m_high_ && !inArena(o))
+        {
+            delete o;
+            m_ntrim_++;
+            return ;
+        }
         
         o->reset();
-        m_queue_.push(o);
-        m_free_++;
+        m_stack_.push_front(o);
+    }
+
+    /*
+     * Release the objects that were not needed since the last trim, i.e.
+     * the minimum free count over the interval, but keep at least low.
+     */
+    uint32_t trim()
+    {
+        uint32_t nfree = (uint32_t)m_stack_.size();
+        uint32_t n = 0;
+        if (nfree > m_low_)
+        {
+            n = MIN(m_min_free_, nfree - m_low_);
+            n = MIN(n, NC_POOL_TRIM_BATCH);
+        }
+
+        /* the back is the coldest, arena objects stay there */
+        uint32_t ntrim = 0;
+        NcObjectStack kept;
+        for (uint32_t i = 0; i < n; i++)
+        {
+            T o = m_stack_.back();
+            m_stack_.pop_back();
+            if (inArena(o))
+            {
+                kept.push_front(o);
+                continue;
+            }
+            delete o;
+            ntrim++;
+        }
+        m_stack_.insert(m_stack_.end(), kept.begin(), kept.end());
+        m_ntrim_ += ntrim;
+
+        m_min_free_ = (uint32_t)m_stack_.size();
+        return ntrim;
     }
 
     inline T current()
@@ -141,10 +240,81 @@ public:
         return m_current_;
     }
 
+    inline uint32_t nfree()
+    {
+        return (uint32_t)m_stack_.size();
+    }
+
+    inline uint32_t nused()
+    {
+        return m_nused_;
+    }
+
+    inline uint64_t nhit()
+    {
+        return m_hit_;
+    }
+
+    inline uint64_t nmiss()
+    {
+        return m_miss_;
+    }
+
+    inline uint64_t ntrim()
+    {
+        return m_ntrim_;
+    }
+
+    void dump()
+    {
+        LOG_VERBOSE("%s pool: used %" PRIu32 " free %" PRIu32 " (low %" PRIu32 
+            " high %" PRIu32 ") hit %" PRIu64 " miss %" PRIu64 " trim %" PRIu64,
+            m_name_, m_nused_, nfree(), m_low_, m_high_, m_hit_, m_miss_, m_ntrim_);
+    }
+
 private:
-    NcObjectQueue   m_queue_;
-    uint32_t        m_free_;
+    template<class RT>
+    inline T create()
+    {
+        void *p = m_arena_ == NULL ? NULL : m_arena_->alloc(sizeof(RT));
+        if (p != NULL)
+        {
+            return new (p) RT();
+        }
+
+        return new RT();
+    }
+
+    inline bool inArena(T o)
+    {
+        return m_arena_ != NULL && m_arena_->contains(o);
+    }
+
+    inline void destroy(T o)
+    {
+        if (inArena(o))
+        {
+            o->~NcObjectType();
+            return ;
+        }
+
+        delete o;
+    }
+
+private:
+    NcObjectStack   m_stack_;       /* free objects, the front is the warmest */
+    const char      *m_name_;       /* pool name, for stats */
+    uint32_t        m_low_;         /* free objects kept by trim */
+    uint32_t        m_high_;        /* max free objects */
+    uint32_t        m_min_free_;    /* min # free objects since last trim */
+    uint32_t        m_nused_;       /* # objects handed out */
+    uint64_t        m_hit_;         /* # allocs served from the free list */
+    uint64_t        m_miss_;        /* # allocs that had to new */
+    uint64_t        m_ntrim_;       /* # free objects deleted */
     T               m_current_;
+    NcArena         *m_arena_;      /* arena for new objects, optional */
+    NcBudget        *m_budget_;     /* budget charged for objects in use, optional */
+    size_t          m_osize_;       /* bytes charged per object */
 };
 
 class NcInstance 
@@ -165,10 +335,17 @@ public:
     // 监控的数据
     uint16_t        stats_port;                  /* stats monitoring port */
     int             stats_interval;              /* stats aggregation interval */
+    int64_t         stats_next;                  /* next stats dump time in msec */
+    int64_t         trim_next;                   /* next pool trim time in msec */
     char            *stats_addr;                 /* stats monitoring addr */
 
     char            hostname[NC_MAXHOSTNAMELEN]; /* hostname */
     size_t          mbuf_chunk_size;             /* mbuf chunk size */
+    uint32_t        pool_prealloc;               /* # objects preallocated per pool */
+    size_t          arena_size;                  /* buffer arena size, 0 if off */
+    size_t          memory_budget;               /* process-wide buffer budget, 0 if off */
+    NcBudget        budget;                      /* process-wide buffer budget */
+    NcArena         arena;                       /* buffer arena for mbufs and msgs */
     pid_t           pid;                         /* process id */
     char            *pid_filename;               /* pid filename */
     unsigned        pidfile;                     /* pid file created? */
@@ -185,7 +362,8 @@ public:
 class NcContext 
 {
 public:
-    NcContext() : server_pool(NULL), instance(NULL)
+    NcContext() : throttled_q(&NcConnBase::m_throttle_tqe_), nthrottle(0),
+        server_pool(NULL), instance(NULL)
     { }
 
     rstatus_t createProxyConn();
@@ -194,6 +372,17 @@ public:
 
     rstatus_t calcConnections();
 
+    void dumpStats();
+
+    void trimPools();
+
+    // 超过budget时暂停client的读事件, 低于低水位后恢复
+    void throttle(NcConnBase *conn);
+
+    void unthrottle(NcConnBase *conn);
+
+    void rearmThrottled();
+
     inline void setInstance(NcInstance *_instance)
     {
         instance = _instance;
@@ -215,10 +404,14 @@ public:
     }
 
 public:
-    NcObjectPool<NcMbuf*>           mbuf_pool;
+    NcMbufPool                      mbuf_pool;
     NcObjectPool<NcConnBase*>       c_pool, s_pool, p_pool;
     NcObjectPool<NcMsgBase*>        msg_pool;
 
+    NcBudget                        budget;         /* pool buffer budget */
+    NcTailQueue<NcConnBase>         throttled_q;    /* clients with reads paused */
+    uint64_t                        nthrottle;      /* # times a client was throttled */
+
     uint32_t        id;             /* unique context id */
     int             max_timeout;    /* max timeout in msec */
     int             timeout;        /* timeout in msec */
@@ -236,18 +429,40 @@ public:
 class NcMsgBase : public rbnode
 {
 public:
-    void reset()
+    virtual ~NcMsgBase()
+    { }
+
+    virtual void reset()
     {
         rbnode::reset();
 
         m_id_ = NcUtil::uniqNextId();
         m_peer_ = NULL;
         m_mlen_ = 0; 
-        m_start_ts_ = NcUtil::ncUsecNow();
+        m_start_ts_ = NcUtil::ncCachedUsec();
         pos = NULL;
 
+        state = 0;
         m_err_ = 0;
+        m_error_ = 0;
+        m_ferror_ = 0;
+        m_request_ = 0;
+        m_quit_ = 0;
+        m_noreply_ = 0;
+        m_noforward_ = 0;
+        m_done_ = 0;
+        m_fdone_ = 0;
+        m_swallow_ = 0;
         m_type_ = kPROTOCOL_HTTP;
+
+        m_frag_id_ = 0;
+        m_frag_owner_ = NULL;
+        m_nfrag_ = 0;
+        m_nfrag_done_ = 0;
+
+        m_c_tqe_.reset();
+        m_s_tqe_.reset();
+        m_m_tqe_.reset();
     }
 
     inline void setProtocolType(NcProtocolType type)
@@ -273,6 +488,9 @@ public:
 public:
     uint64_t        m_id_;              /* message id */
     NcMsgBase       *m_peer_;           /* message peer */
+    NcQueueEntry<NcMsgBase> m_c_tqe_;   /* link in client q */
+    NcQueueEntry<NcMsgBase> m_s_tqe_;   /* link in server q */
+    NcQueueEntry<NcMsgBase> m_m_tqe_;   /* link in send q / frag msg q */
     uint32_t        m_mlen_;            /* message length */  
     int64_t         m_start_ts_;        /* request start timestamp in usec */
     uint8_t         *pos;
@@ -289,6 +507,11 @@ public:
     unsigned        m_fdone_;           /* all fragments are done? */
     unsigned        m_swallow_;         /* swallow response? */
     NcProtocolType  m_type_;            // 类型
+
+    uint64_t        m_frag_id_;         /* id of the split request, 0 if not split */
+    NcMsgBase       *m_frag_owner_;     /* owner of a fragment, NULL for the owner */
+    uint32_t        m_nfrag_;           /* # fragments (owner) */
+    uint32_t        m_nfrag_done_;      /* # fragments done (owner) */
 };
 
 #endif
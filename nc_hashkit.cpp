@@ -1,33 +1,33 @@
+#include <math.h>
+#include <algorithm>
 #include <nc_hashkit.h>
 
-static rstatus_t random_update(NcServerPool *pool)
-{
-    #define RANDOM_CONTINUUM_ADDITION   10  /* # extra slots to build into continuum */
-    #define RANDOM_POINTS_PER_SERVER    1
-
-    int64_t now = NcUtil::ncUsecNow();
-
-    if (now < 0)
-    {
-        LOG_WARN("now < 0");
-        return NC_ERROR;
-    }
+#define KETAMA_POINTS_PER_SERVER    160 /* 40 points per hash */
+#define KETAMA_MAX_HOSTLEN          86
+#define KETAMA_LUT_MAX_BITS         16  /* at most 64K + 1 prefixes */
 
+/*
+ * Count the live servers of pool and the sum of their weights, and set
+ * when the first of the ejected ones is due to come back.
+ */
+static uint32_t live_servers(NcServerPool *pool, int64_t now, uint32_t *total_weight)
+{
     uint32_t nserver = pool->server.size();
     uint32_t nlive_server = 0;
     pool->next_rebuild = 0LL;
+    *total_weight = 0;
 
-    for (int i = 0; i < nserver; i++)
+    for (uint32_t i = 0; i < nserver; i++)
     {
         NcServer *server = (pool->server)[i];
-        if (pool->auto_eject_hosts) 
+        if (pool->auto_eject_hosts)
         {
-            if (server->getNextRetry() <= now) 
+            if (server->getNextRetry() <= now)
             {
                 server->setNextRetry(0LL);
                 nlive_server++;
-            } 
-            else if (pool->next_rebuild == 0LL || server->getNextRetry() < pool->next_rebuild) 
+            }
+            else if (pool->next_rebuild == 0LL || server->getNextRetry() < pool->next_rebuild)
             {
                 pool->next_rebuild = server->getNextRetry();
             }
@@ -35,67 +35,998 @@ static rstatus_t random_update(NcServerPool *pool)
             {
                 // pass
             }
-        } 
-        else 
+        }
+        else
         {
             nlive_server++;
         }
+
+        ASSERT(server->getWeight() > 0);
+
+        /* count weight only for live servers */
+        if (!pool->auto_eject_hosts || server->getNextRetry() <= now)
+        {
+            *total_weight += server->getWeight();
+        }
     }
 
     pool->nlive_server = nlive_server;
-    if (nlive_server == 0) 
+    if (nlive_server == 0)
     {
-        LOG_DEBUG("no live servers for pool %" PRIu32 " '%.*s'", 
+        LOG_DEBUG("no live servers for pool %" PRIu32 " '%.*s'",
             pool->idx, pool->name.length(), pool->name.c_str());
+        pool->ncontinuum = 0;
+    }
+
+    return nlive_server;
+}
+
+static inline bool ejected(NcServerPool *pool, NcServer *server, int64_t now)
+{
+    return pool->auto_eject_hosts && server->getNextRetry() > now;
+}
+
+/*
+ * Name of server on a continuum, as in twemproxy: host, plus :port unless
+ * it is the memcached port
+ */
+static int server_name(NcServer *server, char *buf, size_t size)
+{
+    NcStringView &name = server->getName();
+    int n = server->getPort() != CONF_DEFAULT_KETAMA_PORT && server->getPort() != 0 ?
+        snprintf(buf, size, "%.*s:%u", name.length(), name.c_str(), server->getPort()) :
+        snprintf(buf, size, "%.*s", name.length(), name.c_str());
+
+    return MIN(n, (int)size - 1);
+}
+
+static uint32_t ketama_hash(const char *key, size_t key_length, uint32_t alignment)
+{
+    unsigned char results[16];
+    NcMd5 md5;
+
+    md5.signature((unsigned char*)key, (unsigned long)key_length, results);
+
+    return ((uint32_t) (results[3 + alignment * 4] & 0xFF) << 24)
+        | ((uint32_t) (results[2 + alignment * 4] & 0xFF) << 16)
+        | ((uint32_t) (results[1 + alignment * 4] & 0xFF) << 8)
+        | (results[0 + alignment * 4] & 0xFF);
+}
+
+static bool ketama_item_cmp(const NcContinuum &ct1, const NcContinuum &ct2)
+{
+    return ct1.value < ct2.value;
+}
+
+static rstatus_t ketama_update(NcServerPool *pool, int64_t now)
+{
+    uint32_t total_weight;
+    uint32_t nlive_server = live_servers(pool, now, &total_weight);
+    if (nlive_server == 0)
+    {
         return NC_OK;
     }
 
-    if (nlive_server > pool->nserver_continuum) 
+    LOG_DEBUG("%" PRIu32 " of %" PRIu32 " servers are live for pool "
+        "%" PRIu32 " '%.*s'", nlive_server, pool->server.size(), pool->idx,
+        pool->name.length(), pool->name.c_str());
+
+    /*
+     * Build a continuum with the servers that are live and points from
+     * these servers that are proportial to their weight
+     */
+    std::vector<NcContinuum> &continuum = pool->continuum;
+    continuum.clear();
+    continuum.reserve(nlive_server * KETAMA_POINTS_PER_SERVER + 1);
+    for (uint32_t i = 0; i < pool->server.size(); i++)
+    {
+        NcServer *server = (pool->server)[i];
+        if (ejected(pool, server, now))
+        {
+            continue;
+        }
+
+        float pct = (float)server->getWeight() / (float)total_weight;
+        uint32_t pointer_per_server = (uint32_t) ((floorf((float) (pct *
+            KETAMA_POINTS_PER_SERVER / 4 * (float)nlive_server + 0.0000000001))) * 4);
+        uint32_t pointer_per_hash = 4;
+
+        LOG_DEBUG("%.*s weight %" PRIu32 " of %" PRIu32 " pct %0.5f points "
+            "per server %" PRIu32 "", server->getPname().length(),
+            server->getPname().c_str(), server->getWeight(), total_weight,
+            pct, pointer_per_server);
+
+        char name[KETAMA_MAX_HOSTLEN];
+        int namelen = server_name(server, name, sizeof(name));
+        for (uint32_t pointer_index = 1;
+            pointer_index <= pointer_per_server / pointer_per_hash; pointer_index++)
+        {
+            char host[KETAMA_MAX_HOSTLEN] = "";
+            int hostlen = snprintf(host, KETAMA_MAX_HOSTLEN, "%.*s-%u", namelen, name,
+                pointer_index - 1);
+            hostlen = MIN(hostlen, KETAMA_MAX_HOSTLEN - 1);
+
+            for (uint32_t x = 0; x < pointer_per_hash; x++)
+            {
+                NcContinuum point;
+                point.value = ketama_hash(host, hostlen, x);
+                point.index = i;
+                continuum.push_back(point);
+            }
+        }
+    }
+
+    pool->ncontinuum = continuum.size();
+    std::stable_sort(continuum.begin(), continuum.end(), ketama_item_cmp);
+
+    /* past the last point is the first one again */
+    NcContinuum sentinel;
+    sentinel.value = UINT32_MAX;
+    sentinel.index = continuum.empty() ? 0 : continuum[0].index;
+    continuum.push_back(sentinel);
+
+    // 前缀表: 每个前缀的第一个点, 大约每个前缀一到两个点
+    uint32_t bits = 1;
+    while (bits < KETAMA_LUT_MAX_BITS && (1U << bits) < pool->ncontinuum)
     {
-        uint32_t nserver_continuum = nlive_server + RANDOM_CONTINUUM_ADDITION;
-        uint32_t ncontinuum = nserver_continuum * RANDOM_POINTS_PER_SERVER;
+        bits++;
+    }
+    pool->continuum_shift = 32 - bits;
 
-        for (uint32_t i = 0; i < (ncontinuum - pool->continuum.size()); i++)
+    std::vector<uint32_t> &lut = pool->continuum_lut;
+    lut.resize((1U << bits) + 1);
+    uint32_t idx = 0;
+    for (uint32_t prefix = 0; prefix < (1U << bits); prefix++)
+    {
+        uint32_t start = prefix << pool->continuum_shift;
+        while (idx < pool->ncontinuum && continuum[idx].value < start)
         {
-            pool->continuum.push_back(new NcContinuum());
+            idx++;
         }
+        lut[prefix] = idx;
+    }
+    lut[1U << bits] = pool->ncontinuum;
+
+    LOG_DEBUG("updated pool %" PRIu32 " '%.*s' with %" PRIu32 " of "
+        "%" PRIu32 " servers live, %" PRIu32 " points, %" PRIu32 " prefixes",
+        pool->idx, pool->name.length(), pool->name.c_str(), nlive_server,
+        pool->server.size(), pool->ncontinuum, 1U << bits);
+
+    return NC_OK;
+}
 
-        srandom((uint32_t)time(NULL));
-        pool->nserver_continuum = nserver_continuum;
+static rstatus_t modula_update(NcServerPool *pool, int64_t now)
+{
+    uint32_t total_weight;
+    uint32_t nlive_server = live_servers(pool, now, &total_weight);
+    if (nlive_server == 0)
+    {
+        return NC_OK;
     }
 
-    uint32_t continuum_index = 0;
-    uint32_t pointer_counter = 0;                           /* # pointers on continuum */
-    uint32_t points_per_server, pointer_per_server;         /* points per server */
-    for (uint32_t i = 0; i < nserver; i++)
+    /* as many points as its weight for each live server */
+    pool->continuum.clear();
+    for (uint32_t i = 0; i < pool->server.size(); i++)
     {
         NcServer *server = (pool->server)[i];
-        if (pool->auto_eject_hosts && server->getNextRetry() > now) 
+        if (ejected(pool, server, now))
         {
             continue;
         }
 
-        pointer_per_server = 1;
+        NcContinuum point;
+        point.value = 0;
+        point.index = i;
+        pool->continuum.insert(pool->continuum.end(), server->getWeight(), point);
+    }
+    pool->ncontinuum = pool->continuum.size();
 
-        pool->continuum[continuum_index]->index = i;
-        pool->continuum[continuum_index]->value = 0;
+    LOG_DEBUG("updated pool %" PRIu32 " '%.*s' with %" PRIu32 " of "
+        "%" PRIu32 " servers live, %" PRIu32 " points", pool->idx,
+        pool->name.length(), pool->name.c_str(), nlive_server,
+        pool->server.size(), pool->ncontinuum);
 
-        continuum_index++;
+    return NC_OK;
+}
 
-        pointer_counter += pointer_per_server;
+static rstatus_t random_update(NcServerPool *pool, int64_t now)
+{
+    uint32_t total_weight;
+    uint32_t nlive_server = live_servers(pool, now, &total_weight);
+    if (nlive_server == 0)
+    {
+        return NC_OK;
+    }
+
+    /* one point for each live server */
+    srandom((uint32_t)time(NULL));
+    pool->continuum.clear();
+    for (uint32_t i = 0; i < pool->server.size(); i++)
+    {
+        if (ejected(pool, (pool->server)[i], now))
+        {
+            continue;
+        }
+
+        NcContinuum point;
+        point.value = 0;
+        point.index = i;
+        pool->continuum.push_back(point);
+    }
+    pool->ncontinuum = pool->continuum.size();
+
+    LOG_DEBUG("updated pool %" PRIu32 " '%.*s' with %" PRIu32 " of "
+        "%" PRIu32 " servers live", pool->idx, pool->name.length(),
+        pool->name.c_str(), nlive_server, pool->server.size());
+
+    return NC_OK;
+}
+
+static rstatus_t jump_update(NcServerPool *pool, int64_t now)
+{
+    uint32_t total_weight;
+    uint32_t nlive_server = live_servers(pool, now, &total_weight);
+    if (nlive_server == 0)
+    {
+        return NC_OK;
+    }
+
+    /* every server keeps its bucket, whether it is live or not */
+    pool->lookup.resize(pool->server.size());
+    for (uint32_t i = 0; i < pool->server.size(); i++)
+    {
+        pool->lookup[i] = ejected(pool, (pool->server)[i], now) ? UINT32_MAX : i;
     }
+    pool->ncontinuum = pool->lookup.size();
 
     LOG_DEBUG("updated pool %" PRIu32 " '%.*s' with %" PRIu32 " of "
-        "%" PRIu32 " servers live in %" PRIu32 " slots "
-        "active points in %" PRIu32 " slots", pool->idx,
-        pool->name.length(), pool->name.c_str(), nlive_server, nserver,
-        pool->nserver_continuum, 
-        (pool->nserver_continuum + RANDOM_CONTINUUM_ADDITION) * points_per_server);
+        "%" PRIu32 " servers live", pool->idx, pool->name.length(),
+        pool->name.c_str(), nlive_server, pool->server.size());
+
+    return NC_OK;
+}
+
+static uint32_t gcd(uint32_t a, uint32_t b)
+{
+    while (b != 0)
+    {
+        uint32_t t = a % b;
+        a = b;
+        b = t;
+    }
+
+    return a;
+}
+
+/*
+ * Maglev (Eisenbud et al.): each live server walks the slots of the table
+ * in an order of its own, given by an offset and a skip from the hash of
+ * its name, and the servers take turns to claim the next free slot in
+ * their order until the table is full. Servers end up with shares of the
+ * table within a slot of each other, weighted by taking weight / gcd of
+ * the weights turns in each round.
+ */
+static rstatus_t maglev_update(NcServerPool *pool, int64_t now)
+{
+    uint32_t total_weight;
+    uint32_t nlive_server = live_servers(pool, now, &total_weight);
+    if (nlive_server == 0)
+    {
+        return NC_OK;
+    }
+
+    uint32_t m = pool->maglev_size;
+    if (m < nlive_server)
+    {
+        LOG_WARN("pool '%.*s': maglev_size %" PRIu32 " is less than its %" PRIu32
+            " servers", pool->name.length(), pool->name.c_str(), m, nlive_server);
+    }
+
+    std::vector<uint32_t> live, pos, skip, turns;
+    uint32_t wgcd = 0;
+    for (uint32_t i = 0; i < pool->server.size(); i++)
+    {
+        NcServer *server = (pool->server)[i];
+        if (ejected(pool, server, now))
+        {
+            continue;
+        }
+
+        char name[KETAMA_MAX_HOSTLEN];
+        int namelen = server_name(server, name, sizeof(name));
+        live.push_back(i);
+        pos.push_back(NcHashKit::hash(kHASH_MD5, name, namelen) % m);
+        skip.push_back(NcHashKit::hash(kHASH_MURMUR, name, namelen) % (m - 1) + 1);
+        turns.push_back(server->getWeight());
+        wgcd = gcd(server->getWeight(), wgcd);
+    }
+
+    for (uint32_t k = 0; k < turns.size(); k++)
+    {
+        turns[k] = MAX(turns[k] / MAX(wgcd, 1), 1);
+    }
+
+    pool->lookup.assign(m, UINT32_MAX);
+    uint32_t filled = 0;
+    while (filled < m)
+    {
+        for (uint32_t k = 0; k < live.size() && filled < m; k++)
+        {
+            for (uint32_t t = 0; t < turns[k] && filled < m; t++)
+            {
+                while (pool->lookup[pos[k]] != UINT32_MAX)
+                {
+                    pos[k] = (uint32_t)(((uint64_t)pos[k] + skip[k]) % m);
+                }
+                pool->lookup[pos[k]] = live[k];
+                filled++;
+            }
+        }
+    }
+    pool->ncontinuum = m;
+
+    LOG_DEBUG("updated pool %" PRIu32 " '%.*s' with %" PRIu32 " of "
+        "%" PRIu32 " servers live in %" PRIu32 " slots", pool->idx,
+        pool->name.length(), pool->name.c_str(), nlive_server,
+        pool->server.size(), m);
+
+    return NC_OK;
+}
+
+static rstatus_t hrw_update(NcServerPool *pool, int64_t now)
+{
+    uint32_t total_weight;
+    uint32_t nlive_server = live_servers(pool, now, &total_weight);
+    if (nlive_server == 0)
+    {
+        return NC_OK;
+    }
+
+    /* the seed comes from the name, so a server keeps its keys across restarts */
+    uint32_t npadded = (pool->server.size() + HRW_LANES - 1) / HRW_LANES * HRW_LANES;
+    pool->hrw_seed.assign(npadded, 0);
+    pool->hrw_scale.assign(npadded, INFINITY);
+    for (uint32_t i = 0; i < pool->server.size(); i++)
+    {
+        NcServer *server = (pool->server)[i];
+        char name[KETAMA_MAX_HOSTLEN];
+        int namelen = server_name(server, name, sizeof(name));
+        pool->hrw_seed[i] = NcHashKit::hash(kHASH_MURMUR, name, namelen);
+        pool->hrw_scale[i] = ejected(pool, server, now) ? INFINITY :
+            1.0f / (float)MAX(server->getWeight(), 1);
+    }
+    pool->ncontinuum = pool->server.size();
+
+    LOG_DEBUG("updated pool %" PRIu32 " '%.*s' with %" PRIu32 " of "
+        "%" PRIu32 " servers live", pool->idx, pool->name.length(),
+        pool->name.c_str(), nlive_server, pool->server.size());
 
     return NC_OK;
 }
 
 rstatus_t NcHashKit::update(NcServerPool *pool)
 {
-    return random_update(pool);
-}
\ No newline at end of file
+    int64_t now = NcUtil::ncCachedUsec();
+    if (now < 0)
+    {
+        LOG_WARN("now < 0");
+        return NC_ERROR;
+    }
+
+    switch (pool->dist_type)
+    {
+    case kDIST_KETAMA:
+        return ketama_update(pool, now);
+
+    case kDIST_MODULA:
+        return modula_update(pool, now);
+
+    case kDIST_RANDOM:
+        return random_update(pool, now);
+
+    case kDIST_JUMP:
+        return jump_update(pool, now);
+
+    case kDIST_MAGLEV:
+        return maglev_update(pool, now);
+
+    case kDIST_HRW:
+        return hrw_update(pool, now);
+
+    default:
+        /* redis_cluster routes by its slot table */
+        return NC_OK;
+    }
+}
+
+#define BATCH_RUN   32  /* keys whose continuum ranges are read ahead */
+
+/*
+ * fnv1a_64 as NcHashUtil::fnv164aHash (only the low 32 bits matter) of
+ * four keys at a time: their multiply chains are independent, so they
+ * overlap up to the end of the shortest, where each goes on by itself.
+ */
+static void fnv1a64_batch(uint8_t **key, const uint32_t *keylen, uint32_t n, uint32_t *hashv)
+{
+    const uint32_t init = 0x84222325, prime = 0x1b3;
+    uint32_t i = 0;
+
+    for (; i + 4 <= n; i += 4)
+    {
+        const char *k0 = (const char *)key[i], *k1 = (const char *)key[i + 1];
+        const char *k2 = (const char *)key[i + 2], *k3 = (const char *)key[i + 3];
+        uint32_t h0 = init, h1 = init, h2 = init, h3 = init;
+
+        uint32_t common = MIN(MIN(keylen[i], keylen[i + 1]), MIN(keylen[i + 2], keylen[i + 3]));
+        for (uint32_t j = 0; j < common; j++)
+        {
+            h0 = (h0 ^ (uint32_t)k0[j]) * prime;
+            h1 = (h1 ^ (uint32_t)k1[j]) * prime;
+            h2 = (h2 ^ (uint32_t)k2[j]) * prime;
+            h3 = (h3 ^ (uint32_t)k3[j]) * prime;
+        }
+        for (uint32_t j = common; j < keylen[i]; j++)
+        {
+            h0 = (h0 ^ (uint32_t)k0[j]) * prime;
+        }
+        for (uint32_t j = common; j < keylen[i + 1]; j++)
+        {
+            h1 = (h1 ^ (uint32_t)k1[j]) * prime;
+        }
+        for (uint32_t j = common; j < keylen[i + 2]; j++)
+        {
+            h2 = (h2 ^ (uint32_t)k2[j]) * prime;
+        }
+        for (uint32_t j = common; j < keylen[i + 3]; j++)
+        {
+            h3 = (h3 ^ (uint32_t)k3[j]) * prime;
+        }
+
+        hashv[i] = h0;
+        hashv[i + 1] = h1;
+        hashv[i + 2] = h2;
+        hashv[i + 3] = h3;
+    }
+
+    for (; i < n; i++)
+    {
+        const char *k = (const char *)key[i];
+        uint32_t h = init;
+        for (uint32_t j = 0; j < keylen[i]; j++)
+        {
+            h = (h ^ (uint32_t)k[j]) * prime;
+        }
+        hashv[i] = h;
+    }
+}
+
+template <uint32_t (NcHashUtil::*fn)(const char *, size_t)>
+static void hash_batch(uint8_t **key, const uint32_t *keylen, uint32_t n, uint32_t *hashv)
+{
+    NcHashUtil util;
+    for (uint32_t i = 0; i < n; i++)
+    {
+        hashv[i] = (util.*fn)((const char *)key[i], keylen[i]);
+    }
+}
+
+void NcHashKit::hash(int type, uint8_t **key, uint32_t *keylen, uint32_t n,
+    const NcStringView &tag, uint32_t *hashv)
+{
+    if (tag.length() > 0)
+    {
+        for (uint32_t i = 0; i < n; i++)
+        {
+            nc_hashtag(&key[i], &keylen[i], tag.c_str()[0], tag.c_str()[1]);
+        }
+    }
+
+    switch (type)
+    {
+    case kHASH_ONE_AT_A_TIME:
+        hash_batch<&NcHashUtil::one_at_a_timeHash>(key, keylen, n, hashv);
+        break;
+
+    case kHASH_MD5:
+        hash_batch<&NcHashUtil::md5Hash>(key, keylen, n, hashv);
+        break;
+
+    case kHASH_CRC16:
+        hash_batch<&NcHashUtil::crc16Hash>(key, keylen, n, hashv);
+        break;
+
+    case kHASH_CRC32:
+        hash_batch<&NcHashUtil::crc32Hash>(key, keylen, n, hashv);
+        break;
+
+    case kHASH_CRC32A:
+        hash_batch<&NcHashUtil::crc32aHash>(key, keylen, n, hashv);
+        break;
+
+    case kHASH_FNV1_64:
+        hash_batch<&NcHashUtil::fnv164Hash>(key, keylen, n, hashv);
+        break;
+
+    case kHASH_FNV1A_64:
+        fnv1a64_batch(key, keylen, n, hashv);
+        break;
+
+    case kHASH_FNV1_32:
+        hash_batch<&NcHashUtil::fnv132Hash>(key, keylen, n, hashv);
+        break;
+
+    case kHASH_FNV1A_32:
+        hash_batch<&NcHashUtil::fnv132aHash>(key, keylen, n, hashv);
+        break;
+
+    case kHASH_HSIEH:
+        hash_batch<&NcHashUtil::hsiehHash>(key, keylen, n, hashv);
+        break;
+
+    case kHASH_MURMUR:
+        hash_batch<&NcHashUtil::murmurHash>(key, keylen, n, hashv);
+        break;
+
+    case kHASH_JENKINS:
+        hash_batch<&NcHashUtil::jenkinsHash>(key, keylen, n, hashv);
+        break;
+
+    case kHASH_CRC32C:
+        hash_batch<&NcHashUtil::crc32cHash>(key, keylen, n, hashv);
+        break;
+
+    case kHASH_XXH3_64:
+        hash_batch<&NcHashUtil::xxh3Hash>(key, keylen, n, hashv);
+        break;
+
+    case kHASH_WYHASH:
+        hash_batch<&NcHashUtil::wyhashHash>(key, keylen, n, hashv);
+        break;
+
+    default:
+        memset(hashv, 0, n * sizeof(uint32_t));
+        break;
+    }
+}
+
+/*
+ * ketamaDispatch() for a run of keys: the prefix table reads of all of
+ * them are issued first, so their misses overlap rather than each one
+ * stalling its own search.
+ */
+static void ketama_dispatch_batch(NcServerPool *pool, const uint32_t *hashv, uint32_t n,
+    uint32_t *idx)
+{
+    const NcContinuum *continuum = &pool->continuum[0];
+    const uint32_t *lut = &pool->continuum_lut[0];
+    uint32_t shift = pool->continuum_shift;
+    uint32_t lo[BATCH_RUN], hi[BATCH_RUN];
+
+    for (uint32_t run = 0; run < n; run += BATCH_RUN)
+    {
+        uint32_t m = MIN(n - run, (uint32_t)BATCH_RUN);
+        for (uint32_t i = 0; i < m; i++)
+        {
+            uint32_t prefix = hashv[run + i] >> shift;
+            lo[i] = lut[prefix];
+            hi[i] = lut[prefix + 1];
+            __builtin_prefetch(continuum + lo[i]);
+        }
+
+        for (uint32_t i = 0; i < m; i++)
+        {
+            uint32_t hv = hashv[run + i];
+            const NcContinuum *base = continuum + lo[i];
+            uint32_t count = hi[i] - lo[i] + 1;
+            while (count > 1)
+            {
+                uint32_t half = count >> 1;
+                base = base[half - 1].value < hv ? base + half : base;
+                count -= half;
+            }
+            idx[run + i] = base->index;
+        }
+    }
+}
+
+void NcHashKit::dispatch(NcServerPool *pool, const uint32_t *hashv, uint32_t n, uint32_t *idx)
+{
+    ASSERT(pool != NULL);
+
+    if (pool->ncontinuum == 0)
+    {
+        memset(idx, 0, n * sizeof(uint32_t));
+        return ;
+    }
+
+    switch (pool->dist_type)
+    {
+    case kDIST_KETAMA:
+        ketama_dispatch_batch(pool, hashv, n, idx);
+        break;
+
+    case kDIST_MAGLEV:
+        for (uint32_t i = 0; i < n; i++)
+        {
+            idx[i] = pool->lookup[hashv[i] % pool->ncontinuum];
+        }
+        break;
+
+    default:
+        for (uint32_t i = 0; i < n; i++)
+        {
+            idx[i] = dispatch(pool, hashv[i]);
+        }
+        break;
+    }
+}
+
+static inline uint64_t read64(const uint8_t *p)
+{
+    uint64_t v;
+    memcpy(&v, p, sizeof(v));
+    return v;
+}
+
+static inline uint32_t read32(const uint8_t *p)
+{
+    uint32_t v;
+    memcpy(&v, p, sizeof(v));
+    return v;
+}
+
+/* 64x64 -> 128 bits, the low and high halves */
+static inline void mul128(uint64_t *lo, uint64_t *hi)
+{
+    __uint128_t r = (__uint128_t)*lo * *hi;
+    *lo = (uint64_t)r;
+    *hi = (uint64_t)(r >> 64);
+}
+
+static inline uint64_t mul128_fold64(uint64_t a, uint64_t b)
+{
+    mul128(&a, &b);
+    return a ^ b;
+}
+
+/*
+ * crc32c (Castagnoli, polynomial 0x82f63b78 reflected), by table or by
+ * the crc32 instruction of SSE4.2, which one picked once when the
+ * program starts.
+ */
+static uint32_t crc32c_table[8][256];
+
+static uint32_t crc32c_sw(const char *key, size_t key_length)
+{
+    const uint8_t *p = (const uint8_t *)key;
+    uint32_t crc = 0xffffffff;
+
+    // 一次8个字节, slicing-by-8
+    while (key_length >= 8)
+    {
+        uint64_t v = read64(p) ^ crc;
+        crc = crc32c_table[7][v & 0xff] ^
+              crc32c_table[6][(v >> 8) & 0xff] ^
+              crc32c_table[5][(v >> 16) & 0xff] ^
+              crc32c_table[4][(v >> 24) & 0xff] ^
+              crc32c_table[3][(v >> 32) & 0xff] ^
+              crc32c_table[2][(v >> 40) & 0xff] ^
+              crc32c_table[1][(v >> 48) & 0xff] ^
+              crc32c_table[0][v >> 56];
+        p += 8;
+        key_length -= 8;
+    }
+    while (key_length--)
+    {
+        crc = crc32c_table[0][(crc ^ *p++) & 0xff] ^ (crc >> 8);
+    }
+
+    return ~crc;
+}
+
+#if defined(__x86_64__) && defined(__GNUC__)
+#include <nmmintrin.h>
+
+__attribute__((target("sse4.2")))
+static uint32_t crc32c_hw(const char *key, size_t key_length)
+{
+    const uint8_t *p = (const uint8_t *)key;
+    uint64_t crc = 0xffffffff;
+
+    while (key_length >= 8)
+    {
+        crc = _mm_crc32_u64(crc, read64(p));
+        p += 8;
+        key_length -= 8;
+    }
+    uint32_t crc32 = (uint32_t)crc;
+    while (key_length--)
+    {
+        crc32 = _mm_crc32_u8(crc32, *p++);
+    }
+
+    return ~crc32;
+}
+#endif
+
+uint32_t (*nc_crc32c)(const char *key, size_t key_length) = crc32c_sw;
+
+static struct NcCrc32cInit
+{
+    NcCrc32cInit()
+    {
+        for (uint32_t i = 0; i < 256; i++)
+        {
+            uint32_t crc = i;
+            for (int k = 0; k < 8; k++)
+            {
+                crc = (crc >> 1) ^ (0x82f63b78 & (0 - (crc & 1)));
+            }
+            crc32c_table[0][i] = crc;
+        }
+        for (uint32_t i = 0; i < 256; i++)
+        {
+            for (int t = 1; t < 8; t++)
+            {
+                uint32_t crc = crc32c_table[t - 1][i];
+                crc32c_table[t][i] = crc32c_table[0][crc & 0xff] ^ (crc >> 8);
+            }
+        }
+
+#if defined(__x86_64__) && defined(__GNUC__)
+        __builtin_cpu_init();
+        if (__builtin_cpu_supports("sse4.2"))
+        {
+            nc_crc32c = crc32c_hw;
+        }
+#endif
+    }
+} crc32c_init;
+
+/*
+ * XXH3 64 bits (xxHash 0.8) with seed 0 and the default secret, the
+ * scalar code path of the reference.
+ */
+#define XXH_PRIME32_1   0x9e3779b1U
+#define XXH_PRIME32_2   0x85ebca77U
+#define XXH_PRIME32_3   0xc2b2ae3dU
+#define XXH_PRIME64_1   0x9e3779b185ebca87ULL
+#define XXH_PRIME64_2   0xc2b2ae3d27d4eb4fULL
+#define XXH_PRIME64_3   0x165667b19e3779f9ULL
+#define XXH_PRIME64_4   0x85ebca77c2b2ae63ULL
+#define XXH_PRIME64_5   0x27d4eb2f165667c5ULL
+#define XXH_PRIME_MX1   0x165667919e3779f9ULL
+#define XXH_PRIME_MX2   0x9fb21c651e98df25ULL
+#define XXH_SECRET_SIZE 192
+#define XXH_STRIPE_LEN  64
+
+static const uint8_t xxh3_secret[XXH_SECRET_SIZE] = {
+    0xb8, 0xfe, 0x6c, 0x39, 0x23, 0xa4, 0x4b, 0xbe, 0x7c, 0x01, 0x81, 0x2c, 0xf7, 0x21, 0xad, 0x1c,
+    0xde, 0xd4, 0x6d, 0xe9, 0x83, 0x90, 0x97, 0xdb, 0x72, 0x40, 0xa4, 0xa4, 0xb7, 0xb3, 0x67, 0x1f,
+    0xcb, 0x79, 0xe6, 0x4e, 0xcc, 0xc0, 0xe5, 0x78, 0x82, 0x5a, 0xd0, 0x7d, 0xcc, 0xff, 0x72, 0x21,
+    0xb8, 0x08, 0x46, 0x74, 0xf7, 0x43, 0x24, 0x8e, 0xe0, 0x35, 0x90, 0xe6, 0x81, 0x3a, 0x26, 0x4c,
+    0x3c, 0x28, 0x52, 0xbb, 0x91, 0xc3, 0x00, 0xcb, 0x88, 0xd0, 0x65, 0x8b, 0x1b, 0x53, 0x2e, 0xa3,
+    0x71, 0x64, 0x48, 0x97, 0xa2, 0x0d, 0xf9, 0x4e, 0x38, 0x19, 0xef, 0x46, 0xa9, 0xde, 0xac, 0xd8,
+    0xa8, 0xfa, 0x76, 0x3f, 0xe3, 0x9c, 0x34, 0x3f, 0xf9, 0xdc, 0xbb, 0xc7, 0xc7, 0x0b, 0x4f, 0x1d,
+    0x8a, 0x51, 0xe0, 0x4b, 0xcd, 0xb4, 0x59, 0x31, 0xc8, 0x9f, 0x7e, 0xc9, 0xd9, 0x78, 0x73, 0x64,
+    0xea, 0xc5, 0xac, 0x83, 0x34, 0xd3, 0xeb, 0xc3, 0xc5, 0x81, 0xa0, 0xff, 0xfa, 0x13, 0x63, 0xeb,
+    0x17, 0x0d, 0xdd, 0x51, 0xb7, 0xf0, 0xda, 0x49, 0xd3, 0x16, 0x55, 0x26, 0x29, 0xd4, 0x68, 0x9e,
+    0x2b, 0x16, 0xbe, 0x58, 0x7d, 0x47, 0xa1, 0xfc, 0x8f, 0xf8, 0xb8, 0xd1, 0x7a, 0xd0, 0x31, 0xce,
+    0x45, 0xcb, 0x3a, 0x8f, 0x95, 0x16, 0x04, 0x28, 0xaf, 0xd7, 0xfb, 0xca, 0xbb, 0x4b, 0x40, 0x7e,
+};
+
+static inline uint64_t xxh64_avalanche(uint64_t h)
+{
+    h ^= h >> 33;
+    h *= XXH_PRIME64_2;
+    h ^= h >> 29;
+    h *= XXH_PRIME64_3;
+    h ^= h >> 32;
+    return h;
+}
+
+static inline uint64_t xxh3_avalanche(uint64_t h)
+{
+    h ^= h >> 37;
+    h *= XXH_PRIME_MX1;
+    h ^= h >> 32;
+    return h;
+}
+
+static inline uint64_t xxh3_rrmxmx(uint64_t h, uint64_t len)
+{
+    h ^= ((h << 49) | (h >> 15)) ^ ((h << 24) | (h >> 40));
+    h *= XXH_PRIME_MX2;
+    h ^= (h >> 35) + len;
+    h *= XXH_PRIME_MX2;
+    return h ^ (h >> 28);
+}
+
+static inline uint64_t xxh3_mix16(const uint8_t *p, const uint8_t *secret)
+{
+    return mul128_fold64(read64(p) ^ read64(secret), read64(p + 8) ^ read64(secret + 8));
+}
+
+static inline void xxh3_accumulate512(uint64_t *acc, const uint8_t *p, const uint8_t *secret)
+{
+    for (int i = 0; i < 8; i++)
+    {
+        uint64_t v = read64(p + 8 * i);
+        uint64_t k = v ^ read64(secret + 8 * i);
+        acc[i ^ 1] += v;
+        acc[i] += (uint64_t)(uint32_t)k * (k >> 32);
+    }
+}
+
+static uint64_t xxh3_long(const uint8_t *p, size_t len)
+{
+    uint64_t acc[8] = {
+        XXH_PRIME32_3, XXH_PRIME64_1, XXH_PRIME64_2, XXH_PRIME64_3,
+        XXH_PRIME64_4, XXH_PRIME32_2, XXH_PRIME64_5, XXH_PRIME32_1
+    };
+    const size_t nstripe = (XXH_SECRET_SIZE - XXH_STRIPE_LEN) / 8;
+    const size_t block_len = XXH_STRIPE_LEN * nstripe;
+    size_t nblock = (len - 1) / block_len;
+
+    for (size_t n = 0; n <= nblock; n++)
+    {
+        size_t last = n < nblock ? nstripe : ((len - 1) - block_len * nblock) / XXH_STRIPE_LEN;
+        for (size_t s = 0; s < last; s++)
+        {
+            xxh3_accumulate512(acc, p + n * block_len + s * XXH_STRIPE_LEN, xxh3_secret + s * 8);
+        }
+
+        if (n < nblock)
+        {
+            // scramble
+            const uint8_t *secret = xxh3_secret + XXH_SECRET_SIZE - XXH_STRIPE_LEN;
+            for (int i = 0; i < 8; i++)
+            {
+                acc[i] = (acc[i] ^ (acc[i] >> 47) ^ read64(secret + 8 * i)) * XXH_PRIME32_1;
+            }
+        }
+    }
+    xxh3_accumulate512(acc, p + len - XXH_STRIPE_LEN,
+        xxh3_secret + XXH_SECRET_SIZE - XXH_STRIPE_LEN - 7);
+
+    uint64_t h = (uint64_t)len * XXH_PRIME64_1;
+    for (int i = 0; i < 4; i++)
+    {
+        h += mul128_fold64(acc[2 * i] ^ read64(xxh3_secret + 11 + 16 * i),
+            acc[2 * i + 1] ^ read64(xxh3_secret + 11 + 16 * i + 8));
+    }
+
+    return xxh3_avalanche(h);
+}
+
+uint64_t nc_xxh3_64(const char *key, size_t key_length)
+{
+    const uint8_t *p = (const uint8_t *)key;
+    const uint8_t *secret = xxh3_secret;
+    size_t len = key_length;
+
+    if (len == 0)
+    {
+        return xxh64_avalanche(read64(secret + 56) ^ read64(secret + 64));
+    }
+    else if (len <= 3)
+    {
+        uint32_t combined = ((uint32_t)p[0] << 16) | ((uint32_t)p[len >> 1] << 24) |
+            (uint32_t)p[len - 1] | ((uint32_t)len << 8);
+        return xxh64_avalanche(combined ^ (uint64_t)(read32(secret) ^ read32(secret + 4)));
+    }
+    else if (len <= 8)
+    {
+        uint64_t v = read32(p + len - 4) + ((uint64_t)read32(p) << 32);
+        return xxh3_rrmxmx(v ^ (read64(secret + 8) ^ read64(secret + 16)), len);
+    }
+    else if (len <= 16)
+    {
+        uint64_t lo = read64(p) ^ read64(secret + 24) ^ read64(secret + 32);
+        uint64_t hi = read64(p + len - 8) ^ read64(secret + 40) ^ read64(secret + 48);
+        return xxh3_avalanche(len + __builtin_bswap64(lo) + hi + mul128_fold64(lo, hi));
+    }
+    else if (len <= 128)
+    {
+        uint64_t acc = len * XXH_PRIME64_1;
+        if (len > 32)
+        {
+            if (len > 64)
+            {
+                if (len > 96)
+                {
+                    acc += xxh3_mix16(p + 48, secret + 96);
+                    acc += xxh3_mix16(p + len - 64, secret + 112);
+                }
+                acc += xxh3_mix16(p + 32, secret + 64);
+                acc += xxh3_mix16(p + len - 48, secret + 80);
+            }
+            acc += xxh3_mix16(p + 16, secret + 32);
+            acc += xxh3_mix16(p + len - 32, secret + 48);
+        }
+        acc += xxh3_mix16(p, secret);
+        acc += xxh3_mix16(p + len - 16, secret + 16);
+        return xxh3_avalanche(acc);
+    }
+    else if (len <= 240)
+    {
+        uint64_t acc = len * XXH_PRIME64_1;
+        for (size_t i = 0; i < 8; i++)
+        {
+            acc += xxh3_mix16(p + 16 * i, secret + 16 * i);
+        }
+        acc = xxh3_avalanche(acc);
+
+        uint64_t acc_end = xxh3_mix16(p + len - 16, secret + 136 - 17);
+        for (size_t i = 8; i < len / 16; i++)
+        {
+            acc_end += xxh3_mix16(p + 16 * i, secret + 16 * (i - 8) + 3);
+        }
+        return xxh3_avalanche(acc + acc_end);
+    }
+
+    return xxh3_long(p, len);
+}
+
+/* wyhash (final4) with seed 0 and the default secret */
+static const uint64_t wyhash_secret[4] = {
+    0x2d358dccaa6c78a5ULL, 0x8bb84b93962eacc9ULL, 0x4b33a62ed433d4a3ULL, 0x4d5a2da51de1aa47ULL
+};
+
+uint64_t nc_wyhash(const char *key, size_t key_length)
+{
+    const uint8_t *p = (const uint8_t *)key;
+    const uint64_t *secret = wyhash_secret;
+    size_t len = key_length;
+    uint64_t seed = mul128_fold64(secret[0], secret[1]);
+    uint64_t a, b;
+
+    if (len <= 16)
+    {
+        if (len >= 4)
+        {
+            size_t off = (len >> 3) << 2;
+            a = ((uint64_t)read32(p) << 32) | read32(p + off);
+            b = ((uint64_t)read32(p + len - 4) << 32) | read32(p + len - 4 - off);
+        }
+        else if (len > 0)
+        {
+            a = ((uint64_t)p[0] << 16) | ((uint64_t)p[len >> 1] << 8) | p[len - 1];
+            b = 0;
+        }
+        else
+        {
+            a = b = 0;
+        }
+    }
+    else
+    {
+        size_t i = len;
+        if (i >= 48)
+        {
+            uint64_t see1 = seed, see2 = seed;
+            do
+            {
+                seed = mul128_fold64(read64(p) ^ secret[1], read64(p + 8) ^ seed);
+                see1 = mul128_fold64(read64(p + 16) ^ secret[2], read64(p + 24) ^ see1);
+                see2 = mul128_fold64(read64(p + 32) ^ secret[3], read64(p + 40) ^ see2);
+                p += 48;
+                i -= 48;
+            } while (i >= 48);
+            seed ^= see1 ^ see2;
+        }
+        while (i > 16)
+        {
+            seed = mul128_fold64(read64(p) ^ secret[1], read64(p + 8) ^ seed);
+            i -= 16;
+            p += 16;
+        }
+        a = read64(p + i - 16);
+        b = read64(p + i - 8);
+    }
+
+    a ^= secret[1];
+    b ^= seed;
+    mul128(&a, &b);
+    return mul128_fold64(a ^ secret[0] ^ len, b ^ secret[1]);
+}
@@ -1,6 +1,7 @@
 #ifndef _NC_HASHKIT_H_
 #define _NC_HASHKIT_H_
 
+#include <math.h>
 #include <nc_util.h>
 #include <nc_server.h>
 
@@ -18,6 +19,9 @@ typedef enum
     kHASH_HSIEH             = 0xa,
     kHASH_MURMUR            = 0xb,
     kHASH_JENKINS           = 0xc,
+    kHASH_CRC32C            = 0xd,
+    kHASH_XXH3_64           = 0xe,
+    kHASH_WYHASH            = 0xf,
 } HashType;
 
 // 使用的分布式一致性方法
@@ -26,8 +30,23 @@ typedef enum
     kDIST_KETAMA            = 0x100,
     kDIST_MODULA            = 0x200,
     kDIST_RANDOM            = 0x300,
+    kDIST_REDIS_CLUSTER     = 0x400,    /* slot table of a redis cluster */
+    kDIST_JUMP              = 0x500,    /* jump consistent hash */
+    kDIST_MAGLEV            = 0x600,    /* maglev lookup table */
+    kDIST_HRW               = 0x700,    /* weighted rendezvous hashing */
 } HashDistType;
 
+#define HRW_LANES   8   /* hrw: servers scored at once */
+
+/*
+ * Hashes that take 8 bytes or more a step, in nc_hashkit.cpp. crc32c is
+ * the crc32 instruction of SSE4.2 where the cpu has it and a table where
+ * it does not, which of them is decided once at startup.
+ */
+extern uint32_t (*nc_crc32c)(const char *key, size_t key_length);
+uint64_t nc_xxh3_64(const char *key, size_t key_length);
+uint64_t nc_wyhash(const char *key, size_t key_length);
+
 typedef unsigned int MD5_u32plus;
 
 /*
@@ -902,6 +921,21 @@ public:
             ((uint32_t) (results[1] & 0xFF) << 8) |
             (results[0] & 0xFF);
     }
+
+    uint32_t crc32cHash(const char *key, size_t key_length)
+    {
+        return nc_crc32c(key, key_length);
+    }
+
+    uint32_t xxh3Hash(const char *key, size_t key_length)
+    {
+        return (uint32_t)nc_xxh3_64(key, key_length);
+    }
+
+    uint32_t wyhashHash(const char *key, size_t key_length)
+    {
+        return (uint32_t)nc_wyhash(key, key_length);
+    }
 };
 
 class NcHashKit
@@ -962,6 +996,18 @@ public:
         case kHASH_JENKINS: 
             hashv = util.jenkinsHash(key, key_length); 
             break;
+
+        case kHASH_CRC32C:
+            hashv = util.crc32cHash(key, key_length);
+            break;
+
+        case kHASH_XXH3_64:
+            hashv = util.xxh3Hash(key, key_length);
+            break;
+
+        case kHASH_WYHASH:
+            hashv = util.wyhashHash(key, key_length);
+            break;
             
         default: 
             break;
@@ -970,22 +1016,183 @@ public:
         return hashv;
     }
 
+    /*
+     * Hash of the hash tag of key, the bytes between the two characters
+     * of tag, or of the whole key if there is no tag in it (or no tag).
+     */
+    static uint32_t hash(int type, uint8_t *key, uint32_t keylen, const NcStringView &tag)
+    {
+        if (tag.length() > 0)
+        {
+            nc_hashtag(&key, &keylen, tag.c_str()[0], tag.c_str()[1]);
+        }
+
+        return hash(type, (const char *)key, keylen);
+    }
+
+    /*
+     * Hashes of n keys, each narrowed to its hash tag first (key[i] and
+     * keylen[i] are moved onto it), as hash() of each but with the type
+     * switched on once for the batch. fnv1a_64 keys are hashed four at a
+     * time, so the multiply chains of different keys overlap.
+     */
+    static void hash(int type, uint8_t **key, uint32_t *keylen, uint32_t n,
+        const NcStringView &tag, uint32_t *hashv);
+
+    /* rebuild the continuum of pool from its live servers */
     static rstatus_t update(NcServerPool *pool);
 
+    /*
+     * Server of the first point at or after hashv on a ketama continuum,
+     * the sentinel past the last point wrapping around to the first. The
+     * point is among lut[p] .. lut[p + 1] for the prefix p of hashv, and
+     * found there by a binary search whose compares turn into conditional
+     * moves rather than branches.
+     */
+    inline static uint32_t ketamaDispatch(const NcContinuum *continuum,
+        const uint32_t *lut, uint32_t shift, uint32_t hashv)
+    {
+        uint32_t prefix = hashv >> shift;
+        const NcContinuum *base = continuum + lut[prefix];
+        uint32_t n = lut[prefix + 1] - lut[prefix] + 1;
+
+        while (n > 1)
+        {
+            uint32_t half = n >> 1;
+            base = base[half - 1].value < hashv ? base + half : base;
+            n -= half;
+        }
+
+        return base->index;
+    }
+
+    /*
+     * Jump consistent hash (Lamping and Veach) over all the servers of the
+     * pool, live or not: a key whose bucket is ejected jumps again from
+     * where it got to, so only the keys of ejected servers move.
+     */
+    inline static uint32_t jumpDispatch(const uint32_t *bucket, uint32_t nbucket,
+        uint32_t hashv)
+    {
+        uint64_t key = hashv;
+        for (;;)
+        {
+            int64_t b = -1, j = 0;
+            while (j < (int64_t)nbucket)
+            {
+                b = j;
+                key = key * 2862933555777941757ULL + 1;
+                j = (int64_t)((b + 1) * ((double)(1LL << 31) / (double)((key >> 33) + 1)));
+            }
+
+            if (bucket[b] != UINT32_MAX)
+            {
+                return bucket[b];
+            }
+        }
+    }
+
+    /* -log2 of a uniform (0, 1) drawn from hashv and seed */
+    inline static float hrwScore(uint32_t hashv, uint32_t seed)
+    {
+        uint32_t h = hashv ^ seed;
+        h ^= h >> 16;
+        h *= 0x85ebca6b;
+        h ^= h >> 13;
+        h *= 0xc2b2ae35;
+        h ^= h >> 16;
+
+        float u = ((float)(h >> 8) + 0.5f) * (1.0f / 16777216.0f);
+
+        // u = 2^e * m, m in [1, 2), log2(m) = 2 / ln2 * atanh((m - 1) / (m + 1))
+        uint32_t bits;
+        memcpy(&bits, &u, sizeof(bits));
+        float e = (float)((int32_t)(bits >> 23) - 127);
+        bits = (bits & 0x007fffff) | 0x3f800000;
+        float m;
+        memcpy(&m, &bits, sizeof(m));
+        float t = (m - 1.0f) / (m + 1.0f);
+        float t2 = t * t;
+        float log2m = 2.88539008f * t * (1.0f + t2 * (1.0f / 3 + t2 * (1.0f / 5 + t2 * (1.0f / 7))));
+
+        return -(e + log2m);
+    }
+
+    /*
+     * Weighted rendezvous hashing: each server scores the key with its own
+     * seed, -log2(u) / weight for a uniform u, and the lowest score wins.
+     * An ejected server scores infinity, the others keep their scores, so
+     * only its keys move. The seeds and scales are packed and padded to
+     * HRW_LANES servers with infinite scales, so scores are worked out a
+     * fixed HRW_LANES at a time by a loop the compiler turns into vector
+     * code (log2 is a series, within 2e-5), then searched for the lowest.
+     */
+    inline static uint32_t hrwDispatch(const uint32_t *seed, const float *scale,
+        uint32_t npadded, uint32_t hashv)
+    {
+        float low = INFINITY;
+        uint32_t best = 0;
+
+        for (uint32_t base = 0; base < npadded; base += HRW_LANES)
+        {
+            float score[HRW_LANES];
+            for (uint32_t i = 0; i < HRW_LANES; i++)
+            {
+                score[i] = hrwScore(hashv, seed[base + i]) * scale[base + i];
+            }
+
+            for (uint32_t i = 0; i < HRW_LANES; i++)
+            {
+                best = score[i] < low ? base + i : best;
+                low = score[i] < low ? score[i] : low;
+            }
+        }
+
+        return best;
+    }
+
     inline static uint32_t dispatch(NcServerPool *pool, uint32_t hashv)
     {
         ASSERT(pool != NULL);
 
-        int ncontinuum = pool->continuum.size();
+        if (pool->ncontinuum == 0)
+        {
+            return 0;
+        }
+
         switch (pool->dist_type)
         {
+        case kDIST_KETAMA:
+            return ketamaDispatch(&pool->continuum[0], &pool->continuum_lut[0],
+                pool->continuum_shift, hashv);
+
+        case kDIST_MODULA:
+            return pool->continuum[hashv % pool->ncontinuum].index;
+
         case kDIST_RANDOM:
-            NcContinuum *c = pool->continuum[random() % ncontinuum];
-            return c->index;
-        }
+            return pool->continuum[random() % pool->ncontinuum].index;
+
+        case kDIST_JUMP:
+            return jumpDispatch(&pool->lookup[0], pool->ncontinuum, hashv);
+
+        case kDIST_MAGLEV:
+            return pool->lookup[hashv % pool->ncontinuum];
+
+        case kDIST_HRW:
+            return hrwDispatch(&pool->hrw_seed[0], &pool->hrw_scale[0],
+                pool->hrw_seed.size(), hashv);
 
-        return 0;
+        default:
+            return 0;
+        }
     }
+
+    /*
+     * Servers of n hashes, as dispatch() of each; idx may be hashv. On a
+     * ketama continuum the prefix table ranges of a run of keys are read
+     * (and their points prefetched) before any of them is searched.
+     */
+    static void dispatch(NcServerPool *pool, const uint32_t *hashv, uint32_t n, uint32_t *idx);
 };
 
 #endif
\ No newline at end of file
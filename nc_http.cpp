@@ -0,0 +1,687 @@
+#include <strings.h>
+#include <nc_http.h>
+
+#define HTTP_KEEPALIVE_HEADER   "Connection: keep-alive\r\n"
+
+#define http_name(_start, _end, _name)                              \
+    ((size_t)((_end) - (_start)) == sizeof(_name) - 1 &&            \
+     strncasecmp((const char *)(_start), _name, sizeof(_name) - 1) == 0)
+
+static const struct
+{
+    const char      *name;
+    uint32_t        len;
+    NcHttpMethod    method;
+} s_methods[] = {
+    { "GET",        3,  kHTTP_METHOD_GET },
+    { "HEAD",       4,  kHTTP_METHOD_HEAD },
+    { "POST",       4,  kHTTP_METHOD_POST },
+    { "PUT",        3,  kHTTP_METHOD_PUT },
+    { "DELETE",     6,  kHTTP_METHOD_DELETE },
+    { "OPTIONS",    7,  kHTTP_METHOD_OPTIONS },
+    { "PATCH",      5,  kHTTP_METHOD_PATCH },
+};
+
+static inline bool httpSpace(uint8_t c)
+{
+    return c == ' ' || c == '\t';
+}
+
+/* "HTTP/1.x" at p, the minor version in *minor */
+static bool httpVersion(const uint8_t *p, const uint8_t *end, uint8_t *minor)
+{
+    if (end - p < 8 || memcmp(p, "HTTP/1.", 7) != 0 || (p[7] != '0' && p[7] != '1'))
+    {
+        return false;
+    }
+
+    *minor = p[7];
+    return true;
+}
+
+/* true if the comma separated list [start, end) holds token */
+static bool httpToken(const uint8_t *start, const uint8_t *end, const char *token,
+    size_t len)
+{
+    const uint8_t *p = start;
+    while (p < end)
+    {
+        while (p < end && (httpSpace(*p) || *p == ','))
+        {
+            p++;
+        }
+        const uint8_t *t = p;
+        while (p < end && *p != ',')
+        {
+            p++;
+        }
+        const uint8_t *e = p;
+        while (e > t && httpSpace(e[-1]))
+        {
+            e--;
+        }
+        if ((size_t)(e - t) == len && strncasecmp((const char *)t, token, len) == 0)
+        {
+            return true;
+        }
+    }
+
+    return false;
+}
+
+/* route key of a request whose target is [start, end) */
+bool NcHttp::setKey(NcMsg *r, const NcConfHttpKey *key, uint8_t *start, uint8_t *end)
+{
+    /* absolute-form "http://host/path": the path starts after the authority */
+    if (start < end && *start != '/')
+    {
+        uint8_t *scheme = (uint8_t *)memchr(start, ':', (size_t)(end - start));
+        if (scheme != NULL && end - scheme > 3 && scheme[1] == '/' && scheme[2] == '/')
+        {
+            uint8_t *path = (uint8_t *)memchr(scheme + 3, '/', (size_t)(end - scheme - 3));
+            start = path != NULL ? path : end;
+        }
+    }
+
+    uint8_t *p = start;
+    while (p < end && *p != '?' && *p != '#')
+    {
+        p++;
+    }
+    end = p;
+
+    if (key != NULL && key->type == kHTTP_KEY_SEGMENT)
+    {
+        /* "/a/b/c": segment 1 is "a" */
+        uint32_t n = 0;
+        uint8_t *seg = start, *segend = start;
+        for (p = start; p < end && n < key->segment; n++)
+        {
+            while (p < end && *p == '/')
+            {
+                p++;
+            }
+            seg = p;
+            while (p < end && *p != '/')
+            {
+                p++;
+            }
+            segend = p;
+        }
+
+        if (n == key->segment && segend > seg)
+        {
+            start = seg;
+            end = segend;
+        }
+        else
+        {
+            start = end;
+        }
+    }
+
+    r->m_keys_.push_back(NcKeypos(start, end));
+    return true;
+}
+
+/* "<method> <target> HTTP/1.x" in [start, end), end pointing at the '\n' */
+bool NcHttp::parseRequestLine(NcMsg *r, const NcConfHttpKey *key, uint8_t *start,
+    uint8_t *end)
+{
+    if (end > start && end[-1] == '\r')
+    {
+        end--;
+    }
+
+    uint8_t *method = start, *p = start;
+    while (p < end && *p != ' ')
+    {
+        p++;
+    }
+    uint32_t mlen = (uint32_t)(p - method);
+    if (mlen == 0 || p == end)
+    {
+        return false;
+    }
+
+    uint8_t *target = ++p;
+    while (p < end && *p != ' ')
+    {
+        p++;
+    }
+    uint8_t *tend = p;
+    if (tend == target || p == end)
+    {
+        return false;
+    }
+
+    uint8_t minor;
+    p++;
+    if (end - p != 8 || !httpVersion(p, end, &minor))
+    {
+        LOG_DEBUG("unsupported http version '%.*s'", (int)(end - p), p);
+        return false;
+    }
+    if (minor == '0')
+    {
+        r->m_flags_ |= HTTP_VERSION_10;
+    }
+
+    r->m_cmd_ = kHTTP_METHOD_OTHER;
+    for (uint32_t i = 0; i < sizeof(s_methods) / sizeof(s_methods[0]); i++)
+    {
+        if (s_methods[i].len == mlen && memcmp(s_methods[i].name, method, mlen) == 0)
+        {
+            r->m_cmd_ = s_methods[i].method;
+            break;
+        }
+    }
+    if (r->m_cmd_ == kHTTP_METHOD_OTHER && mlen == 7 && memcmp(method, "CONNECT", 7) == 0)
+    {
+        LOG_DEBUG("http CONNECT is not supported");
+        return false;
+    }
+
+    return setKey(r, key, target, tend);
+}
+
+/* "HTTP/1.x <status> <reason>" */
+bool NcHttp::parseStatusLine(NcMsg *r, uint8_t *start, uint8_t *end)
+{
+    if (end > start && end[-1] == '\r')
+    {
+        end--;
+    }
+
+    uint8_t minor;
+    if (!httpVersion(start, end, &minor) || end - start < 12 || start[8] != ' ')
+    {
+        return false;
+    }
+
+    uint8_t *p = start + 9;
+    if (!isdigit(p[0]) || !isdigit(p[1]) || !isdigit(p[2]) ||
+        (p + 3 < end && p[3] != ' '))
+    {
+        return false;
+    }
+
+    r->m_cmd_ = (uint32_t)((p[0] - '0') * 100 + (p[1] - '0') * 10 + (p[2] - '0'));
+    if (r->m_cmd_ < 100)
+    {
+        return false;
+    }
+
+    return true;
+}
+
+/* "<name>: <value>" in [start, end), end pointing at the '\n' */
+bool NcHttp::parseHeader(NcMsg *r, const NcConfHttpKey *key, uint8_t *start, uint8_t *end)
+{
+    if (end > start && end[-1] == '\r')
+    {
+        end--;
+    }
+
+    if (httpSpace(*start))
+    {
+        /* obsolete line folding */
+        return false;
+    }
+
+    uint8_t *colon = (uint8_t *)memchr(start, ':', (size_t)(end - start));
+    if (colon == NULL || colon == start || httpSpace(colon[-1]))
+    {
+        return false;
+    }
+
+    uint8_t *value = colon + 1, *vend = end;
+    while (value < vend && httpSpace(*value))
+    {
+        value++;
+    }
+    while (vend > value && httpSpace(vend[-1]))
+    {
+        vend--;
+    }
+
+    if (http_name(start, colon, "Content-Length"))
+    {
+        uint64_t n = 0;
+        if (value == vend)
+        {
+            return false;
+        }
+        for (uint8_t *p = value; p < vend; p++)
+        {
+            if (!isdigit(*p) || (n = n * 10 + (uint64_t)(*p - '0')) > NC_HTTP_MAX_BODY)
+            {
+                return false;
+            }
+        }
+
+        if ((r->m_flags_ & HTTP_LENGTH) && r->m_integer_ != (int64_t)n)
+        {
+            LOG_DEBUG("conflicting Content-Length");
+            return false;
+        }
+        r->m_flags_ |= HTTP_LENGTH;
+        r->m_integer_ = (int64_t)n;
+    }
+    else if (http_name(start, colon, "Transfer-Encoding"))
+    {
+        /* chunked has to be the last coding, anything else is read until close */
+        if (vend - value < 7 || strncasecmp((char *)vend - 7, "chunked", 7) != 0 ||
+            (vend - value > 7 && !httpSpace(vend[-8]) && vend[-8] != ','))
+        {
+            LOG_DEBUG("unsupported Transfer-Encoding '%.*s'", (int)(vend - value), value);
+            return false;
+        }
+        r->m_flags_ |= HTTP_CHUNKED;
+    }
+    else if (r->m_request_ && http_name(start, colon, "Connection"))
+    {
+        if (httpToken(value, vend, "close", 5))
+        {
+            r->m_flags_ |= HTTP_CLOSE;
+        }
+        if (httpToken(value, vend, "keep-alive", 10))
+        {
+            r->m_flags_ |= HTTP_KEEPALIVE;
+        }
+        /* hop-by-hop, dropped with the headers it names at the end of the headers */
+        r->m_flags_ |= HTTP_CONNECTION;
+    }
+
+    if (r->m_request_ && key != NULL && key->type == kHTTP_KEY_HEADER &&
+        !(r->m_flags_ & HTTP_KEY_HEADER) &&
+        (uint32_t)(colon - start) == key->header.length() &&
+        strncasecmp((const char *)start, (const char *)key->header.c_str(),
+            key->header.length()) == 0)
+    {
+        r->m_flags_ |= HTTP_KEY_HEADER;
+        r->m_keys_[0] = NcKeypos(value, vend);
+    }
+
+    return true;
+}
+
+/*
+ * Remove the Connection headers of a request and the headers they name,
+ * whose end of headers is at eoh in the last mbuf. Each line lies in one
+ * mbuf, the rest of that mbuf moves over it; removed is what went from the
+ * last mbuf, where the end of headers and what follows it moved back.
+ */
+bool NcHttp::dropHopHeaders(NcMsg *r, uint8_t *eoh, uint32_t *removed)
+{
+    NcMbufQueue *queue = &r->m_mbuf_queue_;
+    NcMbuf *b = queue->back();
+    char options[NC_HTTP_MAX_OPTIONS];
+    size_t noption = 0;
+    *removed = 0;
+
+    /* the names listed by all Connection headers, copied before lines move */
+    for (NcMbuf *m = queue->front(); m != NULL; m = queue->next(m))
+    {
+        uint8_t *end = m == b ? eoh : m->getLast();
+        for (uint8_t *q = m->getPos(), *nl; q < end; q = nl + 1)
+        {
+            nl = (uint8_t *)memchr(q, '\n', (size_t)(end - q));
+            ASSERT(nl != NULL);
+            uint8_t *colon = (uint8_t *)memchr(q, ':', (size_t)(nl - q));
+            if (colon == NULL || !http_name(q, colon, "Connection"))
+            {
+                continue;
+            }
+            uint8_t *vend = nl[-1] == '\r' ? nl - 1 : nl;
+            if (noption + (size_t)(vend - colon) > sizeof(options))
+            {
+                LOG_DEBUG("too many Connection options");
+                return false;
+            }
+            options[noption++] = ',';
+            memcpy(options + noption, colon + 1, (size_t)(vend - colon - 1));
+            noption += (size_t)(vend - colon - 1);
+        }
+    }
+
+    uint8_t *target = NULL, *tend = NULL;
+    bool rekey = false;
+    for (NcMbuf *m = queue->front(); m != NULL; m = queue->next(m))
+    {
+        uint8_t *end = m == b ? eoh : m->getLast();
+        for (uint8_t *q = m->getPos(), *nl; q < end; )
+        {
+            nl = (uint8_t *)memchr(q, '\n', (size_t)(end - q));
+            if (target == NULL && nl > q && !(nl == q + 1 && *q == '\r'))
+            {
+                /* the request line, its target is the key if the header goes */
+                target = (uint8_t *)memchr(q, ' ', (size_t)(nl - q)) + 1;
+                tend = (uint8_t *)memchr(target, ' ', (size_t)(nl - target));
+                q = nl + 1;
+                continue;
+            }
+
+            uint8_t *colon = (uint8_t *)memchr(q, ':', (size_t)(nl - q));
+            if (target == NULL || colon == NULL || (!http_name(q, colon, "Connection") &&
+                !httpToken((uint8_t *)options, (uint8_t *)options + noption, (char *)q,
+                    (size_t)(colon - q))))
+            {
+                q = nl + 1;
+                continue;
+            }
+
+            uint32_t len = (uint32_t)(nl + 1 - q);
+            if (r->m_flags_ & HTTP_KEY_HEADER)
+            {
+                NcKeypos &k = r->m_keys_[0];
+                if (k.start >= q && k.start <= nl)
+                {
+                    rekey = true;
+                }
+                else if (k.start > nl && k.start < m->getLast())
+                {
+                    k = NcKeypos(k.start - len, k.end - len);
+                }
+            }
+
+            memmove(q, nl + 1, (size_t)(m->getLast() - nl - 1));
+            m->cutLast(len);
+            r->m_mlen_ -= len;
+            end -= len;
+            if (m == b)
+            {
+                *removed += len;
+            }
+        }
+    }
+
+    if (rekey)
+    {
+        /* the route header was hop-by-hop, the path routes as if it were missing */
+        r->m_flags_ &= ~HTTP_KEY_HEADER;
+        r->m_keys_.clear();
+        setKey(r, NULL, target, tend);
+    }
+
+    return true;
+}
+
+void NcHttp::parse(NcMsg *r, const NcConfHttpKey *key, NcMsg *req)
+{
+    enum
+    {
+        SW_START,
+        SW_HEADER,
+        SW_BODY,
+        SW_CHUNK_SIZE,
+        SW_CHUNK_DATA,
+        SW_CHUNK_CR,
+        SW_CHUNK_LF,
+        SW_TRAILER,
+    };
+
+    NcMbuf *b = r->m_mbuf_queue_.back();
+    ASSERT(b != NULL);
+    ASSERT(r->pos >= b->getPos() && r->pos <= b->getLast());
+
+    uint8_t *p = r->pos, *last = b->getLast();
+    int state = r->state;
+
+    while (p < last)
+    {
+        switch (state)
+        {
+        case SW_START:
+        case SW_HEADER:
+        case SW_CHUNK_SIZE:
+        case SW_TRAILER:
+        {
+            /* the whole line is needed, p is its start */
+            uint8_t *nl = (uint8_t *)memchr(p, '\n', (size_t)(last - p));
+            if (nl == NULL)
+            {
+                if (last - p >= NC_HTTP_MAX_LINE)
+                {
+                    goto error;
+                }
+                r->setPending((uint32_t)(last - p));
+                goto line_again;
+            }
+
+            bool empty = nl == p || (nl == p + 1 && *p == '\r');
+            if (state == SW_START)
+            {
+                /* empty lines before a request line are ignored */
+                if (empty && r->m_request_)
+                {
+                    p = nl + 1;
+                    break;
+                }
+                if (empty || !(r->m_request_ ? parseRequestLine(r, key, p, nl) :
+                    parseStatusLine(r, p, nl)))
+                {
+                    goto error;
+                }
+                state = SW_HEADER;
+            }
+            else if (state == SW_HEADER && !empty)
+            {
+                if (!parseHeader(r, key, p, nl))
+                {
+                    goto error;
+                }
+            }
+            else if (state == SW_HEADER)
+            {
+                /* end of the headers, what follows depends on the framing */
+                uint32_t flags = r->m_flags_;
+                if ((flags & HTTP_CHUNKED) && (flags & HTTP_LENGTH))
+                {
+                    LOG_DEBUG("both Content-Length and chunked");
+                    goto error;
+                }
+
+                if (r->m_request_ && (flags & HTTP_CONNECTION))
+                {
+                    uint32_t n;
+                    if (!dropHopHeaders(r, p, &n))
+                    {
+                        goto error;
+                    }
+                    p -= n;
+                    nl -= n;
+                    last -= n;
+                    r->m_flags_ &= ~HTTP_CONNECTION;
+                }
+
+                if (r->m_request_ && (flags & HTTP_VERSION_10))
+                {
+                    /* the server connection is shared, it has to stay open */
+                    uint32_t n = sizeof(HTTP_KEEPALIVE_HEADER) - 1;
+                    if (b->size() < n)
+                    {
+                        /* no room, move the rest to an mbuf with some and resume there */
+                        r->pos = p;
+                        r->state = state;
+                        r->setPending(n);
+                        r->m_result_ = kMSG_PARSE_REPAIR;
+                        return;
+                    }
+                    memmove(p + n, p, (size_t)(last - p));
+                    memcpy(p, HTTP_KEEPALIVE_HEADER, n);
+                    b->setLast(n);
+                    r->m_mlen_ += n;
+                    p += n;
+                    nl += n;
+                    last += n;
+                }
+
+                if (!r->m_request_)
+                {
+                    uint32_t status = r->m_cmd_;
+                    if (status == 101)
+                    {
+                        LOG_DEBUG("http upgrade is not supported");
+                        goto error;
+                    }
+                    if (status < 200)
+                    {
+                        /* interim reply, the final one follows in the same message */
+                        r->m_flags_ = 0;
+                        r->m_integer_ = 0;
+                        state = SW_START;
+                        p = nl + 1;
+                        break;
+                    }
+                    if (status == 204 || status == 304 || (req != NULL &&
+                        req->m_type_ == kPROTOCOL_HTTP && method(req) == kHTTP_METHOD_HEAD))
+                    {
+                        p = nl + 1;
+                        goto done;
+                    }
+                    if (!(flags & (HTTP_CHUNKED | HTTP_LENGTH)))
+                    {
+                        LOG_DEBUG("http reply delimited by close is not supported");
+                        goto error;
+                    }
+                }
+
+                p = nl + 1;
+                if (flags & HTTP_CHUNKED)
+                {
+                    state = SW_CHUNK_SIZE;
+                }
+                else if (r->m_integer_ > 0)
+                {
+                    r->m_rlen_ = (uint32_t)r->m_integer_;
+                    state = SW_BODY;
+                }
+                else
+                {
+                    goto done;
+                }
+                break;
+            }
+            else if (state == SW_CHUNK_SIZE)
+            {
+                /* "<hex size>[;ext]" */
+                uint64_t n = 0;
+                uint8_t *q = p;
+                for (; q < nl && isxdigit(*q); q++)
+                {
+                    n = n * 16 + (uint64_t)(isdigit(*q) ? *q - '0' : (*q | 0x20) - 'a' + 10);
+                    if (n > NC_HTTP_MAX_BODY)
+                    {
+                        goto error;
+                    }
+                }
+                if (q == p || (q < nl && *q != ';' && !httpSpace(*q) && *q != '\r'))
+                {
+                    goto error;
+                }
+
+                p = nl + 1;
+                if (n == 0)
+                {
+                    state = SW_TRAILER;
+                }
+                else
+                {
+                    r->m_rlen_ = (uint32_t)n;
+                    state = SW_CHUNK_DATA;
+                }
+                break;
+            }
+            else if (empty)
+            {
+                /* SW_TRAILER: the empty line ends the message */
+                p = nl + 1;
+                goto done;
+            }
+
+            p = nl + 1;
+            break;
+        }
+
+        case SW_BODY:
+        case SW_CHUNK_DATA:
+        {
+            /* the data stays where it was read */
+            uint32_t n = MIN(r->m_rlen_, (uint32_t)(last - p));
+            r->m_rlen_ -= n;
+            p += n;
+            if (r->m_rlen_ == 0)
+            {
+                if (state == SW_BODY)
+                {
+                    goto done;
+                }
+                state = SW_CHUNK_CR;
+            }
+            break;
+        }
+
+        case SW_CHUNK_CR:
+            if (*p != '\r')
+            {
+                goto error;
+            }
+            p++;
+            state = SW_CHUNK_LF;
+            break;
+
+        case SW_CHUNK_LF:
+            if (*p != '\n')
+            {
+                goto error;
+            }
+            p++;
+            state = SW_CHUNK_SIZE;
+            break;
+
+        default:
+            ASSERT(0);
+            break;
+        }
+    }
+
+    r->pos = p;
+    r->state = state;
+    r->setPending(state == SW_BODY ? r->m_rlen_ :
+        state == SW_CHUNK_DATA ? r->m_rlen_ + 2 : 0);
+    r->m_result_ = kMSG_PARSE_AGAIN;
+    return;
+
+line_again:
+    /* resume at the line start, in the same mbuf or in a repaired one */
+    r->pos = p;
+    r->state = state;
+    r->m_result_ = b->full() ? kMSG_PARSE_REPAIR : kMSG_PARSE_AGAIN;
+    return;
+
+done:
+    r->pos = p;
+    r->state = SW_START;
+    r->setPending(0);
+    r->m_result_ = kMSG_PARSE_OK;
+    return;
+
+error:
+    LOG_DEBUG("parse %s %" PRIu64 " failed at state %d: '%.*s'",
+        r->m_request_ ? "req" : "rsp", r->m_id_, state, (int)MIN(16, last - p), p);
+    r->pos = p;
+    r->state = state;
+    r->m_result_ = kMSG_PARSE_ERROR;
+    errno = EINVAL;
+}
+
+void NcHttp::parseRequest(NcMsg *r, const NcConfHttpKey *key)
+{
+    parse(r, key, NULL);
+}
+
+void NcHttp::parseResponse(NcMsg *r, NcMsg *req)
+{
+    parse(r, NULL, req);
+}
@@ -0,0 +1,91 @@
+#ifndef _NC_HTTP_H_
+#define _NC_HTTP_H_
+
+#include <nc_message.h>
+
+#define NC_HTTP_MAX_LINE        (MBUF_LARGE_SIZE - MBUF_HSIZE) /* max start / header line */
+#define NC_HTTP_MAX_BODY        (1024 * 1024 * 1024)    /* max body / chunk length */
+#define NC_HTTP_MAX_OPTIONS     256     /* max length of all Connection header values */
+
+typedef enum
+{
+    kHTTP_METHOD_OTHER,
+    kHTTP_METHOD_GET,
+    kHTTP_METHOD_HEAD,
+    kHTTP_METHOD_POST,
+    kHTTP_METHOD_PUT,
+    kHTTP_METHOD_DELETE,
+    kHTTP_METHOD_OPTIONS,
+    kHTTP_METHOD_PATCH,
+} NcHttpMethod;
+
+/* what was learned from the headers, in NcMsg::m_flags_ */
+#define HTTP_CHUNKED        0x01    /* Transfer-Encoding: chunked */
+#define HTTP_LENGTH         0x02    /* Content-Length seen, length in m_integer_ */
+#define HTTP_KEY_HEADER     0x04    /* the route header was found */
+#define HTTP_VERSION_10     0x08    /* HTTP/1.0 */
+#define HTTP_KEEPALIVE      0x10    /* Connection: keep-alive */
+#define HTTP_CLOSE          0x20    /* Connection: close */
+#define HTTP_CONNECTION     0x40    /* a Connection header to drop */
+
+/*
+ * Incremental HTTP/1.x parser. The start line, each header line and each
+ * chunk size line are scanned in place and have to be contiguous, a line
+ * running past a full mbuf is repaired into a new one; bodies and chunk
+ * data are skipped wherever they lie. A message ends with its headers, its
+ * Content-Length bytes or its last chunk and trailers, so pipelined
+ * requests on a keep-alive connection split like any other protocol.
+ *
+ * A request is routed on its path, one segment of the path or a header
+ * (conf http_key:); the key points into the mbufs. Server connections are
+ * kept open across clients: the Connection header of a request and the
+ * headers it names are hop-by-hop and removed from the mbufs, an HTTP/1.0
+ * request keeps its version and gets "Connection: keep-alive" added, and a
+ * request asking to close makes the proxy close the client connection once
+ * its reply has been sent. Replies without any framing (read until close)
+ * are not supported.
+ */
+class NcHttp
+{
+public:
+    static void parseRequest(NcMsg *r, const NcConfHttpKey *key);
+
+    /* req is the request the reply belongs to, NULL if unknown */
+    static void parseResponse(NcMsg *r, NcMsg *req);
+
+    /* method of a request, kHTTP_METHOD_OTHER if not parsed yet */
+    static NcHttpMethod method(NcMsg *r)
+    {
+        return (NcHttpMethod)r->m_cmd_;
+    }
+
+    /* status code of a reply, 0 if not parsed yet */
+    static uint32_t status(NcMsg *r)
+    {
+        return r->m_cmd_;
+    }
+
+    /* the client connection is to be closed after the reply to r */
+    static bool close(NcMsg *r)
+    {
+        return (r->m_flags_ & HTTP_CLOSE) ||
+            ((r->m_flags_ & HTTP_VERSION_10) && !(r->m_flags_ & HTTP_KEEPALIVE));
+    }
+
+private:
+    static void parse(NcMsg *r, const NcConfHttpKey *key, NcMsg *req);
+
+    static bool parseRequestLine(NcMsg *r, const NcConfHttpKey *key, uint8_t *start,
+        uint8_t *end);
+
+    static bool parseStatusLine(NcMsg *r, uint8_t *start, uint8_t *end);
+
+    static bool parseHeader(NcMsg *r, const NcConfHttpKey *key, uint8_t *start,
+        uint8_t *end);
+
+    static bool setKey(NcMsg *r, const NcConfHttpKey *key, uint8_t *start, uint8_t *end);
+
+    static bool dropHopHeaders(NcMsg *r, uint8_t *eoh, uint32_t *removed);
+};
+
+#endif
@@ -12,14 +12,27 @@
 #include <limits.h>
 #include <time.h>
 #include <unistd.h>
+#include <new>
+#include <vector>
+#include <algorithm>
+#include <sys/mman.h>
 #include <nc_util.h>
 #include <nc_log.h>
+#include <nc_arena.h>
+#include <nc_queue.h>
+#include <nc_budget.h>
 
 #define MBUF_MAGIC      0xdeadbeef
 #define MBUF_MIN_SIZE   512
 #define MBUF_MAX_SIZE   16777216
 #define MBUF_SIZE       16384
 #define MBUF_HSIZE      sizeof(NcMbuf)
+#define MBUF_SLAB_SIZE  1048576
+#define MBUF_SMALL_SIZE 4096
+#define MBUF_LARGE_SIZE 262144
+#define MBUF_NCLASS     4
+#define MBUF_SLICE      MBUF_NCLASS     /* class of slice headers */
+#define MBUF_INLINE     (MBUF_NCLASS + 1) /* class of the buffer inlined in NcMsg */
 
 /*
 * mbuf header is at the tail end of the mbuf. This enables us to catch
@@ -39,29 +52,61 @@
 *                        \      mbuf
 *                        mbuf->last (one byte past valid byte)
 *
+* The header at the tail owns the chunk and counts references to it. A
+* split() hands out a slice: a header from the header-only slab whose
+* start/end bound a window of the same chunk. The chunk goes back to its
+* slab when the owner and all slices have been freed.
+*
 */
+class NcMbufPool;
+class NcMbufSlab;
+
 class NcMbuf
 {
+    friend class NcMbufSlab;
+    friend class NcMbufPool;
+
 public:
-    NcMbuf()
+    NcMbuf(uint32_t chunk_size, uint8_t cls)
     { 
-        m_chunk_size_ = NcUtil::ncMbufChunkSize();
-        m_data_ = (uint8_t *)nc_alloc(m_chunk_size_);
-        m_start_ = m_data_;
-        m_end_ = m_data_ + (m_chunk_size_ - MBUF_HSIZE);
-        m_pos_ = m_start_;
-        m_last_ = m_start_;
+        m_chunk_size_ = chunk_size;
+        m_class_ = cls;
+        m_next_ = NULL;
         m_magic_ = MBUF_MAGIC;
+        reset();
     }
 
-    ~NcMbuf()
+    inline void reset()
     {
-        nc_free(m_data_);
+        m_mqe_.reset();
+        m_owner_ = this;
+        m_ref_ = 0;
+        m_start_ = (uint8_t *)this - (m_chunk_size_ - MBUF_HSIZE);
+        m_end_ = (uint8_t *)this;
+        rewind();
     }
 
-    inline void reset()
+    inline bool isSlice()
     {
-        rewind();
+        return m_owner_ != this;
+    }
+
+    // 数据在NcMsg内嵌的buffer里, 不能做slice
+    inline bool isInline()
+    {
+        return m_owner_->m_class_ == MBUF_INLINE;
+    }
+
+    // 只用于NcMsg内嵌的mbuf, 不经过pool分配
+    inline bool inUse()
+    {
+        return m_ref_ > 0;
+    }
+
+    inline void acquire()
+    {
+        ASSERT(m_ref_ == 0);
+        m_ref_ = 1;
     }
 
     inline bool empty()
@@ -74,6 +119,11 @@ public:
         return m_last_ == m_end_ ? true : false;
     }
 
+    inline uint8_t* getStart()
+    {
+        return m_start_;
+    }
+
     inline uint8_t* getPos()
     {
         return m_pos_;
@@ -94,15 +144,28 @@ public:
         m_last_ += n; 
     }
 
+    // 去掉最后n个字节
+    inline void cutLast(uint32_t n)
+    {
+        ASSERT(n <= length());
+        m_last_ -= n;
+    }
+
     inline void setComplete()
     {
         m_pos_ = m_last_;
     }
 
+    // 数据不变, 从头再发送一次
+    inline void rewindPos()
+    {
+        m_pos_ = m_start_;
+    }
+
     inline void rewind()
     {
         m_pos_ = m_start_;
-        m_last_ = m_end_;
+        m_last_ = m_start_;
     }
 
     inline uint32_t length()
@@ -115,9 +178,16 @@ public:
         return (uint32_t)(m_end_ - m_last_);
     }
 
+    // 底层chunk的数据容量, slice返回所属chunk的容量
     inline size_t dataSize()
     {
-        return m_chunk_size_ - MBUF_HSIZE;
+        return m_owner_->m_chunk_size_ - MBUF_HSIZE;
+    }
+
+    // 底层chunk占用的内存, 含header
+    inline size_t chunkSize()
+    {
+        return m_owner_->m_chunk_size_;
     }
 
     inline void copy(uint8_t *pos, size_t n)
@@ -135,17 +205,11 @@ public:
     {
         va_list args;
         int n;
-        uint32_t _size = size();
 
         va_start(args, fmt);
-        n = nc_vsnprintf(m_last_, _size, fmt, args);
+        n = vsnprintf(fmt, args);
         va_end(args);
 
-        if (n > 0)
-        {
-            m_last_ += n;
-        }
-        
         return n;
     }
 
@@ -154,7 +218,7 @@ public:
         int n;
         uint32_t _size = size();
 
-        n = nc_vsnprintf(m_last_, _size, fmt, args);
+        n = ::vsnprintf((char *)m_last_, (size_t)_size, fmt, args);
 
         if (n > 0)
         {
@@ -164,34 +228,632 @@ public:
         return n;
     }
     
-    // 分割mbuf的数据
-    inline NcMbuf* split(uint8_t *pos)
+    // 分割mbuf的数据, 未解析的部分成为共享同一chunk的slice, 不拷贝
+    inline NcMbuf* split(NcMbufPool *pool, uint8_t *pos);
+
+    // 分割mbuf的数据, 未解析的部分拷贝到从pool分配的新mbuf
+    inline NcMbuf* splitCopy(NcMbufPool *pool, uint8_t *pos, size_t size = 0);
+
+public:
+    NcQueueEntry<NcMbuf>    m_mqe_;     /* link in msg mbuf q */
+
+private:
+    uint32_t           m_magic_;   /* mbuf magic (const) */
+    uint8_t            *m_pos_;    /* read marker */
+    uint8_t            *m_last_;   /* write marker */
+    uint8_t            *m_start_;  /* start of buffer (const) */
+    uint8_t            *m_end_;    /* end of buffer (const) */
+    NcMbuf             *m_next_;   /* next free mbuf in the slab free list */
+    NcMbuf             *m_owner_;  /* header owning the chunk, this if not a slice */
+    uint32_t           m_ref_;     /* # headers referencing the chunk (owner only) */
+    uint32_t           m_chunk_size_; // 对应的size
+    uint8_t            m_class_;   /* size class index in the pool (const) */
+};
+
+/*
+ * Slab allocator for one mbuf size class. Chunks of chunk_size bytes are carved
+ * out of large anonymous mappings (slabs) and never handed back to the
+ * system; freed chunks go to a LIFO free list threaded through the mbuf
+ * headers, so the most recently used (cache warm) chunk is reused first.
+ * trim() moves chunks that stayed free for a whole interval to a cold
+ * list and drops their data pages with madvise, keeping the header page.
+ *
+ *   <------------------------ slab_size ------------------------>
+ *   +-------------+-------------+-------------+-----------------+
+ *   |   chunk 0   |   chunk 1   |   chunk 2   |  ...  (uncarved)|
+ *   +-------------+-------------+-------------+-----------------+
+ *   ^                                         ^                 ^
+ *   |                                         |                 |
+ *   slab                                m_cursor_         m_limit_
+ */
+class NcMbufSlab
+{
+public:
+    NcMbufSlab() : m_class_(0), m_chunk_size_(MBUF_SIZE), m_slab_size_(MBUF_SLAB_SIZE),
+        m_cursor_(NULL), m_limit_(NULL), m_free_(NULL), m_cold_(NULL),
+        m_nfree_(0), m_ncold_(0), m_min_free_(0), m_nused_(0), m_nused_max_(0),
+        m_hit_(0), m_miss_(0), m_ntrim_(0),
+        m_fill_bytes_(0), m_fill_max_(0), m_nfill_(0), m_arena_(NULL)
+    { }
+
+    ~NcMbufSlab()
+    {
+        for (uint32_t i = 0; i < m_slabs_.size(); i++)
+        {
+            if (m_arena_ == NULL || !m_arena_->contains(m_slabs_[i]))
+            {
+                ::munmap(m_slabs_[i], m_slab_size_);
+            }
+        }
+    }
+
+    // 设置arena后slab优先从arena分配
+    inline void setArena(NcArena *arena)
+    {
+        m_arena_ = arena;
+    }
+
+    void init(size_t chunk_size, uint8_t cls)
+    {
+        m_class_ = cls;
+        m_chunk_size_ = NC_ALIGN(chunk_size, NC_ALIGNMENT);
+        m_slab_size_ = MAX(MBUF_SLAB_SIZE, m_chunk_size_);
+        m_slab_size_ -= m_slab_size_ % m_chunk_size_;
+    }
+
+    inline NcMbuf* alloc()
+    {
+        NcMbuf *mbuf = m_free_;
+        if (mbuf != NULL)
+        {
+            m_free_ = mbuf->m_next_;
+            m_nfree_--;
+            m_min_free_ = MIN(m_min_free_, m_nfree_);
+            m_hit_++;
+        }
+        else if (m_cold_ != NULL)
+        {
+            mbuf = m_cold_;
+            m_cold_ = mbuf->m_next_;
+            m_ncold_--;
+            m_hit_++;
+        }
+        else
+        {
+            mbuf = carve();
+            if (mbuf == NULL)
+            {
+                return NULL;
+            }
+            m_miss_++;
+        }
+
+        ASSERT(mbuf->m_magic_ == MBUF_MAGIC);
+        mbuf->m_next_ = NULL;
+        mbuf->m_ref_ = 1;
+
+        m_nused_++;
+        if (m_nused_ > m_nused_max_)
+        {
+            m_nused_max_ = m_nused_;
+        }
+
+        return mbuf;
+    }
+
+    inline void free(NcMbuf *mbuf)
+    {
+        if (mbuf == NULL)
+        {
+            return ;
+        }
+
+        ASSERT(mbuf->m_magic_ == MBUF_MAGIC);
+        ASSERT(mbuf->m_class_ == m_class_);
+
+        /* remember how much of the chunk was used, for sizing -m */
+        uint32_t fill = (uint32_t)(mbuf->m_last_ - mbuf->m_start_);
+        if (fill > 0)
+        {
+            m_fill_bytes_ += fill;
+            m_fill_max_ = MAX(m_fill_max_, fill);
+            m_nfill_++;
+        }
+
+        mbuf->reset();
+        mbuf->m_next_ = m_free_;
+        m_free_ = mbuf;
+        m_nfree_++;
+        m_nused_--;
+    }
+
+    inline size_t chunkSize()
+    {
+        return m_chunk_size_;
+    }
+
+    inline uint32_t nslab()
+    {
+        return (uint32_t)m_slabs_.size();
+    }
+
+    /*
+     * Give the data pages of chunks that were not needed since the last
+     * trim back to the system, keeping at least low warm chunks. Only
+     * classes spanning more than one page can do so, as the page holding
+     * the header stays mapped.
+     */
+    uint32_t trim(uint32_t low)
+    {
+        size_t page = (size_t)::sysconf(_SC_PAGESIZE);
+        uint32_t n = 0;
+
+        if (m_chunk_size_ >= 2 * page && m_nfree_ > low)
+        {
+            n = MIN(m_min_free_, m_nfree_ - low);
+        }
+
+        for (uint32_t i = 0; i < n; i++)
+        {
+            NcMbuf *mbuf = m_free_;
+            m_free_ = mbuf->m_next_;
+            m_nfree_--;
+
+            uint8_t *start = (uint8_t *)NC_ALIGN_PTR(mbuf->m_start_, page);
+            uint8_t *end = (uint8_t *)((uintptr_t)mbuf & ~((uintptr_t)page - 1));
+            /* arena pages stay, DONTNEED would only split hugepages */
+            if (end > start && (m_arena_ == NULL || !m_arena_->contains(mbuf)))
+            {
+                ::madvise(start, (size_t)(end - start), MADV_DONTNEED);
+            }
+
+            mbuf->m_next_ = m_cold_;
+            m_cold_ = mbuf;
+            m_ncold_++;
+        }
+
+        m_ntrim_ += n;
+        m_min_free_ = m_nfree_;
+        return n;
+    }
+
+    /* # chunks carved out of the slabs so far */
+    inline uint32_t nchunk()
+    {
+        return m_nused_ + m_nfree_ + m_ncold_;
+    }
+
+    inline uint32_t nused()
+    {
+        return m_nused_;
+    }
+
+    inline uint32_t nfree()
+    {
+        return m_nfree_ + m_ncold_;
+    }
+
+    inline uint64_t nhit()
+    {
+        return m_hit_;
+    }
+
+    inline uint64_t nmiss()
+    {
+        return m_miss_;
+    }
+
+    inline uint64_t ntrim()
+    {
+        return m_ntrim_;
+    }
+
+    // 打印slab的占用情况
+    void dump()
+    {
+        uint32_t capacity = nslab() * (uint32_t)(m_slab_size_ / m_chunk_size_);
+
+        LOG_VERBOSE("mbuf slab %" PRIu8 ": chunk_size %zu slab_size %zu slabs %" PRIu32
+            " chunks %" PRIu32 "/%" PRIu32 " used %" PRIu32 " (max %" PRIu32 ")"
+            " free %" PRIu32 " (cold %" PRIu32 ") hit %" PRIu64 " miss %" PRIu64 
+            " trim %" PRIu64 " avg fill %" PRIu64 " max fill %" PRIu32 " bytes",
+            m_class_, m_chunk_size_, m_slab_size_, nslab(), nchunk(), capacity,
+            m_nused_, m_nused_max_, nfree(), m_ncold_, m_hit_, m_miss_, m_ntrim_,
+            m_nfill_ == 0 ? 0 : m_fill_bytes_ / m_nfill_, m_fill_max_);
+    }
+
+private:
+    NcMbuf* carve()
+    {
+        if (m_cursor_ == m_limit_)
+        {
+            void *slab = m_arena_ == NULL ? NULL : m_arena_->alloc(m_slab_size_, 
+                (size_t)::sysconf(_SC_PAGESIZE));
+            if (slab == NULL)
+            {
+                slab = ::mmap(NULL, m_slab_size_, PROT_READ | PROT_WRITE,
+                    MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+            }
+            if (slab == MAP_FAILED)
+            {
+                LOG_ERROR("mmap of mbuf slab (%zu bytes) failed: %s",
+                    m_slab_size_, strerror(errno));
+                return NULL;
+            }
+
+            m_slabs_.push_back((uint8_t *)slab);
+            m_cursor_ = (uint8_t *)slab;
+            m_limit_ = m_cursor_ + m_slab_size_;
+
+            LOG_DEBUG("new mbuf slab %p, slabs : %d", slab, m_slabs_.size());
+        }
+
+        uint8_t *chunk = m_cursor_;
+        m_cursor_ += m_chunk_size_;
+
+        return new (chunk + m_chunk_size_ - MBUF_HSIZE) NcMbuf((uint32_t)m_chunk_size_,
+            m_class_);
+    }
+
+private:
+    uint8_t                 m_class_;       /* size class index (const) */
+    size_t                  m_chunk_size_;  /* mbuf chunk size (const) */
+    size_t                  m_slab_size_;   /* slab size, multiple of chunk size (const) */
+    std::vector<uint8_t*>   m_slabs_;       /* mapped slabs */
+    uint8_t                 *m_cursor_;     /* next chunk to carve in the last slab */
+    uint8_t                 *m_limit_;      /* end of the last slab */
+    NcMbuf                  *m_free_;       /* free list */
+    NcMbuf                  *m_cold_;       /* trimmed free list, data pages dropped */
+
+    uint32_t                m_nfree_;       /* # free chunks */
+    uint32_t                m_ncold_;       /* # trimmed free chunks */
+    uint32_t                m_min_free_;    /* min # free chunks since last trim */
+    uint32_t                m_nused_;       /* # chunks in use */
+    uint32_t                m_nused_max_;   /* max # chunks in use */
+    uint64_t                m_hit_;         /* # allocs served from a free list */
+    uint64_t                m_miss_;        /* # allocs that carved a new chunk */
+    uint64_t                m_ntrim_;       /* # chunks trimmed */
+    uint64_t                m_fill_bytes_;  /* sum of bytes used by freed chunks */
+    uint32_t                m_fill_max_;    /* max bytes used by a freed chunk */
+    uint64_t                m_nfill_;       /* # freed chunks with data */
+    NcArena                 *m_arena_;      /* backing arena, NULL for mmap */
+};
+
+/*
+ * Size-classed mbuf pool. Small requests (the common case for caches) get
+ * a 512 byte chunk instead of a full mbuf_chunk_size one; bulk values grow
+ * into the 4K / -m / 256K classes. Every class has its own slab and free
+ * list, and the class index is kept in the mbuf header so free() can hand
+ * the chunk back without a lookup.
+ */
+class NcMbufPool
+{
+public:
+    NcMbufPool() : m_nclass_(0), m_default_(0), m_nslice_(0), m_copied_(0), 
+        m_budget_(NULL)
+    { }
+
+    // mbuf_chunk_size是默认的class, 其余class围绕它排列
+    void init(size_t chunk_size)
     {
-        FUNCTION_INTO(NcMbuf); 
+        size_t sizes[MBUF_NCLASS] = {
+            MBUF_MIN_SIZE, MBUF_SMALL_SIZE, chunk_size, MBUF_LARGE_SIZE
+        };
+        std::sort(sizes, sizes + MBUF_NCLASS);
 
-        NcMbuf *nbuf = new NcMbuf();
-        if (nbuf == NULL) 
+        m_nclass_ = 0;
+        for (uint32_t i = 0; i < MBUF_NCLASS; i++)
+        {
+            size_t size = NC_ALIGN(sizes[i], NC_ALIGNMENT);
+            if (m_nclass_ > 0 && m_slabs_[m_nclass_ - 1].chunkSize() == size)
+            {
+                continue;
+            }
+
+            m_slabs_[m_nclass_].init(size, (uint8_t)m_nclass_);
+            if (size == NC_ALIGN(chunk_size, NC_ALIGNMENT))
+            {
+                m_default_ = m_nclass_;
+            }
+            m_nclass_++;
+        }
+
+        m_hslab_.init(MBUF_HSIZE, MBUF_SLICE);
+    }
+
+    /*
+     * Allocate an mbuf from the smallest class that can hold size bytes of
+     * data; requests larger than the largest class get the largest class
+     * and are spread over several mbufs by the caller.
+     */
+    inline NcMbuf* alloc(size_t size)
+    {
+        return charge(m_slabs_[classFor(size)].alloc());
+    }
+
+    // 已分配的chunk计入budget
+    inline void setBudget(NcBudget *budget)
+    {
+        m_budget_ = budget;
+    }
+
+    inline void setArena(NcArena *arena)
+    {
+        for (uint32_t i = 0; i < MBUF_NCLASS; i++)
+        {
+            m_slabs_[i].setArena(arena);
+        }
+        m_hslab_.setArena(arena);
+    }
+
+    /* allocate an mbuf of the default (mbuf_chunk_size) class */
+    inline NcMbuf* alloc()
+    {
+        return charge(m_slabs_[m_default_].alloc());
+    }
+
+    /*
+     * Free an mbuf or a slice. The chunk itself is returned to its slab
+     * only when the last header referencing it goes away.
+     */
+    inline void free(NcMbuf *mbuf)
+    {
+        if (mbuf == NULL)
+        {
+            return ;
+        }
+
+        NcMbuf *chunk = mbuf->m_owner_;
+        if (chunk != mbuf)
+        {
+            ASSERT(mbuf->m_class_ == MBUF_SLICE);
+            m_hslab_.free(mbuf);
+        }
+
+        ASSERT(chunk->m_ref_ > 0);
+        if (--chunk->m_ref_ > 0)
+        {
+            return ;
+        }
+
+        /* the inline buffer lives in its NcMsg, nothing to give back */
+        if (chunk->m_class_ == MBUF_INLINE)
+        {
+            chunk->reset();
+            return ;
+        }
+
+        ASSERT(chunk->m_class_ < m_nclass_);
+        if (m_budget_ != NULL)
+        {
+            m_budget_->uncharge(chunk->m_chunk_size_);
+        }
+        m_slabs_[chunk->m_class_].free(chunk);
+    }
+
+    /*
+     * Make a slice of mbuf covering [pos, end of mbuf), sharing its chunk.
+     * The slice keeps the unused room of the chunk, so it can be received
+     * into directly.
+     */
+    inline NcMbuf* slice(NcMbuf *mbuf, uint8_t *pos)
+    {
+        NcMbuf *nbuf = m_hslab_.alloc();
+        if (nbuf == NULL)
         {
-            LOG_DEBUG("nbuf is NULL, chunk_size : %d", m_chunk_size_);
             return NULL;
         }
 
-        uint32_t _size = (size_t)(m_last_ - pos);
-        LOG_DEBUG("m_last_ : %p, pos : %p, size : %d", m_last_, pos, _size);
-        nbuf->copy(pos, _size);
-        m_last_ = pos;
+        NcMbuf *chunk = mbuf->m_owner_;
+        chunk->m_ref_++;
+
+        nbuf->m_owner_ = chunk;
+        nbuf->m_start_ = pos;
+        nbuf->m_pos_ = pos;
+        nbuf->m_last_ = mbuf->m_last_;
+        nbuf->m_end_ = mbuf->m_end_;
+        m_nslice_++;
 
         return nbuf;
     }
 
+    /*
+     * Make a read-only slice of mbuf covering [pos, last), sharing its
+     * chunk; there is no room in it, so nothing is ever written through it.
+     */
+    inline NcMbuf* slice(NcMbuf *mbuf, uint8_t *pos, uint8_t *last)
+    {
+        ASSERT(pos <= last && last <= mbuf->m_last_);
+
+        NcMbuf *nbuf = slice(mbuf, pos);
+        if (nbuf != NULL)
+        {
+            nbuf->m_last_ = last;
+            nbuf->m_end_ = last;
+        }
+
+        return nbuf;
+    }
+
+    inline void addCopied(size_t n)
+    {
+        m_copied_ += n;
+    }
+
+    /* # slices made so far */
+    inline uint64_t nslice()
+    {
+        return m_nslice_;
+    }
+
+    /* # bytes copied by splitCopy so far */
+    inline uint64_t copied()
+    {
+        return m_copied_;
+    }
+
+    inline uint32_t classFor(size_t size)
+    {
+        for (uint32_t i = 0; i < m_nclass_; i++)
+        {
+            if (size <= m_slabs_[i].chunkSize() - MBUF_HSIZE)
+            {
+                return i;
+            }
+        }
+
+        return m_nclass_ - 1;
+    }
+
+    inline uint32_t nclass()
+    {
+        return m_nclass_;
+    }
+
+    inline NcMbufSlab& slab(uint32_t cls)
+    {
+        ASSERT(cls < m_nclass_);
+        return m_slabs_[cls];
+    }
+
+    /* default chunk size, i.e. mbuf_chunk_size */
+    inline size_t chunkSize()
+    {
+        return m_slabs_[m_default_].chunkSize();
+    }
+
+    inline uint32_t nslab()
+    {
+        uint32_t n = 0;
+        for (uint32_t i = 0; i < m_nclass_; i++)
+        {
+            n += m_slabs_[i].nslab();
+        }
+        return n;
+    }
+
+    inline uint32_t nchunk()
+    {
+        uint32_t n = 0;
+        for (uint32_t i = 0; i < m_nclass_; i++)
+        {
+            n += m_slabs_[i].nchunk();
+        }
+        return n;
+    }
+
+    inline uint32_t nused()
+    {
+        uint32_t n = 0;
+        for (uint32_t i = 0; i < m_nclass_; i++)
+        {
+            n += m_slabs_[i].nused();
+        }
+        return n;
+    }
+
+    /* bytes of chunks currently handed out, over all classes */
+    inline uint64_t usedBytes()
+    {
+        uint64_t n = 0;
+        for (uint32_t i = 0; i < m_nclass_; i++)
+        {
+            n += (uint64_t)m_slabs_[i].nused() * m_slabs_[i].chunkSize();
+        }
+        return n;
+    }
+
+    // 回收空闲chunk的物理内存, 每个class保留low个
+    uint32_t trim(uint32_t low)
+    {
+        uint32_t n = 0;
+        for (uint32_t i = 0; i < m_nclass_; i++)
+        {
+            n += m_slabs_[i].trim(low);
+        }
+        return n;
+    }
+
+    void dump()
+    {
+        for (uint32_t i = 0; i < m_nclass_; i++)
+        {
+            m_slabs_[i].dump();
+        }
+
+        LOG_VERBOSE("mbuf slices : %" PRIu64 " live %" PRIu32 " split copied %" 
+            PRIu64 " bytes", m_nslice_, m_hslab_.nused(), m_copied_);
+    }
+
 private:
-    uint32_t           m_magic_;   /* mbuf magic (const) */
-    uint8_t            *m_pos_;    /* read marker */
-    uint8_t            *m_last_;   /* write marker */
-    uint8_t            *m_start_;  /* start of buffer (const) */
-    uint8_t            *m_end_;    /* end of buffer (const) */
-    uint8_t            *m_data_;
-    uint32_t           m_chunk_size_; // 对应的size
+    NcMbufSlab              m_slabs_[MBUF_NCLASS];  /* slabs, by ascending chunk size */
+    uint32_t                m_nclass_;              /* # size classes in use */
+    uint32_t                m_default_;             /* class of mbuf_chunk_size */
+    NcMbufSlab              m_hslab_;               /* slab of slice headers */
+    uint64_t                m_nslice_;              /* # slices made */
+    uint64_t                m_copied_;              /* # bytes copied by splitCopy */
+    NcBudget                *m_budget_;             /* budget charged for chunks, optional */
+
+private:
+    inline NcMbuf* charge(NcMbuf *mbuf)
+    {
+        if (mbuf != NULL && m_budget_ != NULL)
+        {
+            m_budget_->charge(mbuf->m_chunk_size_);
+        }
+        return mbuf;
+    }
 };
 
+inline NcMbuf* NcMbuf::split(NcMbufPool *pool, uint8_t *pos)
+{
+    FUNCTION_INTO(NcMbuf); 
+
+    ASSERT(pos >= m_pos_ && pos <= m_last_);
+
+    /* a slice must not outlive the NcMsg holding an inline buffer */
+    if (isInline())
+    {
+        return splitCopy(pool, pos);
+    }
+
+    NcMbuf *nbuf = pool->slice(this, pos);
+    if (nbuf == NULL) 
+    {
+        LOG_DEBUG("nbuf is NULL");
+        return NULL;
+    }
+
+    /* the rest of the chunk now belongs to the slice */
+    m_last_ = pos;
+    m_end_ = pos;
+
+    return nbuf;
+}
+
+/* size is the room wanted in the new mbuf, at least the bytes after pos */
+inline NcMbuf* NcMbuf::splitCopy(NcMbufPool *pool, uint8_t *pos, size_t size)
+{
+    FUNCTION_INTO(NcMbuf); 
+
+    ASSERT(pos >= m_pos_ && pos <= m_last_);
+
+    uint32_t _size = (size_t)(m_last_ - pos);
+    NcMbuf *nbuf = pool->alloc(MAX(size, (size_t)_size));
+    if (nbuf == NULL) 
+    {
+        LOG_DEBUG("nbuf is NULL, chunk_size : %d", m_chunk_size_);
+        return NULL;
+    }
+
+    LOG_DEBUG("m_last_ : %p, pos : %p, size : %d", m_last_, pos, _size);
+    nbuf->copy(pos, _size);
+    pool->addCopied(_size);
+    m_last_ = pos;
+
+    return nbuf;
+}
+
+typedef NcTailQueue<NcMbuf> NcMbufQueue;
+
 #endif
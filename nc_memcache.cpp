@@ -0,0 +1,634 @@
+#include <nc_memcache.h>
+
+#define RETRIEVAL   MEMCACHE_CMD_RETRIEVAL
+#define STORAGE     MEMCACHE_CMD_STORAGE | MEMCACHE_CMD_NOREPLY
+#define NOREPLY     MEMCACHE_CMD_NOREPLY
+
+static const NcMemcacheCommand s_commands[] = {
+    /* name         type                    min max nbytes  flags */
+    { "get",        kMEMCACHE_CMD_GET,      2,  0,  0,      RETRIEVAL },
+    { "gets",       kMEMCACHE_CMD_GETS,     2,  0,  0,      RETRIEVAL },
+    { "set",        kMEMCACHE_CMD_SET,      5,  5,  4,      STORAGE },
+    { "add",        kMEMCACHE_CMD_ADD,      5,  5,  4,      STORAGE },
+    { "replace",    kMEMCACHE_CMD_REPLACE,  5,  5,  4,      STORAGE },
+    { "append",     kMEMCACHE_CMD_APPEND,   5,  5,  4,      STORAGE },
+    { "prepend",    kMEMCACHE_CMD_PREPEND,  5,  5,  4,      STORAGE },
+    { "cas",        kMEMCACHE_CMD_CAS,      6,  6,  4,      STORAGE },
+    { "incr",       kMEMCACHE_CMD_INCR,     3,  3,  0,      NOREPLY },
+    { "decr",       kMEMCACHE_CMD_DECR,     3,  3,  0,      NOREPLY },
+    { "delete",     kMEMCACHE_CMD_DELETE,   2,  3,  0,      NOREPLY },
+    { "touch",      kMEMCACHE_CMD_TOUCH,    3,  3,  0,      NOREPLY },
+    { "quit",       kMEMCACHE_CMD_QUIT,     1,  1,  0,      MEMCACHE_CMD_QUIT },
+};
+
+#undef RETRIEVAL
+#undef STORAGE
+#undef NOREPLY
+
+#define MEMCACHE_NCOMMAND   (sizeof(s_commands) / sizeof(s_commands[0]))
+
+const NcMemcacheCommand* NcMemcache::lookup(const uint8_t *name, uint32_t len)
+{
+    for (uint32_t i = 0; i < MEMCACHE_NCOMMAND; i++)
+    {
+        const char *cname = s_commands[i].name;
+        if (strlen(cname) == len && memcmp(cname, name, len) == 0)
+        {
+            return &s_commands[i];
+        }
+    }
+
+    return NULL;
+}
+
+const NcMemcacheCommand* NcMemcache::command(NcMsg *r)
+{
+    if (r->m_cmd_ == 0 || r->m_cmd_ > MEMCACHE_NCOMMAND)
+    {
+        return NULL;
+    }
+
+    return &s_commands[r->m_cmd_ - 1];
+}
+
+/* parse a non-negative decimal into *n, false on junk or overflow of max */
+static bool memcacheNumber(const uint8_t *start, const uint8_t *end, uint32_t max,
+    uint32_t *n)
+{
+    uint64_t v = 0;
+    if (start == end)
+    {
+        return false;
+    }
+
+    for (const uint8_t *p = start; p < end; p++)
+    {
+        if (!isdigit(*p))
+        {
+            return false;
+        }
+        v = v * 10 + (uint64_t)(*p - '0');
+        if (v > max)
+        {
+            return false;
+        }
+    }
+
+    *n = (uint32_t)v;
+    return true;
+}
+
+/* command line in [start, end), end pointing at the '\n' */
+bool NcMemcache::parseLine(NcMsg *r, uint8_t *start, uint8_t *end)
+{
+    if (end > start && end[-1] == '\r')
+    {
+        end--;
+    }
+
+    const NcMemcacheCommand *cmd = NULL;
+    uint32_t ntoken = 0;
+    bool noreply = false;
+
+    for (uint8_t *p = start; p < end; ntoken++)
+    {
+        while (p < end && *p == ' ')
+        {
+            p++;
+        }
+        if (p == end)
+        {
+            break;
+        }
+        uint8_t *token = p;
+        while (p < end && *p != ' ')
+        {
+            p++;
+        }
+        uint32_t len = (uint32_t)(p - token);
+
+        if (noreply)
+        {
+            /* noreply has to be the last token */
+            return false;
+        }
+
+        if (ntoken == 0)
+        {
+            cmd = lookup(token, len);
+            if (cmd == NULL)
+            {
+                LOG_DEBUG("unsupported memcache command '%.*s'", len, token);
+                return false;
+            }
+        }
+        else if (ntoken == 1 || (cmd->flags & MEMCACHE_CMD_RETRIEVAL))
+        {
+            if (len > NC_MEMCACHE_MAX_KEY)
+            {
+                LOG_DEBUG("key too long: %" PRIu32 " bytes", len);
+                return false;
+            }
+            r->m_keys_.push_back(NcKeypos(token, p));
+        }
+        else if ((cmd->flags & MEMCACHE_CMD_NOREPLY) && ntoken >= cmd->min &&
+            len == 7 && memcmp(token, "noreply", 7) == 0)
+        {
+            noreply = true;
+        }
+        else if (ntoken == cmd->nbytes)
+        {
+            if (!memcacheNumber(token, p, NC_MEMCACHE_MAX_DATA, &r->m_rlen_))
+            {
+                return false;
+            }
+        }
+    }
+
+    if (cmd == NULL)
+    {
+        return false;
+    }
+
+    uint32_t nargs = ntoken - (noreply ? 1 : 0);
+    if (nargs < cmd->min || (cmd->max != 0 && nargs > cmd->max))
+    {
+        LOG_DEBUG("wrong number of tokens %" PRIu32 " for '%s'", ntoken, cmd->name);
+        return false;
+    }
+
+    r->m_cmd_ = (uint32_t)(cmd - s_commands) + 1;
+    r->m_noreply_ = noreply ? 1 : 0;
+    if (cmd->flags & MEMCACHE_CMD_QUIT)
+    {
+        r->m_quit_ = 1;
+    }
+
+    return true;
+}
+
+/* "VALUE <key> <flags> <bytes> [<cas unique>]" */
+bool NcMemcache::parseValue(NcMsg *r, uint8_t *start, uint8_t *end)
+{
+    if (end > start && end[-1] == '\r')
+    {
+        end--;
+    }
+
+    uint32_t ntoken = 0;
+    for (uint8_t *p = start; p < end; ntoken++)
+    {
+        while (p < end && *p == ' ')
+        {
+            p++;
+        }
+        if (p == end)
+        {
+            break;
+        }
+        uint8_t *token = p;
+        while (p < end && *p != ' ')
+        {
+            p++;
+        }
+
+        if (ntoken == 3 && !memcacheNumber(token, p, NC_MEMCACHE_MAX_DATA, &r->m_rlen_))
+        {
+            return false;
+        }
+    }
+
+    return ntoken == 4 || ntoken == 5;
+}
+
+void NcMemcache::parseRequest(NcMsg *r)
+{
+    enum
+    {
+        SW_START,
+        SW_DATA,
+        SW_DATA_CR,
+        SW_DATA_LF,
+    };
+
+    NcMbuf *b = r->m_mbuf_queue_.back();
+    ASSERT(b != NULL);
+    ASSERT(r->pos >= b->getPos() && r->pos <= b->getLast());
+
+    uint8_t *p = r->pos, *last = b->getLast();
+    int state = r->state;
+
+    for (; p < last; p++)
+    {
+        switch (state)
+        {
+        case SW_START:
+        {
+            /* the whole command line is needed, p is its start */
+            uint8_t *nl = (uint8_t *)memchr(p, '\n', (size_t)(last - p));
+            if (nl == NULL)
+            {
+                if (last - p >= NC_MEMCACHE_MAX_LINE)
+                {
+                    goto error;
+                }
+                r->setPending((uint32_t)(last - p));
+                goto line_again;
+            }
+
+            if (!parseLine(r, p, nl))
+            {
+                goto error;
+            }
+
+            p = nl;
+            if (command(r)->flags & MEMCACHE_CMD_STORAGE)
+            {
+                state = r->m_rlen_ > 0 ? SW_DATA : SW_DATA_CR;
+                break;
+            }
+
+            p++;
+            goto done;
+        }
+
+        case SW_DATA:
+        {
+            /* the payload stays where it was read */
+            uint32_t n = MIN(r->m_rlen_, (uint32_t)(last - p));
+            r->m_rlen_ -= n;
+            p += n;
+            p--;
+            if (r->m_rlen_ == 0)
+            {
+                state = SW_DATA_CR;
+            }
+            break;
+        }
+
+        case SW_DATA_CR:
+            if (*p != '\r')
+            {
+                goto error;
+            }
+            state = SW_DATA_LF;
+            break;
+
+        case SW_DATA_LF:
+            if (*p != '\n')
+            {
+                goto error;
+            }
+            p++;
+            goto done;
+
+        default:
+            ASSERT(0);
+            break;
+        }
+    }
+
+    r->pos = p;
+    r->state = state;
+    r->setPending(state == SW_DATA ? r->m_rlen_ + 2 : 0);
+    r->m_result_ = kMSG_PARSE_AGAIN;
+    return;
+
+line_again:
+    /* resume at the line start, in the same mbuf or in a repaired one */
+    r->pos = p;
+    r->state = state;
+    r->m_result_ = b->full() ? kMSG_PARSE_REPAIR : kMSG_PARSE_AGAIN;
+    return;
+
+done:
+    r->pos = p;
+    r->state = SW_START;
+    r->setPending(0);
+    r->m_result_ = kMSG_PARSE_OK;
+    return;
+
+error:
+    LOG_DEBUG("parse req %" PRIu64 " failed at state %d: '%.*s'", r->m_id_,
+        state, (int)MIN(16, last - p), p);
+    r->pos = p;
+    r->state = state;
+    r->m_result_ = kMSG_PARSE_ERROR;
+    errno = EINVAL;
+}
+
+void NcMemcache::parseResponse(NcMsg *r)
+{
+    enum
+    {
+        SW_START,
+        SW_DATA,
+        SW_DATA_CR,
+        SW_DATA_LF,
+    };
+
+    NcMbuf *b = r->m_mbuf_queue_.back();
+    ASSERT(b != NULL);
+    ASSERT(r->pos >= b->getPos() && r->pos <= b->getLast());
+
+    uint8_t *p = r->pos, *last = b->getLast();
+    int state = r->state;
+
+    for (; p < last; p++)
+    {
+        switch (state)
+        {
+        case SW_START:
+        {
+            uint8_t *nl = (uint8_t *)memchr(p, '\n', (size_t)(last - p));
+            if (nl == NULL)
+            {
+                if (last - p >= NC_MEMCACHE_MAX_LINE)
+                {
+                    goto error;
+                }
+                r->setPending((uint32_t)(last - p));
+                goto line_again;
+            }
+
+            /*
+             * A retrieval reply is VALUE lines with their data up to END,
+             * any other line is a complete reply on its own.
+             */
+            if (nl - p > 6 && memcmp(p, "VALUE ", 6) == 0)
+            {
+                if (!parseValue(r, p, nl))
+                {
+                    goto error;
+                }
+                p = nl;
+                state = r->m_rlen_ > 0 ? SW_DATA : SW_DATA_CR;
+                break;
+            }
+
+            p = nl + 1;
+            goto done;
+        }
+
+        case SW_DATA:
+        {
+            uint32_t n = MIN(r->m_rlen_, (uint32_t)(last - p));
+            r->m_rlen_ -= n;
+            p += n;
+            p--;
+            if (r->m_rlen_ == 0)
+            {
+                state = SW_DATA_CR;
+            }
+            break;
+        }
+
+        case SW_DATA_CR:
+            if (*p != '\r')
+            {
+                goto error;
+            }
+            state = SW_DATA_LF;
+            break;
+
+        case SW_DATA_LF:
+            if (*p != '\n')
+            {
+                goto error;
+            }
+            state = SW_START;
+            break;
+
+        default:
+            ASSERT(0);
+            break;
+        }
+    }
+
+    r->pos = p;
+    r->state = state;
+    r->setPending(state == SW_DATA ? r->m_rlen_ + 2 : 0);
+    r->m_result_ = kMSG_PARSE_AGAIN;
+    return;
+
+line_again:
+    r->pos = p;
+    r->state = state;
+    r->m_result_ = b->full() ? kMSG_PARSE_REPAIR : kMSG_PARSE_AGAIN;
+    return;
+
+done:
+    r->pos = p;
+    r->state = SW_START;
+    r->setPending(0);
+    r->m_result_ = kMSG_PARSE_OK;
+    return;
+
+error:
+    LOG_DEBUG("parse rsp %" PRIu64 " failed at state %d: '%.*s'", r->m_id_,
+        state, (int)MIN(16, last - p), p);
+    r->pos = p;
+    r->state = state;
+    r->m_result_ = kMSG_PARSE_ERROR;
+    errno = EINVAL;
+}
+
+bool NcMemcache::fragmentable(NcMsg *r)
+{
+    const NcMemcacheCommand *cmd = command(r);
+    return cmd != NULL && (cmd->flags & MEMCACHE_CMD_RETRIEVAL);
+}
+
+rstatus_t NcMemcache::fragment(NcMsg *r, std::vector<NcMsg*> &subs, NcContext *ctx)
+{
+    const NcMemcacheCommand *cmd = command(r);
+    std::vector<uint32_t> &seq = r->m_frag_seq_;
+    ASSERT(cmd != NULL && seq.size() == r->m_keys_.size());
+
+    rstatus_t status;
+    for (uint32_t f = 0; f < subs.size(); f++)
+    {
+        status = subs[f]->append(ctx, (uint8_t *)cmd->name, strlen(cmd->name));
+        if (status != NC_OK)
+        {
+            return status;
+        }
+    }
+
+    uint8_t buf[NC_MEMCACHE_MAX_KEY + 1];
+    for (uint32_t i = 0; i < seq.size(); i++)
+    {
+        NcMsg *sub = subs[seq[i]];
+        NcKeypos &key = r->m_keys_[i];
+        uint32_t keylen = key.length();
+        ASSERT(keylen <= NC_MEMCACHE_MAX_KEY);
+
+        /* a key is copied in one piece, route on the copy */
+        buf[0] = ' ';
+        memcpy(buf + 1, key.start, keylen);
+        status = sub->append(ctx, buf, keylen + 1);
+        if (status != NC_OK)
+        {
+            return status;
+        }
+
+        uint8_t *last = sub->m_mbuf_queue_.back()->getLast();
+        sub->m_keys_.push_back(NcKeypos(last - keylen, last));
+    }
+
+    for (uint32_t f = 0; f < subs.size(); f++)
+    {
+        status = subs[f]->append(ctx, (uint8_t *)CRLF, CRLF_LEN);
+        if (status != NC_OK)
+        {
+            return status;
+        }
+    }
+
+    return NC_OK;
+}
+
+bool NcMemcache::collapsible(NcMsg *r)
+{
+    const NcMemcacheCommand *cmd = command(r);
+    return cmd != NULL && (cmd->flags & MEMCACHE_CMD_RETRIEVAL) && r->m_keys_.size() == 1;
+}
+
+bool NcMemcache::cacheable(NcMsg *r)
+{
+    /* the cas unique of a gets reply is only good until the next write */
+    const NcMemcacheCommand *cmd = command(r);
+    return cmd != NULL && cmd->type == kMEMCACHE_CMD_GET && r->m_keys_.size() == 1;
+}
+
+bool NcMemcache::cacheableReply(NcMsg *rsp)
+{
+    uint8_t buf[6];
+    uint32_t n = 0;
+    NcMsgReader reader(rsp);
+    for (int c; n < sizeof(buf) && (c = reader.getc()) >= 0; )
+    {
+        buf[n++] = (uint8_t)c;
+    }
+
+    return (n == 6 && memcmp(buf, "VALUE ", 6) == 0) ||
+        (n == 5 && memcmp(buf, "END\r\n", 5) == 0);
+}
+
+bool NcMemcache::mutating(NcMsg *r)
+{
+    const NcMemcacheCommand *cmd = command(r);
+    return cmd != NULL && !(cmd->flags & MEMCACHE_CMD_RETRIEVAL) && !r->m_keys_.empty();
+}
+
+rstatus_t NcMemcache::error(NcMsg *rsp, NcContext *ctx, err_t err)
+{
+    rsp->freeMbuf(ctx);
+    rsp->setLength(0);
+
+    char buf[128];
+    int n = snprintf(buf, sizeof(buf), "SERVER_ERROR %s\r\n", strerror(err != 0 ? err : EINVAL));
+    return rsp->append(ctx, (uint8_t *)buf, (size_t)MIN(n, (int)sizeof(buf) - 1));
+}
+
+rstatus_t NcMemcache::coalesce(NcMsg *r, std::vector<NcMsg*> &frags, NcContext *ctx)
+{
+    NcMsg *rsp = (NcMsg *)r->m_peer_;
+    ASSERT(rsp != NULL);
+
+    if (r->m_ferror_)
+    {
+        return error(rsp, ctx, r->m_err_);
+    }
+
+    /* "VALUE <key> <flags> <bytes> [<cas>]", room for the CRLF put back */
+    uint8_t line[NC_MEMCACHE_MAX_KEY + 96];
+    uint32_t len;
+    rstatus_t status;
+
+    /* a reply that is neither values nor END (an error) is the reply */
+    std::vector<NcMsgReader> readers(frags.size());
+    for (uint32_t f = 0; f < frags.size(); f++)
+    {
+        NcMsg *frsp = (NcMsg *)frags[f]->m_peer_;
+        ASSERT(frsp != NULL);
+        readers[f].reset(frsp);
+
+        NcMsgReader probe = readers[f];
+        if (!probe.readLine(line, sizeof(line) - 2, &len) ||
+            !((len > 6 && memcmp(line, "VALUE ", 6) == 0) ||
+              (len == 3 && memcmp(line, "END", 3) == 0)))
+        {
+            return readers[f].copyTo(rsp, ctx, frsp->m_mlen_);
+        }
+    }
+
+    for (uint32_t i = 0; i < r->m_keys_.size(); i++)
+    {
+        NcMsgReader &reader = readers[r->m_frag_seq_[i]];
+        NcKeypos &key = r->m_keys_[i];
+
+        /* the next block of the fragment is either this key or a miss */
+        NcMsgReader probe = reader;
+        if (!probe.readLine(line, sizeof(line) - 2, &len))
+        {
+            goto invalid;
+        }
+        if (len < 6 || memcmp(line, "VALUE ", 6) != 0 || len < 6 + key.length() + 1 ||
+            memcmp(line + 6, key.start, key.length()) != 0 || line[6 + key.length()] != ' ')
+        {
+            continue;
+        }
+
+        /* <flags> <bytes> follow the key */
+        uint8_t *p = line + 6 + key.length() + 1, *end = line + len;
+        uint8_t *flags_end = (uint8_t *)memchr(p, ' ', (size_t)(end - p));
+        if (flags_end == NULL)
+        {
+            goto invalid;
+        }
+        p = flags_end + 1;
+        uint8_t *bytes_end = (uint8_t *)memchr(p, ' ', (size_t)(end - p));
+        uint32_t bytes;
+        if (!memcacheNumber(p, bytes_end != NULL ? bytes_end : end, NC_MEMCACHE_MAX_DATA,
+            &bytes))
+        {
+            goto invalid;
+        }
+
+        line[len] = '\r';
+        line[len + 1] = '\n';
+        status = rsp->append(ctx, line, len + 2);
+        if (status != NC_OK)
+        {
+            return status;
+        }
+
+        /* the data and its CRLF, sliced when long */
+        reader = probe;
+        status = reader.copyTo(rsp, ctx, bytes + 2);
+        if (status == NC_ERROR)
+        {
+            goto invalid;
+        }
+        if (status != NC_OK)
+        {
+            return status;
+        }
+    }
+
+    for (uint32_t f = 0; f < readers.size(); f++)
+    {
+        if (!readers[f].readLine(line, sizeof(line) - 2, &len) || len != 3 ||
+            memcmp(line, "END", 3) != 0)
+        {
+            goto invalid;
+        }
+    }
+
+    return rsp->append(ctx, (uint8_t *)"END\r\n", 5);
+
+invalid:
+    LOG_ERROR("bad fragment reply for req %" PRIu64 " '%s'", r->m_id_, command(r)->name);
+    return error(rsp, ctx, EINVAL);
+}
@@ -0,0 +1,102 @@
+#ifndef _NC_MEMCACHE_H_
+#define _NC_MEMCACHE_H_
+
+#include <nc_message.h>
+
+#define NC_MEMCACHE_MAX_KEY     250                     /* max key length */
+#define NC_MEMCACHE_MAX_LINE    (MBUF_LARGE_SIZE - MBUF_HSIZE) /* max command / reply line */
+#define NC_MEMCACHE_MAX_DATA    (1024 * 1024 * 1024)    /* max storage payload */
+
+typedef enum
+{
+    kMEMCACHE_CMD_GET,
+    kMEMCACHE_CMD_GETS,
+    kMEMCACHE_CMD_SET,
+    kMEMCACHE_CMD_ADD,
+    kMEMCACHE_CMD_REPLACE,
+    kMEMCACHE_CMD_APPEND,
+    kMEMCACHE_CMD_PREPEND,
+    kMEMCACHE_CMD_CAS,
+    kMEMCACHE_CMD_INCR,
+    kMEMCACHE_CMD_DECR,
+    kMEMCACHE_CMD_DELETE,
+    kMEMCACHE_CMD_TOUCH,
+    kMEMCACHE_CMD_QUIT,
+} NcMemcacheCmdType;
+
+#define MEMCACHE_CMD_RETRIEVAL  0x01    /* get/gets, one or more keys */
+#define MEMCACHE_CMD_STORAGE    0x02    /* followed by a <bytes> payload */
+#define MEMCACHE_CMD_NOREPLY    0x04    /* takes an optional trailing noreply */
+#define MEMCACHE_CMD_QUIT       0x08    /* closes the client connection */
+
+/*
+ * A command line has ntoken tokens (command name included) between min
+ * and max, plus one if it ends with noreply; max 0 means no limit. Storage
+ * commands carry the payload length in token nbytes.
+ */
+class NcMemcacheCommand
+{
+public:
+    const char          *name;
+    NcMemcacheCmdType   type;
+    uint32_t            min;
+    uint32_t            max;
+    uint32_t            nbytes;
+    uint32_t            flags;
+};
+
+/*
+ * Incremental memcache ASCII parser. Command lines and reply lines are
+ * scanned in place and have to be contiguous, like redis keys: a line that
+ * runs past a full mbuf is repaired into a new one. Storage payloads and
+ * VALUE data are skipped wherever they lie, so values are never copied.
+ * All keys of a request, including every key of a multi-get, are recorded
+ * as NcKeypos pointing into the mbufs.
+ */
+class NcMemcache
+{
+public:
+    static void parseRequest(NcMsg *r);
+
+    static void parseResponse(NcMsg *r);
+
+    static const NcMemcacheCommand* lookup(const uint8_t *name, uint32_t len);
+
+    /* command of a parsed request, NULL if not parsed yet */
+    static const NcMemcacheCommand* command(NcMsg *r);
+
+    /*
+     * A get / gets is split by key when its keys live on several servers.
+     * fragment() fills subs[f] with the command for the keys of fragment f
+     * of r, coalesce() merges the VALUE blocks of the fragments' replies in
+     * key order, misses left out, into the reply of r.
+     */
+    static bool fragmentable(NcMsg *r);
+
+    static rstatus_t fragment(NcMsg *r, std::vector<NcMsg*> &subs, NcContext *ctx);
+
+    static rstatus_t coalesce(NcMsg *r, std::vector<NcMsg*> &frags, NcContext *ctx);
+
+    /* a get / gets of a single key, which identical requests may share a reply of */
+    static bool collapsible(NcMsg *r);
+
+    /* a get (not gets) of a single key, which the near cache may answer */
+    static bool cacheable(NcMsg *r);
+
+    /* a VALUE or a miss the near cache may keep */
+    static bool cacheableReply(NcMsg *rsp);
+
+    /* a storage, delete, arithmetic or touch command */
+    static bool mutating(NcMsg *r);
+
+    // 请求失败时的错误响应
+    static rstatus_t error(NcMsg *rsp, NcContext *ctx, err_t err);
+
+private:
+
+    static bool parseLine(NcMsg *r, uint8_t *start, uint8_t *end);
+
+    static bool parseValue(NcMsg *r, uint8_t *start, uint8_t *end);
+};
+
+#endif
@@ -0,0 +1,307 @@
+#include <arpa/inet.h>
+#include <nc_memcache_binary.h>
+
+#define K   MCBIN_OP_VALID | MCBIN_OP_KEY
+#define Q   MCBIN_OP_QUIET
+
+static const uint8_t s_opflags[256] = {
+    K,                  /* 0x00 get */
+    K,                  /* 0x01 set */
+    K,                  /* 0x02 add */
+    K,                  /* 0x03 replace */
+    K,                  /* 0x04 delete */
+    K,                  /* 0x05 incr */
+    K,                  /* 0x06 decr */
+    MCBIN_OP_VALID | MCBIN_OP_QUIT,             /* 0x07 quit */
+    0,                  /* 0x08 flush */
+    K | Q,              /* 0x09 getq */
+    MCBIN_OP_VALID | MCBIN_OP_LOCAL,            /* 0x0a noop */
+    0,                  /* 0x0b version */
+    K,                  /* 0x0c getk */
+    K | Q,              /* 0x0d getkq */
+    K,                  /* 0x0e append */
+    K,                  /* 0x0f prepend */
+    0,                  /* 0x10 stat */
+    K | Q,              /* 0x11 setq */
+    K | Q,              /* 0x12 addq */
+    K | Q,              /* 0x13 replaceq */
+    K | Q,              /* 0x14 deleteq */
+    K | Q,              /* 0x15 incrq */
+    K | Q,              /* 0x16 decrq */
+    MCBIN_OP_VALID | MCBIN_OP_QUIT | Q,         /* 0x17 quitq */
+    0,                  /* 0x18 flushq */
+    K | Q,              /* 0x19 appendq */
+    K | Q,              /* 0x1a prependq */
+    0,                  /* 0x1b verbosity */
+    K,                  /* 0x1c touch */
+    K,                  /* 0x1d gat */
+    K | Q,              /* 0x1e gatq */
+    0, 0, 0, 0,         /* 0x1f - 0x22 */
+    K,                  /* 0x23 gatk */
+    K | Q,              /* 0x24 gatkq */
+};
+
+#undef K
+#undef Q
+
+uint32_t NcMemcacheBinary::flags(NcMsg *r)
+{
+    return r->m_cmd_ == 0 ? 0 : s_opflags[opcode(r)];
+}
+
+void NcMemcacheBinary::setOpaque(uint8_t *header, uint32_t opaque)
+{
+    opaque = htonl(opaque);
+    memcpy(header + 12, &opaque, sizeof(opaque));
+}
+
+void NcMemcacheBinary::parse(NcMsg *r, uint8_t magic)
+{
+    enum
+    {
+        SW_HEADER,
+        SW_VALUE,
+    };
+
+    NcMbuf *b = r->m_mbuf_queue_.back();
+    ASSERT(b != NULL);
+    ASSERT(r->pos >= b->getPos() && r->pos <= b->getLast());
+
+    uint8_t *p = r->pos, *last = b->getLast();
+    uint32_t avail = (uint32_t)(last - p), need;
+    uint16_t keylen;
+    uint32_t bodylen, opaque;
+    uint8_t extlen, op;
+
+    switch (r->state)
+    {
+    case SW_HEADER:
+        /* header, extras and key in one piece; p is the header */
+        if (avail < MCBIN_HEADER_SIZE)
+        {
+            r->setPending(MCBIN_HEADER_SIZE - avail);
+            goto header_again;
+        }
+
+        op = p[1];
+        extlen = p[4];
+        memcpy(&keylen, p + 2, sizeof(keylen));
+        memcpy(&bodylen, p + 8, sizeof(bodylen));
+        memcpy(&opaque, p + 12, sizeof(opaque));
+        keylen = ntohs(keylen);
+        bodylen = ntohl(bodylen);
+        opaque = ntohl(opaque);
+
+        if (p[0] != magic || (uint32_t)extlen + keylen > bodylen ||
+            bodylen > NC_MEMCACHE_MAX_DATA)
+        {
+            goto error;
+        }
+
+        if (r->m_request_)
+        {
+            if (!(s_opflags[op] & MCBIN_OP_VALID) || keylen > NC_MEMCACHE_MAX_KEY ||
+                ((s_opflags[op] & MCBIN_OP_KEY) && keylen == 0))
+            {
+                LOG_DEBUG("unsupported binary request opcode 0x%02x keylen %u", op, keylen);
+                goto error;
+            }
+        }
+
+        need = MCBIN_HEADER_SIZE + extlen + keylen;
+        if (avail < need)
+        {
+            r->setPending(need - avail);
+            goto header_again;
+        }
+
+        r->m_cmd_ = (uint32_t)op + 1;
+        r->m_header_ = p;
+        r->m_opaque_ = opaque;
+        if (r->m_request_)
+        {
+            if (keylen > 0)
+            {
+                uint8_t *key = p + MCBIN_HEADER_SIZE + extlen;
+                r->m_keys_.push_back(NcKeypos(key, key + keylen));
+            }
+            if (s_opflags[op] & MCBIN_OP_QUIT)
+            {
+                r->m_quit_ = 1;
+            }
+            if (s_opflags[op] & MCBIN_OP_LOCAL)
+            {
+                r->m_noforward_ = 1;
+            }
+            else
+            {
+                setOpaque(p, (uint32_t)r->m_id_);
+            }
+        }
+
+        r->m_rlen_ = bodylen - extlen - keylen;
+        p += need;
+        r->state = SW_VALUE;
+        /* fall through */
+
+    case SW_VALUE:
+    {
+        /* the value stays where it was read */
+        uint32_t n = MIN(r->m_rlen_, (uint32_t)(last - p));
+        r->m_rlen_ -= n;
+        p += n;
+        if (r->m_rlen_ == 0)
+        {
+            goto done;
+        }
+        break;
+    }
+
+    default:
+        ASSERT(0);
+        break;
+    }
+
+    r->pos = p;
+    r->setPending(r->m_rlen_);
+    r->m_result_ = kMSG_PARSE_AGAIN;
+    return;
+
+header_again:
+    r->pos = p;
+    r->m_result_ = b->full() ? kMSG_PARSE_REPAIR : kMSG_PARSE_AGAIN;
+    return;
+
+done:
+    r->pos = p;
+    r->state = SW_HEADER;
+    r->setPending(0);
+    r->m_result_ = kMSG_PARSE_OK;
+    return;
+
+error:
+    LOG_DEBUG("parse %s %" PRIu64 " failed: bad binary header",
+        r->m_request_ ? "req" : "rsp", r->m_id_);
+    r->pos = p;
+    r->m_result_ = kMSG_PARSE_ERROR;
+    errno = EINVAL;
+}
+
+void NcMemcacheBinary::parseRequest(NcMsg *r)
+{
+    parse(r, MCBIN_REQ_MAGIC);
+}
+
+void NcMemcacheBinary::parseResponse(NcMsg *r)
+{
+    parse(r, MCBIN_RSP_MAGIC);
+}
+
+rstatus_t NcMemcacheBinary::reply(NcMsg *r, NcContext *ctx)
+{
+    NcMsg *rsp = (NcMsg *)r->m_peer_;
+    ASSERT(rsp != NULL && opcode(r) == MCBIN_CMD_NOOP);
+
+    uint8_t header[MCBIN_HEADER_SIZE];
+    memset(header, 0, sizeof(header));
+    header[0] = MCBIN_RSP_MAGIC;
+    header[1] = MCBIN_CMD_NOOP;
+    setOpaque(header, r->m_opaque_);
+
+    return rsp->append(ctx, header, sizeof(header));
+}
+
+rstatus_t NcMemcacheBinary::forward(NcMsg *r, NcConn *s_conn, NcContext *ctx)
+{
+    if (!(flags(r) & MCBIN_OP_QUIET))
+    {
+        s_conn->enqueueInput(r);
+        return NC_OK;
+    }
+
+    /* join the batch whose NOOP has not gone out yet */
+    NcMsg *noop = (NcMsg*)(s_conn->m_imsg_q_.back());
+    if (noop != NULL && noop->m_swallow_ && noop->m_type_ == kPROTOCOL_MEMCACHED_BINARY &&
+        noop->m_mbuf_queue_.front()->length() == MCBIN_HEADER_SIZE)
+    {
+        s_conn->m_imsg_q_.insertBefore(r, noop);
+        return NC_OK;
+    }
+
+    noop = (NcMsg*)(ctx->msg_pool).alloc<NcMsg>();
+    if (noop == NULL)
+    {
+        return NC_ENOMEM;
+    }
+
+    uint8_t header[MCBIN_HEADER_SIZE];
+    memset(header, 0, sizeof(header));
+    header[0] = MCBIN_REQ_MAGIC;
+    header[1] = MCBIN_CMD_NOOP;
+    setOpaque(header, (uint32_t)noop->m_id_);
+    if (noop->append(ctx, header, sizeof(header)) != NC_OK)
+    {
+        (ctx->msg_pool).free(noop);
+        return NC_ENOMEM;
+    }
+
+    noop->m_request_ = 1;
+    noop->m_swallow_ = 1;
+    noop->setProtocolType(kPROTOCOL_MEMCACHED_BINARY);
+    noop->m_cmd_ = MCBIN_CMD_NOOP + 1;
+    noop->m_header_ = noop->m_mbuf_queue_.front()->getPos();
+
+    s_conn->enqueueInput(r);
+    s_conn->enqueueInput(noop);
+
+    return NC_OK;
+}
+
+bool NcMemcacheBinary::responseFilter(NcMsg *rsp, NcConn *s_conn)
+{
+    NcContext *ctx = (NcContext*)(s_conn->getContext());
+    NcMsg *pmsg = (NcMsg*)(s_conn->m_omsg_q_.front());
+
+    while (pmsg != NULL && (uint32_t)pmsg->m_id_ != rsp->m_opaque_ &&
+        (flags(pmsg) & MCBIN_OP_QUIET))
+    {
+        /* no reply was sent for this one */
+        s_conn->dequeueOutput(pmsg);
+        LOG_DEBUG("quiet req %" PRIu64 " on s %d had no reply", pmsg->m_id_, s_conn->m_sd_);
+
+        if (pmsg->m_swallow_)
+        {
+            s_conn->freeMsg(pmsg);
+        }
+        else
+        {
+            pmsg->m_done_ = 1;
+            pmsg->m_noreply_ = 1;
+            NcConn *c_conn = (NcConn*)(pmsg->data);
+            if ((ctx->getEvb()).addOutput(c_conn) != NC_OK)
+            {
+                c_conn->m_err_ = errno;
+            }
+        }
+
+        pmsg = (NcMsg*)(s_conn->m_omsg_q_.front());
+    }
+
+    if (pmsg == NULL)
+    {
+        /* stray reply, left to the generic filter */
+        return false;
+    }
+
+    if ((uint32_t)pmsg->m_id_ != rsp->m_opaque_)
+    {
+        LOG_ERROR("rsp %" PRIu64 " opaque %" PRIu32 " does not match req %" PRIu64
+            " on s %d", rsp->m_id_, rsp->m_opaque_, pmsg->m_id_, s_conn->m_sd_);
+        s_conn->freeMsg(rsp, false);
+        s_conn->m_err_ = EINVAL;
+        return true;
+    }
+
+    setOpaque(rsp->m_header_, pmsg->m_opaque_);
+    return false;
+}
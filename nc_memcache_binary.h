@@ -0,0 +1,75 @@
+#ifndef _NC_MEMCACHE_BINARY_H_
+#define _NC_MEMCACHE_BINARY_H_
+
+#include <nc_memcache.h>
+
+#define MCBIN_HEADER_SIZE       24
+#define MCBIN_REQ_MAGIC         0x80
+#define MCBIN_RSP_MAGIC         0x81
+
+/* opcodes the proxy has to tell apart */
+#define MCBIN_CMD_QUIT          0x07
+#define MCBIN_CMD_NOOP          0x0a
+
+#define MCBIN_OP_VALID          0x01    /* supported opcode */
+#define MCBIN_OP_KEY            0x02    /* carries a key */
+#define MCBIN_OP_QUIET          0x04    /* the reply may be suppressed (miss / success) */
+#define MCBIN_OP_QUIT           0x08    /* closes the client connection */
+#define MCBIN_OP_LOCAL          0x10    /* answered by the proxy */
+
+/*
+ * Memcache binary protocol. Every packet is a fixed 24 byte header
+ * followed by extras, key and value; bodylen covers all three:
+ *
+ *   0      1      2      3      4      5      6      7
+ *   +------+------+------+------+------+------+------+------+
+ *   |magic |opcode|   keylen    |extlen|dtype |vbucket/status|
+ *   +------+------+------+------+------+------+------+------+
+ *   |          bodylen          |          opaque           |
+ *   +------+------+------+------+------+------+------+------+
+ *   |                          cas                          |
+ *   +------+------+------+------+------+------+------+------+
+ *
+ * Only header, extras and key have to be contiguous; the value is skipped
+ * wherever it lies. The opaque of a forwarded request is replaced by the
+ * request's id, which is unique on any server connection, and restored in
+ * its reply: replies to quiet requests (GETQ/GETKQ/SETQ...) are only sent
+ * on a hit or an error, so the opaque is how a reply finds its request and
+ * every quiet request passed over is known to have had no reply. Each
+ * batch of quiet requests to a server ends with one NOOP of the proxy's
+ * own, whose reply is swallowed; the client's NOOP is answered by the proxy
+ * once everything before it has been answered.
+ */
+class NcMemcacheBinary
+{
+public:
+    static void parseRequest(NcMsg *r);
+
+    static void parseResponse(NcMsg *r);
+
+    static rstatus_t reply(NcMsg *r, NcContext *ctx);
+
+    /* queue a request on a server, closing a quiet batch with a NOOP */
+    static rstatus_t forward(NcMsg *r, NcConn *s_conn, NcContext *ctx);
+
+    /*
+     * Match a reply with its request at the head of the server's out queue,
+     * completing the quiet requests it passes over. Returns true if the
+     * reply has been consumed.
+     */
+    static bool responseFilter(NcMsg *rsp, NcConn *s_conn);
+
+    static uint32_t flags(NcMsg *r);
+
+    static uint8_t opcode(NcMsg *r)
+    {
+        return (uint8_t)(r->m_cmd_ - 1);
+    }
+
+private:
+    static void parse(NcMsg *r, uint8_t magic);
+
+    static void setOpaque(uint8_t *header, uint32_t opaque);
+};
+
+#endif
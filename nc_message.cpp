@@ -1,15 +1,22 @@
 #include <nc_message.h>
 #include <nc_client.h>
 #include <nc_server.h>
+#include <nc_redis.h>
+#include <nc_memcache.h>
+#include <nc_memcache_binary.h>
+#include <nc_http.h>
+#include <nc_mysql.h>
+#include <nc_redis_cluster.h>
 
 inline NcMbuf* NcMsg::ensureMbuf(NcContext *ctx, size_t len)
 {
-    NcMbuf *buf = m_mbuf_queue_.front();
-    if (buf == NULL || buf->size() >= len)
+    NcMbuf *buf = m_mbuf_queue_.empty() ? NULL : m_mbuf_queue_.back();
+    if (buf != NULL && buf->size() >= len)
     {
-        buf = (ctx->mbuf_pool).alloc<NcMbuf>();
+        return buf;
     }
-    
+
+    buf = allocMbuf(ctx, len);
     if (buf != NULL)
     {
         m_mbuf_queue_.push(buf);
@@ -35,7 +42,7 @@ rstatus_t NcMsg::append(NcContext *ctx, uint8_t *pos, size_t n)
 
 rstatus_t NcMsg::preAppend(NcContext *ctx, uint8_t *pos, size_t n)
 {
-    NcMbuf *buf = (ctx->mbuf_pool).alloc<NcMbuf>();
+    NcMbuf *buf = allocMbuf(ctx, n);
     if (buf == NULL)
     {
         LOG_WARN("buf is NULL");
@@ -52,7 +59,7 @@ rstatus_t NcMsg::preAppend(NcContext *ctx, uint8_t *pos, size_t n)
 rstatus_t NcMsg::prependFormat(NcContext *ctx, const char *fmt, ...)
 {
     va_list args;
-    NcMbuf *buf = (ctx->mbuf_pool).alloc<NcMbuf>();
+    NcMbuf *buf = (ctx->mbuf_pool).alloc();
     if (buf == NULL)
     {
         LOG_WARN("buf is NULL");
@@ -73,6 +80,50 @@ rstatus_t NcMsg::prependFormat(NcContext *ctx, const char *fmt, ...)
     return NC_OK;
 }
 
+rstatus_t NcMsg::appendFrom(NcContext *ctx, NcMbuf *mbuf, uint8_t *pos, size_t n)
+{
+    ASSERT(pos >= mbuf->getPos() && pos + n <= mbuf->getLast());
+
+    if (n == 0)
+    {
+        return NC_OK;
+    }
+
+    NcMbuf *buf;
+    if (n >= NC_MSG_SLICE_MIN && !mbuf->isInline())
+    {
+        buf = (ctx->mbuf_pool).slice(mbuf, pos, pos + n);
+    }
+    else
+    {
+        buf = m_mbuf_queue_.empty() ? NULL : m_mbuf_queue_.back();
+        if (buf != NULL && buf->size() >= n)
+        {
+            buf->copy(pos, n);
+            m_mlen_ += (uint32_t)n;
+            return NC_OK;
+        }
+
+        // 后面多半还有要拷贝的小数据, 直接分配small class
+        buf = allocMbuf(ctx, MAX(n, (size_t)(MBUF_SMALL_SIZE - MBUF_HSIZE)));
+        if (buf != NULL)
+        {
+            buf->copy(pos, n);
+        }
+    }
+
+    if (buf == NULL)
+    {
+        LOG_WARN("buf is NULL");
+        return NC_ENOMEM;
+    }
+
+    m_mbuf_queue_.push(buf);
+    m_mlen_ += (uint32_t)n;
+
+    return NC_OK;
+}
+
 rstatus_t NcMsg::parse(NcConn* conn)
 {
     FUNCTION_INTO(NcMsg);
@@ -87,15 +138,71 @@ rstatus_t NcMsg::parse(NcConn* conn)
         return NC_OK;
     }
 
-    // TODO : 测试，默认解析完成
-    static int testi = 0;
-    if (testi >= 0)
+    switch (m_type_)
     {
+    case kPROTOCOL_REDIS:
+        if (m_request_)
+        {
+            NcRedis::parseRequest(this);
+        }
+        else
+        {
+            NcRedis::parseResponse(this);
+        }
+        break;
+
+    case kPROTOCOL_MEMCACHED:
+        if (m_request_)
+        {
+            NcMemcache::parseRequest(this);
+        }
+        else
+        {
+            NcMemcache::parseResponse(this);
+        }
+        break;
+
+    case kPROTOCOL_MEMCACHED_BINARY:
+        if (m_request_)
+        {
+            NcMemcacheBinary::parseRequest(this);
+        }
+        else
+        {
+            NcMemcacheBinary::parseResponse(this);
+        }
+        break;
+
+    case kPROTOCOL_HTTP:
+        if (m_request_)
+        {
+            NcHttp::parseRequest(this, ((NcServerPool*)(conn->m_owner_))->http_key);
+        }
+        else
+        {
+            // HEAD请求的响应没有body, 需要知道对应的请求
+            NcHttp::parseResponse(this, (NcMsg*)(conn->m_omsg_q_.front()));
+        }
+        break;
+
+    case kPROTOCOL_MYSQL:
+        if (m_request_)
+        {
+            NcMysql::parseRequest(this);
+        }
+        else
+        {
+            // 结果集的格式取决于请求的命令
+            NcMysql::parseResponse(this, (NcMsg*)(conn->m_omsg_q_.front()));
+        }
+        break;
+
+    default:
+        // 还没有parser的协议, 一次读到的数据作为一个消息
         m_result_ = kMSG_PARSE_OK;
-        NcMbuf *mbuf = m_mbuf_queue_.back();
-        pos = mbuf->getLast();
+        pos = m_mbuf_queue_.back()->getLast();
+        break;
     }
-    testi++;
 
     switch (m_result_)
     {
@@ -105,6 +212,11 @@ rstatus_t NcMsg::parse(NcConn* conn)
 
     case kMSG_PARSE_REPAIR:
         status = repairDone(conn);
+        if (status == NC_OK && m_type_ == kPROTOCOL_HTTP)
+        {
+            // http的header需要空间时也会repair, 移过去的数据可能已经完整
+            return parse(conn);
+        }
         break;
 
     case kMSG_PARSE_AGAIN:
@@ -128,12 +240,12 @@ rstatus_t NcMsg::parseDone(NcConn* conn)
 
     NcContext *ctx = (NcContext*)(conn->getContext());
     ASSERT(ctx != NULL);
-    NcMbuf *mbuf = m_mbuf_queue_.back();
-    if (mbuf == NULL)
+    if (m_mbuf_queue_.empty())
     {
         LOG_ERROR("mbuf is NULL");
         return NC_ENOMEM;
     }
+    NcMbuf *mbuf = m_mbuf_queue_.back();
 
     LOG_DEBUG("mbuf : %p, pos : %p, last : %p", mbuf, pos, mbuf->getLast());
     if (pos == mbuf->getLast()) 
@@ -147,9 +259,10 @@ rstatus_t NcMsg::parseDone(NcConn* conn)
      * Input mbuf has un-parsed data. Split mbuf of the current message msg
      * into (mbuf, nbuf), where mbuf is the portion of the message that has
      * been parsed and nbuf is the portion of the message that is un-parsed.
-     * Parse nbuf as a new message nmsg in the next iteration.
+     * nbuf is a slice of the same chunk, so nothing is copied. Parse nbuf
+     * as a new message nmsg in the next iteration.
      */
-    NcMbuf *nbuf = mbuf->split(pos);
+    NcMbuf *nbuf = mbuf->split(&ctx->mbuf_pool, pos);
     if (nbuf == NULL) 
     {
         LOG_DEBUG("nbuf is NULL");
@@ -168,6 +281,9 @@ rstatus_t NcMsg::parseDone(NcConn* conn)
 
     nmsg->m_mbuf_queue_.push(nbuf);
     nmsg->pos = nbuf->getPos();
+    nmsg->m_request_ = m_request_;
+    nmsg->m_type_ = m_type_;
+    nmsg->setData(data);
     /* update length of current (msg) and new message (nmsg) */
     nmsg->m_mlen_ = nbuf->length();
     m_mlen_ -= nmsg->m_mlen_;
@@ -182,14 +298,23 @@ rstatus_t NcMsg::parseDone(NcConn* conn)
 rstatus_t NcMsg::repairDone(NcConn* conn)
 {
     FUNCTION_INTO(NcMsg);
-     
-    NcMbuf *mbuf = m_mbuf_queue_.back();
-    if (mbuf == NULL)
+
+    NcContext *ctx = (NcContext*)(conn->getContext());
+    ASSERT(ctx != NULL);
+    if (m_mbuf_queue_.empty())
     {
         return NC_ERROR;
     }
 
-    NcMbuf *nbuf = mbuf->split(pos);
+    /*
+     * A token straddles the end of the mbuf; it has to be contiguous, so
+     * the tail is copied into a fresh mbuf rather than sliced. The parser
+     * left what the token still needs in pending, so the new mbuf is big
+     * enough to complete it.
+     */
+    NcMbuf *mbuf = m_mbuf_queue_.back();
+    size_t tail = (size_t)(mbuf->getLast() - pos);
+    NcMbuf *nbuf = mbuf->splitCopy(&ctx->mbuf_pool, pos, tail + m_pending_);
     if (nbuf == NULL) 
     {
         LOG_DEBUG("nbuf is NULL");
@@ -198,12 +323,419 @@ rstatus_t NcMsg::repairDone(NcConn* conn)
 
     m_mbuf_queue_.push(nbuf);
     pos = nbuf->getPos();
+    m_pending_ = 0;
 
     return NC_OK;
 }
 
+rstatus_t NcMsg::reply(NcConn* conn)
+{
+    FUNCTION_INTO(NcMsg);
+
+    NcContext *ctx = (NcContext*)(conn->getContext());
+    ASSERT(ctx != NULL);
+
+    switch (m_type_)
+    {
+    case kPROTOCOL_REDIS:
+        return NcRedis::reply(this, ctx);
+
+    case kPROTOCOL_MEMCACHED_BINARY:
+        return NcMemcacheBinary::reply(this, ctx);
+
+    case kPROTOCOL_MYSQL:
+        return NcMysql::reply(this, conn, ctx);
+
+    default:
+        return NC_OK;
+    }
+}
+
+rstatus_t NcMsg::fragment(NcConn* conn, NcQueue<NcMsg*> &frag_msgq)
+{
+    FUNCTION_INTO(NcMsg);
+
+    NcContext *ctx = (NcContext*)(conn->getContext());
+    NcServerPool *pool = (NcServerPool*)(conn->m_owner_);
+    ASSERT(ctx != NULL && pool != NULL);
+
+    uint32_t nserver = (uint32_t)pool->server.size();
+    if (m_keys_.size() < 2 || nserver < 2)
+    {
+        return NC_OK;
+    }
+
+    switch (m_type_)
+    {
+    case kPROTOCOL_REDIS:
+        if (!NcRedis::fragmentable(this))
+        {
+            return NC_OK;
+        }
+        break;
+
+    case kPROTOCOL_MEMCACHED:
+        if (!NcMemcache::fragmentable(this))
+        {
+            return NC_OK;
+        }
+        break;
+
+    default:
+        return NC_OK;
+    }
+
+    /* fragments are numbered in the order their server is first hit */
+    std::vector<uint32_t> frag_of(nserver, UINT32_MAX);
+    uint32_t nfrag = 0;
+    std::vector<NcMsg*> subs;
+    rstatus_t status;
+    m_frag_seq_.resize(m_keys_.size());
+    pool->index(&m_keys_[0], (uint32_t)m_keys_.size(), &m_frag_seq_[0]);
+    for (uint32_t i = 0; i < m_keys_.size(); i++)
+    {
+        uint32_t idx = m_frag_seq_[i] % nserver;
+        if (frag_of[idx] == UINT32_MAX)
+        {
+            frag_of[idx] = nfrag++;
+        }
+        m_frag_seq_[i] = frag_of[idx];
+    }
+
+    if (nfrag == 1)
+    {
+        m_frag_seq_.clear();
+        return NC_OK;
+    }
+
+    subs.reserve(nfrag);
+    for (uint32_t f = 0; f < nfrag; f++)
+    {
+        NcMsg *sub = (NcMsg*)(ctx->msg_pool).alloc<NcMsg>();
+        if (sub == NULL)
+        {
+            status = NC_ENOMEM;
+            goto error;
+        }
+
+        sub->m_request_ = 1;
+        sub->setProtocolType(m_type_);
+        sub->setData(data);
+        sub->m_cmd_ = m_cmd_;
+        sub->m_frag_id_ = m_id_;
+        sub->m_frag_owner_ = this;
+        subs.push_back(sub);
+    }
+
+    status = m_type_ == kPROTOCOL_REDIS ? 
+        NcRedis::fragment(this, subs, ctx) : NcMemcache::fragment(this, subs, ctx);
+    if (status != NC_OK)
+    {
+        goto error;
+    }
+
+    for (uint32_t f = 0; f < nfrag; f++)
+    {
+        frag_msgq.push(subs[f]);
+    }
+
+    m_frag_id_ = m_id_;
+    m_nfrag_ = nfrag;
+
+    LOG_DEBUG("split req %" PRIu64 " with %" PRIu32 " keys from c %d into %" PRIu32
+        " fragments", m_id_, (uint32_t)m_keys_.size(), conn->m_sd_, nfrag);
+
+    return NC_OK;
+
+error:
+    for (uint32_t f = 0; f < subs.size(); f++)
+    {
+        conn->freeMsg(subs[f]);
+    }
+    m_frag_seq_.clear();
+    errno = status == NC_ENOMEM ? ENOMEM : EINVAL;
+    return status;
+}
+
+void NcMsg::coalesce(NcConn* conn)
+{
+    FUNCTION_INTO(NcMsg);
+
+    NcContext *ctx = (NcContext*)(conn->getContext());
+    ASSERT(ctx != NULL && m_peer_ != NULL);
+
+    /* the fragments follow their owner in the client's queue */
+    std::vector<NcMsg*> frags;
+    frags.reserve(m_nfrag_);
+    NcMsg *frag = (NcMsg*)(conn->m_omsg_q_.next(this));
+    for (uint32_t f = 0; f < m_nfrag_; f++)
+    {
+        ASSERT(frag != NULL && frag->m_frag_owner_ == this);
+        frags.push_back(frag);
+        frag = (NcMsg*)(conn->m_omsg_q_.next(frag));
+    }
+
+    rstatus_t status = m_type_ == kPROTOCOL_REDIS ? 
+        NcRedis::coalesce(this, frags, ctx) : NcMemcache::coalesce(this, frags, ctx);
+    if (status != NC_OK)
+    {
+        conn->m_err_ = ENOMEM;
+    }
+
+    LOG_DEBUG("merged %" PRIu32 " fragments of req %" PRIu64 " on c %d into rsp len %"
+        PRIu32 "%s", m_nfrag_, m_id_, conn->m_sd_, m_peer_->m_mlen_, m_ferror_ ? " (error)" : "");
+
+    for (uint32_t f = 0; f < frags.size(); f++)
+    {
+        conn->dequeueOutput(frags[f]);
+        conn->freeMsg(frags[f]);
+    }
+}
+
+uint64_t NcMsg::digest()
+{
+    uint64_t hash = 0xcbf29ce484222325ULL;
+    for (NcMbuf *mbuf = m_mbuf_queue_.front(); mbuf != NULL; mbuf = m_mbuf_queue_.next(mbuf))
+    {
+        for (uint8_t *p = mbuf->getStart(); p < mbuf->getLast(); p++)
+        {
+            hash ^= *p;
+            hash *= 0x100000001b3ULL;
+        }
+    }
+
+    /* 0 stands for no digest */
+    return hash != 0 ? hash : 1;
+}
+
+bool NcMsg::identical(NcMsg *r)
+{
+    if (m_mlen_ != r->m_mlen_)
+    {
+        return false;
+    }
+
+    NcMbuf *a = m_mbuf_queue_.front(), *b = r->m_mbuf_queue_.front();
+    uint8_t *p = a != NULL ? a->getStart() : NULL;
+    uint8_t *q = b != NULL ? b->getStart() : NULL;
+    while (a != NULL && b != NULL)
+    {
+        size_t n = MIN((size_t)(a->getLast() - p), (size_t)(b->getLast() - q));
+        if (memcmp(p, q, n) != 0)
+        {
+            return false;
+        }
+        p += n;
+        q += n;
+
+        if (p == a->getLast() && (a = m_mbuf_queue_.next(a)) != NULL)
+        {
+            p = a->getStart();
+        }
+        if (q == b->getLast() && (b = r->m_mbuf_queue_.next(b)) != NULL)
+        {
+            q = b->getStart();
+        }
+    }
+
+    return a == NULL && b == NULL;
+}
+
+bool NcMsg::collapse(NcConn* conn)
+{
+    NcServerPool *pool = (NcServerPool*)(conn->m_owner_);
+    if (!pool->collapse || m_noreply_ || m_frag_id_ != 0 || m_frag_owner_ != NULL)
+    {
+        return false;
+    }
+
+    bool collapsible = m_type_ == kPROTOCOL_REDIS ? NcRedis::collapsible(this) :
+        m_type_ == kPROTOCOL_MEMCACHED ? NcMemcache::collapsible(this) : false;
+    if (!collapsible)
+    {
+        return false;
+    }
+
+    uint64_t digest = this->digest();
+    std::unordered_map<uint64_t, NcMsg*>::iterator it = pool->collapsing.find(digest);
+    if (it == pool->collapsing.end())
+    {
+        /* others wait on this one once it is forwarded */
+        m_digest_ = digest;
+        return false;
+    }
+
+    NcMsg *leader = it->second;
+    if (!identical(leader))
+    {
+        return false;
+    }
+
+    leader->m_waiter_q_.push(this);
+    pool->ncollapse_hit++;
+
+    LOG_DEBUG("collapse req %" PRIu64 " from c %d into req %" PRIu64 ", %" PRIu32 
+        " waiting", m_id_, conn->m_sd_, leader->m_id_, (uint32_t)leader->m_waiter_q_.size());
+
+    return true;
+}
+
+void NcMsg::fanout(NcConn* s_conn, NcMsg *rsp, err_t err)
+{
+    if (m_digest_ == 0)
+    {
+        return ;
+    }
+
+    NcContext *ctx = (NcContext*)(s_conn->getContext());
+    NcServerPool *pool = ((NcServer*)(s_conn->m_owner_))->getServerPool();
+    std::unordered_map<uint64_t, NcMsg*>::iterator it = pool->collapsing.find(m_digest_);
+    if (it != pool->collapsing.end() && it->second == this)
+    {
+        pool->collapsing.erase(it);
+    }
+    m_digest_ = 0;
+
+    NcMsg *msg;
+    while ((msg = (NcMsg*)m_waiter_q_.pop()) != NULL)
+    {
+        /* its client has gone away */
+        if (msg->m_swallow_)
+        {
+            s_conn->freeMsg(msg);
+            continue;
+        }
+
+        NcMsg *copy = NULL;
+        if (rsp != NULL)
+        {
+            copy = (NcMsg*)(ctx->msg_pool).alloc<NcMsg>();
+            NcMsgReader reader(rsp);
+            if (copy != NULL && reader.copyTo(copy, ctx, rsp->m_mlen_) != NC_OK)
+            {
+                copy->freeMbuf(ctx);
+                (ctx->msg_pool).free(copy);
+                copy = NULL;
+            }
+        }
+
+        msg->m_done_ = 1;
+        if (copy != NULL)
+        {
+            copy->m_type_ = rsp->m_type_;
+            copy->m_peer_ = msg;
+            msg->m_peer_ = copy;
+        }
+        else
+        {
+            msg->m_error_ = 1;
+            msg->m_err_ = rsp != NULL ? ENOMEM : err;
+        }
+
+        NcConn *c_conn = (NcConn*)(msg->data);
+        NcMsg *front = (NcMsg*)(c_conn->m_omsg_q_.front());
+        if (front != NULL && front->requestDone(c_conn) && 
+            (ctx->getEvb()).addOutput(c_conn) != NC_OK)
+        {
+            c_conn->m_err_ = errno;
+        }
+    }
+}
+
+bool NcMsg::cached(NcConn* conn)
+{
+    NcServerPool *pool = (NcServerPool*)(conn->m_owner_);
+    if (!pool->cache.enabled())
+    {
+        return false;
+    }
+
+    bool mutating = m_type_ == kPROTOCOL_REDIS ? NcRedis::mutating(this) :
+        m_type_ == kPROTOCOL_MEMCACHED ? NcMemcache::mutating(this) : false;
+    if (mutating)
+    {
+        for (uint32_t i = 0; i < m_keys_.size(); i++)
+        {
+            pool->cache.invalidate(m_keys_[i].start, m_keys_[i].length());
+        }
+        return false;
+    }
+
+    bool cacheable = m_type_ == kPROTOCOL_REDIS ? NcRedis::cacheable(this) :
+        m_type_ == kPROTOCOL_MEMCACHED ? NcMemcache::cacheable(this) : false;
+    if (!cacheable || m_noreply_ || m_frag_owner_ != NULL)
+    {
+        return false;
+    }
+
+    uint8_t *key = m_keys_[0].start;
+    uint32_t keylen = m_keys_[0].length();
+    NcMsg *rsp = pool->cache.lookup(key, keylen);
+    if (rsp == NULL)
+    {
+        m_cache_gen_ = pool->cache.generation(key, keylen);
+        return false;
+    }
+
+    m_peer_ = rsp;
+    rsp->m_peer_ = this;
+    m_done_ = 1;
+
+    LOG_DEBUG("cache hit req %" PRIu64 " from c %d, rsp len %" PRIu32, 
+        m_id_, conn->m_sd_, rsp->m_mlen_);
+
+    NcContext *ctx = (NcContext*)(conn->getContext());
+    NcMsg *front = (NcMsg*)(conn->m_omsg_q_.front());
+    if (front != NULL && front->requestDone(conn) && 
+        (ctx->getEvb()).addOutput(conn) != NC_OK)
+    {
+        conn->m_err_ = errno;
+    }
+
+    return true;
+}
+
+void NcMsg::cacheFill(NcConn* s_conn, NcMsg *rsp)
+{
+    if (m_cache_gen_ == 0)
+    {
+        return ;
+    }
+
+    uint64_t gen = m_cache_gen_;
+    m_cache_gen_ = 0;
+
+    bool cacheable = m_type_ == kPROTOCOL_REDIS ? NcRedis::cacheableReply(rsp) :
+        NcMemcache::cacheableReply(rsp);
+    if (cacheable)
+    {
+        NcServerPool *pool = ((NcServer*)(s_conn->m_owner_))->getServerPool();
+        pool->cache.insert(m_keys_[0].start, m_keys_[0].length(), gen, rsp);
+    }
+}
+
 bool NcMsg::requestDone(NcConn* conn)
 {
+    if (!m_done_)
+    {
+        return false;
+    }
+
+    if (m_frag_id_ == 0 || m_fdone_)
+    {
+        return true;
+    }
+
+    /* a fragment is sent as part of its owner */
+    if (m_frag_owner_ != NULL || m_nfrag_done_ < m_nfrag_)
+    {
+        return false;
+    }
+
+    /* all fragments are done, merge their replies */
+    coalesce(conn);
+    m_fdone_ = 1;
+
     return true;
 }
 
@@ -218,6 +750,11 @@ bool NcMsg::requestFilter(NcConn* conn)
         return true;
     }
 
+    if (m_type_ == kPROTOCOL_MYSQL)
+    {
+        NcMysql::requestFilter(this, conn);
+    }
+
     /*
      * Handle "quit\r\n" (memcache) or "*1\r\n$4\r\nquit\r\n" (redis), which
      * is the protocol way of doing a passive close. The connection is closed
@@ -240,6 +777,19 @@ bool NcMsg::requestFilter(NcConn* conn)
         return true;
     }
 
+    /*
+     * "Connection: close" (or HTTP/1.0 without keep-alive) is forwarded,
+     * the connection is closed once its reply has been written and what
+     * the client sent after it is discarded.
+     */
+    if (m_type_ == kPROTOCOL_HTTP && NcHttp::close(this))
+    {
+        LOG_DEBUG("close c %d after req %" PRIu64, conn->m_sd_, m_id_);
+
+        conn->m_eof_ = 1;
+        conn->m_recv_ready_ = 0;
+    }
+
     // TODO : 判断是否需要鉴权
 
     return false;
@@ -257,8 +807,22 @@ void NcMsg::requestForward(NcConn* conn)
 
     NcServerPool *pool = (NcServerPool*)(conn->m_owner_);
     ASSERT(pool != NULL);
-    // TODO : 需要特殊处理
-    NcConn *s_conn = pool->getConn(NULL, 0);
+    if (cached(conn) || collapse(conn))
+    {
+        return ;
+    }
+
+    // 按第一个key路由, 没有key的请求(ping等)key为空
+    uint8_t *key = NULL;
+    uint32_t keylen = 0;
+    if (!m_keys_.empty())
+    {
+        key = m_keys_[0].start;
+        keylen = m_keys_[0].length();
+    }
+    // mysql: 被pin住的client只用它自己的连接
+    NcConn *s_conn = m_type_ == kPROTOCOL_MYSQL ? NcMysql::getConn(this, conn) : 
+        pool->getConn(key, keylen);
     if (s_conn == NULL) 
     {
         requestForwardError(conn);
@@ -277,7 +841,24 @@ void NcMsg::requestForward(NcConn* conn)
         }
     }
 
-    s_conn->enqueueInput(this);
+    if (m_type_ == kPROTOCOL_MEMCACHED_BINARY)
+    {
+        if (NcMemcacheBinary::forward(this, s_conn, ctx) != NC_OK)
+        {
+            requestForwardError(conn);
+            return ;
+        }
+    }
+    else
+    {
+        s_conn->enqueueInput(this);
+    }
+
+    if (m_digest_ != 0)
+    {
+        pool->collapsing[m_digest_] = this;
+        pool->ncollapse_lead++;
+    }
 
     LOG_DEBUG("forward from c %d to s %d req %" PRIu64 " len %" PRIu32
         " type %d", conn->m_sd_, s_conn->m_sd_, m_id_, m_mlen_, m_type_);
@@ -296,6 +877,14 @@ void NcMsg::requestForwardError(NcConn* conn)
     m_error_ = 1;
     m_err_ = errno;
 
+    if (m_frag_owner_ != NULL)
+    {
+        NcMsg *owner = (NcMsg*)m_frag_owner_;
+        owner->m_nfrag_done_++;
+        owner->m_ferror_ = 1;
+        owner->m_err_ = m_err_;
+    }
+
     /* noreply request don't expect any response */
     if (m_noreply_) 
     {
@@ -303,13 +892,14 @@ void NcMsg::requestForwardError(NcConn* conn)
         return ;
     }
 
+    /* this may be freed from here on, merged into its owner's reply */
     NcMsg* nmsg = (NcMsg*)(conn->m_omsg_q_).front();
     if (nmsg->requestDone(conn)) 
     {
         rstatus_t status = (ctx->getEvb()).addOutput(conn);
         if (status != NC_OK) 
         {
-            m_err_ = errno;
+            conn->m_err_ = errno;
         }
     }
     
@@ -332,12 +922,63 @@ rstatus_t NcMsg::requestMakeReply(NcConn* conn)
 
     m_peer_ = (NcMsgBase*)rsp;
     rsp->m_peer_ = (NcMsg*)this;
+    rsp->m_type_ = m_type_;
     m_done_ = 1;
     conn->enqueueOutput(this);
 
     return NC_OK;
 }
 
+NcMsg* NcMsg::makeError(NcConn* conn)
+{
+    FUNCTION_INTO(NcMsg);
+
+    NcContext *ctx = (NcContext*)(conn->getContext());
+    ASSERT(ctx != NULL && m_peer_ == NULL);
+
+    err_t err = m_err_ != 0 ? m_err_ : EINVAL;
+    NcMsg *rsp = (NcMsg*)(ctx->msg_pool).alloc<NcMsg>();
+    if (rsp == NULL) 
+    {
+        return NULL;
+    }
+
+    rstatus_t status;
+    switch (m_type_)
+    {
+    case kPROTOCOL_REDIS:
+        status = NcRedis::error(rsp, ctx, err);
+        break;
+
+    case kPROTOCOL_MEMCACHED:
+        status = NcMemcache::error(rsp, ctx, err);
+        break;
+
+    case kPROTOCOL_MYSQL:
+        status = NcMysql::error(rsp, ctx, (uint8_t)(m_opaque_ + 1), 1105, "HY000", 
+            strerror(err));
+        break;
+
+    default:
+        status = NC_ERROR;
+        break;
+    }
+
+    if (status != NC_OK)
+    {
+        rsp->freeMbuf(ctx);
+        (ctx->msg_pool).free(rsp);
+        errno = err;
+        return NULL;
+    }
+
+    m_peer_ = (NcMsgBase*)rsp;
+    rsp->m_peer_ = (NcMsg*)this;
+    rsp->m_type_ = m_type_;
+
+    return rsp;
+}
+
 bool NcMsg::responseFilter(NcConn* conn)
 {
     FUNCTION_INTO(NcMsg);
@@ -351,6 +992,17 @@ bool NcMsg::responseFilter(NcConn* conn)
 
     LOG_DEBUG("m_omsg_q_ size : %d", conn->m_omsg_q_.size());
 
+    if (m_type_ == kPROTOCOL_MEMCACHED_BINARY && 
+        NcMemcacheBinary::responseFilter(this, conn))
+    {
+        return true;
+    }
+
+    if (m_type_ == kPROTOCOL_MYSQL && NcMysql::responseFilter(this, conn))
+    {
+        return true;
+    }
+
     NcMsg *pmsg = (NcMsg*)(conn->m_omsg_q_.front());
     if (pmsg == NULL) 
     {
@@ -381,6 +1033,32 @@ bool NcMsg::responseFilter(NcConn* conn)
         return true;
     }
 
+    if (m_type_ == kPROTOCOL_REDIS && NcRedisCluster::responseFilter(this, pmsg, conn))
+    {
+        return true;
+    }
+
+    /* identical reads waiting on this one, even if its own client is gone */
+    pmsg->fanout(conn, this, 0);
+    pmsg->cacheFill(conn, this);
+
+    /*
+     * The client of this request has gone away, or the request was made
+     * by the proxy itself: nobody waits for the response.
+     */
+    if (pmsg->m_swallow_)
+    {
+        conn->dequeueOutput(pmsg);
+        pmsg->m_done_ = 1;
+
+        LOG_DEBUG("swallow rsp %" PRIu64 " len %" PRIu32 " of req %" PRIu64 
+            " on s %d", m_id_, m_mlen_, pmsg->m_id_, conn->m_sd_);
+
+        conn->freeMsg(pmsg);
+        conn->freeMsg(this, false);
+        return true;
+    }
+
     return false;
 }
 
@@ -402,6 +1080,16 @@ void NcMsg::responseForward(NcConn* conn)
     pmsg->m_peer_ = this;
     m_peer_ = pmsg;
 
+    if (pmsg->m_frag_owner_ != NULL)
+    {
+        ((NcMsg*)(pmsg->m_frag_owner_))->m_nfrag_done_++;
+    }
+
+    if (m_type_ == kPROTOCOL_MYSQL)
+    {
+        NcMysql::responseForward(this, pmsg, conn);
+    }
+
     NcConn* c_conn = (NcConn*)(pmsg->data);
     NcMsg* msg = (NcMsg*)(c_conn->m_omsg_q_.front());
     
@@ -425,8 +1113,108 @@ void NcMsg::freeMbuf(NcContext *ctx)
     NcMbuf *mbuf = NULL;
     while (!m_mbuf_queue_.empty())
     {
-        mbuf = m_mbuf_queue_.front();
+        mbuf = m_mbuf_queue_.pop();
         (ctx->mbuf_pool).free(mbuf);
-        m_mbuf_queue_.pop();
     }
-}
\ No newline at end of file
+}
+void NcMsgReader::reset(NcMsg *msg)
+{
+    m_queue_ = msg != NULL ? msg->getMbufQueue() : NULL;
+    m_mbuf_ = m_queue_ != NULL ? m_queue_->front() : NULL;
+    m_pos_ = m_mbuf_ != NULL ? m_mbuf_->getPos() : NULL;
+}
+
+bool NcMsgReader::seek(uint8_t *p)
+{
+    for (NcMbuf *mbuf = m_queue_->front(); mbuf != NULL; mbuf = m_queue_->next(mbuf))
+    {
+        if (p >= mbuf->getPos() && p <= mbuf->getLast())
+        {
+            m_mbuf_ = mbuf;
+            m_pos_ = p;
+            return true;
+        }
+    }
+
+    return false;
+}
+
+bool NcMsgReader::readLine(uint8_t *buf, uint32_t size, uint32_t *len)
+{
+    uint32_t n = 0;
+    for (;;)
+    {
+        int c = getc();
+        if (c < 0)
+        {
+            return false;
+        }
+        if (c == '\n')
+        {
+            break;
+        }
+        if (n == size)
+        {
+            return false;
+        }
+        buf[n++] = (uint8_t)c;
+    }
+
+    if (n > 0 && buf[n - 1] == '\r')
+    {
+        n--;
+    }
+    *len = n;
+
+    return true;
+}
+
+bool NcMsgReader::readInteger(int64_t *n)
+{
+    int64_t v = 0;
+    int c = getc(), ndigit = 0;
+    bool neg = (c == '-');
+    if (neg)
+    {
+        c = getc();
+    }
+
+    for (; c >= '0' && c <= '9'; c = getc())
+    {
+        if (++ndigit > 18)
+        {
+            return false;
+        }
+        v = v * 10 + (c - '0');
+    }
+
+    if (ndigit == 0 || c != '\r' || getc() != '\n')
+    {
+        return false;
+    }
+    *n = neg ? -v : v;
+
+    return true;
+}
+
+rstatus_t NcMsgReader::copyTo(NcMsg *dst, NcContext *ctx, uint32_t n)
+{
+    while (n > 0)
+    {
+        if (peek() < 0)
+        {
+            return NC_ERROR;
+        }
+
+        uint32_t len = MIN(n, (uint32_t)(m_mbuf_->getLast() - m_pos_));
+        rstatus_t status = dst->appendFrom(ctx, m_mbuf_, m_pos_, len);
+        if (status != NC_OK)
+        {
+            return status;
+        }
+        m_pos_ += len;
+        n -= len;
+    }
+
+    return NC_OK;
+}
@@ -85,6 +85,15 @@
 
 class NcKeypos 
 {
+public:
+    NcKeypos(uint8_t *_start = NULL, uint8_t *_end = NULL) : start(_start), end(_end)
+    { }
+
+    inline uint32_t length() const
+    {
+        return (uint32_t)(end - start);
+    }
+
 public:
     uint8_t     *start;     /* key start pos */
     uint8_t     *end;       /* key end pos */
@@ -98,9 +107,60 @@ typedef enum
     kMSG_PARSE_AGAIN,        /* incomplete -> parse again */
 } NcMsgParseResult;
 
+#define NC_MSG_INLINE_SIZE  128     /* payload bytes kept inside NcMsg */
+#define NC_MSG_MAX_DEPTH    8       /* max nesting of a parsed reply */
+#define NC_MSG_SLICE_MIN    512     /* runs this long are sliced, not copied, by appendFrom */
+
 class NcMsg : public NcMsgBase
 {
+    friend class NcRedis;
+    friend class NcMemcache;
+    friend class NcMemcacheBinary;
+    friend class NcHttp;
+    friend class NcMysql;
+    friend class NcRedisCluster;
+
 public:
+    NcMsg() : m_mbuf_queue_(&NcMbuf::m_mqe_), m_waiter_q_(&NcMsgBase::m_s_tqe_)
+    {
+        /* the inline buffer is laid out like any chunk: data, then header */
+        m_inline_mbuf_ = new (m_inline_ + NC_MSG_INLINE_SIZE) 
+            NcMbuf(NC_MSG_INLINE_SIZE + MBUF_HSIZE, MBUF_INLINE);
+        reset();
+    }
+
+    void reset()
+    {
+        NcMsgBase::reset();
+
+        m_mbuf_queue_.clear();
+        m_inline_mbuf_->reset();
+        m_result_ = kMSG_PARSE_OK;
+        m_pending_ = 0;
+
+        m_cmd_ = 0;
+        m_narg_ = 0;
+        m_rnarg_ = 0;
+        m_rlen_ = 0;
+        m_integer_ = 0;
+        m_depth_ = 0;
+        m_keys_.clear();
+        m_header_ = NULL;
+        m_opaque_ = 0;
+        m_flags_ = 0;
+        m_frag_seq_.clear();
+        m_waiter_q_.clear();
+        m_digest_ = 0;
+        m_cache_gen_ = 0;
+    }
+
+    /*
+     * Get an mbuf with room for size bytes. The first buffer of a small
+     * message is the one inlined in NcMsg, later ones and big ones come
+     * from the pool.
+     */
+    inline NcMbuf* allocMbuf(NcContext *ctx, size_t size);
+
     inline NcMbuf* ensureMbuf(NcContext *ctx, size_t len);
 
     rstatus_t append(NcContext *ctx, uint8_t *pos, size_t n);
@@ -109,25 +169,94 @@ public:
 
     rstatus_t prependFormat(NcContext *ctx, const char *fmt, ...);
 
+    /*
+     * Append n bytes at pos, which lie in mbuf of another message. Long
+     * runs are added as a slice sharing mbuf's chunk, short ones copied.
+     */
+    rstatus_t appendFrom(NcContext *ctx, NcMbuf *mbuf, uint8_t *pos, size_t n);
+
     void dump(NcContext *ctx, int level);
 
-    inline NcQueue<NcMbuf*>* getMbufQueue()
+    inline NcMbufQueue* getMbufQueue()
     {
         return &m_mbuf_queue_;
     }
 
+    // parser已知的剩余字节数, recvChain用来选择mbuf的size class
+    inline void setPending(uint32_t n)
+    {
+        m_pending_ = n;
+    }
+
+    inline uint32_t getPending()
+    {
+        return m_pending_;
+    }
+
     rstatus_t parse(NcConn* conn);
 
     rstatus_t parseDone(NcConn* conn);
     
     rstatus_t repairDone(NcConn* conn);
 
-    // TODO : 默认OK
-    rstatus_t reply()
+    // 不转发的请求(例如ping)由proxy直接填充响应
+    rstatus_t reply(NcConn* conn);
+
+    inline std::vector<NcKeypos>& getKeys()
+    {
+        return m_keys_;
+    }
+
+    inline uint32_t getCommand()
     {
-        return NC_OK;
+        return m_cmd_;
     }
 
+    inline NcMsgParseResult getResult()
+    {
+        return m_result_;
+    }
+
+    // 拆分后每个key所在的fragment序号
+    inline std::vector<uint32_t>& getFragSeq()
+    {
+        return m_frag_seq_;
+    }
+
+    /*
+     * Split a multi-key request whose keys live on several servers into
+     * one sub-request per server, queued in frag_msgq in the order the
+     * servers are first hit. Nothing is queued when the request goes to
+     * a single server as it is.
+     */
+    rstatus_t fragment(NcConn* conn, NcQueue<NcMsg*> &frag_msgq);
+
+    /*
+     * Request collapsing (collapse: true): a single key read identical to
+     * one already forwarded and not answered yet is not forwarded itself,
+     * it waits on that one and gets a copy of its reply. collapse() returns
+     * true if the request has been attached that way; fanout() hands the
+     * reply of a forwarded read, or err if there is none, to its waiters.
+     */
+    bool collapse(NcConn* conn);
+
+    void fanout(NcConn* s_conn, NcMsg *rsp, err_t err);
+
+    /* FNV-1a of the request bytes, and whether two requests are byte-equal */
+    uint64_t digest();
+
+    bool identical(NcMsg *r);
+
+    /*
+     * Near cache (cache_size): cached() answers a get of a single key from
+     * the cache of the pool, or drops the keys of a write from it; it
+     * returns true if the request has been answered. cacheFill() keeps the
+     * reply of a get that missed.
+     */
+    bool cached(NcConn* conn);
+
+    void cacheFill(NcConn* s_conn, NcMsg *rsp);
+
     // 处理request
     bool requestDone(NcConn* conn);
 
@@ -139,6 +268,12 @@ public:
 
     rstatus_t requestMakeReply(NcConn* conn);
 
+    /*
+     * Reply of a request that failed before it got one (no server, server
+     * gone), NULL if the protocol has no way to tell the client.
+     */
+    NcMsg* makeError(NcConn* conn);
+
     // 处理response
     bool responseFilter(NcConn* conn);
 
@@ -147,8 +282,105 @@ public:
     void freeMbuf(NcContext *ctx);
 
 private:
-    NcQueue<NcMbuf*>    m_mbuf_queue_;
+    void coalesce(NcConn* conn);
+
+private:
+    NcMbufQueue         m_mbuf_queue_;
     NcMsgParseResult    m_result_;
+    uint32_t            m_pending_;     /* bytes still expected by the parser, 0 if unknown */
+    NcMbuf              *m_inline_mbuf_; /* header of the inline buffer */
+    uint8_t             m_inline_[NC_MSG_INLINE_SIZE + MBUF_HSIZE] __attribute__((aligned(8)));
+
+    /*
+     * Parser state, kept across recvChain calls so a message arriving in
+     * several reads is scanned once: pos and state (in NcMsgBase) say
+     * where to resume, the fields below hold what was learned so far.
+     */
+    uint32_t            m_cmd_;         /* command, index in the protocol's table (http: method
+                                           or status code); 0 if unknown */
+    uint32_t            m_narg_;        /* # request args */
+    uint32_t            m_rnarg_;       /* # request args left */
+    uint32_t            m_rlen_;        /* length being read / bytes left of the current arg */
+    int64_t             m_integer_;     /* number being read; < 0 for a nil length */
+    uint32_t            m_depth_;       /* # open reply arrays */
+    uint32_t            m_nelem_[NC_MSG_MAX_DEPTH]; /* # elements left per open array */
+    std::vector<NcKeypos> m_keys_;      /* keys, pointing into the mbufs */
+    uint8_t             *m_header_;     /* fixed header of a binary packet, in the mbufs */
+    uint32_t            m_opaque_;      /* opaque of a binary packet as parsed; mysql: sequence id */
+    uint32_t            m_flags_;       /* protocol specific, learned from the headers */
+    std::vector<uint32_t> m_frag_seq_;  /* fragment of each key (owner) */
+
+    NcTailQueue<NcMsgBase> m_waiter_q_; /* identical reads collapsed into this one */
+    uint64_t            m_digest_;      /* digest of a read others may collapse into, 0 if none */
+    uint64_t            m_cache_gen_;   /* cache generation of the key of a get that missed, 0 if none */
+};
+
+/*
+ * Sequential reader over the mbufs of a parsed message, used to walk the
+ * replies of the fragments while they are merged. Tokens are read a byte
+ * at a time whatever the mbuf boundaries, data is passed on with
+ * copyTo(), which slices what is long enough.
+ */
+class NcMsgReader
+{
+public:
+    NcMsgReader(NcMsg *msg = NULL)
+    {
+        reset(msg);
+    }
+
+    void reset(NcMsg *msg);
+
+    /* move to p, which has to lie in one of the mbufs */
+    bool seek(uint8_t *p);
+
+    /* next byte, -1 at the end of the message */
+    inline int peek()
+    {
+        while (m_mbuf_ != NULL && m_pos_ == m_mbuf_->getLast())
+        {
+            m_mbuf_ = m_queue_->next(m_mbuf_);
+            m_pos_ = m_mbuf_ != NULL ? m_mbuf_->getPos() : NULL;
+        }
+
+        return m_mbuf_ != NULL ? *m_pos_ : -1;
+    }
+
+    inline int getc()
+    {
+        int c = peek();
+        if (c >= 0)
+        {
+            m_pos_++;
+        }
+        return c;
+    }
+
+    /* a line without its CRLF into buf; false if incomplete or over size */
+    bool readLine(uint8_t *buf, uint32_t size, uint32_t *len);
+
+    /* a signed decimal number ending with CRLF */
+    bool readInteger(int64_t *n);
+
+    /* append the next n bytes to dst */
+    rstatus_t copyTo(NcMsg *dst, NcContext *ctx, uint32_t n);
+
+private:
+    NcMbufQueue         *m_queue_;
+    NcMbuf              *m_mbuf_;
+    uint8_t             *m_pos_;
 };
 
+inline NcMbuf* NcMsg::allocMbuf(NcContext *ctx, size_t size)
+{
+    if (m_mbuf_queue_.empty() && size <= NC_MSG_INLINE_SIZE && 
+        !m_inline_mbuf_->inUse())
+    {
+        m_inline_mbuf_->acquire();
+        return m_inline_mbuf_;
+    }
+
+    return (ctx->mbuf_pool).alloc(size);
+}
+
 #endif
@@ -0,0 +1,1487 @@
+#include <sys/socket.h>
+#include <nc_mysql.h>
+#include <nc_server.h>
+
+#define V   MYSQL_COM_VALID
+
+static const uint8_t s_comflags[32] = {
+    0,                  /* 0x00 sleep */
+    MYSQL_COM_QUIT_FLAG,                        /* 0x01 quit */
+    V,                  /* 0x02 init_db */
+    V,                  /* 0x03 query */
+    V,                  /* 0x04 field_list */
+    0,                  /* 0x05 create_db */
+    0,                  /* 0x06 drop_db */
+    0,                  /* 0x07 refresh */
+    0,                  /* 0x08 shutdown */
+    V,                  /* 0x09 statistics */
+    V,                  /* 0x0a processlist */
+    0,                  /* 0x0b connect */
+    V,                  /* 0x0c process_kill */
+    0,                  /* 0x0d debug */
+    V | MYSQL_COM_LOCAL,                        /* 0x0e ping */
+    0,                  /* 0x0f time */
+    0,                  /* 0x10 delayed_insert */
+    0,                  /* 0x11 change_user */
+    0,                  /* 0x12 binlog_dump */
+    0,                  /* 0x13 table_dump */
+    0,                  /* 0x14 connect_out */
+    0,                  /* 0x15 register_slave */
+    V | MYSQL_COM_SESSION,                      /* 0x16 stmt_prepare */
+    V,                  /* 0x17 stmt_execute */
+    V | MYSQL_COM_NOREPLY,                      /* 0x18 stmt_send_long_data */
+    V | MYSQL_COM_NOREPLY,                      /* 0x19 stmt_close */
+    V,                  /* 0x1a stmt_reset */
+    V | MYSQL_COM_SESSION,                      /* 0x1b set_option */
+    V,                  /* 0x1c stmt_fetch */
+    0,                  /* 0x1d daemon */
+    0,                  /* 0x1e binlog_dump_gtid */
+    V,                  /* 0x1f reset_connection */
+};
+
+#undef V
+
+/* phases of a reply, NcMsg::state */
+enum
+{
+    SW_FIRST,           /* OK, ERR, or the column count of a result set */
+    SW_COLUMNS,         /* column definitions, up to EOF */
+    SW_ROWS,            /* rows, up to EOF or ERR */
+    SW_DEFS,            /* definitions of a prepared statement, m_rnarg_ EOFs to go */
+    SW_FIELDS,          /* COM_FIELD_LIST, up to EOF or ERR */
+};
+
+/*
+ * SHA1 (RFC 3174), all mysql_native_password needs. Only used during the
+ * handshakes, so it is kept short rather than fast.
+ */
+class NcSha1
+{
+public:
+    NcSha1() : m_len_(0)
+    {
+        m_h_[0] = 0x67452301;
+        m_h_[1] = 0xefcdab89;
+        m_h_[2] = 0x98badcfe;
+        m_h_[3] = 0x10325476;
+        m_h_[4] = 0xc3d2e1f0;
+    }
+
+    void update(const uint8_t *data, size_t len)
+    {
+        while (len > 0)
+        {
+            size_t used = (size_t)(m_len_ & 63);
+            size_t n = MIN(len, 64 - used);
+            memcpy(m_block_ + used, data, n);
+            m_len_ += n;
+            data += n;
+            len -= n;
+            if ((m_len_ & 63) == 0)
+            {
+                transform();
+            }
+        }
+    }
+
+    void final(uint8_t *digest)
+    {
+        uint64_t bits = m_len_ * 8;
+        uint8_t pad = 0x80;
+        update(&pad, 1);
+        pad = 0;
+        while ((m_len_ & 63) != 56)
+        {
+            update(&pad, 1);
+        }
+
+        uint8_t length[8];
+        for (int i = 0; i < 8; i++)
+        {
+            length[i] = (uint8_t)(bits >> (56 - 8 * i));
+        }
+        update(length, sizeof(length));
+
+        for (int i = 0; i < MYSQL_SALT_LEN; i++)
+        {
+            digest[i] = (uint8_t)(m_h_[i / 4] >> (24 - 8 * (i % 4)));
+        }
+    }
+
+private:
+    static inline uint32_t rol(uint32_t x, int n)
+    {
+        return (x << n) | (x >> (32 - n));
+    }
+
+    void transform()
+    {
+        uint32_t w[80];
+        for (int i = 0; i < 16; i++)
+        {
+            w[i] = (uint32_t)m_block_[4 * i] << 24 | (uint32_t)m_block_[4 * i + 1] << 16 |
+                (uint32_t)m_block_[4 * i + 2] << 8 | (uint32_t)m_block_[4 * i + 3];
+        }
+        for (int i = 16; i < 80; i++)
+        {
+            w[i] = rol(w[i - 3] ^ w[i - 8] ^ w[i - 14] ^ w[i - 16], 1);
+        }
+
+        uint32_t a = m_h_[0], b = m_h_[1], c = m_h_[2], d = m_h_[3], e = m_h_[4];
+        for (int i = 0; i < 80; i++)
+        {
+            uint32_t f, k;
+            if (i < 20)
+            {
+                f = (b & c) | (~b & d);
+                k = 0x5a827999;
+            }
+            else if (i < 40)
+            {
+                f = b ^ c ^ d;
+                k = 0x6ed9eba1;
+            }
+            else if (i < 60)
+            {
+                f = (b & c) | (b & d) | (c & d);
+                k = 0x8f1bbcdc;
+            }
+            else
+            {
+                f = b ^ c ^ d;
+                k = 0xca62c1d6;
+            }
+
+            uint32_t t = rol(a, 5) + f + e + k + w[i];
+            e = d;
+            d = c;
+            c = rol(b, 30);
+            b = a;
+            a = t;
+        }
+
+        m_h_[0] += a;
+        m_h_[1] += b;
+        m_h_[2] += c;
+        m_h_[3] += d;
+        m_h_[4] += e;
+    }
+
+private:
+    uint32_t    m_h_[5];
+    uint64_t    m_len_;
+    uint8_t     m_block_[64];
+};
+
+static inline uint16_t getInt2(const uint8_t *p)
+{
+    return (uint16_t)(p[0] | p[1] << 8);
+}
+
+static inline uint8_t* putInt2(uint8_t *p, uint16_t n)
+{
+    p[0] = (uint8_t)n;
+    p[1] = (uint8_t)(n >> 8);
+    return p + 2;
+}
+
+static inline uint8_t* putInt4(uint8_t *p, uint32_t n)
+{
+    p = putInt2(p, (uint16_t)n);
+    return putInt2(p, (uint16_t)(n >> 16));
+}
+
+static inline uint8_t* putString(uint8_t *p, const NcStringView &s)
+{
+    memcpy(p, s.c_str(), s.length());
+    p += s.length();
+    *p++ = '\0';
+    return p;
+}
+
+/* skip the length encoded integer at p[*i] of a payload of n bytes */
+static bool skipLenenc(const uint8_t *p, uint32_t n, uint32_t *i)
+{
+    if (*i >= n)
+    {
+        return false;
+    }
+
+    uint8_t c = p[*i];
+    uint32_t size = c < 0xfb ? 1 : c == 0xfc ? 3 : c == 0xfd ? 4 : c == 0xfe ? 9 : 0;
+    if (size == 0)
+    {
+        return false;
+    }
+
+    *i += size;
+    return *i <= n;
+}
+
+/* buf holds a payload after MYSQL_HEADER_SIZE bytes left for the header */
+static rstatus_t putPacket(NcMsg *m, NcContext *ctx, uint8_t *buf, uint32_t n, uint8_t seq)
+{
+    uint32_t len = n - MYSQL_HEADER_SIZE;
+    buf[0] = (uint8_t)len;
+    buf[1] = (uint8_t)(len >> 8);
+    buf[2] = (uint8_t)(len >> 16);
+    buf[3] = seq;
+
+    return m->append(ctx, buf, n);
+}
+
+/* the next packet of a message into buf; false if incomplete or over size */
+static bool readPacket(NcMsgReader &reader, uint8_t *buf, uint32_t size, uint32_t *len,
+    uint8_t *seq)
+{
+    uint8_t header[MYSQL_HEADER_SIZE];
+    for (uint32_t i = 0; i < MYSQL_HEADER_SIZE; i++)
+    {
+        int c = reader.getc();
+        if (c < 0)
+        {
+            return false;
+        }
+        header[i] = (uint8_t)c;
+    }
+
+    uint32_t n = (uint32_t)header[0] | (uint32_t)header[1] << 8 | (uint32_t)header[2] << 16;
+    if (n > size)
+    {
+        return false;
+    }
+
+    for (uint32_t i = 0; i < n; i++)
+    {
+        int c = reader.getc();
+        if (c < 0)
+        {
+            return false;
+        }
+        buf[i] = (uint8_t)c;
+    }
+
+    *len = n;
+    *seq = header[3];
+    return true;
+}
+
+/* a NUL terminated string at *p, up to end */
+static bool getString(const uint8_t **p, const uint8_t *end, NcStringView *s)
+{
+    const uint8_t *nul = (const uint8_t *)memchr(*p, '\0', (size_t)(end - *p));
+    if (nul == NULL)
+    {
+        return false;
+    }
+
+    *s = NcStringView(*p, (uint32_t)(nul - *p));
+    *p = nul + 1;
+    return true;
+}
+
+/* a == b in a time that does not depend on where they differ */
+static bool sameToken(const uint8_t *a, const uint8_t *b, uint32_t n)
+{
+    volatile uint8_t diff = 0;
+    for (uint32_t i = 0; i < n; i++)
+    {
+        diff |= a[i] ^ b[i];
+    }
+
+    return diff == 0;
+}
+
+void NcMysql::scramble(uint8_t *out, const uint8_t *password, uint32_t len,
+    const uint8_t *salt)
+{
+    uint8_t stage1[MYSQL_SALT_LEN], stage2[MYSQL_SALT_LEN], h[MYSQL_SALT_LEN];
+
+    NcSha1 s1;
+    s1.update(password, len);
+    s1.final(stage1);
+
+    NcSha1 s2;
+    s2.update(stage1, sizeof(stage1));
+    s2.final(stage2);
+
+    NcSha1 s3;
+    s3.update(salt, MYSQL_SALT_LEN);
+    s3.update(stage2, sizeof(stage2));
+    s3.final(h);
+
+    for (int i = 0; i < MYSQL_SALT_LEN; i++)
+    {
+        out[i] = stage1[i] ^ h[i];
+    }
+}
+
+uint32_t NcMysql::flags(NcMsg *r)
+{
+    uint8_t cmd = command(r);
+    return r->m_cmd_ == 0 || cmd >= sizeof(s_comflags) ? 0 : s_comflags[cmd];
+}
+
+bool NcMysql::classify(NcMsg *r, NcMsg *req, uint8_t *p, uint32_t len)
+{
+    uint8_t *payload = p + MYSQL_HEADER_SIZE;
+    uint32_t n = MIN(len, MYSQL_PEEK);
+
+    if (len == 0)
+    {
+        return false;
+    }
+
+    uint8_t type = payload[0];
+    if (r->m_request_)
+    {
+        r->m_cmd_ = (uint32_t)type + 1;
+        r->m_opaque_ = p[3];
+        r->m_flags_ |= MYSQL_LAST;
+        return true;
+    }
+
+    uint8_t cmd = req != NULL ? command(req) : 0;
+    if (r->m_cmd_ == 0)
+    {
+        r->m_cmd_ = (uint32_t)type + 1;
+        r->m_opaque_ = p[3];
+
+        /* greeting, handshake replies and statistics are a single packet */
+        if (req == NULL || (req->m_flags_ & MYSQL_REQ_AUTH) || cmd == MYSQL_COM_STATISTICS)
+        {
+            r->m_flags_ |= MYSQL_LAST;
+            return true;
+        }
+
+        if (cmd == MYSQL_COM_FIELD_LIST)
+        {
+            r->state = SW_FIELDS;
+        }
+        else if (cmd == MYSQL_COM_STMT_FETCH)
+        {
+            r->state = SW_ROWS;
+        }
+    }
+
+    bool eof = type == 0xfe && len < 9;
+    uint16_t status = 0;
+    if (type == 0x00 && r->state == SW_FIRST && cmd != MYSQL_COM_STMT_PREPARE)
+    {
+        /* OK: header, affected rows, last insert id, status */
+        uint32_t i = 1;
+        if (!skipLenenc(payload, n, &i) || !skipLenenc(payload, n, &i) || i + 2 > n)
+        {
+            return false;
+        }
+        status = getInt2(payload + i);
+    }
+    else if (eof && len >= 5)
+    {
+        status = getInt2(payload + 3);
+    }
+
+    switch (r->state)
+    {
+    case SW_FIRST:
+        if (type == 0xff)
+        {
+            r->m_flags_ |= MYSQL_LAST;
+        }
+        else if (type == 0x00 && cmd == MYSQL_COM_STMT_PREPARE)
+        {
+            /* statement id, # columns, # params: a definition block each */
+            if (len < 12)
+            {
+                return false;
+            }
+            r->m_rnarg_ = (getInt2(payload + 5) > 0 ? 1 : 0) + (getInt2(payload + 7) > 0 ? 1 : 0);
+            if (r->m_rnarg_ == 0)
+            {
+                r->m_flags_ |= MYSQL_LAST;
+            }
+            else
+            {
+                r->state = SW_DEFS;
+            }
+        }
+        else if (type == 0x00 || eof)
+        {
+            setStatus(r, status);
+            if (!(status & MYSQL_STATUS_MORE_RESULTS))
+            {
+                r->m_flags_ |= MYSQL_LAST;
+            }
+        }
+        else if (type == 0xfb)
+        {
+            /* LOAD DATA LOCAL INFILE, never offered */
+            return false;
+        }
+        else
+        {
+            r->state = SW_COLUMNS;
+        }
+        break;
+
+    case SW_COLUMNS:
+        if (type == 0xff)
+        {
+            r->m_flags_ |= MYSQL_LAST;
+        }
+        else if (eof)
+        {
+            /* the rows of a cursor come with COM_STMT_FETCH */
+            setStatus(r, status);
+            if (status & MYSQL_STATUS_CURSOR_EXISTS)
+            {
+                r->m_flags_ |= MYSQL_LAST;
+            }
+            else
+            {
+                r->state = SW_ROWS;
+            }
+        }
+        break;
+
+    case SW_ROWS:
+        if (type == 0xff)
+        {
+            r->m_flags_ |= MYSQL_LAST;
+        }
+        else if (eof)
+        {
+            setStatus(r, status);
+            if (status & MYSQL_STATUS_MORE_RESULTS)
+            {
+                r->state = SW_FIRST;
+            }
+            else
+            {
+                r->m_flags_ |= MYSQL_LAST;
+            }
+        }
+        break;
+
+    case SW_DEFS:
+        if (eof && --r->m_rnarg_ == 0)
+        {
+            r->m_flags_ |= MYSQL_LAST;
+        }
+        break;
+
+    case SW_FIELDS:
+        if (type == 0xff || eof)
+        {
+            r->m_flags_ |= MYSQL_LAST;
+        }
+        break;
+
+    default:
+        ASSERT(0);
+        break;
+    }
+
+    return true;
+}
+
+void NcMysql::parse(NcMsg *r, NcMsg *req)
+{
+    NcMbuf *b = r->m_mbuf_queue_.back();
+    ASSERT(b != NULL);
+    ASSERT(r->pos >= b->getPos() && r->pos <= b->getLast());
+
+    uint8_t *p = r->pos, *last = b->getLast();
+    uint32_t len, n, need;
+
+    for (;;)
+    {
+        /* the payload stays where it was read */
+        n = MIN(r->m_rlen_, (uint32_t)(last - p));
+        r->m_rlen_ -= n;
+        p += n;
+        if (r->m_rlen_ > 0)
+        {
+            r->pos = p;
+            r->setPending(r->m_rlen_);
+            r->m_result_ = kMSG_PARSE_AGAIN;
+            return;
+        }
+
+        if (r->m_flags_ & MYSQL_IN_PACKET)
+        {
+            r->m_flags_ &= ~MYSQL_IN_PACKET;
+            if ((r->m_flags_ & (MYSQL_CONTINUED | MYSQL_LAST)) == MYSQL_LAST)
+            {
+                goto done;
+            }
+        }
+
+        /* header and the start of the payload in one piece; p is the header */
+        need = MYSQL_HEADER_SIZE;
+        if ((uint32_t)(last - p) < need)
+        {
+            goto header_again;
+        }
+
+        len = (uint32_t)p[0] | (uint32_t)p[1] << 8 | (uint32_t)p[2] << 16;
+        if (!(r->m_flags_ & MYSQL_CONTINUED))
+        {
+            need += MIN(len, MYSQL_PEEK);
+            if ((uint32_t)(last - p) < need)
+            {
+                goto header_again;
+            }
+
+            if (!classify(r, req, p, len))
+            {
+                goto error;
+            }
+        }
+
+        /* a payload of the max length goes on in the next packet */
+        if (len == MYSQL_MAX_PAYLOAD)
+        {
+            r->m_flags_ |= MYSQL_CONTINUED;
+        }
+        else
+        {
+            r->m_flags_ &= ~MYSQL_CONTINUED;
+        }
+
+        r->m_flags_ |= MYSQL_IN_PACKET;
+        r->m_rlen_ = len;
+        p += MYSQL_HEADER_SIZE;
+    }
+
+header_again:
+    r->pos = p;
+    r->setPending(need - (uint32_t)(last - p));
+    r->m_result_ = b->full() ? kMSG_PARSE_REPAIR : kMSG_PARSE_AGAIN;
+    return;
+
+done:
+    r->pos = p;
+    r->setPending(0);
+    r->m_result_ = kMSG_PARSE_OK;
+    return;
+
+error:
+    LOG_DEBUG("parse %s %" PRIu64 " failed: bad mysql packet 0x%02x state %d",
+        r->m_request_ ? "req" : "rsp", r->m_id_, p[MYSQL_HEADER_SIZE], r->state);
+    r->pos = p;
+    r->m_result_ = kMSG_PARSE_ERROR;
+    errno = EINVAL;
+}
+
+void NcMysql::parseRequest(NcMsg *r)
+{
+    parse(r, NULL);
+}
+
+void NcMysql::parseResponse(NcMsg *r, NcMsg *req)
+{
+    parse(r, req);
+}
+
+void NcMysql::setStatus(NcMsg *r, uint16_t status)
+{
+    r->m_flags_ = (r->m_flags_ & ~MYSQL_STATUS_MASK) | status | MYSQL_HAS_STATUS;
+}
+
+void NcMysql::requestFilter(NcMsg *r, NcConn *c_conn)
+{
+    if (!c_conn->m_authenticated_)
+    {
+        /* the handshake response, or the answer to an auth switch */
+        r->m_flags_ |= MYSQL_REQ_AUTH;
+        r->m_noforward_ = 1;
+        return;
+    }
+
+    uint32_t f = flags(r);
+    if (f & MYSQL_COM_QUIT_FLAG)
+    {
+        r->m_quit_ = 1;
+        return;
+    }
+
+    if (!(f & MYSQL_COM_VALID))
+    {
+        LOG_DEBUG("unsupported mysql command 0x%02x req %" PRIu64 " from c %d",
+            command(r), r->m_id_, c_conn->m_sd_);
+        r->m_flags_ |= MYSQL_REQ_UNSUPPORTED;
+        r->m_noforward_ = 1;
+        return;
+    }
+
+    if (f & MYSQL_COM_LOCAL)
+    {
+        r->m_flags_ |= MYSQL_REQ_OK;
+        r->m_noforward_ = 1;
+        return;
+    }
+
+    if (f & MYSQL_COM_NOREPLY)
+    {
+        r->m_noreply_ = 1;
+    }
+
+    if (f & MYSQL_COM_SESSION)
+    {
+        r->m_flags_ |= MYSQL_REQ_SESSION;
+    }
+
+    switch (command(r))
+    {
+    case MYSQL_COM_QUERY:
+        classifyQuery(r, c_conn);
+        break;
+
+    case MYSQL_COM_INIT_DB:
+    {
+        /* the database every server connection is in already */
+        uint8_t buf[MYSQL_PEEK];
+        uint32_t len;
+        uint8_t seq;
+        NcMsgReader reader(r);
+        NcServerPool *pool = (NcServerPool*)(c_conn->m_owner_);
+        if (readPacket(reader, buf, sizeof(buf), &len, &seq) && len > 1 &&
+            NcStringView(buf + 1, len - 1) == pool->mysql_db)
+        {
+            r->m_flags_ |= MYSQL_REQ_OK;
+            r->m_noforward_ = 1;
+        }
+        else
+        {
+            r->m_flags_ |= MYSQL_REQ_SESSION;
+        }
+        break;
+    }
+
+    case MYSQL_COM_RESET_CONNECTION:
+        r->m_flags_ |= MYSQL_REQ_RESET;
+        break;
+
+    default:
+        break;
+    }
+}
+
+/*
+ * Look at the first words of a query, with comments and string literals
+ * skipped, for what starts a transaction or leaves state in the session;
+ * anything else is stateless. A few harmless SETs every client library
+ * sends on connect are answered by the proxy.
+ */
+void NcMysql::classifyQuery(NcMsg *r, NcConn *c_conn)
+{
+    const int nword = 4, wordlen = 16;
+    char word[nword][wordlen];
+    int ntoken = 0;
+    bool uservar = false;
+
+    NcMsgReader reader(r);
+    for (uint32_t i = 0; i < MYSQL_HEADER_SIZE + 1; i++)
+    {
+        reader.getc();
+    }
+
+    int c = reader.getc();
+    while (c >= 0)
+    {
+        if (isspace(c) || c == ';')
+        {
+            c = reader.getc();
+            continue;
+        }
+
+        if (c == '#' || (c == '-' && reader.peek() == '-'))
+        {
+            while (c >= 0 && c != '\n')
+            {
+                c = reader.getc();
+            }
+            continue;
+        }
+
+        if (c == '/' && reader.peek() == '*')
+        {
+            reader.getc();
+            if (reader.peek() == '!')
+            {
+                /* executable comment: the version, then what it holds counts */
+                reader.getc();
+                while (isdigit(reader.peek()))
+                {
+                    reader.getc();
+                }
+                c = reader.getc();
+                continue;
+            }
+
+            int prev = 0;
+            c = reader.getc();
+            while (c >= 0 && !(prev == '*' && c == '/'))
+            {
+                prev = c;
+                c = reader.getc();
+            }
+            c = reader.getc();
+            continue;
+        }
+
+        if (c == '*' && reader.peek() == '/')
+        {
+            /* end of an executable comment */
+            reader.getc();
+            c = reader.getc();
+            continue;
+        }
+
+        char token[wordlen];
+        int n = 0;
+        if (c == '\'' || c == '"' || c == '`')
+        {
+            int quote = c;
+            c = reader.getc();
+            while (c >= 0 && c != quote)
+            {
+                if (c == '\\' && quote != '`')
+                {
+                    c = reader.getc();
+                }
+                if (c >= 0 && n < wordlen - 1)
+                {
+                    token[n++] = (char)toupper(c);
+                }
+                c = reader.getc();
+            }
+            c = reader.getc();
+        }
+        else if (c == '@')
+        {
+            c = reader.getc();
+            if (c == '@')
+            {
+                /* a system variable is read as it is */
+                c = reader.getc();
+            }
+            else
+            {
+                uservar = true;
+            }
+            token[n++] = '@';
+        }
+        else if (isalnum(c) || c == '_' || c == '$')
+        {
+            while (c >= 0 && (isalnum(c) || c == '_' || c == '$' || c == '.'))
+            {
+                if (n < wordlen - 1)
+                {
+                    token[n++] = (char)toupper(c);
+                }
+                c = reader.getc();
+            }
+        }
+        else
+        {
+            token[n++] = (char)c;
+            c = reader.getc();
+        }
+
+        token[n] = '\0';
+        if (ntoken < nword)
+        {
+            memcpy(word[ntoken], token, (size_t)n + 1);
+        }
+        ntoken++;
+
+        /* USE decides it all, no need to look further */
+        if (ntoken == 1 && strcmp(word[0], "USE") == 0)
+        {
+            break;
+        }
+    }
+
+    if (ntoken == 0)
+    {
+        return;
+    }
+
+    const char *w0 = word[0];
+    const char *w1 = ntoken > 1 ? word[1] : "";
+    if (strcmp(w0, "BEGIN") == 0 || (strcmp(w0, "START") == 0 && strcmp(w1, "TRANSACTION") == 0))
+    {
+        r->m_flags_ |= MYSQL_REQ_TRX;
+    }
+    else if (strcmp(w0, "SET") == 0)
+    {
+        if (ntoken == 3 && strcmp(w1, "NAMES") == 0 && strcmp(word[2], "UTF8MB4") == 0)
+        {
+            r->m_flags_ |= MYSQL_REQ_OK;
+        }
+        else if (ntoken == 4 && strcmp(w1, "AUTOCOMMIT") == 0 && strcmp(word[2], "=") == 0 &&
+            strcmp(word[3], "1") == 0 && c_conn->m_pinned_ == NULL)
+        {
+            r->m_flags_ |= MYSQL_REQ_OK;
+        }
+        else
+        {
+            r->m_flags_ |= MYSQL_REQ_SESSION;
+        }
+    }
+    else if (strcmp(w0, "USE") == 0 || strcmp(w0, "LOCK") == 0 ||
+        strcmp(w0, "PREPARE") == 0 || strcmp(w0, "EXECUTE") == 0 ||
+        strcmp(w0, "DEALLOCATE") == 0 || strcmp(w0, "HANDLER") == 0 ||
+        strcmp(w0, "XA") == 0 || (strcmp(w0, "CREATE") == 0 && strcmp(w1, "TEMPORARY") == 0))
+    {
+        r->m_flags_ |= MYSQL_REQ_SESSION;
+    }
+
+    if (uservar)
+    {
+        r->m_flags_ |= MYSQL_REQ_SESSION;
+    }
+
+    if (r->m_flags_ & MYSQL_REQ_OK)
+    {
+        r->m_noforward_ = 1;
+    }
+
+    LOG_DEBUG("query req %" PRIu64 " from c %d: %s%s%s", r->m_id_, c_conn->m_sd_,
+        (r->m_flags_ & MYSQL_REQ_TRX) ? "trx " : "",
+        (r->m_flags_ & MYSQL_REQ_SESSION) ? "session " : "",
+        (r->m_flags_ & MYSQL_REQ_OK) ? "local" : "");
+}
+
+rstatus_t NcMysql::ok(NcMsg *rsp, NcContext *ctx, uint8_t seq)
+{
+    uint8_t buf[MYSQL_HEADER_SIZE + 7];
+    uint8_t *p = buf + MYSQL_HEADER_SIZE;
+
+    *p++ = 0x00;    /* header */
+    *p++ = 0;       /* affected rows */
+    *p++ = 0;       /* last insert id */
+    p = putInt2(p, MYSQL_STATUS_AUTOCOMMIT);
+    p = putInt2(p, 0);  /* warnings */
+
+    return putPacket(rsp, ctx, buf, (uint32_t)(p - buf), seq);
+}
+
+rstatus_t NcMysql::error(NcMsg *rsp, NcContext *ctx, uint8_t seq, uint16_t code,
+    const char *state, const char *message)
+{
+    uint8_t buf[MYSQL_HEADER_SIZE + 9 + 256];
+    uint8_t *p = buf + MYSQL_HEADER_SIZE;
+    uint32_t n = MIN((uint32_t)strlen(message), 256);
+
+    *p++ = 0xff;
+    p = putInt2(p, code);
+    *p++ = '#';
+    memcpy(p, state, 5);
+    p += 5;
+    memcpy(p, message, n);
+    p += n;
+
+    return putPacket(rsp, ctx, buf, (uint32_t)(p - buf), seq);
+}
+
+rstatus_t NcMysql::greet(NcConn *c_conn, NcContext *ctx)
+{
+    /* a fresh challenge from the kernel, 7 bit with no NUL or '$' as mysqld makes it */
+    if (NcUtil::ncRandomBytes(c_conn->m_salt_, MYSQL_SALT_LEN) != NC_OK)
+    {
+        return NC_ERROR;
+    }
+    for (int i = 0; i < MYSQL_SALT_LEN; i++)
+    {
+        c_conn->m_salt_[i] &= 0x7f;
+        if (c_conn->m_salt_[i] == '\0' || c_conn->m_salt_[i] == '$')
+        {
+            c_conn->m_salt_[i]++;
+        }
+    }
+
+    /* the greeting is the reply to a request of nobody */
+    NcMsg *r = (NcMsg*)(ctx->msg_pool).alloc<NcMsg>();
+    if (r == NULL)
+    {
+        return NC_ENOMEM;
+    }
+
+    r->m_request_ = 1;
+    r->setProtocolType(kPROTOCOL_MYSQL);
+    r->setData(c_conn);
+    r->m_flags_ |= MYSQL_REQ_AUTH;
+
+    rstatus_t status = r->requestMakeReply(c_conn);
+    if (status != NC_OK)
+    {
+        (ctx->msg_pool).free(r);
+        return status;
+    }
+
+    c_conn->m_stage_ = kMYSQL_STAGE_GREETING;
+
+    uint8_t buf[MYSQL_HEADER_SIZE + 128];
+    uint8_t *p = buf + MYSQL_HEADER_SIZE;
+
+    *p++ = 10;      /* protocol version */
+    p = putString(p, NcStringView((const uint8_t *)MYSQL_SERVER_VERSION,
+        sizeof(MYSQL_SERVER_VERSION) - 1));
+    p = putInt4(p, (uint32_t)NcUtil::uniqNextId());
+    memcpy(p, c_conn->m_salt_, 8);
+    p += 8;
+    *p++ = 0;
+    p = putInt2(p, (uint16_t)MYSQL_CAPABILITIES);
+    *p++ = MYSQL_CHARSET;
+    p = putInt2(p, MYSQL_STATUS_AUTOCOMMIT);
+    p = putInt2(p, (uint16_t)(MYSQL_CAPABILITIES >> 16));
+    *p++ = MYSQL_SALT_LEN + 1;
+    memset(p, 0, 10);
+    p += 10;
+    memcpy(p, c_conn->m_salt_ + 8, MYSQL_SALT_LEN - 8);
+    p += MYSQL_SALT_LEN - 8;
+    *p++ = 0;
+    p = putString(p, NcStringView((const uint8_t *)MYSQL_AUTH_PLUGIN,
+        sizeof(MYSQL_AUTH_PLUGIN) - 1));
+
+    status = putPacket((NcMsg*)(r->m_peer_), ctx, buf, (uint32_t)(p - buf), 0);
+    if (status != NC_OK)
+    {
+        return status;
+    }
+
+    return (ctx->getEvb()).addOutput(c_conn);
+}
+
+rstatus_t NcMysql::authenticate(NcMsg *r, NcConn *c_conn, NcMsg *rsp, NcContext *ctx)
+{
+    NcServerPool *pool = (NcServerPool*)(c_conn->m_owner_);
+    uint8_t buf[MYSQL_MAX_HANDSHAKE];
+    uint32_t len;
+    uint8_t seq = 0;
+    char message[128];
+    uint16_t code = 1045;
+    const char *state = "28000";
+
+    NcMsgReader reader(r);
+    if (!readPacket(reader, buf, sizeof(buf), &len, &seq))
+    {
+        code = 1043;
+        state = "08S01";
+        snprintf(message, sizeof(message), "Bad handshake");
+        goto deny;
+    }
+
+    {
+        const uint8_t *token;
+        uint32_t tlen;
+
+        if (c_conn->m_stage_ == kMYSQL_STAGE_AUTH_SWITCH)
+        {
+            token = buf;
+            tlen = len;
+        }
+        else
+        {
+            /* capabilities, max packet, charset, 23 reserved */
+            const uint8_t *p = buf + 32, *end = buf + len;
+            uint32_t caps = len >= 4 ? (uint32_t)getInt2(buf) | (uint32_t)getInt2(buf + 2) << 16 : 0;
+            NcStringView user, db, plugin;
+
+            if (!(caps & MYSQL_CLIENT_PROTOCOL_41))
+            {
+                code = 1251;
+                state = "08004";
+                snprintf(message, sizeof(message), "Client does not support authentication "
+                    "protocol requested by server; consider upgrading MySQL client");
+                goto deny;
+            }
+
+            if (len < 32 || !getString(&p, end, &user) || p >= end)
+            {
+                code = 1043;
+                state = "08S01";
+                snprintf(message, sizeof(message), "Bad handshake");
+                goto deny;
+            }
+
+            if (caps & (MYSQL_CLIENT_SECURE_CONNECTION | MYSQL_CLIENT_PLUGIN_AUTH_LENENC))
+            {
+                tlen = *p++;
+                token = p;
+                p += tlen;
+            }
+            else
+            {
+                NcStringView t;
+                if (!getString(&p, end, &t))
+                {
+                    p = end + 1;
+                }
+                token = t.c_str();
+                tlen = t.length();
+            }
+
+            if (p > end)
+            {
+                code = 1043;
+                state = "08S01";
+                snprintf(message, sizeof(message), "Bad handshake");
+                goto deny;
+            }
+
+            if ((caps & MYSQL_CLIENT_CONNECT_WITH_DB) && p < end && !getString(&p, end, &db))
+            {
+                db = NcStringView(p, (uint32_t)(end - p));
+                p = end;
+            }
+
+            if ((caps & MYSQL_CLIENT_PLUGIN_AUTH) && p < end && !getString(&p, end, &plugin))
+            {
+                plugin = NcStringView(p, (uint32_t)(end - p));
+            }
+
+            if (!(user == pool->mysql_user))
+            {
+                snprintf(message, sizeof(message), "Access denied for user '%.*s'",
+                    (int)MIN(user.length(), 64), user.c_str());
+                goto deny;
+            }
+
+            if (db.length() > 0 && !(db == pool->mysql_db))
+            {
+                code = 1049;
+                state = "42000";
+                snprintf(message, sizeof(message), "Unknown database '%.*s'",
+                    (int)MIN(db.length(), 64), db.c_str());
+                goto deny;
+            }
+
+            if (plugin.length() > 0 && !(plugin == NcStringView((const uint8_t *)MYSQL_AUTH_PLUGIN,
+                sizeof(MYSQL_AUTH_PLUGIN) - 1)))
+            {
+                /* ask for mysql_native_password with the same salt */
+                uint8_t sw[MYSQL_HEADER_SIZE + 64];
+                uint8_t *q = sw + MYSQL_HEADER_SIZE;
+                *q++ = 0xfe;
+                q = putString(q, NcStringView((const uint8_t *)MYSQL_AUTH_PLUGIN,
+                    sizeof(MYSQL_AUTH_PLUGIN) - 1));
+                memcpy(q, c_conn->m_salt_, MYSQL_SALT_LEN);
+                q += MYSQL_SALT_LEN;
+                *q++ = 0;
+
+                LOG_DEBUG("c %d asked to switch from auth plugin '%.*s'", c_conn->m_sd_,
+                    plugin.length(), plugin.c_str());
+                c_conn->m_stage_ = kMYSQL_STAGE_AUTH_SWITCH;
+                return putPacket(rsp, ctx, sw, (uint32_t)(q - sw), (uint8_t)(seq + 1));
+            }
+        }
+
+        bool granted;
+        if (pool->mysql_password.length() == 0)
+        {
+            granted = tlen == 0;
+        }
+        else
+        {
+            uint8_t expected[MYSQL_SALT_LEN];
+            scramble(expected, pool->mysql_password.c_str(), pool->mysql_password.length(),
+                c_conn->m_salt_);
+            granted = tlen == MYSQL_SALT_LEN && sameToken(token, expected, MYSQL_SALT_LEN);
+        }
+
+        if (!granted)
+        {
+            snprintf(message, sizeof(message), "Access denied for user '%.*s' (using password: %s)",
+                (int)MIN(pool->mysql_user.length(), 64), pool->mysql_user.c_str(),
+                tlen > 0 ? "YES" : "NO");
+            goto deny;
+        }
+    }
+
+    LOG_DEBUG("c %d logged in", c_conn->m_sd_);
+    c_conn->m_authenticated_ = 1;
+    return ok(rsp, ctx, (uint8_t)(seq + 1));
+
+deny:
+    LOG_WARN("login of c %d failed: %s", c_conn->m_sd_, message);
+
+    /* closed once the error has been written */
+    c_conn->m_eof_ = 1;
+    c_conn->m_recv_ready_ = 0;
+    return error(rsp, ctx, (uint8_t)(seq + 1), code, state, message);
+}
+
+rstatus_t NcMysql::reply(NcMsg *r, NcConn *c_conn, NcContext *ctx)
+{
+    NcMsg *rsp = (NcMsg *)r->m_peer_;
+    ASSERT(rsp != NULL);
+
+    uint8_t seq = (uint8_t)(r->m_opaque_ + 1);
+    if (r->m_flags_ & MYSQL_REQ_AUTH)
+    {
+        return authenticate(r, c_conn, rsp, ctx);
+    }
+
+    if (r->m_flags_ & MYSQL_REQ_OK)
+    {
+        return ok(rsp, ctx, seq);
+    }
+
+    return error(rsp, ctx, seq, 1047, "08S01", "Unknown command");
+}
+
+void NcMysql::pin(NcConn *c_conn, NcConn *s_conn, uint32_t why)
+{
+    if (c_conn->m_pinned_ == NULL)
+    {
+        LOG_DEBUG("pin c %d to s %d (%" PRIu32 ")", c_conn->m_sd_, s_conn->m_sd_, why);
+        c_conn->m_pinned_ = s_conn;
+        s_conn->m_pinned_ = c_conn;
+    }
+    c_conn->m_pin_ |= why;
+}
+
+NcConn* NcMysql::getConn(NcMsg *r, NcConn *c_conn)
+{
+    NcConn *s_conn = c_conn->m_pinned_;
+    if (s_conn == NULL)
+    {
+        NcServerPool *pool = (NcServerPool*)(c_conn->m_owner_);
+        s_conn = pool->nextConn();
+        if (s_conn == NULL)
+        {
+            LOG_WARN("no server connection for req %" PRIu64 " from c %d: %s",
+                r->m_id_, c_conn->m_sd_, strerror(errno));
+            return NULL;
+        }
+    }
+
+    if (r->m_flags_ & MYSQL_REQ_TRX)
+    {
+        pin(c_conn, s_conn, MYSQL_PIN_TRX);
+    }
+
+    if (r->m_flags_ & MYSQL_REQ_SESSION)
+    {
+        pin(c_conn, s_conn, MYSQL_PIN_SESSION);
+    }
+
+    return s_conn;
+}
+
+void NcMysql::responseForward(NcMsg *rsp, NcMsg *req, NcConn *s_conn)
+{
+    NcConn *c_conn = (NcConn*)(req->data);
+    if (command(rsp) == 0xff || !(rsp->m_flags_ & MYSQL_HAS_STATUS))
+    {
+        return;
+    }
+
+    if (c_conn->m_pinned_ != NULL && c_conn->m_pinned_ != s_conn)
+    {
+        /* a reply to what was sent before the client was pinned */
+        return;
+    }
+
+    if ((req->m_flags_ & MYSQL_REQ_RESET) && command(rsp) == 0x00)
+    {
+        c_conn->m_pin_ = 0;
+    }
+
+    uint16_t st = status(rsp);
+    if ((st & MYSQL_STATUS_IN_TRANS) || !(st & MYSQL_STATUS_AUTOCOMMIT))
+    {
+        pin(c_conn, s_conn, MYSQL_PIN_TRX);
+    }
+    else
+    {
+        c_conn->m_pin_ &= ~MYSQL_PIN_TRX;
+    }
+
+    if (c_conn->m_pinned_ != NULL && c_conn->m_pin_ == 0)
+    {
+        LOG_DEBUG("unpin c %d from s %d", c_conn->m_sd_, s_conn->m_sd_);
+        c_conn->m_pinned_ = NULL;
+        s_conn->m_pinned_ = NULL;
+
+        /* one opened while all were pinned is not kept */
+        NcServer *server = (NcServer*)(s_conn->m_owner_);
+        if (server->nconn() > server->getServerPool()->server_connections)
+        {
+            s_conn->m_pin_ = MYSQL_PIN_DIRTY;
+        }
+    }
+}
+
+void NcMysql::unpin(NcConn *c_conn)
+{
+    NcConn *s_conn = c_conn->m_pinned_;
+    if (s_conn == NULL)
+    {
+        return;
+    }
+
+    c_conn->m_pinned_ = NULL;
+    c_conn->m_pin_ = 0;
+    s_conn->m_pinned_ = NULL;
+
+    /*
+     * What the client left in the session (or an open transaction) must
+     * not leak to others: the connection serves nobody from now on and is
+     * closed once idle. An idle one is shut down, its read event closes it.
+     */
+    LOG_DEBUG("c %d went away pinned, s %d is closed", c_conn->m_sd_, s_conn->m_sd_);
+    s_conn->m_pin_ = MYSQL_PIN_DIRTY;
+    if (!s_conn->active())
+    {
+        ::shutdown(s_conn->m_sd_, SHUT_RDWR);
+    }
+}
+
+void NcMysql::lost(NcConn *s_conn, NcContext *ctx)
+{
+    NcConn *c_conn = s_conn->m_pinned_;
+    if (c_conn == NULL)
+    {
+        return;
+    }
+
+    c_conn->m_pinned_ = NULL;
+    c_conn->m_pin_ = 0;
+    s_conn->m_pinned_ = NULL;
+
+    /* its transaction or session is gone, so is the client once it has the errors */
+    LOG_WARN("s %d closed, pinned c %d is closed too", s_conn->m_sd_, c_conn->m_sd_);
+    c_conn->m_eof_ = 1;
+    c_conn->m_recv_ready_ = 0;
+    if ((ctx->getEvb()).addOutput(c_conn) != NC_OK)
+    {
+        c_conn->m_err_ = errno;
+    }
+}
+
+bool NcMysql::sendable(NcMsg *r, NcConn *s_conn)
+{
+    return s_conn->m_authenticated_ || (r->m_flags_ & MYSQL_REQ_AUTH);
+}
+
+NcMsg* NcMysql::authRequest(NcContext *ctx, uint8_t *buf, uint32_t n, uint8_t seq)
+{
+    NcMsg *r = (NcMsg*)(ctx->msg_pool).alloc<NcMsg>();
+    if (r == NULL)
+    {
+        return NULL;
+    }
+
+    if (putPacket(r, ctx, buf, n, seq) != NC_OK)
+    {
+        (ctx->msg_pool).free(r);
+        return NULL;
+    }
+
+    r->m_request_ = 1;
+    r->m_swallow_ = 1;
+    r->setProtocolType(kPROTOCOL_MYSQL);
+    r->m_flags_ |= MYSQL_REQ_AUTH;
+
+    return r;
+}
+
+NcMsg* NcMysql::handshake(const uint8_t *greeting, uint32_t len, uint8_t seq,
+    NcConn *s_conn, NcContext *ctx)
+{
+    NcServerPool *pool = ((NcServer*)(s_conn->m_owner_))->getServerPool();
+    const uint8_t *p = greeting + 1, *end = greeting + len;
+    uint8_t salt[MYSQL_SALT_LEN];
+    NcStringView version;
+    uint32_t caps;
+
+    if (greeting[0] == 0xff)
+    {
+        LOG_ERROR("s %d refused: %.*s", s_conn->m_sd_, (int)(len > 9 ? len - 9 : 0), greeting + 9);
+        return NULL;
+    }
+
+    /* version, thread id, salt, filler, capabilities, charset, status, more of both */
+    if (greeting[0] != 10 || !getString(&p, end, &version) || end - p < 4 + 8 + 1 + 2 + 1 + 2 + 2 + 1 + 10 + 12)
+    {
+        LOG_ERROR("s %d sent a bad greeting", s_conn->m_sd_);
+        return NULL;
+    }
+
+    p += 4;
+    memcpy(salt, p, 8);
+    p += 8 + 1;
+    caps = getInt2(p);
+    p += 2 + 1 + 2;
+    caps |= (uint32_t)getInt2(p) << 16;
+    p += 2 + 1 + 10;
+    memcpy(salt + 8, p, MYSQL_SALT_LEN - 8);
+
+    if (!(caps & MYSQL_CLIENT_PROTOCOL_41) || !(caps & MYSQL_CLIENT_SECURE_CONNECTION))
+    {
+        LOG_ERROR("s %d server '%.*s' is too old", s_conn->m_sd_, version.length(), version.c_str());
+        return NULL;
+    }
+
+    if (pool->mysql_user.length() + pool->mysql_db.length() > MYSQL_MAX_HANDSHAKE / 2)
+    {
+        LOG_ERROR("mysql_user or mysql_db too long");
+        return NULL;
+    }
+
+    caps &= MYSQL_CAPABILITIES;
+    if (pool->mysql_db.length() == 0)
+    {
+        caps &= ~MYSQL_CLIENT_CONNECT_WITH_DB;
+    }
+
+    uint8_t buf[MYSQL_HEADER_SIZE + MYSQL_MAX_HANDSHAKE];
+    uint8_t *q = buf + MYSQL_HEADER_SIZE;
+    q = putInt4(q, caps);
+    q = putInt4(q, MYSQL_MAX_PAYLOAD + 1);
+    *q++ = MYSQL_CHARSET;
+    memset(q, 0, 23);
+    q += 23;
+    q = putString(q, pool->mysql_user);
+    if (pool->mysql_password.length() > 0)
+    {
+        *q++ = MYSQL_SALT_LEN;
+        scramble(q, pool->mysql_password.c_str(), pool->mysql_password.length(), salt);
+        q += MYSQL_SALT_LEN;
+    }
+    else
+    {
+        *q++ = 0;
+    }
+    if (caps & MYSQL_CLIENT_CONNECT_WITH_DB)
+    {
+        q = putString(q, pool->mysql_db);
+    }
+    if (caps & MYSQL_CLIENT_PLUGIN_AUTH)
+    {
+        q = putString(q, NcStringView((const uint8_t *)MYSQL_AUTH_PLUGIN,
+            sizeof(MYSQL_AUTH_PLUGIN) - 1));
+    }
+
+    LOG_DEBUG("s %d logging in to '%.*s' as '%.*s'", s_conn->m_sd_, version.length(),
+        version.c_str(), pool->mysql_user.length(), pool->mysql_user.c_str());
+
+    return authRequest(ctx, buf, (uint32_t)(q - buf), (uint8_t)(seq + 1));
+}
+
+bool NcMysql::responseFilter(NcMsg *rsp, NcConn *s_conn)
+{
+    if (s_conn->m_authenticated_)
+    {
+        return false;
+    }
+
+    NcContext *ctx = (NcContext*)(s_conn->getContext());
+    NcServerPool *pool = ((NcServer*)(s_conn->m_owner_))->getServerPool();
+    uint8_t buf[MYSQL_MAX_HANDSHAKE];
+    uint32_t len = 0;
+    uint8_t seq = 0;
+    NcMsg *auth = NULL;
+    NcMsgBase *front;
+
+    NcMsgReader reader(rsp);
+    bool complete = readPacket(reader, buf, sizeof(buf), &len, &seq) && len > 0;
+    s_conn->freeMsg(rsp, false);
+    if (!complete)
+    {
+        LOG_ERROR("s %d sent a bad handshake packet", s_conn->m_sd_);
+        goto error;
+    }
+
+    if (s_conn->m_stage_ == kMYSQL_STAGE_GREETING)
+    {
+        auth = handshake(buf, len, seq, s_conn, ctx);
+    }
+    else
+    {
+        NcMsg *pmsg = (NcMsg*)(s_conn->m_omsg_q_.front());
+        if (pmsg == NULL || !(pmsg->m_flags_ & MYSQL_REQ_AUTH))
+        {
+            LOG_ERROR("s %d sent a handshake packet out of turn", s_conn->m_sd_);
+            goto error;
+        }
+        s_conn->dequeueOutput(pmsg);
+        s_conn->freeMsg(pmsg);
+
+        if (buf[0] == 0x00)
+        {
+            LOG_DEBUG("s %d logged in to '%.*s'", s_conn->m_sd_, pool->name.length(),
+                pool->name.c_str());
+            s_conn->m_authenticated_ = 1;
+            if (!s_conn->m_imsg_q_.empty())
+            {
+                goto rearm;
+            }
+            return true;
+        }
+
+        const uint8_t *p = buf + 1, *end = buf + len;
+        NcStringView plugin;
+        if (buf[0] == 0xfe && getString(&p, end, &plugin) && end - p >= MYSQL_SALT_LEN &&
+            plugin == NcStringView((const uint8_t *)MYSQL_AUTH_PLUGIN, sizeof(MYSQL_AUTH_PLUGIN) - 1))
+        {
+            uint8_t sw[MYSQL_HEADER_SIZE + MYSQL_SALT_LEN];
+            uint32_t n = 0;
+            if (pool->mysql_password.length() > 0)
+            {
+                scramble(sw + MYSQL_HEADER_SIZE, pool->mysql_password.c_str(),
+                    pool->mysql_password.length(), p);
+                n = MYSQL_SALT_LEN;
+            }
+            auth = authRequest(ctx, sw, MYSQL_HEADER_SIZE + n, (uint8_t)(seq + 1));
+        }
+        else if (buf[0] == 0xfe)
+        {
+            LOG_ERROR("s %d asks for auth plugin '%.*s', only " MYSQL_AUTH_PLUGIN
+                " is supported", s_conn->m_sd_, plugin.length(), plugin.c_str());
+            goto error;
+        }
+        else
+        {
+            LOG_ERROR("login on s %d failed: %.*s", s_conn->m_sd_,
+                (int)(buf[0] == 0xff && len > 9 ? len - 9 : 0), buf + 9);
+            goto error;
+        }
+    }
+
+    if (auth == NULL)
+    {
+        goto error;
+    }
+
+    /* the handshake goes out before the requests waiting for it */
+    auth->setData(s_conn);
+    front = s_conn->m_imsg_q_.front();
+    if (front == NULL)
+    {
+        s_conn->enqueueInput(auth);
+    }
+    else
+    {
+        s_conn->m_imsg_q_.insertBefore(auth, front);
+    }
+    s_conn->m_stage_ = kMYSQL_STAGE_AUTH;
+
+rearm:
+    /* the write event was taken while nothing could be sent */
+    (ctx->getEvb()).delOutput(s_conn);
+    if ((ctx->getEvb()).addOutput(s_conn) != NC_OK)
+    {
+        s_conn->m_err_ = errno;
+    }
+    return true;
+
+error:
+    s_conn->m_err_ = EACCES;
+    return true;
+}
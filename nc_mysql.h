@@ -0,0 +1,206 @@
+#ifndef _NC_MYSQL_H_
+#define _NC_MYSQL_H_
+
+#include <nc_message.h>
+
+#define MYSQL_HEADER_SIZE       4           /* 3 byte payload length, 1 byte sequence id */
+#define MYSQL_MAX_PAYLOAD       0xffffff    /* a payload this long goes on in the next packet */
+#define MYSQL_PEEK              32          /* payload bytes a packet is classified on */
+#define MYSQL_SALT_LEN          20
+#define MYSQL_MAX_HANDSHAKE     1024        /* max handshake packet payload */
+#define MYSQL_CHARSET           45          /* utf8mb4_general_ci, of every server connection */
+#define MYSQL_CHARSET_NAME      "utf8mb4"
+#define MYSQL_AUTH_PLUGIN       "mysql_native_password"
+#define MYSQL_SERVER_VERSION    "5.7.99-nutcracker"
+
+/* commands the proxy has to tell apart */
+#define MYSQL_COM_QUIT                  0x01
+#define MYSQL_COM_INIT_DB               0x02
+#define MYSQL_COM_QUERY                 0x03
+#define MYSQL_COM_FIELD_LIST            0x04
+#define MYSQL_COM_STATISTICS            0x09
+#define MYSQL_COM_PING                  0x0e
+#define MYSQL_COM_CHANGE_USER           0x11
+#define MYSQL_COM_STMT_PREPARE          0x16
+#define MYSQL_COM_STMT_EXECUTE          0x17
+#define MYSQL_COM_STMT_FETCH            0x1c
+#define MYSQL_COM_RESET_CONNECTION      0x1f
+
+#define MYSQL_COM_VALID         0x01    /* forwarded */
+#define MYSQL_COM_LOCAL         0x02    /* answered by the proxy */
+#define MYSQL_COM_NOREPLY       0x04    /* the server sends no reply */
+#define MYSQL_COM_SESSION       0x08    /* leaves state in the session */
+#define MYSQL_COM_QUIT_FLAG     0x10    /* closes the client connection */
+
+/* capabilities, the same set is offered to clients and asked of servers */
+#define MYSQL_CLIENT_LONG_PASSWORD      0x00000001
+#define MYSQL_CLIENT_LONG_FLAG          0x00000004
+#define MYSQL_CLIENT_CONNECT_WITH_DB    0x00000008
+#define MYSQL_CLIENT_PROTOCOL_41        0x00000200
+#define MYSQL_CLIENT_TRANSACTIONS       0x00002000
+#define MYSQL_CLIENT_SECURE_CONNECTION  0x00008000
+#define MYSQL_CLIENT_MULTI_RESULTS      0x00020000
+#define MYSQL_CLIENT_PS_MULTI_RESULTS   0x00040000
+#define MYSQL_CLIENT_PLUGIN_AUTH        0x00080000
+#define MYSQL_CLIENT_PLUGIN_AUTH_LENENC 0x00200000
+
+#define MYSQL_CAPABILITIES  (MYSQL_CLIENT_LONG_PASSWORD | MYSQL_CLIENT_LONG_FLAG |  \
+    MYSQL_CLIENT_CONNECT_WITH_DB | MYSQL_CLIENT_PROTOCOL_41 |                       \
+    MYSQL_CLIENT_TRANSACTIONS | MYSQL_CLIENT_SECURE_CONNECTION |                    \
+    MYSQL_CLIENT_MULTI_RESULTS | MYSQL_CLIENT_PS_MULTI_RESULTS |                    \
+    MYSQL_CLIENT_PLUGIN_AUTH)
+
+/* server status, in OK and EOF packets */
+#define MYSQL_STATUS_IN_TRANS       0x0001
+#define MYSQL_STATUS_AUTOCOMMIT     0x0002
+#define MYSQL_STATUS_MORE_RESULTS   0x0008
+#define MYSQL_STATUS_CURSOR_EXISTS  0x0040
+
+/*
+ * NcMsg::m_flags_: the low 16 bits of a reply hold the last server status
+ * seen, the rest is what the proxy decided about a request and parser state
+ */
+#define MYSQL_STATUS_MASK       0x0000ffff
+#define MYSQL_HAS_STATUS        0x00010000  /* reply: an OK or EOF packet was seen */
+#define MYSQL_REQ_AUTH          0x00020000  /* handshake packet, of a client or the proxy */
+#define MYSQL_REQ_OK            0x00040000  /* answered with OK by the proxy */
+#define MYSQL_REQ_UNSUPPORTED   0x00080000  /* answered with an error by the proxy */
+#define MYSQL_REQ_TRX           0x00100000  /* starts a transaction */
+#define MYSQL_REQ_SESSION       0x00200000  /* leaves state in the session */
+#define MYSQL_REQ_RESET         0x00400000  /* COM_RESET_CONNECTION */
+#define MYSQL_IN_PACKET         0x10000000  /* parser: skipping a payload */
+#define MYSQL_CONTINUED         0x20000000  /* parser: the payload goes on in the next packet */
+#define MYSQL_LAST              0x40000000  /* parser: the message ends with this packet */
+
+/* why a connection is pinned, NcConn::m_pin_ */
+#define MYSQL_PIN_TRX           0x01    /* in a transaction, until the server says it is over */
+#define MYSQL_PIN_SESSION       0x02    /* session state, until the client goes away */
+#define MYSQL_PIN_DIRTY         0x04    /* server: left with state or one too many, closed once idle */
+
+/* handshake stage, NcConn::m_stage_ */
+typedef enum
+{
+    kMYSQL_STAGE_GREETING,      /* client: greeting sent; server: waiting for the greeting */
+    kMYSQL_STAGE_AUTH,          /* server: handshake response sent */
+    kMYSQL_STAGE_AUTH_SWITCH,   /* client: asked to switch to mysql_native_password */
+} NcMysqlStage;
+
+/*
+ * MySQL client/server protocol. Every packet is a 4 byte header, the
+ * payload length and a sequence id, followed by the payload; a request is
+ * a single packet, a reply one or more (a result set is a column count,
+ * the column definitions, EOF, the rows and EOF). The header and the first
+ * MYSQL_PEEK bytes of a payload have to be contiguous, the rest is skipped
+ * wherever it lies.
+ *
+ * The proxy speaks first to a client: it sends its own greeting, checks
+ * the client's credentials against mysql_user / mysql_password of the pool
+ * (mysql_native_password only) and answers OK itself. Server connections
+ * log in with the same credentials and mysql_db when they connect and are
+ * kept open; requests wait in the server's in queue until the login is
+ * done. Both sides agree on the same capabilities and server connections
+ * always use utf8mb4, so packets are passed through unchanged.
+ *
+ * Stateless queries of all clients are multiplexed on the server
+ * connections of a pool (server_connections: per server), taking the
+ * servers in turn. A client is pinned to one server connection while it
+ * is in a transaction, as told by the status of the replies, and for good
+ * once it leaves state in the session (SET, USE, user variables, prepared
+ * statements, temporary tables...). A pinned server connection serves
+ * that client only; when all of a server's are pinned another is opened
+ * for the others (at most server_max_connections per server, requests of
+ * unpinned clients fail beyond that), and dropped once it is released. A
+ * pinned connection is closed when the client goes away with state left,
+ * and the client is closed when it is lost.
+ */
+class NcMysql
+{
+public:
+    static void parseRequest(NcMsg *r);
+
+    /* req is the request the reply belongs to, NULL if unknown */
+    static void parseResponse(NcMsg *r, NcMsg *req);
+
+    /* decide what to do with a client packet: forward, answer or quit */
+    static void requestFilter(NcMsg *r, NcConn *c_conn);
+
+    /* the proxy's own answer to a request that is not forwarded */
+    static rstatus_t reply(NcMsg *r, NcConn *c_conn, NcContext *ctx);
+
+    /* greet a new client */
+    static rstatus_t greet(NcConn *c_conn, NcContext *ctx);
+
+    /*
+     * Server connection for a request, pinning the client if needed: the
+     * pinned one, else the servers of the pool in turn.
+     */
+    static NcConn* getConn(NcMsg *r, NcConn *c_conn);
+
+    /*
+     * Log a server connection in: consumes the greeting and the replies
+     * to the handshake. Returns true if the reply has been consumed.
+     */
+    static bool responseFilter(NcMsg *rsp, NcConn *s_conn);
+
+    /* requests wait until the server connection has logged in */
+    static bool sendable(NcMsg *r, NcConn *s_conn);
+
+    /* pin or release the client as told by the reply */
+    static void responseForward(NcMsg *rsp, NcMsg *req, NcConn *s_conn);
+
+    /* the client goes away, release its server connection */
+    static void unpin(NcConn *c_conn);
+
+    /* the server connection goes away, its pinned client has to follow */
+    static void lost(NcConn *s_conn, NcContext *ctx);
+
+    static rstatus_t error(NcMsg *rsp, NcContext *ctx, uint8_t seq, uint16_t code,
+        const char *state, const char *message);
+
+    /* SHA1(password) XOR SHA1(salt + SHA1(SHA1(password))) */
+    static void scramble(uint8_t *out, const uint8_t *password, uint32_t len,
+        const uint8_t *salt);
+
+    static uint32_t flags(NcMsg *r);
+
+    static uint8_t command(NcMsg *r)
+    {
+        return (uint8_t)(r->m_cmd_ - 1);
+    }
+
+    static uint16_t status(NcMsg *r)
+    {
+        return (uint16_t)(r->m_flags_ & MYSQL_STATUS_MASK);
+    }
+
+    /* MYSQL_REQ_*: what requestFilter decided */
+    static uint32_t decision(NcMsg *r)
+    {
+        return r->m_flags_ & (MYSQL_REQ_AUTH | MYSQL_REQ_OK | MYSQL_REQ_UNSUPPORTED |
+            MYSQL_REQ_TRX | MYSQL_REQ_SESSION | MYSQL_REQ_RESET);
+    }
+
+private:
+    static void parse(NcMsg *r, NcMsg *req);
+
+    static bool classify(NcMsg *r, NcMsg *req, uint8_t *p, uint32_t len);
+
+    static void classifyQuery(NcMsg *r, NcConn *c_conn);
+
+    static void setStatus(NcMsg *r, uint16_t status);
+
+    static rstatus_t authenticate(NcMsg *r, NcConn *c_conn, NcMsg *rsp, NcContext *ctx);
+
+    /* the handshake response to a server's greeting */
+    static NcMsg* handshake(const uint8_t *greeting, uint32_t len, uint8_t seq,
+        NcConn *s_conn, NcContext *ctx);
+
+    /* a handshake packet of the proxy, buf leaves room for the header */
+    static NcMsg* authRequest(NcContext *ctx, uint8_t *buf, uint32_t n, uint8_t seq);
+
+    static rstatus_t ok(NcMsg *rsp, NcContext *ctx, uint8_t seq);
+
+    static void pin(NcConn *c_conn, NcConn *s_conn, uint32_t why);
+};
+
+#endif
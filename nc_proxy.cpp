@@ -8,6 +8,7 @@
 #include <nc_client.h>
 #include <nc_log.h>
 #include <nc_server.h>
+#include <nc_mysql.h>
 
 void NcProxyConn::ref(void *owner)
 {
@@ -334,6 +335,19 @@ rstatus_t NcProxyConn::accept()
         return status;
     }
 
+    // mysql由proxy先发送greeting
+    if (ctx->protocol_type == kPROTOCOL_MYSQL)
+    {
+        status = NcMysql::greet(conn, ctx);
+        if (status != NC_OK)
+        {
+            LOG_ERROR("greet c %d from p %d failed: %s", conn->getSd(), m_sd_, 
+                strerror(errno));
+            conn->processClose();
+            return NC_OK;
+        }
+    }
+
     LOG_DEBUG("accepted c %d on p %d", conn->getSd(), m_sd_);
     
     return NC_OK;
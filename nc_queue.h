@@ -773,6 +773,8 @@ struct {                                                                \
 #include <list>
 #include <algorithm>
 
+#include <nc_log.h>
+
 template<typename ValType>
 class NcQueue
 {
@@ -849,4 +851,248 @@ private:
     std::list<ValType> m_list_;
 };
 
-#endif
\ No newline at end of file
+
+/*
+ * 侵入式双向队列, 链接节点嵌入在元素内部 (NcMsgBase/NcConnBase).
+ *
+ * An element carries one NcQueueEntry per queue it can be on at the same
+ * time; the queue is told which one to use through a pointer to member,
+ * so push/pop/remove are O(1) and never allocate. The entry to use is set
+ * at runtime because e.g. a request sits on the client omsg_q (c_tqe) and
+ * on the server omsg_q (s_tqe) at once, while both are NcConn::m_omsg_q_.
+ */
+template<typename T>
+class NcQueueEntry
+{
+public:
+    NcQueueEntry() : next(NULL), prev(NULL), owner(NULL)
+    { }
+
+    inline void reset()
+    {
+        next = NULL;
+        prev = NULL;
+        owner = NULL;
+    }
+
+public:
+    T           *next;      /* next element */
+    T           *prev;      /* previous element */
+    const void  *owner;     /* queue the element is on, NULL when on none */
+};
+
+template<typename T>
+class NcTailQueue
+{
+public:
+    typedef NcQueueEntry<T> T::*Link;
+
+    class ConstIterator
+    {
+    public:
+        ConstIterator(Link link = NULL, T *elem = NULL) : m_link_(link), m_elem_(elem)
+        { }
+
+        inline T* operator*() const
+        {
+            return m_elem_;
+        }
+
+        inline ConstIterator& operator++()
+        {
+            m_elem_ = (m_elem_->*m_link_).next;
+            return *this;
+        }
+
+        inline ConstIterator operator++(int)
+        {
+            ConstIterator iter = *this;
+            m_elem_ = (m_elem_->*m_link_).next;
+            return iter;
+        }
+
+        inline bool operator==(const ConstIterator &iter) const
+        {
+            return m_elem_ == iter.m_elem_;
+        }
+
+        inline bool operator!=(const ConstIterator &iter) const
+        {
+            return m_elem_ != iter.m_elem_;
+        }
+
+    private:
+        Link    m_link_;
+        T       *m_elem_;
+    };
+
+    NcTailQueue(Link link) : m_link_(link), m_head_(NULL), m_tail_(NULL), m_size_(0)
+    { }
+
+    inline void setLink(Link link)
+    {
+        m_link_ = link;
+    }
+
+    inline bool empty()
+    {
+        return m_head_ == NULL;
+    }
+
+    inline T* front()
+    {
+        return m_head_;
+    }
+
+    inline T* back()
+    {
+        return m_tail_;
+    }
+
+    inline T* next(T *elem)
+    {
+        return (elem->*m_link_).next;
+    }
+
+    inline T* prev(T *elem)
+    {
+        return (elem->*m_link_).prev;
+    }
+
+    // 插入到最后
+    inline void push(T *elem)
+    {
+        NcQueueEntry<T> &e = elem->*m_link_;
+        ASSERT(e.owner == NULL);
+        e.owner = this;
+        e.next = NULL;
+        e.prev = m_tail_;
+        if (m_tail_ != NULL)
+        {
+            (m_tail_->*m_link_).next = elem;
+        }
+        else
+        {
+            m_head_ = elem;
+        }
+        m_tail_ = elem;
+        m_size_++;
+    }
+
+    // 插入到before之前
+    inline void insertBefore(T *elem, T *before)
+    {
+        NcQueueEntry<T> &e = elem->*m_link_;
+        NcQueueEntry<T> &b = before->*m_link_;
+        ASSERT(e.owner == NULL && b.owner == this);
+        e.owner = this;
+        e.next = before;
+        e.prev = b.prev;
+        if (b.prev != NULL)
+        {
+            (b.prev->*m_link_).next = elem;
+        }
+        else
+        {
+            m_head_ = elem;
+        }
+        b.prev = elem;
+        m_size_++;
+    }
+
+    // 弹出最前一个
+    inline T* pop()
+    {
+        T *elem = m_head_;
+        if (elem != NULL)
+        {
+            remove(elem);
+        }
+        return elem;
+    }
+
+    /*
+     * elem是否在本队列中. The entry records its queue, so an element linked
+     * into another queue through the same member (a server's imsg_q and
+     * omsg_q share s_tqe) is not taken for one of ours.
+     */
+    inline bool contains(T *elem)
+    {
+        return (elem->*m_link_).owner == this;
+    }
+
+    // 不在任何队列中时什么都不做; 在别的队列中是调用者的错误
+    inline void remove(T *elem)
+    {
+        NcQueueEntry<T> &e = elem->*m_link_;
+        if (e.owner != this)
+        {
+            ASSERT(e.owner == NULL);
+            return ;
+        }
+
+        if (e.next != NULL)
+        {
+            (e.next->*m_link_).prev = e.prev;
+        }
+        else
+        {
+            m_tail_ = e.prev;
+        }
+
+        if (e.prev != NULL)
+        {
+            (e.prev->*m_link_).next = e.next;
+        }
+        else
+        {
+            m_head_ = e.next;
+        }
+
+        e.reset();
+        m_size_--;
+    }
+
+    // 移到队尾, 用于轮询
+    inline void rotate()
+    {
+        if (m_head_ != m_tail_)
+        {
+            push(pop());
+        }
+    }
+ 
+    inline size_t size()
+    {
+        return m_size_;
+    } 
+
+    inline ConstIterator begin()
+    {
+        return ConstIterator(m_link_, m_head_);
+    }
+
+    inline ConstIterator end()
+    {
+        return ConstIterator(m_link_, NULL);
+    }
+
+    /*
+     * Forget all elements without touching them: they may already be back
+     * in their pool, whose reset() clears the links.
+     */
+    inline void clear()
+    {
+        m_head_ = NULL;
+        m_tail_ = NULL;
+        m_size_ = 0;
+    }
+
+private:
+    Link    m_link_;    /* entry used by this queue */
+    T       *m_head_;   /* first element */
+    T       *m_tail_;   /* last element */
+    size_t  m_size_;    /* # elements */
+};
+
+#endif
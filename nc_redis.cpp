@@ -0,0 +1,1180 @@
+#include <nc_redis.h>
+
+#define R   REDIS_CMD_READ
+#define W   REDIS_CMD_WRITE
+
+static const NcRedisCommand s_commands[] = {
+    /* name                 type                arity first last step flags */
+    { "get",                kREDIS_CMD_GET,     2,  1,  1,  1,  R },
+    { "set",                kREDIS_CMD_OTHER,   -3, 1,  1,  1,  W },
+    { "setnx",              kREDIS_CMD_OTHER,   3,  1,  1,  1,  W },
+    { "setex",              kREDIS_CMD_OTHER,   4,  1,  1,  1,  W },
+    { "psetex",             kREDIS_CMD_OTHER,   4,  1,  1,  1,  W },
+    { "getset",             kREDIS_CMD_OTHER,   3,  1,  1,  1,  W },
+    { "getdel",             kREDIS_CMD_OTHER,   2,  1,  1,  1,  W },
+    { "getex",              kREDIS_CMD_OTHER,   -2, 1,  1,  1,  W },
+    { "append",             kREDIS_CMD_OTHER,   3,  1,  1,  1,  W },
+    { "strlen",             kREDIS_CMD_OTHER,   2,  1,  1,  1,  R },
+    { "incr",               kREDIS_CMD_OTHER,   2,  1,  1,  1,  W },
+    { "decr",               kREDIS_CMD_OTHER,   2,  1,  1,  1,  W },
+    { "incrby",             kREDIS_CMD_OTHER,   3,  1,  1,  1,  W },
+    { "decrby",             kREDIS_CMD_OTHER,   3,  1,  1,  1,  W },
+    { "incrbyfloat",        kREDIS_CMD_OTHER,   3,  1,  1,  1,  W },
+    { "getrange",           kREDIS_CMD_OTHER,   4,  1,  1,  1,  R },
+    { "setrange",           kREDIS_CMD_OTHER,   4,  1,  1,  1,  W },
+    { "getbit",             kREDIS_CMD_OTHER,   3,  1,  1,  1,  R },
+    { "setbit",             kREDIS_CMD_OTHER,   4,  1,  1,  1,  W },
+    { "bitcount",           kREDIS_CMD_OTHER,   -2, 1,  1,  1,  R },
+    { "bitpos",             kREDIS_CMD_OTHER,   -3, 1,  1,  1,  R },
+    { "bitfield",           kREDIS_CMD_OTHER,   -2, 1,  1,  1,  W },
+
+    { "mget",               kREDIS_CMD_MGET,    -2, 1,  -1, 1,  R },
+    { "mset",               kREDIS_CMD_MSET,    -3, 1,  -1, 2,  W },
+    { "msetnx",             kREDIS_CMD_OTHER,   -3, 1,  -1, 2,  W },
+    { "del",                kREDIS_CMD_DEL,     -2, 1,  -1, 1,  W },
+    { "unlink",             kREDIS_CMD_UNLINK,  -2, 1,  -1, 1,  W },
+    { "exists",             kREDIS_CMD_EXISTS,  -2, 1,  -1, 1,  R },
+    { "touch",              kREDIS_CMD_TOUCH,   -2, 1,  -1, 1,  R },
+
+    { "expire",             kREDIS_CMD_OTHER,   3,  1,  1,  1,  W },
+    { "expireat",           kREDIS_CMD_OTHER,   3,  1,  1,  1,  W },
+    { "pexpire",            kREDIS_CMD_OTHER,   3,  1,  1,  1,  W },
+    { "pexpireat",          kREDIS_CMD_OTHER,   3,  1,  1,  1,  W },
+    { "persist",            kREDIS_CMD_OTHER,   2,  1,  1,  1,  W },
+    { "ttl",                kREDIS_CMD_OTHER,   2,  1,  1,  1,  R },
+    { "pttl",               kREDIS_CMD_OTHER,   2,  1,  1,  1,  R },
+    { "type",               kREDIS_CMD_OTHER,   2,  1,  1,  1,  R },
+    { "dump",               kREDIS_CMD_OTHER,   2,  1,  1,  1,  R },
+    { "restore",            kREDIS_CMD_OTHER,   -4, 1,  1,  1,  W },
+    { "rename",             kREDIS_CMD_OTHER,   3,  1,  2,  1,  W },
+    { "renamenx",           kREDIS_CMD_OTHER,   3,  1,  2,  1,  W },
+
+    { "hget",               kREDIS_CMD_OTHER,   3,  1,  1,  1,  R },
+    { "hset",               kREDIS_CMD_OTHER,   -4, 1,  1,  1,  W },
+    { "hsetnx",             kREDIS_CMD_OTHER,   4,  1,  1,  1,  W },
+    { "hmget",              kREDIS_CMD_OTHER,   -3, 1,  1,  1,  R },
+    { "hmset",              kREDIS_CMD_OTHER,   -4, 1,  1,  1,  W },
+    { "hdel",               kREDIS_CMD_OTHER,   -3, 1,  1,  1,  W },
+    { "hexists",            kREDIS_CMD_OTHER,   3,  1,  1,  1,  R },
+    { "hgetall",            kREDIS_CMD_OTHER,   2,  1,  1,  1,  R },
+    { "hincrby",            kREDIS_CMD_OTHER,   4,  1,  1,  1,  W },
+    { "hincrbyfloat",       kREDIS_CMD_OTHER,   4,  1,  1,  1,  W },
+    { "hkeys",              kREDIS_CMD_OTHER,   2,  1,  1,  1,  R },
+    { "hvals",              kREDIS_CMD_OTHER,   2,  1,  1,  1,  R },
+    { "hlen",               kREDIS_CMD_OTHER,   2,  1,  1,  1,  R },
+    { "hstrlen",            kREDIS_CMD_OTHER,   3,  1,  1,  1,  R },
+    { "hscan",              kREDIS_CMD_OTHER,   -3, 1,  1,  1,  R },
+    { "hrandfield",         kREDIS_CMD_OTHER,   -2, 1,  1,  1,  R },
+
+    { "lpush",              kREDIS_CMD_OTHER,   -3, 1,  1,  1,  W },
+    { "rpush",              kREDIS_CMD_OTHER,   -3, 1,  1,  1,  W },
+    { "lpushx",             kREDIS_CMD_OTHER,   -3, 1,  1,  1,  W },
+    { "rpushx",             kREDIS_CMD_OTHER,   -3, 1,  1,  1,  W },
+    { "lpop",               kREDIS_CMD_OTHER,   -2, 1,  1,  1,  W },
+    { "rpop",               kREDIS_CMD_OTHER,   -2, 1,  1,  1,  W },
+    { "llen",               kREDIS_CMD_OTHER,   2,  1,  1,  1,  R },
+    { "lrange",             kREDIS_CMD_OTHER,   4,  1,  1,  1,  R },
+    { "lindex",             kREDIS_CMD_OTHER,   3,  1,  1,  1,  R },
+    { "lset",               kREDIS_CMD_OTHER,   4,  1,  1,  1,  W },
+    { "lrem",               kREDIS_CMD_OTHER,   4,  1,  1,  1,  W },
+    { "ltrim",              kREDIS_CMD_OTHER,   4,  1,  1,  1,  W },
+    { "linsert",            kREDIS_CMD_OTHER,   5,  1,  1,  1,  W },
+    { "lpos",               kREDIS_CMD_OTHER,   -3, 1,  1,  1,  R },
+    { "rpoplpush",          kREDIS_CMD_OTHER,   3,  1,  2,  1,  W },
+    { "lmove",              kREDIS_CMD_OTHER,   5,  1,  2,  1,  W },
+
+    { "sadd",               kREDIS_CMD_OTHER,   -3, 1,  1,  1,  W },
+    { "srem",               kREDIS_CMD_OTHER,   -3, 1,  1,  1,  W },
+    { "smembers",           kREDIS_CMD_OTHER,   2,  1,  1,  1,  R },
+    { "sismember",          kREDIS_CMD_OTHER,   3,  1,  1,  1,  R },
+    { "smismember",         kREDIS_CMD_OTHER,   -3, 1,  1,  1,  R },
+    { "scard",              kREDIS_CMD_OTHER,   2,  1,  1,  1,  R },
+    { "spop",               kREDIS_CMD_OTHER,   -2, 1,  1,  1,  W },
+    { "srandmember",        kREDIS_CMD_OTHER,   -2, 1,  1,  1,  R },
+    { "sscan",              kREDIS_CMD_OTHER,   -3, 1,  1,  1,  R },
+    { "smove",              kREDIS_CMD_OTHER,   4,  1,  2,  1,  W },
+    { "sdiff",              kREDIS_CMD_OTHER,   -2, 1,  -1, 1,  R },
+    { "sinter",             kREDIS_CMD_OTHER,   -2, 1,  -1, 1,  R },
+    { "sunion",             kREDIS_CMD_OTHER,   -2, 1,  -1, 1,  R },
+    { "sdiffstore",         kREDIS_CMD_OTHER,   -3, 1,  -1, 1,  W },
+    { "sinterstore",        kREDIS_CMD_OTHER,   -3, 1,  -1, 1,  W },
+    { "sunionstore",        kREDIS_CMD_OTHER,   -3, 1,  -1, 1,  W },
+
+    { "zadd",               kREDIS_CMD_OTHER,   -4, 1,  1,  1,  W },
+    { "zincrby",            kREDIS_CMD_OTHER,   4,  1,  1,  1,  W },
+    { "zrem",               kREDIS_CMD_OTHER,   -3, 1,  1,  1,  W },
+    { "zscore",             kREDIS_CMD_OTHER,   3,  1,  1,  1,  R },
+    { "zmscore",            kREDIS_CMD_OTHER,   -3, 1,  1,  1,  R },
+    { "zcard",              kREDIS_CMD_OTHER,   2,  1,  1,  1,  R },
+    { "zcount",             kREDIS_CMD_OTHER,   4,  1,  1,  1,  R },
+    { "zrange",             kREDIS_CMD_OTHER,   -4, 1,  1,  1,  R },
+    { "zrevrange",          kREDIS_CMD_OTHER,   -4, 1,  1,  1,  R },
+    { "zrangebyscore",      kREDIS_CMD_OTHER,   -4, 1,  1,  1,  R },
+    { "zrevrangebyscore",   kREDIS_CMD_OTHER,   -4, 1,  1,  1,  R },
+    { "zrangebylex",        kREDIS_CMD_OTHER,   -4, 1,  1,  1,  R },
+    { "zrevrangebylex",     kREDIS_CMD_OTHER,   -4, 1,  1,  1,  R },
+    { "zrank",              kREDIS_CMD_OTHER,   -3, 1,  1,  1,  R },
+    { "zrevrank",           kREDIS_CMD_OTHER,   -3, 1,  1,  1,  R },
+    { "zlexcount",          kREDIS_CMD_OTHER,   4,  1,  1,  1,  R },
+    { "zremrangebyrank",    kREDIS_CMD_OTHER,   4,  1,  1,  1,  W },
+    { "zremrangebyscore",   kREDIS_CMD_OTHER,   4,  1,  1,  1,  W },
+    { "zremrangebylex",     kREDIS_CMD_OTHER,   4,  1,  1,  1,  W },
+    { "zpopmin",            kREDIS_CMD_OTHER,   -2, 1,  1,  1,  W },
+    { "zpopmax",            kREDIS_CMD_OTHER,   -2, 1,  1,  1,  W },
+    { "zscan",              kREDIS_CMD_OTHER,   -3, 1,  1,  1,  R },
+    { "zunionstore",        kREDIS_CMD_OTHER,   -4, 1,  1,  1,  W },
+    { "zinterstore",        kREDIS_CMD_OTHER,   -4, 1,  1,  1,  W },
+
+    { "pfadd",              kREDIS_CMD_OTHER,   -2, 1,  1,  1,  W },
+    { "pfcount",            kREDIS_CMD_OTHER,   -2, 1,  -1, 1,  R },
+    { "pfmerge",            kREDIS_CMD_OTHER,   -2, 1,  -1, 1,  W },
+
+    { "geoadd",             kREDIS_CMD_OTHER,   -5, 1,  1,  1,  W },
+    { "geodist",            kREDIS_CMD_OTHER,   -4, 1,  1,  1,  R },
+    { "geohash",            kREDIS_CMD_OTHER,   -2, 1,  1,  1,  R },
+    { "geopos",             kREDIS_CMD_OTHER,   -2, 1,  1,  1,  R },
+    { "geosearch",          kREDIS_CMD_OTHER,   -7, 1,  1,  1,  R },
+
+    { "eval",               kREDIS_CMD_EVAL,    -3, 3,  -1, 1,  W | REDIS_CMD_NUMKEYS },
+    { "evalsha",            kREDIS_CMD_EVAL,    -3, 3,  -1, 1,  W | REDIS_CMD_NUMKEYS },
+
+    { "ping",               kREDIS_CMD_PING,    -1, 0,  0,  0,  REDIS_CMD_LOCAL },
+    { "quit",               kREDIS_CMD_QUIT,    -1, 0,  0,  0,  REDIS_CMD_QUIT },
+};
+
+#undef R
+#undef W
+
+#define REDIS_NCOMMAND      (sizeof(s_commands) / sizeof(s_commands[0]))
+#define REDIS_CMD_BUCKETS   512     /* power of 2, > 2 * REDIS_NCOMMAND */
+
+/*
+ * Open addressing table from the lower cased name to index + 1 in
+ * s_commands, built on first use.
+ */
+static uint32_t redisCommandHash(const uint8_t *name, uint32_t len)
+{
+    uint32_t hash = 2166136261UL;
+    for (uint32_t i = 0; i < len; i++)
+    {
+        hash = (hash ^ (uint32_t)(name[i] | 0x20)) * 16777619UL;
+    }
+
+    return hash;
+}
+
+static const uint16_t* redisCommandTable()
+{
+    static uint16_t table[REDIS_CMD_BUCKETS];
+    static bool built = false;
+
+    if (!built)
+    {
+        for (uint32_t i = 0; i < REDIS_NCOMMAND; i++)
+        {
+            const char *name = s_commands[i].name;
+            uint32_t h = redisCommandHash((const uint8_t *)name, (uint32_t)strlen(name));
+            while (table[h & (REDIS_CMD_BUCKETS - 1)] != 0)
+            {
+                h++;
+            }
+            table[h & (REDIS_CMD_BUCKETS - 1)] = (uint16_t)(i + 1);
+        }
+        built = true;
+    }
+
+    return table;
+}
+
+const NcRedisCommand* NcRedis::lookup(const uint8_t *name, uint32_t len)
+{
+    const uint16_t *table = redisCommandTable();
+
+    for (uint32_t h = redisCommandHash(name, len); ; h++)
+    {
+        uint16_t idx = table[h & (REDIS_CMD_BUCKETS - 1)];
+        if (idx == 0)
+        {
+            return NULL;
+        }
+
+        const NcRedisCommand *cmd = &s_commands[idx - 1];
+        if (strlen(cmd->name) == len && strncasecmp(cmd->name, (const char *)name, len) == 0)
+        {
+            return cmd;
+        }
+    }
+}
+
+const NcRedisCommand* NcRedis::command(NcMsg *r)
+{
+    if (r->m_cmd_ == 0 || r->m_cmd_ > REDIS_NCOMMAND)
+    {
+        return NULL;
+    }
+
+    return &s_commands[r->m_cmd_ - 1];
+}
+
+bool NcRedis::setCommand(NcMsg *r, const uint8_t *name, uint32_t len)
+{
+    const NcRedisCommand *cmd = lookup(name, len);
+    if (cmd == NULL)
+    {
+        LOG_DEBUG("unsupported redis command '%.*s'", len, name);
+        return false;
+    }
+
+    if ((cmd->arity > 0 && r->m_narg_ != (uint32_t)cmd->arity) ||
+        (cmd->arity < 0 && r->m_narg_ < (uint32_t)(-cmd->arity)))
+    {
+        LOG_DEBUG("wrong number of args %" PRIu32 " for '%s'", r->m_narg_, cmd->name);
+        return false;
+    }
+
+    r->m_cmd_ = (uint32_t)(cmd - s_commands) + 1;
+    return true;
+}
+
+bool NcRedis::isKey(NcMsg *r, const NcRedisCommand *cmd, uint32_t argi)
+{
+    if (cmd->first == 0 || argi < (uint32_t)cmd->first)
+    {
+        return false;
+    }
+
+    int64_t last;
+    if (cmd->flags & REDIS_CMD_NUMKEYS)
+    {
+        last = cmd->first + r->m_integer_ - 1;
+    }
+    else
+    {
+        last = cmd->last < 0 ? (int64_t)r->m_narg_ + cmd->last : cmd->last;
+    }
+
+    return (int64_t)argi <= last && (argi - cmd->first) % cmd->step == 0;
+}
+
+bool NcRedis::requestDone(NcMsg *r)
+{
+    const NcRedisCommand *cmd = command(r);
+    ASSERT(cmd != NULL);
+
+    if ((cmd->flags & REDIS_CMD_NUMKEYS) &&
+        (r->m_integer_ < 0 || r->m_integer_ > (int64_t)r->m_narg_ - cmd->first))
+    {
+        LOG_DEBUG("bad numkeys %" PRId64 " for '%s'", r->m_integer_, cmd->name);
+        return false;
+    }
+
+    if (cmd->flags & REDIS_CMD_QUIT)
+    {
+        r->m_quit_ = 1;
+    }
+
+    if (cmd->flags & REDIS_CMD_LOCAL)
+    {
+        r->m_noforward_ = 1;
+    }
+
+    return true;
+}
+
+/* inline request in [start, end), end pointing at the '\n' */
+bool NcRedis::parseInline(NcMsg *r, uint8_t *start, uint8_t *end)
+{
+    if (end > start && end[-1] == '\r')
+    {
+        end--;
+    }
+
+    // 先数出参数个数, 负数的last需要它
+    uint32_t narg = 0;
+    for (uint8_t *p = start; p < end; )
+    {
+        while (p < end && (*p == ' ' || *p == '\t'))
+        {
+            p++;
+        }
+        if (p == end)
+        {
+            break;
+        }
+        narg++;
+        while (p < end && *p != ' ' && *p != '\t')
+        {
+            p++;
+        }
+    }
+
+    if (narg == 0)
+    {
+        return false;
+    }
+    r->m_narg_ = narg;
+
+    const NcRedisCommand *cmd = NULL;
+    uint32_t argi = 0;
+    for (uint8_t *p = start; p < end; argi++)
+    {
+        while (p < end && (*p == ' ' || *p == '\t'))
+        {
+            p++;
+        }
+        if (p == end)
+        {
+            break;
+        }
+        uint8_t *token = p;
+        while (p < end && *p != ' ' && *p != '\t')
+        {
+            p++;
+        }
+
+        if (argi == 0)
+        {
+            if (!setCommand(r, token, (uint32_t)(p - token)))
+            {
+                return false;
+            }
+            cmd = command(r);
+        }
+        else if ((cmd->flags & REDIS_CMD_NUMKEYS) && argi == (uint32_t)cmd->first - 1)
+        {
+            r->m_integer_ = nc_atoi(token, (p - token));
+        }
+        else if (isKey(r, cmd, argi))
+        {
+            r->m_keys_.push_back(NcKeypos(token, p));
+        }
+    }
+
+    return requestDone(r);
+}
+
+void NcRedis::parseRequest(NcMsg *r)
+{
+    enum
+    {
+        SW_START,
+        SW_NARG,
+        SW_NARG_LF,
+        SW_ARG_LEN_START,
+        SW_ARG_LEN,
+        SW_ARG_LEN_LF,
+        SW_TOKEN,
+        SW_ARG,
+        SW_ARG_NUM,
+        SW_ARG_CR,
+        SW_ARG_LF,
+        SW_INLINE,
+    };
+
+    NcMbuf *b = r->m_mbuf_queue_.back();
+    ASSERT(b != NULL);
+    ASSERT(r->pos >= b->getPos() && r->pos <= b->getLast());
+
+    uint8_t *p = r->pos, *last = b->getLast();
+    int state = r->state;
+    uint32_t argi;
+    const NcRedisCommand *cmd;
+
+    for (; p < last; p++)
+    {
+        uint8_t ch = *p;
+
+        switch (state)
+        {
+        case SW_START:
+            if (ch == '*')
+            {
+                r->m_narg_ = 0;
+                state = SW_NARG;
+                break;
+            }
+            if (ch == '\r' || ch == '\n')
+            {
+                break;
+            }
+            state = SW_INLINE;
+            /* fall through */
+
+        case SW_INLINE:
+        {
+            /* the whole line is needed, p is its start */
+            uint8_t *nl = (uint8_t *)memchr(p, '\n', (size_t)(last - p));
+            if (nl == NULL)
+            {
+                if (last - p >= NC_REDIS_INLINE_MAX)
+                {
+                    goto error;
+                }
+                r->setPending((uint32_t)(last - p));
+                goto token_again;
+            }
+            if (!parseInline(r, p, nl))
+            {
+                goto error;
+            }
+            p = nl + 1;
+            goto done;
+        }
+
+        case SW_NARG:
+            if (isdigit(ch))
+            {
+                r->m_narg_ = r->m_narg_ * 10 + (uint32_t)(ch - '0');
+                if (r->m_narg_ > NC_REDIS_MAX_NARG)
+                {
+                    goto error;
+                }
+            }
+            else if (ch == '\r' && r->m_narg_ > 0)
+            {
+                state = SW_NARG_LF;
+            }
+            else
+            {
+                goto error;
+            }
+            break;
+
+        case SW_NARG_LF:
+            if (ch != '\n')
+            {
+                goto error;
+            }
+            r->m_rnarg_ = r->m_narg_;
+            state = SW_ARG_LEN_START;
+            break;
+
+        case SW_ARG_LEN_START:
+            if (ch != '$')
+            {
+                goto error;
+            }
+            r->m_rlen_ = 0;
+            state = SW_ARG_LEN;
+            break;
+
+        case SW_ARG_LEN:
+            if (isdigit(ch))
+            {
+                r->m_rlen_ = r->m_rlen_ * 10 + (uint32_t)(ch - '0');
+                if (r->m_rlen_ > NC_REDIS_MAX_BULK)
+                {
+                    goto error;
+                }
+            }
+            else if (ch == '\r')
+            {
+                state = SW_ARG_LEN_LF;
+            }
+            else
+            {
+                goto error;
+            }
+            break;
+
+        case SW_ARG_LEN_LF:
+            if (ch != '\n')
+            {
+                goto error;
+            }
+
+            argi = r->m_narg_ - r->m_rnarg_;
+            cmd = command(r);
+            if (argi == 0 || isKey(r, cmd, argi))
+            {
+                if (r->m_rlen_ > NC_REDIS_MAX_TOKEN)
+                {
+                    goto error;
+                }
+                state = SW_TOKEN;
+            }
+            else if ((cmd->flags & REDIS_CMD_NUMKEYS) && argi == (uint32_t)cmd->first - 1)
+            {
+                /* numkeys, an empty one is not a number */
+                if (r->m_rlen_ == 0)
+                {
+                    goto error;
+                }
+                r->m_integer_ = 0;
+                state = SW_ARG_NUM;
+            }
+            else
+            {
+                state = r->m_rlen_ > 0 ? SW_ARG : SW_ARG_CR;
+            }
+            break;
+
+        case SW_TOKEN:
+            /* command name or key, must be contiguous; p is its start */
+            if ((uint32_t)(last - p) < r->m_rlen_)
+            {
+                r->setPending(r->m_rlen_ + 2 - (uint32_t)(last - p));
+                goto token_again;
+            }
+
+            argi = r->m_narg_ - r->m_rnarg_;
+            if (argi == 0)
+            {
+                if (!setCommand(r, p, r->m_rlen_))
+                {
+                    goto error;
+                }
+            }
+            else
+            {
+                r->m_keys_.push_back(NcKeypos(p, p + r->m_rlen_));
+            }
+
+            p += r->m_rlen_;
+            p--;
+            state = SW_ARG_CR;
+            break;
+
+        case SW_ARG:
+        {
+            /* values are skipped wherever they lie */
+            uint32_t n = MIN(r->m_rlen_, (uint32_t)(last - p));
+            r->m_rlen_ -= n;
+            p += n;
+            p--;
+            if (r->m_rlen_ == 0)
+            {
+                state = SW_ARG_CR;
+            }
+            break;
+        }
+
+        case SW_ARG_NUM:
+            if (!isdigit(ch))
+            {
+                goto error;
+            }
+            r->m_integer_ = r->m_integer_ * 10 + (ch - '0');
+            if (r->m_integer_ > NC_REDIS_MAX_NARG)
+            {
+                /* more keys than a request can have arguments */
+                goto error;
+            }
+            if (--r->m_rlen_ == 0)
+            {
+                state = SW_ARG_CR;
+            }
+            break;
+
+        case SW_ARG_CR:
+            if (ch != '\r')
+            {
+                goto error;
+            }
+            state = SW_ARG_LF;
+            break;
+
+        case SW_ARG_LF:
+            if (ch != '\n')
+            {
+                goto error;
+            }
+            if (--r->m_rnarg_ == 0)
+            {
+                if (!requestDone(r))
+                {
+                    goto error;
+                }
+                p++;
+                goto done;
+            }
+            state = SW_ARG_LEN_START;
+            break;
+
+        default:
+            ASSERT(0);
+            break;
+        }
+    }
+
+    /* all data parsed, wait for more */
+    r->pos = p;
+    r->state = state;
+    r->setPending((state == SW_ARG || state == SW_TOKEN) ? r->m_rlen_ + 2 : 0);
+    r->m_result_ = kMSG_PARSE_AGAIN;
+    return;
+
+token_again:
+    /*
+     * A token needs more data. While its mbuf has room the next read
+     * lands right behind it; once the mbuf is full the token is moved to
+     * a new one (repair). Either way parsing resumes at its start.
+     */
+    r->pos = p;
+    r->state = state;
+    r->m_result_ = b->full() ? kMSG_PARSE_REPAIR : kMSG_PARSE_AGAIN;
+    return;
+
+done:
+    ASSERT(p <= last);
+    r->pos = p;
+    r->state = SW_START;
+    r->setPending(0);
+    r->m_result_ = kMSG_PARSE_OK;
+    return;
+
+error:
+    LOG_DEBUG("parse req %" PRIu64 " failed at state %d: '%.*s'", r->m_id_,
+        state, (int)MIN(16, last - p), p);
+    r->pos = p;
+    r->state = state;
+    r->m_result_ = kMSG_PARSE_ERROR;
+    errno = EINVAL;
+}
+
+void NcRedis::parseResponse(NcMsg *r)
+{
+    enum
+    {
+        SW_START,
+        SW_LINE,
+        SW_BULK_LEN,
+        SW_BULK_LEN_LF,
+        SW_BULK,
+        SW_BULK_CR,
+        SW_BULK_LF,
+        SW_MULTI_LEN,
+        SW_MULTI_LEN_LF,
+    };
+
+    NcMbuf *b = r->m_mbuf_queue_.back();
+    ASSERT(b != NULL);
+    ASSERT(r->pos >= b->getPos() && r->pos <= b->getLast());
+
+    uint8_t *p = r->pos, *last = b->getLast();
+    int state = r->state;
+
+    for (; p < last; p++)
+    {
+        uint8_t ch = *p;
+
+        switch (state)
+        {
+        case SW_START:
+            switch (ch)
+            {
+            case '+':
+            case '-':
+            case ':':
+                state = SW_LINE;
+                break;
+
+            case '$':
+                r->m_integer_ = 0;
+                state = SW_BULK_LEN;
+                break;
+
+            case '*':
+                r->m_integer_ = 0;
+                state = SW_MULTI_LEN;
+                break;
+
+            default:
+                goto error;
+            }
+            break;
+
+        case SW_LINE:
+        {
+            uint8_t *nl = (uint8_t *)memchr(p, '\n', (size_t)(last - p));
+            if (nl == NULL)
+            {
+                p = last - 1;
+                break;
+            }
+            p = nl;
+            goto element;
+        }
+
+        case SW_BULK_LEN:
+        case SW_MULTI_LEN:
+            if (isdigit(ch) && r->m_integer_ >= 0)
+            {
+                r->m_integer_ = r->m_integer_ * 10 + (ch - '0');
+                if (r->m_integer_ > NC_REDIS_MAX_BULK)
+                {
+                    goto error;
+                }
+            }
+            else if (ch == '-' && r->m_integer_ == 0)
+            {
+                /* $-1 / *-1: nil */
+                r->m_integer_ = -1;
+            }
+            else if (ch == '1' && r->m_integer_ == -1)
+            {
+                r->m_integer_ = -2;
+            }
+            else if (ch == '\r' && r->m_integer_ != -1)
+            {
+                state = state == SW_BULK_LEN ? SW_BULK_LEN_LF : SW_MULTI_LEN_LF;
+            }
+            else
+            {
+                goto error;
+            }
+            break;
+
+        case SW_BULK_LEN_LF:
+            if (ch != '\n')
+            {
+                goto error;
+            }
+            if (r->m_integer_ < 0)
+            {
+                goto element;
+            }
+            r->m_rlen_ = (uint32_t)r->m_integer_;
+            state = r->m_rlen_ > 0 ? SW_BULK : SW_BULK_CR;
+            break;
+
+        case SW_BULK:
+        {
+            uint32_t n = MIN(r->m_rlen_, (uint32_t)(last - p));
+            r->m_rlen_ -= n;
+            p += n;
+            p--;
+            if (r->m_rlen_ == 0)
+            {
+                state = SW_BULK_CR;
+            }
+            break;
+        }
+
+        case SW_BULK_CR:
+            if (ch != '\r')
+            {
+                goto error;
+            }
+            state = SW_BULK_LF;
+            break;
+
+        case SW_BULK_LF:
+            if (ch != '\n')
+            {
+                goto error;
+            }
+            goto element;
+
+        case SW_MULTI_LEN_LF:
+            if (ch != '\n')
+            {
+                goto error;
+            }
+            if (r->m_integer_ <= 0)
+            {
+                goto element;
+            }
+            if (r->m_depth_ == NC_MSG_MAX_DEPTH)
+            {
+                goto error;
+            }
+            r->m_nelem_[r->m_depth_++] = (uint32_t)r->m_integer_;
+            state = SW_START;
+            break;
+
+        default:
+            ASSERT(0);
+            break;
+        }
+        continue;
+
+element:
+        /* one element done, close the arrays it completes */
+        while (r->m_depth_ > 0 && --r->m_nelem_[r->m_depth_ - 1] == 0)
+        {
+            r->m_depth_--;
+        }
+        if (r->m_depth_ == 0)
+        {
+            p++;
+            goto done;
+        }
+        state = SW_START;
+    }
+
+    r->pos = p;
+    r->state = state;
+    r->setPending(state == SW_BULK ? r->m_rlen_ + 2 : 0);
+    r->m_result_ = kMSG_PARSE_AGAIN;
+    return;
+
+done:
+    r->pos = p;
+    r->state = SW_START;
+    r->setPending(0);
+    r->m_result_ = kMSG_PARSE_OK;
+    return;
+
+error:
+    LOG_DEBUG("parse rsp %" PRIu64 " failed at state %d: '%.*s'", r->m_id_,
+        state, (int)MIN(16, last - p), p);
+    r->pos = p;
+    r->state = state;
+    r->m_result_ = kMSG_PARSE_ERROR;
+    errno = EINVAL;
+}
+
+rstatus_t NcRedis::reply(NcMsg *r, NcContext *ctx)
+{
+    NcMsg *rsp = (NcMsg *)r->m_peer_;
+    const NcRedisCommand *cmd = command(r);
+    ASSERT(rsp != NULL && cmd != NULL);
+
+    switch (cmd->type)
+    {
+    case kREDIS_CMD_PING:
+        return rsp->append(ctx, (uint8_t *)"+PONG\r\n", 7);
+
+    default:
+        ASSERT(0);
+        return NC_ERROR;
+    }
+}
+
+/* "<type><n>\r\n" into buf, the length of a bulk or multibulk; returns its size */
+static uint32_t redisHeader(uint8_t *buf, uint8_t type, int64_t n)
+{
+    uint8_t digits[24], *d = digits + sizeof(digits);
+    uint64_t v = n < 0 ? (uint64_t)(-n) : (uint64_t)n;
+    do
+    {
+        *--d = (uint8_t)('0' + v % 10);
+        v /= 10;
+    } while (v > 0);
+    if (n < 0)
+    {
+        *--d = '-';
+    }
+
+    uint32_t len = (uint32_t)(digits + sizeof(digits) - d);
+    buf[0] = type;
+    memcpy(buf + 1, d, len);
+    buf[len + 1] = '\r';
+    buf[len + 2] = '\n';
+
+    return len + 3;
+}
+
+bool NcRedis::fragmentable(NcMsg *r)
+{
+    const NcRedisCommand *cmd = command(r);
+    if (cmd == NULL)
+    {
+        return false;
+    }
+
+    switch (cmd->type)
+    {
+    case kREDIS_CMD_MGET:
+    case kREDIS_CMD_DEL:
+    case kREDIS_CMD_UNLINK:
+    case kREDIS_CMD_EXISTS:
+    case kREDIS_CMD_TOUCH:
+    case kREDIS_CMD_MSET:
+        return true;
+
+    default:
+        return false;
+    }
+}
+
+/* the value after an mset key, re-encoded as a bulk */
+rstatus_t NcRedis::appendValue(NcMsgReader &reader, NcMsg *sub, NcContext *ctx)
+{
+    uint8_t buf[32];
+    uint32_t n;
+    int c = reader.peek();
+    rstatus_t status;
+
+    if (c == '\r')
+    {
+        /* multibulk: the key's CRLF, then "$<len>\r\n<value>\r\n" */
+        int64_t len;
+        if (reader.getc() != '\r' || reader.getc() != '\n' || reader.getc() != '$' ||
+            !reader.readInteger(&len) || len < 0)
+        {
+            return NC_ERROR;
+        }
+
+        n = redisHeader(buf, '$', len);
+        status = sub->append(ctx, buf, n);
+        if (status != NC_OK)
+        {
+            return status;
+        }
+        return reader.copyTo(sub, ctx, (uint32_t)len + 2);
+    }
+
+    /* inline: the next blank separated token */
+    while (c == ' ' || c == '\t')
+    {
+        reader.getc();
+        c = reader.peek();
+    }
+
+    NcMsgReader probe = reader;
+    uint32_t len = 0;
+    for (c = probe.getc(); c >= 0 && c != ' ' && c != '\t' && c != '\r' && c != '\n';
+        c = probe.getc())
+    {
+        len++;
+    }
+
+    n = redisHeader(buf, '$', len);
+    status = sub->append(ctx, buf, n);
+    if (status == NC_OK)
+    {
+        status = reader.copyTo(sub, ctx, len);
+    }
+    if (status == NC_OK)
+    {
+        status = sub->append(ctx, (uint8_t *)CRLF, CRLF_LEN);
+    }
+
+    return status;
+}
+
+rstatus_t NcRedis::fragment(NcMsg *r, std::vector<NcMsg*> &subs, NcContext *ctx)
+{
+    const NcRedisCommand *cmd = command(r);
+    std::vector<uint32_t> &seq = r->m_frag_seq_;
+    ASSERT(cmd != NULL && seq.size() == r->m_keys_.size());
+
+    uint32_t step = cmd->type == kREDIS_CMD_MSET ? 2 : 1;
+    uint32_t namelen = (uint32_t)strlen(cmd->name);
+    uint8_t buf[128];
+    uint32_t n;
+    rstatus_t status;
+
+    /* "*<narg>\r\n$<len>\r\n<name>\r\n", narg from the # keys of each */
+    for (uint32_t f = 0; f < subs.size(); f++)
+    {
+        subs[f]->m_narg_ = 1;
+    }
+    for (uint32_t i = 0; i < seq.size(); i++)
+    {
+        subs[seq[i]]->m_narg_ += step;
+    }
+    for (uint32_t f = 0; f < subs.size(); f++)
+    {
+        n = redisHeader(buf, '*', subs[f]->m_narg_);
+        n += redisHeader(buf + n, '$', namelen);
+        memcpy(buf + n, cmd->name, namelen);
+        memcpy(buf + n + namelen, CRLF, CRLF_LEN);
+        status = subs[f]->append(ctx, buf, n + namelen + CRLF_LEN);
+        if (status != NC_OK)
+        {
+            return status;
+        }
+    }
+
+    NcMsgReader reader(r);
+    for (uint32_t i = 0; i < seq.size(); i++)
+    {
+        NcMsg *sub = subs[seq[i]];
+        NcKeypos &key = r->m_keys_[i];
+        uint32_t keylen = key.length();
+
+        /* a key is copied in one piece, route on the copy */
+        n = redisHeader(buf, '$', keylen);
+        if (n + keylen + CRLF_LEN <= sizeof(buf))
+        {
+            memcpy(buf + n, key.start, keylen);
+            memcpy(buf + n + keylen, CRLF, CRLF_LEN);
+            status = sub->append(ctx, buf, n + keylen + CRLF_LEN);
+        }
+        else
+        {
+            status = sub->append(ctx, buf, n);
+            if (status == NC_OK)
+            {
+                status = sub->append(ctx, key.start, keylen);
+            }
+            if (status == NC_OK)
+            {
+                status = sub->append(ctx, (uint8_t *)CRLF, CRLF_LEN);
+            }
+        }
+        if (status != NC_OK)
+        {
+            return status;
+        }
+
+        uint8_t *last = sub->m_mbuf_queue_.back()->getLast() - CRLF_LEN;
+        sub->m_keys_.push_back(NcKeypos(last - keylen, last));
+
+        if (step == 2)
+        {
+            if (!reader.seek(key.end))
+            {
+                return NC_ERROR;
+            }
+            status = appendValue(reader, sub, ctx);
+            if (status != NC_OK)
+            {
+                return status;
+            }
+        }
+    }
+
+    return NC_OK;
+}
+
+bool NcRedis::collapsible(NcMsg *r)
+{
+    const NcRedisCommand *cmd = command(r);
+    return cmd != NULL && (cmd->flags & REDIS_CMD_READ) && cmd->type != kREDIS_CMD_TOUCH &&
+        r->m_keys_.size() == 1;
+}
+
+bool NcRedis::cacheable(NcMsg *r)
+{
+    const NcRedisCommand *cmd = command(r);
+    return cmd != NULL && cmd->type == kREDIS_CMD_GET && r->m_keys_.size() == 1;
+}
+
+bool NcRedis::cacheableReply(NcMsg *rsp)
+{
+    NcMsgReader reader(rsp);
+    return reader.peek() == '$';
+}
+
+bool NcRedis::mutating(NcMsg *r)
+{
+    const NcRedisCommand *cmd = command(r);
+    return cmd != NULL && (cmd->flags & REDIS_CMD_WRITE) && !r->m_keys_.empty();
+}
+
+rstatus_t NcRedis::error(NcMsg *rsp, NcContext *ctx, err_t err)
+{
+    rsp->freeMbuf(ctx);
+    rsp->setLength(0);
+
+    char buf[128];
+    int n = snprintf(buf, sizeof(buf), "-ERR %s\r\n", strerror(err != 0 ? err : EINVAL));
+    return rsp->append(ctx, (uint8_t *)buf, (size_t)MIN(n, (int)sizeof(buf) - 1));
+}
+
+rstatus_t NcRedis::coalesce(NcMsg *r, std::vector<NcMsg*> &frags, NcContext *ctx)
+{
+    NcMsg *rsp = (NcMsg *)r->m_peer_;
+    const NcRedisCommand *cmd = command(r);
+    ASSERT(rsp != NULL && cmd != NULL);
+
+    if (r->m_ferror_)
+    {
+        return error(rsp, ctx, r->m_err_);
+    }
+
+    /* an error from any server is the reply */
+    std::vector<NcMsgReader> readers(frags.size());
+    for (uint32_t f = 0; f < frags.size(); f++)
+    {
+        NcMsg *frsp = (NcMsg *)frags[f]->m_peer_;
+        ASSERT(frsp != NULL);
+        readers[f].reset(frsp);
+        if (readers[f].peek() == '-')
+        {
+            return readers[f].copyTo(rsp, ctx, frsp->m_mlen_);
+        }
+    }
+
+    uint8_t buf[32];
+    uint32_t n;
+    int64_t v, sum = 0;
+    rstatus_t status;
+
+    switch (cmd->type)
+    {
+    case kREDIS_CMD_MGET:
+        for (uint32_t f = 0; f < readers.size(); f++)
+        {
+            if (readers[f].getc() != '*' || !readers[f].readInteger(&v))
+            {
+                goto invalid;
+            }
+        }
+
+        n = redisHeader(buf, '*', (int64_t)r->m_keys_.size());
+        status = rsp->append(ctx, buf, n);
+        if (status != NC_OK)
+        {
+            return status;
+        }
+
+        for (uint32_t i = 0; i < r->m_keys_.size(); i++)
+        {
+            NcMsgReader &reader = readers[r->m_frag_seq_[i]];
+            if (reader.getc() != '$' || !reader.readInteger(&v))
+            {
+                goto invalid;
+            }
+
+            if (v < 0)
+            {
+                status = rsp->append(ctx, (uint8_t *)"$-1\r\n", 5);
+            }
+            else
+            {
+                n = redisHeader(buf, '$', v);
+                status = rsp->append(ctx, buf, n);
+                if (status == NC_OK)
+                {
+                    /* the value and its CRLF, sliced when long */
+                    status = reader.copyTo(rsp, ctx, (uint32_t)v + 2);
+                }
+            }
+
+            if (status == NC_ERROR)
+            {
+                goto invalid;
+            }
+            if (status != NC_OK)
+            {
+                return status;
+            }
+        }
+        break;
+
+    case kREDIS_CMD_MSET:
+        for (uint32_t f = 0; f < readers.size(); f++)
+        {
+            if (readers[f].getc() != '+')
+            {
+                goto invalid;
+            }
+        }
+        return rsp->append(ctx, (uint8_t *)"+OK\r\n", 5);
+
+    default:
+        /* del, unlink, exists, touch: the sum of the counts */
+        for (uint32_t f = 0; f < readers.size(); f++)
+        {
+            if (readers[f].getc() != ':' || !readers[f].readInteger(&v))
+            {
+                goto invalid;
+            }
+            sum += v;
+        }
+
+        n = redisHeader(buf, ':', sum);
+        return rsp->append(ctx, buf, n);
+    }
+
+    return NC_OK;
+
+invalid:
+    LOG_ERROR("bad fragment reply for req %" PRIu64 " '%s'", r->m_id_, cmd->name);
+    return error(rsp, ctx, EINVAL);
+}
@@ -0,0 +1,117 @@
+#ifndef _NC_REDIS_H_
+#define _NC_REDIS_H_
+
+#include <nc_message.h>
+
+#define NC_REDIS_MAX_NARG       (1024 * 1024)           /* max # args of a request */
+#define NC_REDIS_MAX_BULK       (512 * 1024 * 1024)     /* max bulk length */
+#define NC_REDIS_MAX_TOKEN      (MBUF_LARGE_SIZE - MBUF_HSIZE) /* max command / key length */
+#define NC_REDIS_INLINE_MAX     (64 * 1024)             /* max inline request line */
+
+/* commands the proxy itself has to tell apart */
+typedef enum
+{
+    kREDIS_CMD_OTHER,
+    kREDIS_CMD_GET,
+    kREDIS_CMD_MGET,
+    kREDIS_CMD_DEL,
+    kREDIS_CMD_UNLINK,
+    kREDIS_CMD_EXISTS,
+    kREDIS_CMD_TOUCH,
+    kREDIS_CMD_MSET,
+    kREDIS_CMD_PING,
+    kREDIS_CMD_QUIT,
+    kREDIS_CMD_EVAL,
+} NcRedisCmdType;
+
+#define REDIS_CMD_READ      0x01    /* reads keys only */
+#define REDIS_CMD_WRITE     0x02    /* may modify keys */
+#define REDIS_CMD_LOCAL     0x04    /* answered by the proxy */
+#define REDIS_CMD_QUIT      0x08    /* closes the client connection */
+#define REDIS_CMD_NUMKEYS   0x10    /* keys follow a numkeys argument (eval) */
+
+/*
+ * Key layout of a command, as in redis' own command table: arity counts
+ * the command name, negative means at least -arity args. Keys are the args
+ * first, first + step, ... up to last, where a negative last counts from
+ * the end. For REDIS_CMD_NUMKEYS commands arg first - 1 holds the number
+ * of keys that start at first.
+ */
+class NcRedisCommand
+{
+public:
+    const char      *name;
+    NcRedisCmdType  type;
+    int             arity;
+    int             first;
+    int             last;
+    int             step;
+    uint32_t        flags;
+};
+
+/*
+ * Incremental RESP parser. Requests are multibulk ("*<n>\r\n$<len>\r\n...")
+ * or inline ("GET foo\r\n"); replies are status, error, integer, bulk and
+ * (nested) multibulk. Everything is scanned in place in the message's last
+ * mbuf and parsing resumes where the previous read stopped. Only the
+ * command name and the keys need to be contiguous: when one of them runs
+ * past a full mbuf the parser asks for a repair, values are skipped
+ * wherever they lie. Keys are recorded as NcKeypos pointing into the
+ * mbufs.
+ */
+class NcRedis
+{
+public:
+    static void parseRequest(NcMsg *r);
+
+    static void parseResponse(NcMsg *r);
+
+    // 填充本地应答的请求的响应
+    static rstatus_t reply(NcMsg *r, NcContext *ctx);
+
+    static const NcRedisCommand* lookup(const uint8_t *name, uint32_t len);
+
+    /* command of a parsed request, NULL if not parsed yet */
+    static const NcRedisCommand* command(NcMsg *r);
+
+    /*
+     * mget, del, unlink, exists, touch and mset are split by key when
+     * their keys live on several servers. fragment() fills subs[f] with
+     * the command for the keys of fragment f of r, coalesce() merges the
+     * replies of the fragments, in key order, into the reply of r.
+     */
+    static bool fragmentable(NcMsg *r);
+
+    static rstatus_t fragment(NcMsg *r, std::vector<NcMsg*> &subs, NcContext *ctx);
+
+    static rstatus_t coalesce(NcMsg *r, std::vector<NcMsg*> &frags, NcContext *ctx);
+
+    /* a read of a single key, which identical requests may share a reply of */
+    static bool collapsible(NcMsg *r);
+
+    /* a get of a single key, which the near cache may answer */
+    static bool cacheable(NcMsg *r);
+
+    /* a bulk reply (or nil) the near cache may keep */
+    static bool cacheableReply(NcMsg *rsp);
+
+    /* a command that may modify its keys */
+    static bool mutating(NcMsg *r);
+
+    // 请求失败时的错误响应
+    static rstatus_t error(NcMsg *rsp, NcContext *ctx, err_t err);
+
+private:
+    static rstatus_t appendValue(NcMsgReader &reader, NcMsg *sub, NcContext *ctx);
+
+
+    static bool isKey(NcMsg *r, const NcRedisCommand *cmd, uint32_t argi);
+
+    static bool setCommand(NcMsg *r, const uint8_t *name, uint32_t len);
+
+    static bool parseInline(NcMsg *r, uint8_t *start, uint8_t *end);
+
+    static bool requestDone(NcMsg *r);
+};
+
+#endif
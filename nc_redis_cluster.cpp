@@ -0,0 +1,455 @@
+#include <nc_redis_cluster.h>
+#include <nc_server.h>
+#include <nc_hashkit.h>
+
+#define REDIS_CLUSTER_SLOTS_CMD     "*2\r\n$7\r\nCLUSTER\r\n$5\r\nSLOTS\r\n"
+#define REDIS_CLUSTER_ASKING_CMD    "*1\r\n$6\r\nASKING\r\n"
+#define REDIS_CLUSTER_MAX_LINE      256     /* longest error line looked at for a redirect */
+
+uint32_t NcRedisCluster::slot(const uint8_t *key, uint32_t keylen)
+{
+    if (keylen == 0)
+    {
+        return 0;
+    }
+
+    /* the first {...} with something in it, as redis does */
+    nc_hashtag((uint8_t **)&key, &keylen, '{', '}');
+
+    NcHashUtil util;
+    return util.crc16Hash((const char *)key, keylen) & (REDIS_CLUSTER_SLOTS - 1);
+}
+
+void NcRedisCluster::init(NcServerPool *pool)
+{
+    uint32_t nserver = (uint32_t)pool->server.size();
+    ASSERT(nserver > 0 && nserver <= REDIS_CLUSTER_MAX_SERVERS);
+
+    pool->slots.resize(REDIS_CLUSTER_SLOTS);
+    for (uint32_t i = 0; i < REDIS_CLUSTER_SLOTS; i++)
+    {
+        pool->slots[i] = (uint16_t)(i * nserver / REDIS_CLUSTER_SLOTS);
+    }
+
+    pool->slots_refresh = 1;
+    pool->slots_sent = 0;
+    pool->slots_next = 0;
+}
+
+NcMsg* NcRedisCluster::command(NcContext *ctx, const char *cmd, uint32_t len)
+{
+    NcMsg *r = (NcMsg*)(ctx->msg_pool).alloc<NcMsg>();
+    if (r == NULL)
+    {
+        return NULL;
+    }
+
+    if (r->append(ctx, (uint8_t *)cmd, len) != NC_OK)
+    {
+        r->freeMbuf(ctx);
+        (ctx->msg_pool).free(r);
+        return NULL;
+    }
+
+    r->m_request_ = 1;
+    r->m_swallow_ = 1;
+    r->setProtocolType(kPROTOCOL_REDIS);
+
+    return r;
+}
+
+void NcRedisCluster::refresh(NcServerPool *pool)
+{
+    int64_t now = NcUtil::ncCachedUsec();
+    if (pool->slots_refresh == 0 || now < pool->slots_refresh)
+    {
+        return ;
+    }
+
+    /* the one in flight may have been lost with its connection */
+    if (pool->slots_sent != 0 && now - pool->slots_sent < REDIS_CLUSTER_REFRESH_TIMEOUT)
+    {
+        return ;
+    }
+
+    NcContext *ctx = pool->ctx;
+    NcServer *server = pool->server[pool->slots_next++ % pool->server.size()];
+    NcConn *s_conn = server->getConn();
+    NcMsg *r = s_conn != NULL ?
+        command(ctx, REDIS_CLUSTER_SLOTS_CMD, sizeof(REDIS_CLUSTER_SLOTS_CMD) - 1) : NULL;
+    if (r == NULL)
+    {
+        LOG_WARN("refresh slots of pool '%.*s' from '%.*s' failed: %s", pool->name.length(),
+            pool->name.c_str(), server->getPname().length(), server->getPname().c_str(),
+            strerror(errno));
+        pool->slots_refresh = now + REDIS_CLUSTER_REFRESH_RETRY;
+        return ;
+    }
+
+    if (s_conn->m_imsg_q_.empty() && (ctx->getEvb()).addOutput(s_conn) != NC_OK)
+    {
+        s_conn->m_err_ = errno;
+        s_conn->freeMsg(r);
+        return ;
+    }
+
+    r->m_flags_ |= REDIS_CLUSTER_REFRESH;
+    r->setData(s_conn);
+    s_conn->enqueueInput(r);
+    pool->slots_sent = now;
+
+    LOG_DEBUG("refresh slots of pool '%.*s' from '%.*s' on s %d", pool->name.length(),
+        pool->name.c_str(), server->getPname().length(), server->getPname().c_str(),
+        s_conn->m_sd_);
+}
+
+static bool skipLine(NcMsgReader &reader)
+{
+    int c;
+    while ((c = reader.getc()) >= 0 && c != '\n');
+    return c == '\n';
+}
+
+static bool skipValue(NcMsgReader &reader, uint32_t depth)
+{
+    int64_t n;
+    switch (reader.getc())
+    {
+    case '+':
+    case '-':
+    case ':':
+        return skipLine(reader);
+
+    case '$':
+        if (!reader.readInteger(&n))
+        {
+            return false;
+        }
+        for (n = n < 0 ? 0 : n + 2; n > 0; n--)
+        {
+            if (reader.getc() < 0)
+            {
+                return false;
+            }
+        }
+        return true;
+
+    case '*':
+        if (depth >= NC_MSG_MAX_DEPTH || !reader.readInteger(&n))
+        {
+            return false;
+        }
+        for (; n > 0; n--)
+        {
+            if (!skipValue(reader, depth + 1))
+            {
+                return false;
+            }
+        }
+        return true;
+
+    default:
+        return false;
+    }
+}
+
+static bool readNumber(NcMsgReader &reader, int64_t *n)
+{
+    return reader.getc() == ':' && reader.readInteger(n);
+}
+
+/* a bulk string no longer than size */
+static bool readBulk(NcMsgReader &reader, uint8_t *buf, uint32_t size, uint32_t *len)
+{
+    int64_t n;
+    if (reader.getc() != '$' || !reader.readInteger(&n) || n < 0 || n > size)
+    {
+        return false;
+    }
+
+    for (int64_t i = 0; i < n; i++)
+    {
+        int c = reader.getc();
+        if (c < 0)
+        {
+            return false;
+        }
+        buf[i] = (uint8_t)c;
+    }
+    *len = (uint32_t)n;
+
+    return reader.getc() == '\r' && reader.getc() == '\n';
+}
+
+/*
+ * *<n> of
+ *   *<m>: start slot, end slot, master [host, port, id...], replicas...
+ */
+bool NcRedisCluster::loadSlots(NcMsg *rsp, NcServerPool *pool, NcServer *from)
+{
+    NcMsgReader reader(rsp);
+    int64_t nrange, nelem, start, end, nfield, port;
+    uint8_t host[NI_MAXHOST];
+    uint32_t hostlen;
+    std::vector<uint32_t> ranges;
+
+    if (reader.peek() == '-')
+    {
+        uint8_t line[REDIS_CLUSTER_MAX_LINE];
+        uint32_t len = 0;
+        reader.readLine(line, sizeof(line), &len);
+        LOG_WARN("CLUSTER SLOTS on '%.*s' failed: %.*s", from->getPname().length(),
+            from->getPname().c_str(), len, line);
+        return false;
+    }
+
+    if (reader.getc() != '*' || !reader.readInteger(&nrange) || nrange < 0)
+    {
+        return false;
+    }
+
+    for (int64_t i = 0; i < nrange; i++)
+    {
+        if (reader.getc() != '*' || !reader.readInteger(&nelem) || nelem < 3 ||
+            !readNumber(reader, &start) || !readNumber(reader, &end) ||
+            start < 0 || start > end || end >= REDIS_CLUSTER_SLOTS)
+        {
+            return false;
+        }
+
+        if (reader.getc() != '*' || !reader.readInteger(&nfield) || nfield < 2 ||
+            !readBulk(reader, host, sizeof(host), &hostlen) || !readNumber(reader, &port) ||
+            !NcUtil::ncValidPort((int)port))
+        {
+            return false;
+        }
+
+        /* node id and whatever newer servers add, then the replicas */
+        for (int64_t f = 2; f < nfield; f++)
+        {
+            if (!skipValue(reader, 2))
+            {
+                return false;
+            }
+        }
+        for (int64_t e = 3; e < nelem; e++)
+        {
+            if (!skipValue(reader, 1))
+            {
+                return false;
+            }
+        }
+
+        /* an empty host is the node that answered */
+        uint32_t idx = hostlen > 0 ? pool->serverIndex(host, hostlen, (int)port) :
+            from->getIdx();
+        if (idx == UINT32_MAX)
+        {
+            return false;
+        }
+
+        ranges.push_back((uint32_t)start);
+        ranges.push_back((uint32_t)end);
+        ranges.push_back(idx);
+    }
+
+    for (uint32_t r = 0; r < ranges.size(); r += 3)
+    {
+        for (uint32_t s = ranges[r]; s <= ranges[r + 1]; s++)
+        {
+            pool->slots[s] = (uint16_t)ranges[r + 2];
+        }
+    }
+
+    LOG_DEBUG("pool '%.*s' loaded %" PRIu32 " slot ranges from '%.*s', %" PRIu32 " servers",
+        pool->name.length(), pool->name.c_str(), (uint32_t)(ranges.size() / 3),
+        from->getPname().length(), from->getPname().c_str(), (uint32_t)pool->server.size());
+
+    return true;
+}
+
+bool NcRedisCluster::parseRedirect(const uint8_t *line, uint32_t len, bool *ask,
+    uint32_t *slot, NcStringView *host, int *port)
+{
+    const uint8_t *p, *end = line + len;
+    if (len > 7 && memcmp(line, "-MOVED ", 7) == 0)
+    {
+        *ask = false;
+        p = line + 7;
+    }
+    else if (len > 5 && memcmp(line, "-ASK ", 5) == 0)
+    {
+        *ask = true;
+        p = line + 5;
+    }
+    else
+    {
+        return false;
+    }
+
+    uint32_t n = 0;
+    const uint8_t *q = p;
+    for (; q < end && *q >= '0' && *q <= '9'; q++)
+    {
+        n = n * 10 + (*q - '0');
+        if (n >= REDIS_CLUSTER_SLOTS)
+        {
+            return false;
+        }
+    }
+    if (q == p || q == end || *q != ' ')
+    {
+        return false;
+    }
+    *slot = n;
+
+    /* host:port, the host may be an IPv6 address or empty */
+    p = q + 1;
+    q = end;
+    while (q > p && q[-1] != ':')
+    {
+        q--;
+    }
+    if (q == p || q == end)
+    {
+        return false;
+    }
+
+    *port = nc_atoi(q, (end - q));
+    if (!NcUtil::ncValidPort(*port))
+    {
+        return false;
+    }
+    *host = NcStringView(p, (uint32_t)(q - 1 - p));
+
+    return true;
+}
+
+rstatus_t NcRedisCluster::redirect(NcMsg *req, NcConn *s_conn, NcServer *server, bool ask,
+    NcContext *ctx)
+{
+    NcConn *t_conn = server->getConn();
+    if (t_conn == NULL)
+    {
+        return NC_ERROR;
+    }
+
+    NcMsg *asking = NULL;
+    if (ask)
+    {
+        asking = command(ctx, REDIS_CLUSTER_ASKING_CMD, sizeof(REDIS_CLUSTER_ASKING_CMD) - 1);
+        if (asking == NULL)
+        {
+            return NC_ENOMEM;
+        }
+        asking->setData(t_conn);
+    }
+
+    if (t_conn->m_imsg_q_.empty() && (ctx->getEvb()).addOutput(t_conn) != NC_OK)
+    {
+        t_conn->m_err_ = errno;
+        if (asking != NULL)
+        {
+            t_conn->freeMsg(asking);
+        }
+        return NC_ERROR;
+    }
+
+    s_conn->dequeueOutput(req);
+
+    /* sent again from the first byte */
+    NcMbufQueue *queue = req->getMbufQueue();
+    for (NcMbuf *mbuf = queue->front(); mbuf != NULL; mbuf = queue->next(mbuf))
+    {
+        mbuf->rewindPos();
+    }
+    req->m_flags_++;
+
+    if (asking != NULL)
+    {
+        t_conn->enqueueInput(asking);
+    }
+    t_conn->enqueueInput(req);
+
+    LOG_DEBUG("redirect req %" PRIu64 " to '%.*s' on s %d%s", req->m_id_,
+        server->getPname().length(), server->getPname().c_str(), t_conn->m_sd_,
+        ask ? " asking" : "");
+
+    return NC_OK;
+}
+
+bool NcRedisCluster::responseFilter(NcMsg *rsp, NcMsg *req, NcConn *s_conn)
+{
+    NcServer *server = (NcServer*)(s_conn->m_owner_);
+    NcServerPool *pool = server->getServerPool();
+    if (pool->dist_type != kDIST_REDIS_CLUSTER)
+    {
+        return false;
+    }
+
+    NcContext *ctx = (NcContext*)(s_conn->getContext());
+    int64_t now = NcUtil::ncCachedUsec();
+
+    if (req->m_flags_ & REDIS_CLUSTER_REFRESH)
+    {
+        s_conn->dequeueOutput(req);
+        req->m_done_ = 1;
+        pool->slots_sent = 0;
+        if (loadSlots(rsp, pool, server))
+        {
+            pool->slots_refresh = 0;
+        }
+        else
+        {
+            LOG_WARN("bad CLUSTER SLOTS reply from '%.*s'", server->getPname().length(),
+                server->getPname().c_str());
+            pool->slots_refresh = now + REDIS_CLUSTER_REFRESH_RETRY;
+        }
+
+        s_conn->freeMsg(req);
+        s_conn->freeMsg(rsp, false);
+        return true;
+    }
+
+    if (req->m_swallow_ || (req->m_flags_ & REDIS_REDIRECT_MASK) >= REDIS_CLUSTER_MAX_REDIRECT)
+    {
+        return false;
+    }
+
+    NcMsgReader reader(rsp);
+    uint8_t line[REDIS_CLUSTER_MAX_LINE];
+    uint32_t len, slot;
+    NcStringView host;
+    int port;
+    bool ask;
+    if (reader.peek() != '-' || !reader.readLine(line, sizeof(line), &len) ||
+        !parseRedirect(line, len, &ask, &slot, &host, &port))
+    {
+        return false;
+    }
+
+    uint32_t idx = host.empty() ? server->getIdx() :
+        pool->serverIndex(host.data(), host.length(), port);
+    if (idx == UINT32_MAX)
+    {
+        return false;
+    }
+
+    if (!ask)
+    {
+        pool->slots[slot] = (uint16_t)idx;
+        if (pool->slots_refresh == 0)
+        {
+            pool->slots_refresh = now + REDIS_CLUSTER_REFRESH_DELAY;
+        }
+    }
+
+    /* the client gets the redirect if the new server cannot be reached */
+    if (redirect(req, s_conn, pool->server[idx], ask, ctx) != NC_OK)
+    {
+        return false;
+    }
+
+    s_conn->freeMsg(rsp, false);
+    return true;
+}
@@ -0,0 +1,73 @@
+#ifndef _NC_REDIS_CLUSTER_H_
+#define _NC_REDIS_CLUSTER_H_
+
+#include <nc_redis.h>
+
+class NcServer;
+class NcServerPool;
+
+#define REDIS_CLUSTER_SLOTS             16384
+#define REDIS_CLUSTER_MAX_SERVERS       65535           /* server index is kept in 16 bits */
+#define REDIS_CLUSTER_MAX_REDIRECT      5               /* MOVED / ASK followed per request */
+#define REDIS_CLUSTER_REFRESH_TIMEOUT   (1000 * 1000LL) /* CLUSTER SLOTS given up after, in usec */
+#define REDIS_CLUSTER_REFRESH_RETRY     (1000 * 1000LL) /* retry after a failed refresh, in usec */
+#define REDIS_CLUSTER_REFRESH_DELAY     (100 * 1000LL)  /* refresh after a MOVED, in usec */
+
+/* NcMsg::m_flags_ of a redis request */
+#define REDIS_REDIRECT_MASK     0x000000ff  /* # redirects followed */
+#define REDIS_CLUSTER_REFRESH   0x00000100  /* CLUSTER SLOTS of the proxy */
+
+/*
+ * Routing for redis cluster (distribution: redis_cluster). The servers of
+ * the pool are only seeds: the slot of a key, CRC16 of the key or of its
+ * {hash tag} modulo 16384, is looked up in a flat table of the server
+ * owning each slot, and servers named by the cluster are added to the
+ * pool as they show up.
+ *
+ * The table is loaded with CLUSTER SLOTS, sent by the proxy on a server
+ * connection like any request, on the first request and again shortly
+ * after a MOVED; until it is loaded the slots are split evenly among the
+ * seeds. A MOVED reply updates the slot it names at once and the request
+ * is sent again to the new owner; an ASK reply sends the request, after
+ * an ASKING, to the server named without touching the table. Requests are
+ * redirected at most REDIS_CLUSTER_MAX_REDIRECT times, after that the
+ * client gets the redirect.
+ */
+class NcRedisCluster
+{
+public:
+    /* slot of a key, with hash tag semantics */
+    static uint32_t slot(const uint8_t *key, uint32_t keylen);
+
+    /* spread the slots among the seed servers */
+    static void init(NcServerPool *pool);
+
+    /* send CLUSTER SLOTS if a refresh is due and none is in flight */
+    static void refresh(NcServerPool *pool);
+
+    /*
+     * Load the reply to CLUSTER SLOTS, or send a request redirected by
+     * MOVED / ASK to its new server. Returns true if the reply has been
+     * consumed.
+     */
+    static bool responseFilter(NcMsg *rsp, NcMsg *req, NcConn *s_conn);
+
+    /* apply a CLUSTER SLOTS reply to the table; false if it is malformed */
+    static bool loadSlots(NcMsg *rsp, NcServerPool *pool, NcServer *from);
+
+    /*
+     * Parse a "-MOVED <slot> <host>:<port>" or "-ASK ..." error line;
+     * false if line is not a redirect.
+     */
+    static bool parseRedirect(const uint8_t *line, uint32_t len, bool *ask,
+        uint32_t *slot, NcStringView *host, int *port);
+
+private:
+    static NcMsg* command(NcContext *ctx, const char *cmd, uint32_t len);
+
+    /* move req from s_conn to server, after an ASKING if ask */
+    static rstatus_t redirect(NcMsg *req, NcConn *s_conn, NcServer *server, bool ask,
+        NcContext *ctx);
+};
+
+#endif
@@ -1,6 +1,10 @@
 #include <nc_server.h>
 #include <nc_message.h>
 #include <nc_hashkit.h>
+#include <nc_mysql.h>
+#include <nc_redis_cluster.h>
+
+#define NC_INDEX_BATCH  64  /* keys hashed together by index() of a batch */
 
 NcConn* NcServer::getConn()
 {
@@ -17,16 +21,51 @@ NcConn* NcServer::getConn()
         return NULL;
     }
 
-    if (m_ns_conn_q_ < m_server_pool_->server_connections) 
+    if (m_ns_conn_q_ >= m_server_pool_->server_connections) 
     {
-        return (NcConn*)(m_server_pool_->ctx->s_pool).alloc<NcServerConn>();
+        // 被pin住的连接只给它的client用
+        for (uint32_t i = 0; i < m_ns_conn_q_; i++)
+        {
+            NcConn *conn = (NcConn*)m_conn_queue_.front();
+            m_conn_queue_.rotate();
+            if (conn->m_pinned_ == NULL && conn->m_pin_ == 0)
+            {
+                return conn;
+            }
+        }
+
+        if (m_ns_conn_q_ >= m_server_pool_->server_max_connections)
+        {
+            LOG_WARN("server '%.*s' has all %" PRIu32 " connections pinned, "
+                "server_max_connections reached", m_pname_.length(), m_pname_.c_str(),
+                m_ns_conn_q_);
+            errno = EBUSY;
+            return NULL;
+        }
+
+        /* all pinned: one more for the others, closed once it is released */
+        LOG_DEBUG("server '%.*s' has all %" PRIu32 " connections pinned, opening another",
+            m_pname_.length(), m_pname_.c_str(), m_ns_conn_q_);
     }
 
-    NcConnBase *conn = m_conn_queue_.front();
-    m_conn_queue_.remove(conn);
-    m_conn_queue_.push(conn);
+    NcServerConn *conn = (NcServerConn*)(ctx->s_pool).alloc<NcServerConn>();
+    if (conn == NULL)
+    {
+        return NULL;
+    }
 
-    return (NcConn*)conn;
+    conn->ref(this);
+    if (conn->connect() != NC_OK)
+    {
+        LOG_WARN("connect to server '%.*s' failed: %s", m_pname_.length(),
+            m_pname_.c_str(), strerror(errno));
+        err_t err = conn->m_err_;
+        conn->close();
+        errno = err;
+        return NULL;
+    }
+
+    return conn;
 }
 
 void NcServer::failure()
@@ -54,7 +93,7 @@ void NcServer::failure()
         return;
     }
 
-    now = NcUtil::ncUsecNow();
+    now = NcUtil::ncCachedUsec();
     if (now < 0) 
     {
         LOG_DEBUG("now %d < 0", now);
@@ -103,6 +142,9 @@ void NcServerPool::setConf(NcConfPool *_pool)
 
     nlive_server = 0;
     next_rebuild = 0LL;
+    next_server = 0;
+    ncontinuum = 0;
+    continuum_shift = 31;
 
     name = _pool->name;
     addrstr = _pool->listen.pname;
@@ -119,78 +161,216 @@ void NcServerPool::setConf(NcConfPool *_pool)
 
     client_connections = (uint32_t)_pool->client_connections;
     server_connections = (uint32_t)_pool->server_connections;
+    // 不会比server_connections少
+    server_max_connections = (uint32_t)MAX(_pool->server_max_connections,
+        _pool->server_connections);
     server_retry_timeout = (int64_t)_pool->server_retry_timeout * 1000LL;
     server_failure_limit = (uint32_t)_pool->server_failure_limit;
+    http_key = &_pool->http_key;
+    mysql_user = _pool->mysql_user;
+    mysql_password = _pool->mysql_password;
+    mysql_db = _pool->mysql_db;
+    collapse = _pool->collapse ? 1 : 0;
+    ncollapse_lead = 0;
+    ncollapse_hit = 0;
+    cache.init(ctx, _pool->cache_size, (int64_t)_pool->cache_ttl * 1000LL);
+    dist_type = _pool->distribution != CONF_UNSET_NUM ? _pool->distribution : CONF_DEFAULT_DIST;
+    key_hash_type = _pool->hash != CONF_UNSET_NUM ? _pool->hash : CONF_DEFAULT_HASH;
+    hash_tag = _pool->hash_tag;
+    auto_eject_hosts = _pool->auto_eject_hosts ? 1 : 0;
+    maglev_size = (uint32_t)_pool->maglev_size;
 
     for (uint32_t i = 0; i < _pool->server.size(); i++)
     {
         NcServer *ns = new NcServer(this);
         ns->setConf((_pool->server)[i]);
+        ns->m_idx_ = i;
         server.push_back(ns);
     }
+
+    if (dist_type == kDIST_REDIS_CLUSTER)
+    {
+        if (_pool->protocol != kPROTOCOL_REDIS || server.empty())
+        {
+            LOG_WARN("pool '%.*s': redis_cluster needs protocol redis and a seed server, "
+                "using ketama", name.length(), name.c_str());
+            dist_type = CONF_DEFAULT_DIST;
+        }
+        else
+        {
+            NcRedisCluster::init(this);
+        }
+    }
+
+    if (update() != NC_OK)
+    {
+        LOG_ERROR("pool '%.*s': building the continuum failed", name.length(), name.c_str());
+    }
+}
+
+uint32_t NcServerPool::serverIndex(const uint8_t *host, uint32_t hostlen, int port)
+{
+    for (uint32_t i = 0; i < server.size(); i++)
+    {
+        NcServer *s = server[i];
+        if (s->m_port_ == port && NcStringView(host, hostlen) == s->m_name_)
+        {
+            return i;
+        }
+    }
+
+    if (server.size() >= REDIS_CLUSTER_MAX_SERVERS)
+    {
+        LOG_ERROR("pool '%.*s' has too many servers to add %.*s:%d", name.length(),
+            name.c_str(), hostlen, host, port);
+        return UINT32_MAX;
+    }
+
+    char buf[NI_MAXHOST + 16];
+    int n = snprintf(buf, sizeof(buf), "%.*s:%d:1", (int)hostlen, host, port);
+    if (n <= 0 || n >= (int)sizeof(buf))
+    {
+        return UINT32_MAX;
+    }
+
+    NcString value(buf, (uint32_t)n);
+    NcConfServer *cs = new NcConfServer();
+    if (cs->parse(value) != NC_OK)
+    {
+        nc_delete(cs);
+        return UINT32_MAX;
+    }
+    cluster_conf.push_back(cs);
+
+    NcServer *ns = new NcServer(this);
+    ns->setConf(cs);
+    ns->m_idx_ = (uint32_t)server.size();
+    ns->m_next_retry_ = 0LL;
+    ns->m_failure_count_ = 0;
+    server.push_back(ns);
+
+    LOG_DEBUG("pool '%.*s' learned server '%s'", name.length(), name.c_str(), buf);
+
+    return ns->m_idx_;
 }
 
 NcConn* NcServerPool::getConn(uint8_t *key, uint32_t keylen)
 {
     FUNCTION_INTO(NcServerPool);
 
+    if (dist_type == kDIST_REDIS_CLUSTER)
+    {
+        NcRedisCluster::refresh(this);
+    }
+
     uint32_t idx = index(key, keylen);
     LOG_DEBUG("server.size() : %d, idx : %d", server.size(), idx);
     NcServer* s = server[idx % server.size()];
     return s->getConn();
 }
 
-rstatus_t NcServerPool::update()
-{
-    return NcHashKit::update(this);
-}
-
-uint32_t NcServerPool::index(uint8_t *key, uint32_t keylen)
+NcConn* NcServerPool::nextConn()
 {
     FUNCTION_INTO(NcServerPool);
 
-    if (hash_tag.length() > 0)
+    uint32_t nserver = (uint32_t)server.size();
+    if (nserver == 0)
     {
-        uint8_t *tag_start = nc_strchr(key, key + keylen, (hash_tag.c_str())[0]);
-        if (tag_start != NULL) 
+        errno = ENOENT;
+        return NULL;
+    }
+
+    /* the live servers first; if all are ejected, any of them as a key would */
+    int64_t now = NcUtil::ncCachedUsec();
+    for (int pass = 0; pass < 2; pass++)
+    {
+        bool tried = false;
+        for (uint32_t i = 0; i < nserver; i++)
         {
-            uint8_t *tag_end = nc_strchr(tag_start + 1, key + keylen, (hash_tag.c_str())[1]);
-            if ((tag_end != NULL) && (tag_end - tag_start > 1)) 
+            NcServer *s = server[next_server++ % nserver];
+            bool ejected = auto_eject_hosts && s->getNextRetry() > now;
+            if (ejected != (pass == 1))
+            {
+                continue;
+            }
+
+            tried = true;
+            NcConn *conn = s->getConn();
+            if (conn != NULL)
             {
-                key = tag_start + 1;
-                keylen = (uint32_t)(tag_end - key);
+                return conn;
             }
         }
+
+        if (tried)
+        {
+            break;
+        }
     }
 
-    LOG_DEBUG("server.size() : %d", server.size());
+    return NULL;
+}
 
-    uint32_t hashv;
-    if (server.size() <= 1) 
-    {
-        hashv = 0;
-    }
+rstatus_t NcServerPool::update()
+{
+    return NcHashKit::update(this);
+}
 
-    LOG_DEBUG("keylen : %d", keylen);
+uint32_t NcServerPool::index(uint8_t *key, uint32_t keylen)
+{
+    FUNCTION_INTO(NcServerPool);
 
-    if (keylen == 0)
+    if (dist_type == kDIST_REDIS_CLUSTER)
     {
-        hashv = 0;
+        return slots[NcRedisCluster::slot(key, keylen)];
     }
 
-    // 计算hash值
-    hashv = NcHashKit::hash(key_hash_type, (char*)key, keylen);
+    LOG_DEBUG("server.size() : %d, keylen : %d", server.size(), keylen);
+
+    // 先找hash tag再计算hash值
+    uint32_t hashv = NcHashKit::hash(key_hash_type, key, keylen, hash_tag);
     LOG_DEBUG("hashv : %d", hashv);
 
     return NcHashKit::dispatch(this, hashv);
 }
 
+void NcServerPool::index(const NcKeypos *keys, uint32_t nkey, uint32_t *idx)
+{
+    FUNCTION_INTO(NcServerPool);
+
+    if (dist_type == kDIST_REDIS_CLUSTER)
+    {
+        for (uint32_t i = 0; i < nkey; i++)
+        {
+            idx[i] = slots[NcRedisCluster::slot(keys[i].start, keys[i].length())];
+        }
+        return ;
+    }
+
+    // 按NC_INDEX_BATCH个key一组放在栈上, 不分配内存;
+    // hash先放在idx里, 再换成server
+    uint8_t *key[NC_INDEX_BATCH];
+    uint32_t keylen[NC_INDEX_BATCH];
+    for (uint32_t off = 0; off < nkey; off += NC_INDEX_BATCH)
+    {
+        uint32_t n = nkey - off < NC_INDEX_BATCH ? nkey - off : NC_INDEX_BATCH;
+        for (uint32_t i = 0; i < n; i++)
+        {
+            key[i] = keys[off + i].start;
+            keylen[i] = keys[off + i].length();
+        }
+
+        NcHashKit::hash(key_hash_type, key, keylen, n, hash_tag, idx + off);
+        NcHashKit::dispatch(this, idx + off, n, idx + off);
+    }
+}
+
 void NcServerConn::ref(void *owner)
 {
     NcServer *server = (NcServer*)owner;
     ASSERT(server != NULL);
 
-    rstatus_t status = NcUtil::ncResolve(&server->m_addrstr_, server->m_port_, &server->m_info_);
+    rstatus_t status = NcUtil::ncResolve(server->m_addrstr_, server->m_port_, &server->m_info_);
     if (status != NC_OK) 
     {
         m_err_ = EHOSTDOWN;
@@ -259,9 +439,103 @@ void NcServerConn::close()
 {
     FUNCTION_INTO(NcServerConn);
 
-    // TODO :
+    NcServer *server = (NcServer*)m_owner_;
+    ASSERT(server != NULL);
+    NcContext *ctx = server->getContext();
+    ASSERT(ctx != NULL);
+
+    if (m_sd_ < 0)
+    {
+        server->failure();
+        this->unref();
+        (ctx->s_pool).free(this);
+        return ;
+    }
+
+    /* requests not sent yet, then those waiting for a reply */
+    failQueue(m_imsg_q_, true);
+    failQueue(m_omsg_q_, false);
+
+    NcMsgBase *msg = m_rmsg_;
+    if (msg != NULL)
+    {
+        m_rmsg_ = NULL;
+        LOG_DEBUG("close s %d discarding rsp %" PRIu64 " len %" PRIu32 " in error",
+            m_sd_, msg->m_id_, msg->m_mlen_);
+        freeMsg(msg, false);
+    }
+
+    if (m_pinned_ != NULL)
+    {
+        NcMysql::lost(this, ctx);
+    }
+
+    server->failure();
+    this->unref();
+
+    rstatus_t status = ::close(m_sd_);
+    if (status < 0)
+    {
+        LOG_ERROR("close s %d failed, ignored: %s", m_sd_, strerror(errno));
+    }
 
-    return ;
+    m_sd_ = -1;
+    (ctx->s_pool).free(this);
+}
+
+void NcServerConn::failQueue(NcTailQueue<NcMsgBase> &q, bool input)
+{
+    NcContext *ctx = (NcContext*)getContext();
+
+    NcMsgBase *msg, *nmsg;
+    for (msg = q.front(); msg != NULL; msg = nmsg)
+    {
+        nmsg = q.next(msg);
+        if (input)
+        {
+            dequeueInput(msg);
+        }
+        else
+        {
+            dequeueOutput(msg);
+        }
+
+        ((NcMsg*)msg)->fanout(this, NULL, m_err_ != 0 ? m_err_ : ECONNRESET);
+
+        /* nobody waits for it */
+        if (msg->m_swallow_ || msg->m_noreply_)
+        {
+            LOG_DEBUG("close s %d swallow req %" PRIu64 " len %" PRIu32 " type %d",
+                m_sd_, msg->m_id_, msg->m_mlen_, msg->m_type_);
+            freeMsg(msg);
+            continue;
+        }
+
+        msg->m_done_ = 1;
+        msg->m_error_ = 1;
+        msg->m_err_ = m_err_ != 0 ? m_err_ : ECONNRESET;
+        if (msg->m_frag_owner_ != NULL)
+        {
+            NcMsgBase *owner = msg->m_frag_owner_;
+            owner->m_nfrag_done_++;
+            owner->m_ferror_ = 1;
+            owner->m_err_ = msg->m_err_;
+        }
+
+        LOG_DEBUG("close s %d schedule error for req %" PRIu64 " len %" PRIu32 
+            " type %d: %s", m_sd_, msg->m_id_, msg->m_mlen_, msg->m_type_, 
+            strerror(msg->m_err_));
+
+        NcConn *c_conn = (NcConn*)(msg->data);
+        NcMsg *front = (NcMsg*)(c_conn->m_omsg_q_.front());
+        if (front != NULL && front->requestDone(c_conn))
+        {
+            if ((ctx->getEvb()).addOutput(c_conn) != NC_OK)
+            {
+                c_conn->m_err_ = errno;
+            }
+        }
+    }
 }
 
 rstatus_t NcServerConn::connect()
@@ -375,8 +649,7 @@ NcMsgBase* NcServerConn::sendNext()
     }
 
     rstatus_t status;
-    NcQueue<NcMsgBase*>::ConstIterator iter = m_imsg_q_.begin();
-    NcMsg *nmsg = (NcMsg*)(*iter);
+    NcMsg *nmsg = (NcMsg*)(m_imsg_q_.front());
 
     LOG_DEBUG("nmsg : %p", nmsg);
 
@@ -394,15 +667,13 @@ NcMsgBase* NcServerConn::sendNext()
     NcMsg *msg = (NcMsg*)m_smsg_;
     if (msg != NULL)
     {
-        iter++;
-        if (iter == m_imsg_q_.end())
-        {
-            nmsg = NULL;
-        }
-        else
-        {
-            nmsg = (NcMsg*)(*iter);
-        }
+        nmsg = (NcMsg*)(m_imsg_q_.next(msg));
+    }
+
+    // mysql: 登录完成前只发送握手包
+    if (nmsg != NULL && nmsg->m_type_ == kPROTOCOL_MYSQL && !NcMysql::sendable(nmsg, this))
+    {
+        nmsg = NULL;
     }
 
     LOG_DEBUG("nmsg : %p", nmsg);
@@ -483,6 +754,7 @@ NcMsgBase* NcServerConn::recvNext(bool alloc)
     if (msg != NULL) 
     {
         m_rmsg_ = msg;
+        msg->setProtocolType(ctx->protocol_type);
     }
 
     LOG_DEBUG("[2]conn : %p, m_rmsg_ : %p", this, m_rmsg_);
@@ -501,12 +773,16 @@ void NcServerConn::recvDone(NcMsgBase *cmsg, NcMsgBase *rmsg)
     
     LOG_DEBUG("msg mlen : %d", msg->m_mlen_);
 
-    if (msg->responseFilter(this)) 
+    if (!msg->responseFilter(this)) 
     {
-        return ;
+        msg->responseForward(this);
     }
 
-    msg->responseForward(this);
+    // 被client留下会话状态的连接, 空闲后关闭
+    if ((m_pin_ & MYSQL_PIN_DIRTY) && !active())
+    {
+        m_done_ = 1;
+    }
 }
 
 void* NcServerConn::getContext()
@@ -7,6 +7,8 @@
 #include <nc_conf.h>
 #include <nc_log.h>
 #include <nc_connection.h>
+#include <nc_cache.h>
+#include <unordered_map>
 
 /*
  * server_pool is a collection of servers and their continuum. Each
@@ -50,18 +52,20 @@
 class NcServerPool;
 class NcServerConn;
 class NcServer;
+class NcMsg;
+class NcKeypos;
 
 class NcContinuum 
 {
 public:
-    uint32_t index;  /* server index */
     uint32_t value;  /* hash value */
+    uint32_t index;  /* server index */
 };
 
 class NcServerPool
 {
 public:
-    NcServerPool(NcContext *_ctx)
+    NcServerPool(NcContext *_ctx) : nc_conn_q(0), c_conn_q(&NcConnBase::m_conn_tqe_)
     {
         ctx = _ctx;
     }
@@ -73,9 +77,9 @@ public:
             nc_delete(server[i]);
         }
 
-        for (uint32_t i = 0; i < server.size(); i++)
+        for (uint32_t i = 0; i < cluster_conf.size(); i++)
         {
-            nc_delete(continuum[i]);
+            nc_delete(cluster_conf[i]);
         }
     }
 
@@ -91,42 +95,98 @@ public:
 
     uint32_t index(uint8_t *key, uint32_t keylen);
 
+    /*
+     * Server indices of nkey keys of a multi-key request, as index() of
+     * each, hashed and looked up together.
+     */
+    void index(const NcKeypos *keys, uint32_t nkey, uint32_t *idx);
+
     NcConn* getConn(uint8_t *key, uint32_t keylen);
 
+    /*
+     * A connection to the live servers in turn, for requests that may go
+     * to any of them (mysql queries of clients that are not pinned).
+     */
+    NcConn* nextConn();
+
+    /*
+     * Index of the server at host:port, added to the pool if it is not
+     * one of its servers yet (redis_cluster); UINT32_MAX on error.
+     */
+    uint32_t serverIndex(const uint8_t *host, uint32_t hostlen, int port);
+
 public:
     uint32_t           idx;                  /* pool index */
     NcContext          *ctx;                 /* owner context */
 
     NcConnBase         *p_conn;             /* proxy connection (listener) */
     uint32_t           nc_conn_q;           /* # client connection */
-    NcQueue<NcConnBase*>   c_conn_q;        /* client connection q */
+    NcTailQueue<NcConnBase> c_conn_q;       /* client connection q */
 
     std::vector<NcServer*>  server;          /* server[] */
     uint32_t           nlive_server;         /* # live server */
     int64_t            next_rebuild;         /* next distribution rebuild time in usec */
+    uint32_t           next_server;          /* server tried first by nextConn() */
 
-    NcString           name;                 /* pool name (ref in conf_pool) */
-    NcString           addrstr;              /* pool address - hostname:port (ref in conf_pool) */
+    NcStringView       name;                 /* pool name (ref in conf_pool) */
+    NcStringView       addrstr;              /* pool address - hostname:port (ref in conf_pool) */
     uint16_t           port;                 /* port */
     struct sockinfo    info;                 /* listen socket info */
     mode_t             perm;                 /* socket permission */
     int                dist_type;            /* distribution type (dist_type_t) */
     int                key_hash_type;        /* key hash type (hash_type_t) */
-    NcString           hash_tag;             /* key hash tag (ref in conf_pool) */
+    NcStringView       hash_tag;             /* key hash tag (ref in conf_pool) */
+    const NcConfHttpKey *http_key;           /* http route key (ref in conf_pool) */
     int                timeout;              /* timeout in msec */
     int                backlog;              /* listen backlog */
     int                redis_db;             /* redis database to connect to */
+    NcStringView       mysql_user;           /* mysql credentials and database (ref in conf_pool) */
+    NcStringView       mysql_password;
+    NcStringView       mysql_db;
     uint32_t           client_connections;   /* maximum # client connection */
     uint32_t           server_connections;   /* maximum # server connection */
+    uint32_t           server_max_connections; /* hard limit, pinned ones included */
     int64_t            server_retry_timeout; /* server retry timeout in usec */
     uint32_t           server_failure_limit; /* server failure limit */
     unsigned           tcpkeepalive;         /* tcpkeepalive? */
 
     unsigned           auto_eject_hosts;     /* auto_eject_hosts? */
     unsigned           preconnect;           /* preconnect? */
-
-    uint32_t           nserver_continuum;    /* # servers - live and dead on continuum (const) */
-    std::vector<NcContinuum*>   continuum;
+    unsigned           collapse;             /* collapse identical reads? */
+
+    /* collapse: reads in flight others may wait on, by digest of the request */
+    std::unordered_map<uint64_t, NcMsg*>  collapsing;
+    uint64_t           ncollapse_lead;       /* # reads forwarded for others to wait on */
+    uint64_t           ncollapse_hit;        /* # reads answered with the reply of another */
+
+    NcCache            cache;                /* near cache, off unless cache_size is set */
+
+    /*
+     * Points of the live servers, one after the other. For ketama they
+     * are sorted by value and followed by a sentinel standing for the
+     * first point; continuum_lut holds the first point at or after each
+     * hash prefix of 32 - continuum_shift bits, so a lookup only searches
+     * the points sharing the prefix of its hash.
+     */
+    uint32_t           ncontinuum;           /* # points on continuum */
+    std::vector<NcContinuum>    continuum;
+    std::vector<uint32_t>       continuum_lut;
+    uint32_t           continuum_shift;
+
+    /* jump: server of each bucket, UINT32_MAX if ejected; maglev: server of each slot */
+    std::vector<uint32_t>       lookup;
+    uint32_t           maglev_size;          /* maglev: # slots, a prime */
+
+    /* hrw: seed and 1 / weight of each server, infinity if ejected or padding */
+    std::vector<uint32_t>       hrw_seed;
+    std::vector<float>          hrw_scale;
+
+    /* redis_cluster: server of each hash slot, and when to load it from the cluster */
+    std::vector<uint16_t>       slots;
+    int64_t            slots_refresh;        /* next refresh in usec, 0 if none is due */
+    int64_t            slots_sent;           /* CLUSTER SLOTS in flight since, in usec */
+    uint32_t           slots_next;           /* server asked on the next refresh */
+    std::vector<NcConfServer*>  cluster_conf; /* servers learned from the cluster */
 };
 
 class NcServer 
@@ -135,11 +195,24 @@ class NcServer
     friend class NcServerPool;
 
 public:
-    NcServer(NcServerPool *_pool) : m_server_pool_(_pool)
+    NcServer(NcServerPool *_pool) : m_server_pool_(_pool), 
+        m_conn_queue_(&NcConnBase::m_conn_tqe_), m_ns_conn_q_(0)
     { }
 
+    /*
+     * A connection to the server: a new one up to server_connections, then
+     * the next one not pinned by a client. Connections pinned by clients do
+     * not count, another is opened when all of them are, up to
+     * server_max_connections; beyond that NULL with errno EBUSY.
+     */
     NcConn* getConn();
 
+    /* # connections, including those beyond server_connections */
+    inline uint32_t nconn()
+    {
+        return m_ns_conn_q_;
+    }
+
     inline NcContext* getContext()
     {
         ASSERT(m_server_pool_ != NULL);
@@ -162,6 +235,8 @@ public:
         m_port_ = (uint16_t)server->port;
         nc_memcpy(&m_info_, &server->info, sizeof(server->info));
         m_weight_ = server->weight;
+        m_next_retry_ = 0LL;
+        m_failure_count_ = 0;
 
         LOG_DEBUG("info.family : %d, addstr : %s, port : %d, weight: %d", 
             m_info_.family, m_addrstr_.c_str(), m_port_, m_weight_);
@@ -191,18 +266,38 @@ public:
 
     rstatus_t preconnect();
 
+    inline NcStringView& getPname()
+    {
+        return m_pname_;
+    }
+
+    inline NcStringView& getName()
+    {
+        return m_name_;
+    }
+
+    inline uint16_t getPort()
+    {
+        return m_port_;
+    }
+
+    inline uint32_t getIdx()
+    {
+        return m_idx_;
+    }
+
 private:
     NcServerPool    *m_server_pool_;
     uint32_t        m_idx_;           /* server index */
 
-    NcString        m_pname_;         /* hostname:port:weight (ref in conf_server) */
-    NcString        m_name_;          /* hostname:port or [name] (ref in conf_server) */
-    NcString        m_addrstr_;       /* hostname (ref in conf_server) */
+    NcStringView    m_pname_;         /* hostname:port:weight (ref in conf_server) */
+    NcStringView    m_name_;          /* hostname:port or [name] (ref in conf_server) */
+    NcStringView    m_addrstr_;       /* hostname (ref in conf_server) */
     uint16_t        m_port_;          /* port */
     uint32_t        m_weight_;        /* weight */
 
     struct sockinfo m_info_;          /* server socket info */
-    NcQueue<NcConnBase*> m_conn_queue_;
+    NcTailQueue<NcConnBase> m_conn_queue_;
 
     uint32_t        m_ns_conn_q_;     /* # server connection */
     int64_t         m_next_retry_;    /* next retry time in usec */
@@ -248,6 +343,10 @@ public:
     virtual void sendDone(NcMsgBase *msg);
 
     virtual void* getContext();
+
+private:
+    // 连接关闭时, 队列里的请求以错误结束
+    void failQueue(NcTailQueue<NcMsgBase> &q, bool input);
 };
 
 #endif
\ No newline at end of file
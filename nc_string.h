@@ -5,6 +5,7 @@
 #include <stdint.h>
 #include <stdbool.h>
 #include <inttypes.h>
+#include <stdlib.h>
 #include <string.h>
 #include <stdio.h>
 #include <ctype.h>
@@ -12,6 +13,11 @@
 #include <limits.h>
 #include <time.h>
 #include <unistd.h>
+#if defined(__AVX2__)
+#include <immintrin.h>
+#elif defined(__SSE2__)
+#include <emmintrin.h>
+#endif
 
 static inline uint8_t* _nc_strchr(uint8_t *p, uint8_t *last, uint8_t c)
 {
@@ -25,6 +31,86 @@ static inline uint8_t* _nc_strrchr(uint8_t *p, uint8_t *start, uint8_t c)
     return p < start ? NULL : p + 1;
 }
 
+/*
+ * First c in [p, last), NULL if there is none; unlike _nc_strchr it does
+ * not stop at a '\0'. With SSE2 (AVX2) a whole aligned block of 16 (32)
+ * bytes is compared at once. An aligned load never crosses a page, so
+ * reading the bytes of the first block before p and of the last one
+ * after last is safe; matches there are masked out.
+ */
+static inline uint8_t* _nc_memscan(uint8_t *p, uint8_t *last, uint8_t c)
+{
+    if (p >= last)
+    {
+        return NULL;
+    }
+
+#if defined(__AVX2__) || defined(__SSE2__)
+#if defined(__AVX2__)
+    const uintptr_t width = 32;
+    const __m256i needle = _mm256_set1_epi8((char)c);
+#define NC_SCAN_MASK(_b)    (uint32_t)_mm256_movemask_epi8( \
+    _mm256_cmpeq_epi8(_mm256_load_si256((const __m256i *)(_b)), needle))
+#else
+    const uintptr_t width = 16;
+    const __m128i needle = _mm_set1_epi8((char)c);
+#define NC_SCAN_MASK(_b)    (uint32_t)_mm_movemask_epi8( \
+    _mm_cmpeq_epi8(_mm_load_si128((const __m128i *)(_b)), needle))
+#endif
+    uint8_t *block = (uint8_t *)((uintptr_t)p & ~(width - 1));
+    uint32_t mask = NC_SCAN_MASK(block) & (0xffffffffU << (p - block));
+    for (;;)
+    {
+        if (mask != 0)
+        {
+            uint8_t *q = block + __builtin_ctz(mask);
+            return q < last ? q : NULL;
+        }
+
+        block += width;
+        if (block >= last)
+        {
+            return NULL;
+        }
+        mask = NC_SCAN_MASK(block);
+    }
+#undef NC_SCAN_MASK
+#else
+    for (; p < last; p++)
+    {
+        if (*p == c)
+        {
+            return p;
+        }
+    }
+    return NULL;
+#endif
+}
+
+/*
+ * Hash tag of key: what lies between the first open and the first close
+ * after it. False, and key left as it is, if there is none or it is empty.
+ */
+static inline bool _nc_hashtag(uint8_t **key, uint32_t *keylen, uint8_t open, uint8_t close)
+{
+    uint8_t *last = *key + *keylen;
+    uint8_t *start = _nc_memscan(*key, last, open);
+    if (start == NULL)
+    {
+        return false;
+    }
+
+    uint8_t *end = _nc_memscan(start + 1, last, close);
+    if (end == NULL || end - start <= 1)
+    {
+        return false;
+    }
+
+    *key = start + 1;
+    *keylen = (uint32_t)(end - start - 1);
+    return true;
+}
+
 #define nc_memcpy(_d, _c, _n)               memcpy(_d, _c, (size_t)(_n))
 
 #define nc_memmove(_d, _c, _n)              memmove(_d, _c, (size_t)(_n))
@@ -37,6 +123,10 @@ static inline uint8_t* _nc_strrchr(uint8_t *p, uint8_t *start, uint8_t c)
 
 #define nc_strchr(_p, _l, _c)               _nc_strchr((uint8_t *)(_p), (uint8_t *)(_l), (uint8_t)(_c))
 
+#define nc_memscan(_p, _l, _c)              _nc_memscan((uint8_t *)(_p), (uint8_t *)(_l), (uint8_t)(_c))
+
+#define nc_hashtag(_k, _n, _o, _c)          _nc_hashtag((_k), (_n), (uint8_t)(_o), (uint8_t)(_c))
+
 #define nc_strrchr(_p, _s, _c)              _nc_strrchr((uint8_t *)(_p),(uint8_t *)(_s), (uint8_t)(_c))
 
 #define nc_strndup(_s, _n)                  (uint8_t *)strndup((char *)(_s), (size_t)(_n))
@@ -55,75 +145,129 @@ static inline uint8_t* _nc_strrchr(uint8_t *p, uint8_t *start, uint8_t c)
 
 #define nc_safe_vsnprintf(_s, _n, _f, _a)   _safe_vsnprintf((char *)(_s), (size_t)(_n), _f, _a)
 
-class NcString
+#define NC_STRING_SSO_SIZE  23      /* inline capacity, '\0' not included */
+
+/*
+ * Non-owning reference to bytes owned by someone else, typically a
+ * NcString in the conf that outlives every server pool. c_str() is only
+ * '\0' terminated when the view was taken from a NcString.
+ */
+class NcStringView
 {
 public:
-    NcString()
+    NcStringView() : m_data_((const uint8_t *)""), m_len_(0)
+    { }
+
+    NcStringView(const uint8_t *data, uint32_t len) : m_data_(data), m_len_(len)
+    { }
+
+    const uint8_t* data() const
     {
-        m_len_ = 0;
-        // 初始化一个值
-        m_data_ = (uint8_t *)malloc(sizeof(uint8_t));
-        m_data_[0] = '\0';
+        return m_data_;
     }
 
-    NcString(const NcString &s)
+    const uint8_t* c_str() const
     {
-        m_data_ = nc_strndup(s.c_str(), s.length() + 1);
-        if (m_data_ != NULL) 
-        {
-            m_len_ = s.length();
-            m_data_[m_len_] = '\0';
-        }
+        return m_data_;
+    }
+
+    uint32_t length() const
+    {
+        return m_len_;
     }
 
-    NcString(const uint8_t *s, uint32_t len)
+    bool empty() const
     {
-        if (m_data_ == s)
-        {
-            return ;
-        }
+        return m_len_ == 0;
+    }
 
-        m_len_ = len;
-        m_data_ = nc_strndup(s, m_len_ + 1);
-        if (m_data_ != NULL) 
-        {
-            m_data_[m_len_] = '\0';
-        }
-        else
+    int compare(const NcStringView &s) const
+    {
+        if (m_len_ != s.length()) 
         {
-            m_len_ = 0;
+            return m_len_ > s.length() ? 1 : -1;
         }
-        
-        return ;
+
+        return memcmp(m_data_, s.data(), m_len_);
+    }
+
+    bool operator==(const NcStringView &s) const
+    {
+        return compare(s) == 0;
+    }
+
+private:
+    const uint8_t   *m_data_;   /* string data, not owned */
+    uint32_t        m_len_;     /* string length */
+};
+
+/*
+ * Owning string. Strings up to NC_STRING_SSO_SIZE bytes live in m_buf_ and
+ * never touch the heap, which covers the hostnames, "host:port:weight"
+ * names and hash tags of a conf. Copies reuse the existing buffer when it
+ * is big enough and moves steal the heap buffer.
+ */
+class NcString
+{
+public:
+    NcString() : m_len_(0), m_cap_(0), m_data_(m_buf_)
+    {
+        m_buf_[0] = '\0';
+    }
+
+    NcString(const NcString &s) : m_len_(0), m_cap_(0), m_data_(m_buf_)
+    {
+        assign(s.c_str(), s.length());
+    }
+
+    NcString(NcString &&s) : m_len_(0), m_cap_(0), m_data_(m_buf_)
+    {
+        steal(s);
+    }
+
+    NcString(const uint8_t *s, uint32_t len) : m_len_(0), m_cap_(0), m_data_(m_buf_)
+    {
+        assign(s, len);
+    }
+
+    NcString(const char *s, uint32_t len) : m_len_(0), m_cap_(0), m_data_(m_buf_)
+    {
+        assign((const uint8_t *)s, len);
+    }
+
+    NcString(const char *s) : m_len_(0), m_cap_(0), m_data_(m_buf_)
+    {
+        assign((const uint8_t *)s, (uint32_t)nc_strlen(s));
+    }
+
+    explicit NcString(const NcStringView &s) : m_len_(0), m_cap_(0), m_data_(m_buf_)
+    {
+        assign(s.data(), s.length());
     }
 
     ~NcString()
     {
-        if (m_data_ != NULL)
+        if (m_data_ != m_buf_)
         {
             free(m_data_);
         }
-
-        m_data_ = NULL;
     }
 
     NcString& operator=(const NcString &s)
     {
-        if (this == &s)
+        if (this != &s)
         {
-            return *this;
+            assign(s.c_str(), s.length());
         }
 
-        uint8_t *temp = m_data_;
-        m_data_ = nc_strndup(s.c_str(), s.length() + 1);
-        if (m_data_ != NULL) 
+        return *this;
+    }
+
+    NcString& operator=(NcString &&s)
+    {
+        if (this != &s)
         {
-            m_len_ = s.length();
-            m_data_[m_len_] = '\0';
-            if (temp != NULL)
-            {
-                free(temp);
-            }
+            steal(s);
         }
 
         return *this;
@@ -131,62 +275,54 @@ public:
 
     NcString& operator=(const uint8_t *s)
     {
-        if (m_data_ == s)
-        {
-            return *this;
-        }
-
-        uint8_t *temp = m_data_;
-        m_len_ = strlen((const char *)s);
-        m_data_ = nc_strndup(s, m_len_ + 1);
-        if (m_data_ != NULL) 
-        {
-            m_data_[m_len_] = '\0';
-            if (temp != NULL)
-            {
-                free(temp);
-            }
-        }
-        else
-        {
-            m_len_ = 0;
-        }
-        
+        assign(s, (uint32_t)nc_strlen(s));
         return *this;
     }
 
-    bool operator==(const NcString &s)
+    bool operator==(const NcStringView &s) const
     {
-        if (m_len_ <= 0)
-        {
-            return false;
-        }
+        return view() == s;
+    }
 
-        int status = strcmp((char*)m_data_, (const char*)s.c_str());
-        return status == 0 ? true : false;
+    bool operator==(const NcString &s) const
+    {
+        return view() == s.view();
     }
 
-    bool operator==(const uint8_t *s)
+    bool operator==(const uint8_t *s) const
     {
-        if (m_len_ <= 0 || s == NULL)
+        if (s == NULL)
         {
             return false;
         }
 
-        int status = strcmp((char*)m_data_, (const char*)s);
-        return status == 0 ? true : false;
+        return view() == NcStringView(s, (uint32_t)nc_strlen(s));
+    }
+
+    bool operator==(const char *s) const
+    {
+        return *this == (const uint8_t *)s;
+    }
+
+    operator NcStringView() const
+    {
+        return view();
+    }
+
+    NcStringView view() const
+    {
+        return NcStringView(m_data_, m_len_);
     }
 
+    /* len counts the trailing '\0' */
     void setText(const uint8_t *text, uint32_t len)
     {
-        m_len_ = len - 1;
-        m_data_ = (uint8_t*)(text);
+        assign(text, len - 1);
     }
 
     void setRaw(const uint8_t *raw)
     {
-        m_len_ = (uint32_t)(nc_strlen(raw));
-        m_data_ = (uint8_t*)(raw);
+        assign(raw, (uint32_t)nc_strlen(raw));
     }
 
     const uint8_t* c_str() const
@@ -194,29 +330,97 @@ public:
         return m_data_;
     }
 
+    const uint8_t* data() const
+    {
+        return m_data_;
+    }
+
     uint32_t length() const
     {
         return m_len_;
     }
 
-    bool empty()
+    bool empty() const
     {
-        return m_len_ == 0 ? true : false;
+        return m_len_ == 0;
     }
 
-    int compare(const NcString &s)
+    /* heap bytes held, 0 while inline */
+    uint32_t capacity() const
     {
-        if (m_len_ != s.length()) 
+        return m_cap_;
+    }
+
+    bool inlined() const
+    {
+        return m_data_ == m_buf_;
+    }
+
+    int compare(const NcStringView &s) const
+    {
+        return view().compare(s);
+    }
+
+private:
+    void assign(const uint8_t *s, uint32_t len)
+    {
+        uint32_t cap = inlined() ? NC_STRING_SSO_SIZE : m_cap_ - 1;
+        if (len > cap)
         {
-            return m_len_ > s.length() ? 1 : -1;
+            uint8_t *data = (uint8_t *)malloc(len + 1);
+            if (data == NULL)
+            {
+                return ;
+            }
+            nc_memcpy(data, s, len);
+            if (!inlined())
+            {
+                free(m_data_);
+            }
+            m_data_ = data;
+            m_cap_ = len + 1;
+        }
+        else
+        {
+            // s可能指向自身的buffer
+            nc_memmove(m_data_, s, len);
         }
 
-        return nc_strncmp(m_data_, s.c_str(), m_len_);
+        m_len_ = len;
+        m_data_[m_len_] = '\0';
     }
-    
+
+    void steal(NcString &s)
+    {
+        if (!inlined())
+        {
+            free(m_data_);
+            m_data_ = m_buf_;
+            m_cap_ = 0;
+        }
+
+        if (s.inlined())
+        {
+            nc_memcpy(m_buf_, s.m_buf_, s.m_len_ + 1);
+        }
+        else
+        {
+            m_data_ = s.m_data_;
+            m_cap_ = s.m_cap_;
+            s.m_data_ = s.m_buf_;
+            s.m_cap_ = 0;
+        }
+        m_len_ = s.m_len_;
+
+        s.m_len_ = 0;
+        s.m_buf_[0] = '\0';
+    }
+
 private:
-    uint32_t m_len_;   /* string length */
-    uint8_t  *m_data_; /* string data */
+    uint32_t m_len_;                            /* string length */
+    uint32_t m_cap_;                            /* heap buffer size, 0 if inline */
+    uint8_t  *m_data_;                          /* m_buf_ or heap buffer */
+    uint8_t  m_buf_[NC_STRING_SSO_SIZE + 1];    /* inline buffer */
 };
 
-#endif
\ No newline at end of file
+#endif
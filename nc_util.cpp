@@ -1,5 +1,9 @@
 #include <nc_util.h>
 
+#ifdef __linux__
+#include <sys/random.h>
+#endif
+
 extern "C" int _nc_atoi(uint8_t *line, size_t n)
 {
     int value;
@@ -309,4 +313,54 @@ void NcUtil::ncRemovePidfile(const char *name)
     {
         LOG_ERROR("unlink of pid file '%s' failed, ignored: %s", name, strerror(errno));
     }
-}
\ No newline at end of file
+}
+
+rstatus_t NcUtil::ncRandomBytes(uint8_t *buf, size_t n)
+{
+    size_t got = 0;
+#ifdef __linux__
+    while (got < n)
+    {
+        ssize_t r = getrandom(buf + got, n - got, 0);
+        if (r < 0)
+        {
+            if (errno == EINTR)
+            {
+                continue;
+            }
+            break;
+        }
+        got += (size_t)r;
+    }
+    if (got == n)
+    {
+        return NC_OK;
+    }
+#endif
+
+    // 没有getrandom的系统或内核
+    int fd = open("/dev/urandom", O_RDONLY);
+    if (fd < 0)
+    {
+        LOG_ERROR("opening /dev/urandom failed: %s", strerror(errno));
+        return NC_ERROR;
+    }
+    while (got < n)
+    {
+        ssize_t r = read(fd, buf + got, n - got);
+        if (r <= 0)
+        {
+            if (r < 0 && errno == EINTR)
+            {
+                continue;
+            }
+            LOG_ERROR("read of /dev/urandom failed: %s", r < 0 ? strerror(errno) : "eof");
+            close(fd);
+            return NC_ERROR;
+        }
+        got += (size_t)r;
+    }
+    close(fd);
+
+    return NC_OK;
+}
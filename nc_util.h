@@ -335,18 +335,63 @@ public:
         return ncUsecNow() / 1000LL;
     }
 
-    inline static int ncResolve(NcString *name, int port, struct sockinfo *si)
+    /*
+     * Monotonic time in usec, read through the vDSO. Use it where the
+     * resolution matters, e.g. latency stats; everything else reads the
+     * cached value below.
+     */
+    inline static int64_t ncPreciseUsec(void)
     {
-        if (name == NULL || name->length() <= 0)
+        struct timespec ts;
+
+        if (::clock_gettime(CLOCK_MONOTONIC, &ts) < 0)
+        {
+            return -1;
+        }
+
+        return (int64_t)ts.tv_sec * 1000000LL + (int64_t)ts.tv_nsec / 1000LL;
+    }
+
+    // 事件循环每次wait返回后刷新一次, 同一轮事件处理看到的是同一个时间
+    inline static int64_t ncTimeUpdate(void)
+    {
+        int64_t &now = cachedUsec();
+        now = ncPreciseUsec();
+        return now;
+    }
+
+    /* monotonic time in usec as of the last ncTimeUpdate */
+    inline static int64_t ncCachedUsec(void)
+    {
+        int64_t now = cachedUsec();
+        return now != 0 ? now : ncTimeUpdate();
+    }
+
+    inline static int64_t ncCachedMsec(void)
+    {
+        return ncCachedUsec() / 1000LL;
+    }
+
+private:
+    inline static int64_t& cachedUsec(void)
+    {
+        static int64_t now = 0;
+        return now;
+    }
+
+public:
+    inline static int ncResolve(const NcStringView &name, int port, struct sockinfo *si)
+    {
+        if (name.length() <= 0)
         {
             return -1;
         }
 
-        if ((name->c_str())[0] == '/') // unix
+        if ((name.c_str())[0] == '/') // unix
         {
             struct sockaddr_un *un;
 
-            if (name->length() >= NC_UNIX_ADDRSTRLEN) 
+            if (name.length() >= NC_UNIX_ADDRSTRLEN) 
             {
                 return -1;
             }
@@ -354,8 +399,8 @@ public:
             un = &si->addr.un;
 
             un->sun_family = AF_UNIX;
-            nc_memcpy(un->sun_path, name->c_str(), name->length());
-            un->sun_path[name->length()] = '\0';
+            nc_memcpy(un->sun_path, name.c_str(), name.length());
+            un->sun_path[name.length()] = '\0';
 
             si->family = AF_UNIX;
             si->addrlen = sizeof(*un);
@@ -367,7 +412,7 @@ public:
             int status;
             struct addrinfo *ai, *cai; /* head and current addrinfo */
             struct addrinfo hints;
-            char *node, service[NC_UINTMAX_MAXLEN];
+            char node[NI_MAXHOST], service[NC_UINTMAX_MAXLEN];
             bool found;
 
             memset(&hints, 0, sizeof(hints));
@@ -379,21 +424,13 @@ public:
             hints.ai_addr = NULL;
             hints.ai_canonname = NULL;
 
-            if (name != NULL) 
+            /* the view is not '\0' terminated unless it came from a NcString */
+            if (name.length() >= sizeof(node)) 
             {
-                node = (char *)name->c_str();
-            } 
-            else 
-            {
-                /*
-                * If AI_PASSIVE flag is specified in hints.ai_flags, and node is
-                * NULL, then the returned socket addresses will be suitable for
-                * bind(2)ing a socket that will accept(2) connections. The returned
-                * socket address will contain the wildcard IP address.
-                */
-                node = NULL;
-                hints.ai_flags |= AI_PASSIVE;
+                return -1;
             }
+            nc_memcpy(node, name.c_str(), name.length());
+            node[name.length()] = '\0';
             nc_snprintf(service, NC_UINTMAX_MAXLEN, "%d", port);
 
             /*
@@ -496,6 +533,9 @@ public:
 
     static void ncRemovePidfile(const char *name);
 
+    /* n bytes from the kernel's random source, for secrets and challenges */
+    static rstatus_t ncRandomBytes(uint8_t *buf, size_t n);
+
     // 全局的数据
     /* total # connections counter from start */
     inline static uint64_t ncTotalConn(int incr = 0)
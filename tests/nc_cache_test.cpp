@@ -0,0 +1,214 @@
+#include <string>
+#include <nc_cache.h>
+#include <nc_redis.h>
+#include <nc_memcache.h>
+#include "nc_test_util.h"
+
+/* 不解析, 每个mbuf最多chunk字节 */
+static NcMsg* reply(NcContext *ctx, NcProtocolType type, const std::string &data,
+    size_t chunk = 1 << 30)
+{
+    NcMsg *msg = (NcMsg*)(ctx->msg_pool).alloc<NcMsg>();
+    msg->setProtocolType(type);
+    for (size_t off = 0; off < data.size(); )
+    {
+        NcMbuf *mbuf = ctx->mbuf_pool.alloc();
+        size_t n = MIN(MIN(chunk, data.size() - off), mbuf->size());
+        mbuf->copy((uint8_t*)data.data() + off, n);
+        msg->getMbufQueue()->push(mbuf);
+        msg->setLength(msg->m_mlen_ + (uint32_t)n);
+        off += n;
+    }
+    return msg;
+}
+
+static int kind(NcContext *ctx, NcProtocolType type, const std::string &data)
+{
+    NcMsg *msg = feedOne(ctx, type, true, data);
+    int k = 0;
+    if (type == kPROTOCOL_REDIS)
+    {
+        k = NcRedis::cacheable(msg) ? 'r' : NcRedis::mutating(msg) ? 'w' : 0;
+    }
+    else
+    {
+        k = NcMemcache::cacheable(msg) ? 'r' : NcMemcache::mutating(msg) ? 'w' : 0;
+    }
+    release(ctx, msg);
+    return k;
+}
+
+static bool cacheableReply(NcContext *ctx, NcProtocolType type, const std::string &data,
+    size_t chunk = 1 << 30)
+{
+    NcMsg *msg = reply(ctx, type, data, chunk);
+    bool yes = type == kPROTOCOL_REDIS ? NcRedis::cacheableReply(msg) :
+        NcMemcache::cacheableReply(msg);
+    release(ctx, msg);
+    return yes;
+}
+
+static void protocolTest(NcContext *ctx)
+{
+    ASSERT(kind(ctx, kPROTOCOL_REDIS, "*2\r\n$3\r\nGET\r\n$3\r\nfoo\r\n") == 'r');
+    ASSERT(kind(ctx, kPROTOCOL_REDIS, "get foo\r\n") == 'r');
+    ASSERT(kind(ctx, kPROTOCOL_REDIS, "*3\r\n$4\r\nHGET\r\n$1\r\nh\r\n$1\r\nf\r\n") == 0);
+    ASSERT(kind(ctx, kPROTOCOL_REDIS, "*3\r\n$4\r\nMGET\r\n$1\r\na\r\n$1\r\nb\r\n") == 0);
+    ASSERT(kind(ctx, kPROTOCOL_REDIS, "*1\r\n$4\r\nPING\r\n") == 0);
+    ASSERT(kind(ctx, kPROTOCOL_REDIS, "*3\r\n$3\r\nSET\r\n$3\r\nfoo\r\n$1\r\n1\r\n") == 'w');
+    ASSERT(kind(ctx, kPROTOCOL_REDIS, "*3\r\n$3\r\nDEL\r\n$1\r\na\r\n$1\r\nb\r\n") == 'w');
+    ASSERT(kind(ctx, kPROTOCOL_REDIS, "*3\r\n$6\r\nEXPIRE\r\n$1\r\na\r\n$1\r\n1\r\n") == 'w');
+
+    ASSERT(kind(ctx, kPROTOCOL_MEMCACHED, "get foo\r\n") == 'r');
+    ASSERT(kind(ctx, kPROTOCOL_MEMCACHED, "gets foo\r\n") == 0);
+    ASSERT(kind(ctx, kPROTOCOL_MEMCACHED, "get a b\r\n") == 0);
+    ASSERT(kind(ctx, kPROTOCOL_MEMCACHED, "set a 0 0 1\r\nx\r\n") == 'w');
+    ASSERT(kind(ctx, kPROTOCOL_MEMCACHED, "delete a\r\n") == 'w');
+    ASSERT(kind(ctx, kPROTOCOL_MEMCACHED, "incr a 1\r\n") == 'w');
+
+    ASSERT(cacheableReply(ctx, kPROTOCOL_REDIS, "$3\r\nbar\r\n"));
+    ASSERT(cacheableReply(ctx, kPROTOCOL_REDIS, "$-1\r\n"));
+    ASSERT(!cacheableReply(ctx, kPROTOCOL_REDIS, "-WRONGTYPE Operation\r\n"));
+    ASSERT(!cacheableReply(ctx, kPROTOCOL_REDIS, "-MOVED 1 127.0.0.1:7000\r\n"));
+
+    ASSERT(cacheableReply(ctx, kPROTOCOL_MEMCACHED, "VALUE a 0 1\r\nx\r\nEND\r\n"));
+    ASSERT(cacheableReply(ctx, kPROTOCOL_MEMCACHED, "VALUE a 0 1\r\nx\r\nEND\r\n", 2));
+    ASSERT(cacheableReply(ctx, kPROTOCOL_MEMCACHED, "END\r\n"));
+    ASSERT(!cacheableReply(ctx, kPROTOCOL_MEMCACHED, "SERVER_ERROR out of memory\r\n"));
+}
+
+static bool hit(NcContext *ctx, NcCache *cache, const char *key, const std::string &data)
+{
+    NcMsg *rsp = cache->lookup((const uint8_t*)key, (uint32_t)strlen(key));
+    if (rsp == NULL)
+    {
+        return false;
+    }
+
+    /* nothing copied: each mbuf of the reply is a slice of the cached one */
+    NcMbufQueue *queue = rsp->getMbufQueue();
+    for (NcMbuf *mbuf = queue->front(); mbuf != NULL; mbuf = queue->next(mbuf))
+    {
+        ASSERT(mbuf->isSlice());
+    }
+
+    bool same = content(rsp) == data;
+    release(ctx, rsp);
+    return same;
+}
+
+static void fill(NcContext *ctx, NcCache *cache, const char *key, const std::string &data,
+    size_t chunk = 1 << 30)
+{
+    uint32_t keylen = (uint32_t)strlen(key);
+    NcMsg *rsp = reply(ctx, kPROTOCOL_REDIS, data, chunk);
+    cache->insert((const uint8_t*)key, keylen, cache->generation((const uint8_t*)key, keylen),
+        rsp);
+    release(ctx, rsp);
+}
+
+static void cacheTest(NcContext *ctx)
+{
+    NcCache cache;
+    cache.init(ctx, 1 << 20, 1000 * 1000LL);
+
+    std::string small = "$3\r\nbar\r\n";
+    std::string big = "$100000\r\n" + std::string(100000, 'v') + "\r\n";
+
+    ASSERT(!hit(ctx, &cache, "a", small));
+    fill(ctx, &cache, "a", small);
+    ASSERT(hit(ctx, &cache, "a", small) && hit(ctx, &cache, "a", small));
+    ASSERT(!hit(ctx, &cache, "b", small) && !hit(ctx, &cache, "", small));
+
+    // 跨多个mbuf的reply
+    fill(ctx, &cache, "big", big, 3000);
+    ASSERT(hit(ctx, &cache, "big", big));
+    ASSERT(cache.size() == 2);
+
+    // 被cache的mbuf在hit发出去之前被删掉
+    NcMsg *rsp = cache.lookup((const uint8_t*)"big", 3);
+    cache.invalidate((const uint8_t*)"big", 3);
+    ASSERT(content(rsp) == big);
+    release(ctx, rsp);
+    ASSERT(!hit(ctx, &cache, "big", big) && hit(ctx, &cache, "a", small));
+
+    // 请求在路上时key被写过, reply不能进cache
+    uint64_t gen = cache.generation((const uint8_t*)"c", 1);
+    cache.invalidate((const uint8_t*)"c", 1);
+    rsp = reply(ctx, kPROTOCOL_REDIS, small);
+    cache.insert((const uint8_t*)"c", 1, gen, rsp);
+    release(ctx, rsp);
+    ASSERT(!hit(ctx, &cache, "c", small));
+    fill(ctx, &cache, "c", small);
+    ASSERT(hit(ctx, &cache, "c", small));
+
+    // 新的reply替换旧的
+    fill(ctx, &cache, "c", "$-1\r\n");
+    ASSERT(hit(ctx, &cache, "c", "$-1\r\n") && cache.size() == 2);
+
+    cache.clear();
+    ASSERT(cache.size() == 0 && cache.used() == 0);
+}
+
+static void lruTest(NcContext *ctx)
+{
+    NcCache cache;
+    cache.init(ctx, 96 * 1024, 1000 * 1000LL);
+
+    std::string value = "$10000\r\n" + std::string(10000, 'x') + "\r\n";
+    char key[16];
+    for (int i = 0; i < 5; i++)
+    {
+        snprintf(key, sizeof(key), "k%d", i);
+        fill(ctx, &cache, key, value);
+    }
+    ASSERT(cache.size() == 5 && cache.used() <= cache.limit());
+
+    // 每个reply占一整个16k的chunk, 按chunk计
+    ASSERT(cache.used() == 5 * (sizeof(NcCacheEntry) + sizeof(NcMsg) + 2 + MBUF_SIZE));
+
+    // k0最近用过, 超过上限时先淘汰k1
+    ASSERT(hit(ctx, &cache, "k0", value));
+    fill(ctx, &cache, "k5", value);
+    fill(ctx, &cache, "k6", value);
+    ASSERT(cache.used() <= cache.limit());
+    ASSERT(hit(ctx, &cache, "k0", value) && hit(ctx, &cache, "k6", value));
+    ASSERT(!hit(ctx, &cache, "k1", value));
+
+    // 比整个cache还大的不进cache
+    std::string huge = "$100000\r\n" + std::string(100000, 'h') + "\r\n";
+    fill(ctx, &cache, "huge", huge);
+    ASSERT(!hit(ctx, &cache, "huge", huge) && hit(ctx, &cache, "k0", value));
+
+    cache.clear();
+}
+
+static void ttlTest(NcContext *ctx)
+{
+    NcCache cache;
+    cache.init(ctx, 1 << 20, 20 * 1000LL);
+
+    NcUtil::ncTimeUpdate();
+    fill(ctx, &cache, "a", "$1\r\na\r\n");
+    ASSERT(hit(ctx, &cache, "a", "$1\r\na\r\n"));
+
+    usleep(30 * 1000);
+    NcUtil::ncTimeUpdate();
+    ASSERT(!hit(ctx, &cache, "a", "$1\r\na\r\n") && cache.size() == 0);
+}
+
+int main(int argc, char **argv)
+{
+    NcLogger::getInstance().init(LLOG_PVERB, "./test.logs");
+
+    NcContext ctx;
+    ctx.mbuf_pool.init(MBUF_SIZE);
+
+    protocolTest(&ctx);
+    cacheTest(&ctx);
+    lruTest(&ctx);
+    ttlTest(&ctx);
+    ASSERT(ctx.mbuf_pool.nused() == 0);
+
+    return 0;
+}
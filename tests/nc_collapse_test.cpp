@@ -0,0 +1,90 @@
+#include <string>
+#include <nc_redis.h>
+#include <nc_memcache.h>
+#include "nc_test_util.h"
+
+/* 不解析, 每个mbuf最多chunk字节 */
+static NcMsg* raw(NcContext *ctx, const std::string &data, size_t chunk)
+{
+    NcMsg *msg = (NcMsg*)(ctx->msg_pool).alloc<NcMsg>();
+    for (size_t off = 0; off < data.size(); off += chunk)
+    {
+        NcMbuf *mbuf = ctx->mbuf_pool.alloc();
+        size_t n = MIN(chunk, data.size() - off);
+        mbuf->copy((uint8_t*)data.data() + off, n);
+        msg->getMbufQueue()->push(mbuf);
+        msg->setLength(msg->m_mlen_ + (uint32_t)n);
+    }
+    return msg;
+}
+
+static bool collapsible(NcContext *ctx, NcProtocolType type, const std::string &data)
+{
+    NcMsg *msg = feedOne(ctx, type, true, data);
+    bool yes = type == kPROTOCOL_REDIS ? NcRedis::collapsible(msg) :
+        NcMemcache::collapsible(msg);
+    release(ctx, msg);
+    return yes;
+}
+
+static void collapsibleTest(NcContext *ctx)
+{
+    ASSERT(collapsible(ctx, kPROTOCOL_REDIS, "*2\r\n$3\r\nGET\r\n$3\r\nfoo\r\n"));
+    ASSERT(collapsible(ctx, kPROTOCOL_REDIS, "*3\r\n$4\r\nhget\r\n$1\r\nh\r\n$1\r\nf\r\n"));
+    ASSERT(collapsible(ctx, kPROTOCOL_REDIS, "get foo\r\n"));
+
+    // 写, 多key, 没有key, touch
+    ASSERT(!collapsible(ctx, kPROTOCOL_REDIS, "*3\r\n$3\r\nSET\r\n$3\r\nfoo\r\n$1\r\n1\r\n"));
+    ASSERT(!collapsible(ctx, kPROTOCOL_REDIS, "*3\r\n$4\r\nMGET\r\n$1\r\na\r\n$1\r\nb\r\n"));
+    ASSERT(!collapsible(ctx, kPROTOCOL_REDIS, "*1\r\n$4\r\nPING\r\n"));
+    ASSERT(!collapsible(ctx, kPROTOCOL_REDIS, "*2\r\n$5\r\nTOUCH\r\n$1\r\na\r\n"));
+    ASSERT(!collapsible(ctx, kPROTOCOL_REDIS, "*2\r\n$4\r\nINCR\r\n$1\r\na\r\n"));
+
+    ASSERT(collapsible(ctx, kPROTOCOL_MEMCACHED, "get foo\r\n"));
+    ASSERT(collapsible(ctx, kPROTOCOL_MEMCACHED, "gets foo\r\n"));
+    ASSERT(!collapsible(ctx, kPROTOCOL_MEMCACHED, "get a b\r\n"));
+    ASSERT(!collapsible(ctx, kPROTOCOL_MEMCACHED, "set a 0 0 1\r\nx\r\n"));
+    ASSERT(!collapsible(ctx, kPROTOCOL_MEMCACHED, "delete a\r\n"));
+}
+
+static void identicalTest(NcContext *ctx)
+{
+    std::string key(3000, 'k');
+    std::string get = "*2\r\n$3\r\nGET\r\n$3000\r\n" + key + "\r\n";
+    std::string other = get;
+    other[other.size() - 3] = 'x';
+
+    // 同样的字节, 不同的mbuf分布
+    NcMsg *a = feedOne(ctx, kPROTOCOL_REDIS, true, get);
+    NcMsg *b = raw(ctx, get, 100);
+    NcMsg *c = feedOne(ctx, kPROTOCOL_REDIS, true, other);
+    NcMsg *d = feedOne(ctx, kPROTOCOL_REDIS, true, "*2\r\n$3\r\nGET\r\n$3\r\nfoo\r\n");
+    NcMsg *e = feedOne(ctx, kPROTOCOL_REDIS, true, "*2\r\n$3\r\nget\r\n$3\r\nfoo\r\n");
+
+    ASSERT(a->getMbufQueue()->size() < b->getMbufQueue()->size());
+    ASSERT(a->digest() == b->digest() && a->identical(b) && b->identical(a));
+    ASSERT(a->digest() != c->digest() && !a->identical(c) && !c->identical(b));
+    ASSERT(!a->identical(d) && !d->identical(a));
+    ASSERT(d->digest() != e->digest() && !d->identical(e));
+    ASSERT(d->identical(d) && d->digest() != 0);
+
+    release(ctx, a);
+    release(ctx, b);
+    release(ctx, c);
+    release(ctx, d);
+    release(ctx, e);
+}
+
+int main(int argc, char **argv)
+{
+    NcLogger::getInstance().init(LLOG_PVERB, "./test.logs");
+
+    NcContext ctx;
+    ctx.mbuf_pool.init(MBUF_SIZE);
+
+    collapsibleTest(&ctx);
+    identicalTest(&ctx);
+    ASSERT(ctx.mbuf_pool.nused() == 0);
+
+    return 0;
+}
@@ -0,0 +1,174 @@
+#include <string>
+#include <vector>
+#include <nc_hashkit.h>
+#include "nc_test_util.h"
+
+#define NKEY        (1 << 20)
+
+static void route(NcServerPool *pool, const std::vector<uint32_t> &hashes,
+    std::vector<uint32_t> &to)
+{
+    to.resize(hashes.size());
+    for (size_t i = 0; i < hashes.size(); i++)
+    {
+        to[i] = NcHashKit::dispatch(pool, hashes[i]);
+    }
+}
+
+/* 最多的server比平均多多少 */
+static double imbalance(const std::vector<uint32_t> &to, uint32_t nserver)
+{
+    std::vector<uint32_t> load(nserver, 0);
+    uint32_t most = 0;
+    for (size_t i = 0; i < to.size(); i++)
+    {
+        load[to[i]]++;
+        most = MAX(most, load[to[i]]);
+    }
+
+    return (double)most * nserver / to.size();
+}
+
+/*
+ * Load of the most loaded server over the mean, and the keys moved when
+ * a server in the middle of the pool is ejected: all of them, and those
+ * that were not on that server (ideally none).
+ */
+static void distTest(NcContext *ctx, const std::vector<uint32_t> &hashes)
+{
+    const int dists[] = { kDIST_MODULA, kDIST_KETAMA, kDIST_JUMP, kDIST_MAGLEV, kDIST_HRW };
+    const char *names[] = { "modula", "ketama", "jump", "maglev", "hrw" };
+    const int sizes[] = { 10, 100, 500 };
+
+    NcUtil::ncTimeUpdate();
+    for (size_t s = 0; s < sizeof(sizes) / sizeof(sizes[0]); s++)
+    {
+        for (size_t d = 0; d < sizeof(dists) / sizeof(dists[0]); d++)
+        {
+            NcConfPool cp;
+            NcServerPool *pool = makePool(ctx, &cp, manyServers(sizes[s]), dists[d], true);
+
+            std::vector<uint32_t> before, after;
+            int64_t start = NcUtil::ncPreciseUsec();
+            route(pool, hashes, before);
+            int64_t cost = NcUtil::ncPreciseUsec() - start;
+            double load = imbalance(before, sizes[s]);
+
+            uint32_t gone = sizes[s] / 2;
+            pool->server[gone]->setNextRetry(NcUtil::ncCachedUsec() + 1000 * 1000LL);
+            ASSERT(NcHashKit::update(pool) == NC_OK && pool->nlive_server == (uint32_t)sizes[s] - 1);
+            route(pool, hashes, after);
+
+            uint32_t moved = 0, extra = 0;
+            for (size_t i = 0; i < hashes.size(); i++)
+            {
+                ASSERT(after[i] != gone);
+                moved += before[i] != after[i];
+                extra += before[i] != after[i] && before[i] != gone;
+            }
+
+            LOG_DEBUG("%4d servers %-6s: max load %.3f of mean, removing one moves "
+                "%5.2f%% of keys (%5.2f%% not on it, ideal %.2f%%), %5.1f Mlookups/s",
+                sizes[s], names[d], load, 100.0 * moved / hashes.size(),
+                100.0 * extra / hashes.size(), 100.0 / sizes[s],
+                (double)hashes.size() / cost);
+
+            // ketama不一定: 和twemproxy一样, 每个server的点数随live server数的floorf变
+            if (dists[d] == kDIST_JUMP || dists[d] == kDIST_HRW)
+            {
+                ASSERT(extra == 0);
+            }
+            if (dists[d] == kDIST_JUMP || dists[d] == kDIST_MAGLEV || dists[d] == kDIST_HRW)
+            {
+                ASSERT(load < 1.15);
+            }
+            if (dists[d] == kDIST_MAGLEV)
+            {
+                ASSERT(extra < hashes.size() / 50);
+            }
+
+            // 回来以后和原来一样
+            pool->server[gone]->setNextRetry(NcUtil::ncCachedUsec());
+            ASSERT(NcHashKit::update(pool) == NC_OK);
+            route(pool, hashes, after);
+            ASSERT(before == after);
+
+            delete pool;
+        }
+    }
+}
+
+static void maglevTest(NcContext *ctx)
+{
+    // 每个server的槽位数最多差一个, 按weight分
+    NcConfPool cp;
+    cp.maglev_size = 101;
+    NcServerPool *pool = makePool(ctx, &cp, manyServers(7), kDIST_MAGLEV, true);
+    std::vector<uint32_t> slots(7, 0);
+    for (uint32_t i = 0; i < pool->lookup.size(); i++)
+    {
+        slots[pool->lookup[i]]++;
+    }
+    for (uint32_t i = 0; i < 7; i++)
+    {
+        ASSERT(slots[i] == 14 || slots[i] == 15);
+    }
+
+    pool->server[0]->setWeight(3);
+    ASSERT(NcHashKit::update(pool) == NC_OK);
+    slots.assign(7, 0);
+    for (uint32_t i = 0; i < pool->lookup.size(); i++)
+    {
+        slots[pool->lookup[i]]++;
+    }
+    ASSERT(slots[0] >= 33 && slots[0] <= 35 && slots[1] >= 11 && slots[1] <= 12);
+    delete pool;
+}
+
+static void hrwTest(NcContext *ctx, const std::vector<uint32_t> &hashes)
+{
+    // 按weight 1:2:3:4分
+    NcConfPool cp;
+    NcServerPool *pool = makePool(ctx, &cp, manyServers(4), kDIST_HRW, true);
+    for (uint32_t i = 0; i < 4; i++)
+    {
+        pool->server[i]->setWeight(i + 1);
+    }
+    ASSERT(NcHashKit::update(pool) == NC_OK);
+
+    std::vector<uint32_t> to, load(4, 0);
+    route(pool, hashes, to);
+    for (size_t i = 0; i < to.size(); i++)
+    {
+        load[to[i]]++;
+    }
+    for (uint32_t i = 0; i < 4; i++)
+    {
+        double share = (double)load[i] / to.size();
+        LOG_DEBUG("hrw weight %u: %.4f of keys", i + 1, share);
+        ASSERT(fabs(share - (i + 1) / 10.0) < 0.005);
+    }
+    delete pool;
+}
+
+int main(int argc, char **argv)
+{
+    NcLogger::getInstance().init(LLOG_PVERB, "./test.logs");
+
+    NcContext ctx;
+    ctx.mbuf_pool.init(MBUF_SIZE);
+
+    std::vector<uint32_t> hashes;
+    char key[32];
+    for (uint32_t i = 0; i < NKEY; i++)
+    {
+        int n = snprintf(key, sizeof(key), "user:%u", i);
+        hashes.push_back(NcHashKit::hash(kHASH_MURMUR, key, n));
+    }
+
+    maglevTest(&ctx);
+    hrwTest(&ctx, hashes);
+    distTest(&ctx, hashes);
+
+    return 0;
+}
@@ -0,0 +1,244 @@
+#include <string>
+#include <nc_redis.h>
+#include <nc_memcache.h>
+#include "nc_test_util.h"
+
+/*
+ * 按seq拆分req, 检查子请求的内容, 用replies[f]作为子请求f的响应合并,
+ * 返回合并后的响应
+ */
+static std::string split(NcContext *ctx, NcProtocolType type, const std::string &req,
+    const std::vector<uint32_t> &seq, const std::vector<std::string> &subs,
+    const std::vector<std::string> &replies, bool ferror = false)
+{
+    NcMsg *r = feedOne(ctx, type, true, req, 7);
+    ASSERT(r->getKeys().size() == seq.size());
+    ASSERT(type == kPROTOCOL_REDIS ? NcRedis::fragmentable(r) : NcMemcache::fragmentable(r));
+    r->getFragSeq() = seq;
+
+    std::vector<NcMsg*> frags;
+    for (uint32_t f = 0; f < subs.size(); f++)
+    {
+        frags.push_back((NcMsg*)(ctx->msg_pool).alloc<NcMsg>());
+        frags[f]->m_request_ = 1;
+        frags[f]->setProtocolType(type);
+    }
+    rstatus_t status = type == kPROTOCOL_REDIS ? NcRedis::fragment(r, frags, ctx) :
+        NcMemcache::fragment(r, frags, ctx);
+    ASSERT(status == NC_OK);
+
+    for (uint32_t f = 0; f < subs.size(); f++)
+    {
+        NcMsg *sub = frags[f];
+        ASSERT(content(sub) == subs[f]);
+
+        /* the keys of a fragment point into its own copy */
+        NcMbufQueue *queue = sub->getMbufQueue();
+        for (uint32_t i = 0; i < sub->getKeys().size(); i++)
+        {
+            NcKeypos &key = sub->getKeys()[i];
+            bool inside = false;
+            for (NcMbuf *mbuf = queue->front(); mbuf != NULL; mbuf = queue->next(mbuf))
+            {
+                inside = inside || (key.start >= mbuf->getPos() && key.end <= mbuf->getLast());
+            }
+            ASSERT(inside);
+        }
+
+        sub->m_peer_ = feedOne(ctx, type, false, replies[f], 5);
+    }
+
+    NcMsg *rsp = (NcMsg*)(ctx->msg_pool).alloc<NcMsg>();
+    r->m_peer_ = rsp;
+    r->m_ferror_ = ferror ? 1 : 0;
+    r->m_err_ = ferror ? ECONNREFUSED : 0;
+    status = type == kPROTOCOL_REDIS ? NcRedis::coalesce(r, frags, ctx) :
+        NcMemcache::coalesce(r, frags, ctx);
+    ASSERT(status == NC_OK);
+
+    std::string s = content(rsp);
+    for (uint32_t f = 0; f < frags.size(); f++)
+    {
+        release(ctx, (NcMsg*)frags[f]->m_peer_);
+        release(ctx, frags[f]);
+    }
+    release(ctx, rsp);
+    release(ctx, r);
+
+    return s;
+}
+
+static void redisTest(NcContext *ctx)
+{
+    /* mget: values and nils merged back in key order */
+    std::string s = split(ctx, kPROTOCOL_REDIS,
+        multibulk({"MGET", "a", "b", "c", "d", "e"}), {0, 1, 0, 2, 1},
+        {multibulk({"mget", "a", "c"}), multibulk({"mget", "b", "e"}), multibulk({"mget", "d"})},
+        {"*2\r\n$2\r\nva\r\n$-1\r\n", "*2\r\n$2\r\nvb\r\n$0\r\n\r\n", "*1\r\n$2\r\nvd\r\n"});
+    ASSERT(s == "*5\r\n$2\r\nva\r\n$2\r\nvb\r\n$-1\r\n$2\r\nvd\r\n$0\r\n\r\n");
+
+    /* values long enough to be sliced, one of them spread over mbufs */
+    uint64_t nslice = ctx->mbuf_pool.nslice();
+    std::string big1(20000, 'x'), big2(700, 'y');
+    s = split(ctx, kPROTOCOL_REDIS, multibulk({"mget", "k1", "k2", "k3"}), {1, 0, 1},
+        {multibulk({"mget", "k2"}), multibulk({"mget", "k1", "k3"})},
+        {"*1\r\n" + bulk(big2), "*2\r\n" + bulk(big1) + "$-1\r\n"});
+    ASSERT(s == "*3\r\n" + bulk(big1) + bulk(big2) + "$-1\r\n");
+    ASSERT(ctx->mbuf_pool.nslice() > nslice);
+
+    /* del, unlink, exists, touch add up the counts */
+    s = split(ctx, kPROTOCOL_REDIS, multibulk({"DEL", "a", "b", "c"}), {0, 1, 1},
+        {multibulk({"del", "a"}), multibulk({"del", "b", "c"})}, {":1\r\n", ":2\r\n"});
+    ASSERT(s == ":3\r\n");
+    s = split(ctx, kPROTOCOL_REDIS, multibulk({"exists", "a", "b"}), {1, 0},
+        {multibulk({"exists", "b"}), multibulk({"exists", "a"})}, {":0\r\n", ":1\r\n"});
+    ASSERT(s == ":1\r\n");
+
+    /* mset carries the values along, multibulk or inline */
+    s = split(ctx, kPROTOCOL_REDIS, multibulk({"MSET", "a", "1", "b", big2, "c", "3"}), {0, 1, 0},
+        {multibulk({"mset", "a", "1", "c", "3"}), multibulk({"mset", "b", big2})},
+        {"+OK\r\n", "+OK\r\n"});
+    ASSERT(s == "+OK\r\n");
+    s = split(ctx, kPROTOCOL_REDIS, "MSET a 1  b two\r\n", {1, 0},
+        {multibulk({"mset", "b", "two"}), multibulk({"mset", "a", "1"})},
+        {"+OK\r\n", "+OK\r\n"});
+    ASSERT(s == "+OK\r\n");
+
+    /* an error from a server is the reply, a failed fragment fails all */
+    s = split(ctx, kPROTOCOL_REDIS, multibulk({"mget", "a", "b"}), {0, 1},
+        {multibulk({"mget", "a"}), multibulk({"mget", "b"})},
+        {"*1\r\n$1\r\n1\r\n", "-ERR busy\r\n"});
+    ASSERT(s == "-ERR busy\r\n");
+    s = split(ctx, kPROTOCOL_REDIS, multibulk({"mget", "a", "b"}), {0, 1},
+        {multibulk({"mget", "a"}), multibulk({"mget", "b"})},
+        {"*1\r\n$1\r\n1\r\n", "*1\r\n$-1\r\n"}, true);
+    ASSERT(s.find("-ERR ") == 0);
+
+    /* a reply not matching the request */
+    s = split(ctx, kPROTOCOL_REDIS, multibulk({"mget", "a", "b"}), {0, 1},
+        {multibulk({"mget", "a"}), multibulk({"mget", "b"})}, {"*0\r\n", "*1\r\n$-1\r\n"});
+    ASSERT(s.find("-ERR ") == 0);
+
+    NcMsg *get = feedOne(ctx, kPROTOCOL_REDIS, true, multibulk({"get", "a"}));
+    ASSERT(!NcRedis::fragmentable(get));
+    release(ctx, get);
+}
+
+static void memcacheTest(NcContext *ctx)
+{
+    /* misses are left out, the values follow the key order */
+    std::string s = split(ctx, kPROTOCOL_MEMCACHED, "get a b c d\r\n", {0, 1, 1, 0},
+        {"get a d\r\n", "get b c\r\n"},
+        {"VALUE a 0 2\r\nva\r\nEND\r\n", "VALUE b 1 2\r\nvb\r\nVALUE c 2 2\r\nvc\r\nEND\r\n"});
+    ASSERT(s == "VALUE a 0 2\r\nva\r\nVALUE b 1 2\r\nvb\r\nVALUE c 2 2\r\nvc\r\nEND\r\n");
+
+    /* gets keeps the cas, a long value is sliced */
+    std::string big(5000, 'z');
+    s = split(ctx, kPROTOCOL_MEMCACHED, "gets k1 k10 k2\r\n", {0, 1, 0},
+        {"gets k1 k2\r\n", "gets k10\r\n"},
+        {"VALUE k2 0 1 7\r\n2\r\nEND\r\n", "VALUE k10 3 5000 9\r\n" + big + "\r\nEND\r\n"});
+    ASSERT(s == "VALUE k10 3 5000 9\r\n" + big + "\r\nVALUE k2 0 1 7\r\n2\r\nEND\r\n");
+
+    s = split(ctx, kPROTOCOL_MEMCACHED, "get a b\r\n", {0, 1}, {"get a\r\n", "get b\r\n"},
+        {"END\r\n", "END\r\n"});
+    ASSERT(s == "END\r\n");
+
+    s = split(ctx, kPROTOCOL_MEMCACHED, "get a b\r\n", {0, 1}, {"get a\r\n", "get b\r\n"},
+        {"END\r\n", "SERVER_ERROR out of memory\r\n"});
+    ASSERT(s == "SERVER_ERROR out of memory\r\n");
+
+    s = split(ctx, kPROTOCOL_MEMCACHED, "get a b\r\n", {0, 1}, {"get a\r\n", "get b\r\n"},
+        {"END\r\n", "END\r\n"}, true);
+    ASSERT(s.find("SERVER_ERROR ") == 0);
+}
+
+/*
+ * 100个key的mget拆分到16个server: 生成子请求, 合并16个响应,
+ * 统计proxy上每个mget的开销
+ */
+static void mgetBench(NcContext *ctx, uint32_t nkey, uint32_t nserver, uint32_t vlen,
+    int loops)
+{
+    std::vector<std::string> args = {"mget"};
+    std::vector<uint32_t> seq;
+    std::vector<std::string> replies(nserver);
+    std::vector<uint32_t> count(nserver, 0);
+    std::string value(vlen, 'v');
+    for (uint32_t i = 0; i < nkey; i++)
+    {
+        char k[32];
+        snprintf(k, sizeof(k), "key:%06u", i);
+        args.push_back(k);
+        seq.push_back((uint32_t)rand() % nserver);
+        count[seq.back()]++;
+        replies[seq.back()] += bulk(value);
+    }
+    for (uint32_t f = 0; f < nserver; f++)
+    {
+        char n[32];
+        snprintf(n, sizeof(n), "*%u\r\n", count[f]);
+        replies[f] = n + replies[f];
+    }
+
+    NcMsg *r = feedOne(ctx, kPROTOCOL_REDIS, true, multibulk(args));
+    std::vector<NcMsg*> frags;
+    for (uint32_t f = 0; f < nserver; f++)
+    {
+        frags.push_back(new NcMsg());
+        frags[f]->m_request_ = 1;
+        frags[f]->m_peer_ = feedOne(ctx, kPROTOCOL_REDIS, false, replies[f]);
+    }
+    NcMsg rsp;
+    r->m_peer_ = &rsp;
+
+    int64_t cost = 0;
+    uint32_t len = 0;
+    NcLogger::getInstance().setLevel(LLOG_WARN);
+    for (int l = 0; l < loops; l++)
+    {
+        int64_t start = NcUtil::ncPreciseUsec();
+        r->getFragSeq() = seq;
+        ASSERT(NcRedis::fragment(r, frags, ctx) == NC_OK);
+        ASSERT(NcRedis::coalesce(r, frags, ctx) == NC_OK);
+        cost += NcUtil::ncPreciseUsec() - start;
+
+        len = rsp.m_mlen_;
+        rsp.freeMbuf(ctx);
+        rsp.reset();
+        for (uint32_t f = 0; f < nserver; f++)
+        {
+            frags[f]->freeMbuf(ctx);
+            frags[f]->getKeys().clear();
+            frags[f]->setLength(0);
+        }
+    }
+    NcLogger::getInstance().setLevel(LLOG_PVERB);
+
+    for (uint32_t f = 0; f < nserver; f++)
+    {
+        release(ctx, (NcMsg*)frags[f]->m_peer_);
+        delete frags[f];
+    }
+    r->m_peer_ = NULL;
+    release(ctx, r);
+
+    LOG_DEBUG("mget %u keys x %u bytes over %u servers : %.2f us/req, rsp %u bytes",
+        nkey, vlen, nserver, cost / (double)loops, len);
+}
+
+int main(int argc, char **argv)
+{
+    NcLogger::getInstance().init(LLOG_PVERB, "./test.logs");
+
+    NcContext ctx;
+    ctx.mbuf_pool.init(MBUF_SIZE);
+
+    redisTest(&ctx);
+    memcacheTest(&ctx);
+
+    mgetBench(&ctx, 100, 16, 32, 100000);
+    mgetBench(&ctx, 100, 16, 1024, 20000);
+    ASSERT(ctx.mbuf_pool.nused() == 0);
+
+    return 0;
+}
@@ -0,0 +1,134 @@
+#include <string>
+#include <vector>
+#include <nc_hashkit.h>
+
+#define NKEY        (1 << 16)
+#define ROUNDS      16
+
+/* 逐位算的crc32c, 用来对照 */
+static uint32_t bitCrc32c(const uint8_t *p, size_t n)
+{
+    uint32_t crc = 0xffffffff;
+    while (n--)
+    {
+        crc ^= *p++;
+        for (int k = 0; k < 8; k++)
+        {
+            crc = (crc >> 1) ^ (0x82f63b78 & (0 - (crc & 1)));
+        }
+    }
+    return ~crc;
+}
+
+static void vectorTest()
+{
+    ASSERT(nc_crc32c("123456789", 9) == 0xe3069283);
+    ASSERT(nc_crc32c("", 0) == 0);
+
+    // 每种长度和对齐, 和逐位的结果比较
+    uint8_t buf[300];
+    for (uint32_t i = 0; i < sizeof(buf); i++)
+    {
+        buf[i] = (uint8_t)(i * 7 + 1);
+    }
+    for (uint32_t off = 0; off < 8; off++)
+    {
+        for (uint32_t len = 0; off + len <= 280; len++)
+        {
+            ASSERT(nc_crc32c((const char *)buf + off, len) == bitCrc32c(buf + off, len));
+        }
+    }
+
+    /*
+     * XXH3_64bits() of the reference (xxHash 0.8) over the same bytes,
+     * one length for each of its code paths and their edges.
+     */
+    static uint8_t data[3000];
+    for (uint32_t i = 0; i < sizeof(data); i++)
+    {
+        data[i] = (uint8_t)(i * 7 + 1);
+    }
+    const struct { size_t len; uint64_t hash; } xxh3[] = {
+        { 0, 0x2d06800538d394c2ULL }, { 1, 0xe12ef9d2eb86ceebULL },
+        { 3, 0x5c83885a0fb5d516ULL }, { 4, 0x244f36de481e7522ULL },
+        { 8, 0x96cc97a6768fd7a9ULL }, { 9, 0x4781d83b8e99d495ULL },
+        { 16, 0x913bd4a8038027a7ULL }, { 17, 0x2bf6f66973a6179dULL },
+        { 100, 0x985c0aa35f523fe6ULL }, { 128, 0xc4399c7829d0628fULL },
+        { 129, 0x8433489056750b32ULL }, { 240, 0x3c0bb96864e543a1ULL },
+        { 241, 0xbff7215089202d8fULL }, { 1024, 0xac8e32e4ea3ba062ULL },
+        { 1025, 0xc856c953bbdbc807ULL }, { 3000, 0xaf446cc1736d393cULL },
+    };
+    for (size_t i = 0; i < sizeof(xxh3) / sizeof(xxh3[0]); i++)
+    {
+        ASSERT(nc_xxh3_64((const char *)data, xxh3[i].len) == xxh3[i].hash);
+    }
+
+    // wyhash final4, seed 0
+    const struct { const char *key; uint64_t hash; } wy[] = {
+        { "", 0x93228a4de0eec5a2ULL },
+        { "a", 0xaced12527fe5bff8ULL },
+        { "abc", 0x989b4a209c1011c9ULL },
+        { "message digest", 0x309ab4c045215e8fULL },
+        { "abcdefghijklmnopqrstuvwxyz", 0xccaeadc12a061176ULL },
+        { "ABCDEFGHIJKLMNOPQRSTUVWXYZabcdefghijklmnopqrstuvwxyz0123456789", 0x1fdd130ecb5b4709ULL },
+        { "12345678901234567890123456789012345678901234567890123456789012345678901234567890",
+          0x7e22da19f1a6055aULL },
+    };
+    for (size_t i = 0; i < sizeof(wy) / sizeof(wy[0]); i++)
+    {
+        ASSERT(nc_wyhash(wy[i].key, strlen(wy[i].key)) == wy[i].hash);
+    }
+
+    // 路由用的是低32位
+    ASSERT(NcHashKit::hash(kHASH_XXH3_64, (const char *)data, 100) == 0x5f523fe6);
+    ASSERT(NcHashKit::hash(kHASH_WYHASH, "abc", 3) == 0x9c1011c9);
+    ASSERT(NcHashKit::hash(kHASH_CRC32C, "123456789", 9) == 0xe3069283);
+}
+
+static void hashBench()
+{
+    const int types[] = { kHASH_FNV1A_64, kHASH_MURMUR, kHASH_CRC32C, kHASH_XXH3_64, kHASH_WYHASH };
+    const char *names[] = { "fnv1a_64", "murmur", "crc32c", "xxh3_64", "wyhash" };
+    const size_t lens[] = { 8, 16, 32, 64, 128, 256 };
+
+    for (size_t l = 0; l < sizeof(lens) / sizeof(lens[0]); l++)
+    {
+        // NKEY个不同的key, 首尾相接
+        std::string data;
+        srandom(1);
+        for (size_t i = 0; i < NKEY * lens[l]; i++)
+        {
+            data.push_back((char)('a' + random() % 26));
+        }
+        const char *base = data.data();
+
+        double cost[sizeof(types) / sizeof(types[0])];
+        for (size_t t = 0; t < sizeof(types) / sizeof(types[0]); t++)
+        {
+            volatile uint32_t sink = 0;
+            int64_t start = NcUtil::ncPreciseUsec();
+            for (int r = 0; r < ROUNDS; r++)
+            {
+                for (uint32_t i = 0; i < NKEY; i++)
+                {
+                    sink += NcHashKit::hash(types[t], base + i * lens[l], lens[l]);
+                }
+            }
+            cost[t] = 1000.0 * (NcUtil::ncPreciseUsec() - start) / ((double)NKEY * ROUNDS);
+        }
+
+        LOG_DEBUG("%3zu byte keys, ns per key: %s %.1f, %s %.1f, %s %.1f, %s %.1f, %s %.1f",
+            lens[l], names[0], cost[0], names[1], cost[1], names[2], cost[2],
+            names[3], cost[3], names[4], cost[4]);
+    }
+}
+
+int main(int argc, char **argv)
+{
+    NcLogger::getInstance().init(LLOG_PVERB, "./test.logs");
+
+    vectorTest();
+    hashBench();
+
+    return 0;
+}
@@ -0,0 +1,210 @@
+#include <string>
+#include <vector>
+#include <nc_hashkit.h>
+
+#define NKEY        100000
+#define ROUNDS      20
+
+/* 原来逐字节找hash tag的做法, 用来对照 */
+static bool scalarTag(uint8_t **key, uint32_t *keylen, uint8_t open, uint8_t close)
+{
+    uint8_t *start = nc_strchr(*key, *key + *keylen, open);
+    if (start == NULL)
+    {
+        return false;
+    }
+
+    uint8_t *end = nc_strchr(start + 1, *key + *keylen, close);
+    if (end == NULL || end - start <= 1)
+    {
+        return false;
+    }
+
+    *key = start + 1;
+    *keylen = (uint32_t)(end - *key);
+    return true;
+}
+
+static std::string tag(const char *key)
+{
+    uint8_t *p = (uint8_t *)key;
+    uint32_t n = (uint32_t)strlen(key);
+    return nc_hashtag(&p, &n, '{', '}') ? std::string((char *)p, n) : "-";
+}
+
+static void scanTest()
+{
+    // 每种对齐和长度, 和逐字节的结果比较
+    uint8_t buf[256] __attribute__((aligned(64)));
+    for (uint32_t i = 0; i < sizeof(buf); i++)
+    {
+        buf[i] = (uint8_t)('a' + i % 23);
+    }
+    for (uint32_t off = 0; off < 64; off++)
+    {
+        for (uint32_t len = 0; off + len <= 160; len++)
+        {
+            for (uint32_t at = off; at < off + len + 2 && at < sizeof(buf); at++)
+            {
+                uint8_t save = buf[at];
+                buf[at] = '{';
+
+                uint8_t *expect = NULL;
+                for (uint8_t *p = buf + off; p < buf + off + len; p++)
+                {
+                    if (*p == '{')
+                    {
+                        expect = p;
+                        break;
+                    }
+                }
+                ASSERT(nc_memscan(buf + off, buf + off + len, '{') == expect);
+
+                buf[at] = save;
+            }
+        }
+    }
+
+    // '\0'不是结尾, 逐字节的nc_strchr在那里就停了
+    const uint8_t bin[] = { 'a', '\0', 'b', '{', 'x', '}' };
+    ASSERT(nc_memscan(bin, bin + sizeof(bin), '{') == bin + 3);
+    ASSERT(nc_strchr(bin, bin + sizeof(bin), '{') != bin + 3);
+
+    ASSERT(tag("{user1000}.following") == "user1000");
+    ASSERT(tag("foo{bar}{zap}") == "bar");
+    ASSERT(tag("foo{}{bar}") == "-");
+    ASSERT(tag("foo{{bar}}zap") == "{bar");
+    ASSERT(tag("foo{bar") == "-");
+    ASSERT(tag("foo}bar{") == "-");
+    ASSERT(tag("") == "-");
+    ASSERT(tag("a-very-long-key-that-spans-more-than-one-block:{tag}") == "tag");
+}
+
+/*
+ * Key lengths as seen on a cache pool: mostly short ids, some tagged
+ * keys, longer url-like keys, a few big ones.
+ */
+static void makeKeys(std::string &data, std::vector<uint32_t> &offset)
+{
+    char buf[512];
+    srandom(1);
+    for (uint32_t i = 0; i < NKEY; i++)
+    {
+        int n, r = (int)(random() % 100);
+        if (r < 35)
+        {
+            n = snprintf(buf, sizeof(buf), "user:%ld", random() % 10000000);
+        }
+        else if (r < 55)
+        {
+            n = snprintf(buf, sizeof(buf), "session:%08lx%08lx", random(), random());
+        }
+        else if (r < 75)
+        {
+            n = snprintf(buf, sizeof(buf), "{user%ld}:profile:settings", random() % 1000000);
+        }
+        else if (r < 95)
+        {
+            n = snprintf(buf, sizeof(buf), "cache:v2:page:/catalog/%ld/items?sort=price&page=%ld",
+                random() % 100000, random() % 50);
+        }
+        else
+        {
+            n = 200 + (int)(random() % 200);
+            for (int j = 0; j < n; j++)
+            {
+                buf[j] = (char)('a' + random() % 26);
+            }
+        }
+
+        offset.push_back((uint32_t)data.size());
+        data.append(buf, n);
+    }
+    offset.push_back((uint32_t)data.size());
+}
+
+static void hashBench()
+{
+    std::string data;
+    std::vector<uint32_t> offset;
+    makeKeys(data, offset);
+    uint8_t *base = (uint8_t *)&data[0];
+
+    volatile uint32_t sink = 0;
+    int64_t start = NcUtil::ncPreciseUsec();
+    for (int r = 0; r < ROUNDS; r++)
+    {
+        for (uint32_t i = 0; i < NKEY; i++)
+        {
+            uint8_t *key = base + offset[i];
+            uint32_t keylen = offset[i + 1] - offset[i];
+            sink += scalarTag(&key, &keylen, '{', '}') ? keylen : 0;
+        }
+    }
+    int64_t scalar = NcUtil::ncPreciseUsec() - start;
+
+    start = NcUtil::ncPreciseUsec();
+    for (int r = 0; r < ROUNDS; r++)
+    {
+        for (uint32_t i = 0; i < NKEY; i++)
+        {
+            uint8_t *key = base + offset[i];
+            uint32_t keylen = offset[i + 1] - offset[i];
+            sink += nc_hashtag(&key, &keylen, '{', '}') ? keylen : 0;
+        }
+    }
+    int64_t vector = NcUtil::ncPreciseUsec() - start;
+
+    double nkey = (double)NKEY * ROUNDS;
+    LOG_DEBUG("%d keys, %.1f bytes avg; tag scan Mkeys/s: byte loop %.1f, %s %.1f",
+        NKEY, (double)data.size() / NKEY, nkey / scalar,
+#if defined(__AVX2__)
+        "avx2",
+#elif defined(__SSE2__)
+        "sse2",
+#else
+        "scalar",
+#endif
+        nkey / vector);
+
+    const char *names[] = {
+        "one_at_a_time", "md5", "crc16", "crc32", "crc32a", "fnv1_64", "fnv1a_64",
+        "fnv1_32", "fnv1a_32", "hsieh", "murmur", "jenkins", "crc32c", "xxh3_64",
+        "wyhash"
+    };
+    NcString tags("{}");
+    for (int type = kHASH_ONE_AT_A_TIME; type <= kHASH_WYHASH; type++)
+    {
+        start = NcUtil::ncPreciseUsec();
+        for (int r = 0; r < ROUNDS; r++)
+        {
+            for (uint32_t i = 0; i < NKEY; i++)
+            {
+                sink += NcHashKit::hash(type, base + offset[i], offset[i + 1] - offset[i], tags);
+            }
+        }
+        int64_t cost = NcUtil::ncPreciseUsec() - start;
+
+        LOG_DEBUG("  %-14s %6.2f Mkeys/s per core (tag + hash)", names[type - 1], nkey / cost);
+    }
+
+    // 和分开找tag再hash的结果一样
+    for (uint32_t i = 0; i < NKEY; i++)
+    {
+        uint8_t *key = base + offset[i];
+        uint32_t keylen = offset[i + 1] - offset[i];
+        uint32_t fused = NcHashKit::hash(kHASH_FNV1A_64, key, keylen, tags);
+        scalarTag(&key, &keylen, '{', '}');
+        ASSERT(fused == NcHashKit::hash(kHASH_FNV1A_64, (const char *)key, keylen));
+    }
+}
+
+int main(int argc, char **argv)
+{
+    NcLogger::getInstance().init(LLOG_PVERB, "./test.logs");
+
+    scanTest();
+    hashBench();
+
+    return 0;
+}
@@ -0,0 +1,214 @@
+#include <string>
+#include <nc_http.h>
+#include "nc_test_util.h"
+
+static void requestTest(NcContext *ctx)
+{
+    std::vector<NcMsg*> msgs;
+    std::string body(5000, 'b');
+    std::string stream =
+        "\r\n"
+        "GET /users/42/profile?tab=1 HTTP/1.1\r\nHost: a\r\nX-User:  u7 \r\n\r\n"
+        "POST /users/43 HTTP/1.1\r\nContent-Length: 5000\r\n\r\n" + body +
+        "PUT http://example.com/files/x HTTP/1.1\r\nTransfer-Encoding: chunked\r\n\r\n"
+        "5;ext=1\r\nhello\r\n1000\r\n" + std::string(4096, 'c') + "\r\n0\r\nTrailer: t\r\n\r\n"
+        "HEAD / HTTP/1.1\r\nx-user: u9\r\n\r\n"
+        "GET /old HTTP/1.0\r\n\r\n"
+        "DELETE /k HTTP/1.1\r\nConnection: Close\r\n\r\n"
+        "GET /hop HTTP/1.1\r\nKeep-Alive: 5\r\nConnection: keep-alive, X-Trace\r\n"
+        "X-Trace: 1\r\nX-User: u1\r\n\r\n"
+        "GET /v10 HTTP/1.0\r\nX-User: u2\r\nConnection: keep-alive, x-user\r\n\r\n";
+
+    NcConfHttpKey path, segment, header;
+    segment.type = kHTTP_KEY_SEGMENT;
+    segment.segment = 2;
+    header.type = kHTTP_KEY_HEADER;
+    header.header = "X-User";
+
+    // 一次读完, 以及每次只读1字节/7字节(行跨mbuf, 需要repair)
+    size_t rsizes[] = {stream.size(), 1, 7};
+    for (uint32_t r = 0; r < sizeof(rsizes) / sizeof(rsizes[0]); r++)
+    {
+        ASSERT(feed(ctx, kPROTOCOL_HTTP, true, stream, rsizes[r], &msgs, &path) == NC_OK);
+        ASSERT(msgs.size() == 8);
+
+        ASSERT(NcHttp::method(msgs[0]) == kHTTP_METHOD_GET);
+        ASSERT(key(msgs[0]) == "/users/42/profile" && !NcHttp::close(msgs[0]));
+        ASSERT(NcHttp::method(msgs[1]) == kHTTP_METHOD_POST && key(msgs[1]) == "/users/43");
+        ASSERT(content(msgs[1]).size() == 49 + body.size());
+        ASSERT(NcHttp::method(msgs[2]) == kHTTP_METHOD_PUT && key(msgs[2]) == "/files/x");
+        ASSERT(NcHttp::method(msgs[3]) == kHTTP_METHOD_HEAD && key(msgs[3]) == "/");
+        // HTTP/1.0保持版本, 加上keep-alive让server不关连接, client在响应后关闭
+        ASSERT(content(msgs[4]) == "GET /old HTTP/1.0\r\nConnection: keep-alive\r\n\r\n");
+        ASSERT(NcHttp::close(msgs[4]));
+        // Connection头和它列出的header不转发给server
+        ASSERT(NcHttp::close(msgs[5]) && content(msgs[5]) == "DELETE /k HTTP/1.1\r\n\r\n");
+        ASSERT(!NcHttp::close(msgs[6]));
+        ASSERT(content(msgs[6]) == "GET /hop HTTP/1.1\r\nX-User: u1\r\n\r\n");
+        ASSERT(!NcHttp::close(msgs[7]));
+        ASSERT(content(msgs[7]) == "GET /v10 HTTP/1.0\r\nConnection: keep-alive\r\n\r\n");
+        release(ctx, &msgs);
+
+        ASSERT(feed(ctx, kPROTOCOL_HTTP, true, stream, rsizes[r], &msgs,
+            &segment) == NC_OK);
+        ASSERT(key(msgs[0]) == "42" && key(msgs[1]) == "43" && key(msgs[2]) == "x");
+        ASSERT(key(msgs[3]) == "");
+        release(ctx, &msgs);
+
+        // 没有路由header的请求按path路由
+        ASSERT(feed(ctx, kPROTOCOL_HTTP, true, stream, rsizes[r], &msgs,
+            &header) == NC_OK);
+        ASSERT(key(msgs[0]) == "u7" && key(msgs[1]) == "/users/43");
+        ASSERT(key(msgs[3]) == "u9");
+        // 路由header在去掉的header后面, 或者自己被去掉
+        ASSERT(key(msgs[6]) == "u1" && key(msgs[7]) == "/v10");
+        release(ctx, &msgs);
+    }
+
+    // 内嵌buffer放不下keep-alive, 移到新的mbuf再加
+    std::string v10 = "GET /" + std::string(70, 'p') + " HTTP/1.0\r\nX-Pad: " +
+        std::string(20, 'x') + "\r\n\r\n";
+    ASSERT(v10.size() > NC_MSG_INLINE_SIZE - 24 && v10.size() <= NC_MSG_INLINE_SIZE);
+    NcMsg *msg = feedOne(ctx, kPROTOCOL_HTTP, true, v10);
+    ASSERT(content(msg) == v10.substr(0, v10.size() - 2) + "Connection: keep-alive\r\n\r\n");
+    release(ctx, msg);
+
+    // 不支持的版本, CONNECT, 长度冲突, 同时有长度和chunked, 错误的chunk, 折行
+    const char *bad[] = {
+        "GET / HTTP/2.0\r\n\r\n",
+        "GET /\r\n",
+        "CONNECT a:443 HTTP/1.1\r\n\r\n",
+        "POST / HTTP/1.1\r\nContent-Length: 1\r\nContent-Length: 2\r\n\r\n",
+        "POST / HTTP/1.1\r\nContent-Length: 1\r\nTransfer-Encoding: chunked\r\n\r\n",
+        "POST / HTTP/1.1\r\nTransfer-Encoding: gzip\r\n\r\n",
+        "POST / HTTP/1.1\r\nTransfer-Encoding: chunked\r\n\r\nzz\r\n",
+        "POST / HTTP/1.1\r\nTransfer-Encoding: chunked\r\n\r\n1\r\nab\r\n",
+        "GET / HTTP/1.1\r\nA: b\r\n c\r\n\r\n",
+    };
+    for (uint32_t i = 0; i < sizeof(bad) / sizeof(bad[0]); i++)
+    {
+        ASSERT(feed(ctx, kPROTOCOL_HTTP, true, bad[i], 1, &msgs, &path) == NC_ERROR);
+        ASSERT(msgs.back()->getResult() == kMSG_PARSE_ERROR);
+        release(ctx, &msgs);
+    }
+
+    // Connection列出的header太多
+    std::string many = "GET / HTTP/1.1\r\nConnection: " + std::string(NC_HTTP_MAX_OPTIONS, 'o') +
+        "\r\n\r\n";
+    ASSERT(feed(ctx, kPROTOCOL_HTTP, true, many, many.size(), &msgs, &path) == NC_ERROR);
+    release(ctx, &msgs);
+}
+
+static void responseTest(NcContext *ctx)
+{
+    std::vector<NcMsg*> msgs;
+    std::string stream =
+        "HTTP/1.1 200 OK\r\nContent-Length: 3\r\n\r\nabc"
+        "HTTP/1.1 204 No Content\r\n\r\n"
+        "HTTP/1.1 100 Continue\r\n\r\nHTTP/1.1 201 Created\r\ncontent-length: 0\r\n\r\n"
+        "HTTP/1.1 200 OK\r\nTransfer-Encoding: chunked\r\n\r\n"
+        "a\r\n0123456789\r\n0\r\n\r\n"
+        "HTTP/1.1 304 Not Modified\r\nContent-Length: 100\r\n\r\n"
+        "HTTP/1.1 404\r\nContent-Length: 2\r\n\r\nno";
+
+    size_t rsizes[] = {stream.size(), 1, 13};
+    for (uint32_t r = 0; r < sizeof(rsizes) / sizeof(rsizes[0]); r++)
+    {
+        ASSERT(feed(ctx, kPROTOCOL_HTTP, false, stream, rsizes[r], &msgs) == NC_OK);
+        ASSERT(msgs.size() == 6);
+        ASSERT(NcHttp::status(msgs[0]) == 200 && NcHttp::status(msgs[2]) == 201);
+        ASSERT(content(msgs[2]).find("100 Continue") != std::string::npos);
+        ASSERT(NcHttp::status(msgs[5]) == 404);
+        uint32_t total = 0;
+        for (uint32_t i = 0; i < msgs.size(); i++)
+        {
+            total += (uint32_t)content(msgs[i]).size();
+        }
+        ASSERT(total == stream.size());
+        release(ctx, &msgs);
+    }
+
+    // HEAD请求的响应只有header
+    ASSERT(feed(ctx, kPROTOCOL_HTTP, true, "HEAD / HTTP/1.1\r\n\r\n", 64, &msgs) == NC_OK);
+    ASSERT(NcHttp::method(msgs[0]) == kHTTP_METHOD_HEAD);
+    std::string rsp = "HTTP/1.1 200 OK\r\nContent-Length: 10\r\n\r\n";
+    std::vector<NcMsg*> rsps;
+    ASSERT(feed(ctx, kPROTOCOL_HTTP, false, rsp, rsp.size(), &rsps, NULL,
+        std::vector<NcMsg*>(1, msgs[0])) == NC_OK);
+    ASSERT(rsps.size() == 1 && content(rsps[0]) == rsp);
+    release(ctx, &rsps);
+    release(ctx, &msgs);
+
+    // 没有长度的响应(读到连接关闭)和协议升级不支持
+    const char *bad[] = {
+        "HTTP/1.1 200 OK\r\n\r\nabc",
+        "HTTP/1.1 101 Switching Protocols\r\n\r\n",
+        "HTTP/1.1 2x0 OK\r\n\r\n",
+        "HTTP/1.1 200 OK\r\nContent-Length: -1\r\n\r\n",
+        "ICY 200 OK\r\n\r\n",
+    };
+    for (uint32_t i = 0; i < sizeof(bad) / sizeof(bad[0]); i++)
+    {
+        ASSERT(feed(ctx, kPROTOCOL_HTTP, false, bad[i], 1, &msgs) == NC_ERROR);
+        release(ctx, &msgs);
+    }
+}
+
+/* body不拷贝: 4个1MB的body按64KB读入, repair只拷贝行 */
+static void zeroCopyTest(NcContext *ctx)
+{
+    std::vector<NcMsg*> msgs;
+    std::string stream;
+    for (int i = 0; i < 4; i++)
+    {
+        stream += "POST /blob HTTP/1.1\r\nContent-Length: 1048576\r\n\r\n" +
+            std::string(1048576, 'z');
+    }
+
+    uint64_t copied = ctx->mbuf_pool.copied();
+    ASSERT(feed(ctx, kPROTOCOL_HTTP, true, stream, 65536, &msgs) == NC_OK);
+    ASSERT(msgs.size() == 4);
+    LOG_DEBUG("4 x 1MB bodies, %" PRIu64 " bytes copied", ctx->mbuf_pool.copied() - copied);
+    ASSERT(ctx->mbuf_pool.copied() - copied < 1024);
+    release(ctx, &msgs);
+}
+
+/* pipeline了npipe个请求的流 */
+static std::string pipelineStream(int npipe)
+{
+    std::string stream;
+    for (int i = 0; i < npipe; i++)
+    {
+        char req[256];
+        snprintf(req, sizeof(req), "GET /items/%06d HTTP/1.1\r\nHost: cache.local\r\n"
+            "User-Agent: bench/1.0\r\nAccept: */*\r\nX-User: user-%d\r\n\r\n", i, i % 97);
+        stream += req;
+    }
+    return stream;
+}
+
+int main(int argc, char **argv)
+{
+    NcLogger::getInstance().init(LLOG_PVERB, "./test.logs");
+
+    NcContext ctx;
+    ctx.mbuf_pool.init(MBUF_SIZE);
+
+    requestTest(&ctx);
+    responseTest(&ctx);
+    zeroCopyTest(&ctx);
+    ASSERT(ctx.mbuf_pool.nused() == 0);
+
+    NcConfHttpKey header;
+    header.type = kHTTP_KEY_HEADER;
+    header.header = "X-User";
+
+    int pipes[] = {1, 16, 256};
+    for (uint32_t i = 0; i < sizeof(pipes) / sizeof(pipes[0]); i++)
+    {
+        pipelineBench(&ctx, kPROTOCOL_HTTP, pipelineStream(pipes[i]), pipes[i], 1000000,
+            &header);
+    }
+
+    return 0;
+}
@@ -0,0 +1,248 @@
+#include <string>
+#include <vector>
+#include <algorithm>
+#include <nc_hashkit.h>
+#include "nc_test_util.h"
+
+#define NLOOKUP     (1 << 22)
+
+/* 原来twemproxy的二分查找, 用来对照 */
+static uint32_t search(NcServerPool *pool, uint32_t hashv)
+{
+    const NcContinuum *begin = &pool->continuum[0];
+    const NcContinuum *end = begin + pool->ncontinuum;
+    const NcContinuum *left = begin, *right = end;
+
+    while (left < right)
+    {
+        const NcContinuum *middle = left + (right - left) / 2;
+        if (middle->value < hashv)
+        {
+            left = middle + 1;
+        }
+        else
+        {
+            right = middle;
+        }
+    }
+
+    if (right == end)
+    {
+        right = begin;
+    }
+
+    return right->index;
+}
+
+/*
+ * Servers picked by twemproxy for the same servers, worked out with an
+ * independent script (md5 points, floorf weights, lower bound and wrap).
+ */
+static void compatTest(NcContext *ctx)
+{
+    const uint32_t hashes[] = {
+        0, 1, 0x12345678, 0x7fffffff, 0x80000000, 0xdeadbeef, 0xfffffffe, 0xffffffff
+    };
+    const uint32_t expect[] = { 1, 1, 1, 2, 2, 1, 1, 1 };
+
+    // 11211不进point的名字
+    std::vector<std::string> a;
+    a.push_back("127.0.0.1:11211:1");
+    a.push_back("127.0.0.1:11212:1");
+    a.push_back("127.0.0.2:11211:1");
+
+    std::vector<std::string> b;
+    b.push_back("10.0.0.1:6379:1");
+    b.push_back("10.0.0.2:6379:2");
+    b.push_back("10.0.0.3:6379:1");
+
+    const uint32_t count[2][3] = { { 33716, 34287, 31997 }, { 22414, 50933, 26653 } };
+    const uint32_t first[2] = { 0xf35431, 0x5046f6 };
+
+    for (int k = 0; k < 2; k++)
+    {
+        NcConfPool cp;
+        NcServerPool *pool = makePool(ctx, &cp, k == 0 ? a : b, kDIST_KETAMA);
+        ASSERT(pool->ncontinuum == 480 && pool->continuum[0].value == first[k]);
+
+        for (size_t i = 0; i < sizeof(hashes) / sizeof(hashes[0]); i++)
+        {
+            ASSERT(NcHashKit::dispatch(pool, hashes[i]) == expect[i]);
+        }
+
+        uint32_t n[3] = { 0, 0, 0 };
+        for (uint32_t i = 0; i < 100000; i++)
+        {
+            n[NcHashKit::dispatch(pool, i * 2654435761U)]++;
+        }
+        ASSERT(n[0] == count[k][0] && n[1] == count[k][1] && n[2] == count[k][2]);
+
+        delete pool;
+    }
+}
+
+static void searchTest(NcContext *ctx)
+{
+    int sizes[] = { 1, 2, 7, 100, 1000 };
+    for (size_t s = 0; s < sizeof(sizes) / sizeof(sizes[0]); s++)
+    {
+        NcConfPool cp;
+        NcServerPool *pool = makePool(ctx, &cp, manyServers(sizes[s]), kDIST_KETAMA);
+        // 和twemproxy一样, 1/7这样的权重floorf后少4个点
+        ASSERT(pool->ncontinuum <= (uint32_t)sizes[s] * 160);
+        ASSERT(pool->ncontinuum >= (uint32_t)sizes[s] * 156);
+
+        // 每个点上, 前后, 以及两头
+        for (uint32_t i = 0; i < pool->ncontinuum; i++)
+        {
+            uint32_t v = pool->continuum[i].value;
+            ASSERT(NcHashKit::dispatch(pool, v) == search(pool, v));
+            ASSERT(NcHashKit::dispatch(pool, v - 1) == search(pool, v - 1));
+            ASSERT(NcHashKit::dispatch(pool, v + 1) == search(pool, v + 1));
+        }
+        ASSERT(NcHashKit::dispatch(pool, 0) == search(pool, 0));
+        ASSERT(NcHashKit::dispatch(pool, UINT32_MAX) == search(pool, UINT32_MAX));
+
+        srandom(1);
+        for (int i = 0; i < 100000; i++)
+        {
+            uint32_t h = (uint32_t)random() ^ ((uint32_t)random() << 16);
+            ASSERT(NcHashKit::dispatch(pool, h) == search(pool, h));
+        }
+
+        delete pool;
+    }
+}
+
+static void distTest(NcContext *ctx)
+{
+    std::vector<std::string> servers;
+    servers.push_back("10.0.0.1:6379:1");
+    servers.push_back("10.0.0.2:6379:3");
+
+    // modula: 按weight展开
+    NcConfPool cp;
+    NcServerPool *pool = makePool(ctx, &cp, servers, kDIST_MODULA);
+    ASSERT(pool->ncontinuum == 4);
+    ASSERT(NcHashKit::dispatch(pool, 0) == 0 && NcHashKit::dispatch(pool, 5) == 1);
+    delete pool;
+
+    NcConfPool rp;
+    pool = makePool(ctx, &rp, servers, kDIST_RANDOM);
+    ASSERT(pool->ncontinuum == 2);
+    uint32_t n[2] = { 0, 0 };
+    for (int i = 0; i < 1000; i++)
+    {
+        n[NcHashKit::dispatch(pool, 0)]++;
+    }
+    ASSERT(n[0] > 0 && n[1] > 0);
+    delete pool;
+
+    // 被摘掉的server不在continuum上, 到时间再回来
+    NcUtil::ncTimeUpdate();
+    NcConfPool ep;
+    pool = makePool(ctx, &ep, manyServers(3), kDIST_KETAMA, true);
+    pool->server[1]->setNextRetry(NcUtil::ncCachedUsec() + 1000 * 1000LL);
+    ASSERT(NcHashKit::update(pool) == NC_OK);
+    ASSERT(pool->nlive_server == 2 && pool->ncontinuum == 2 * 160);
+    ASSERT(pool->next_rebuild == pool->server[1]->getNextRetry());
+    for (uint32_t i = 0; i < 10000; i++)
+    {
+        ASSERT(NcHashKit::dispatch(pool, i * 2654435761U) != 1);
+    }
+
+    pool->server[1]->setNextRetry(NcUtil::ncCachedUsec());
+    ASSERT(NcHashKit::update(pool) == NC_OK);
+    ASSERT(pool->nlive_server == 3 && pool->ncontinuum == 3 * 160);
+    delete pool;
+}
+
+static void ketamaBench(NcContext *ctx)
+{
+    std::vector<uint32_t> hashes(NLOOKUP);
+    srandom(2);
+    for (size_t i = 0; i < hashes.size(); i++)
+    {
+        hashes[i] = (uint32_t)random() ^ ((uint32_t)random() << 16);
+    }
+
+    int sizes[] = { 10, 100, 1000 };
+    for (size_t s = 0; s < sizeof(sizes) / sizeof(sizes[0]); s++)
+    {
+        NcConfPool cp;
+        NcServerPool *pool = makePool(ctx, &cp, manyServers(sizes[s]), kDIST_KETAMA);
+
+        volatile uint32_t sink = 0;
+        int64_t start = NcUtil::ncPreciseUsec();
+        for (size_t i = 0; i < hashes.size(); i++)
+        {
+            sink += search(pool, hashes[i]);
+        }
+        int64_t bsearch = NcUtil::ncPreciseUsec() - start;
+
+        start = NcUtil::ncPreciseUsec();
+        for (size_t i = 0; i < hashes.size(); i++)
+        {
+            sink += NcHashKit::dispatch(pool, hashes[i]);
+        }
+        int64_t lut = NcUtil::ncPreciseUsec() - start;
+
+        LOG_DEBUG("%4d servers, %6" PRIu32 " points: binary search %6.1f Mlookups/s, "
+            "prefix table %6.1f Mlookups/s", sizes[s], pool->ncontinuum,
+            (double)hashes.size() / bsearch, (double)hashes.size() / lut);
+
+        delete pool;
+    }
+}
+
+/* 小pool里选server: ketama和hrw */
+static void hrwBench(NcContext *ctx)
+{
+    std::vector<uint32_t> hashes(NLOOKUP);
+    srandom(3);
+    for (size_t i = 0; i < hashes.size(); i++)
+    {
+        hashes[i] = (uint32_t)random() ^ ((uint32_t)random() << 16);
+    }
+
+    int sizes[] = { 2, 5, 10, 20 };
+    for (size_t s = 0; s < sizeof(sizes) / sizeof(sizes[0]); s++)
+    {
+        int64_t cost[2];
+        int dists[] = { kDIST_KETAMA, kDIST_HRW };
+        for (int d = 0; d < 2; d++)
+        {
+            NcConfPool cp;
+            NcServerPool *pool = makePool(ctx, &cp, manyServers(sizes[s]), dists[d]);
+
+            volatile uint32_t sink = 0;
+            int64_t start = NcUtil::ncPreciseUsec();
+            for (size_t i = 0; i < hashes.size(); i++)
+            {
+                sink += NcHashKit::dispatch(pool, hashes[i]);
+            }
+            cost[d] = NcUtil::ncPreciseUsec() - start;
+
+            delete pool;
+        }
+
+        LOG_DEBUG("%4d servers: ketama %5.1f ns, hrw %5.1f ns per selection", sizes[s],
+            1000.0 * cost[0] / hashes.size(), 1000.0 * cost[1] / hashes.size());
+    }
+}
+
+int main(int argc, char **argv)
+{
+    NcLogger::getInstance().init(LLOG_PVERB, "./test.logs");
+
+    NcContext ctx;
+    ctx.mbuf_pool.init(MBUF_SIZE);
+
+    compatTest(&ctx);
+    searchTest(&ctx);
+    distTest(&ctx);
+    ketamaBench(&ctx);
+    hrwBench(&ctx);
+
+    return 0;
+}
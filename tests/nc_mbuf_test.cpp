@@ -1,6 +1,225 @@
 #include <nc_mbuf.h>
 
+/*
+ * 模拟一次read收到pipeline的npipe个请求, 每解析完一个请求就split一次,
+ * 返回每个请求平均拷贝的字节数
+ */
+static double splitBench(NcMbufPool *pool, int npipe, int loops, bool copy)
+{
+    char req[32];
+    uint64_t copied = pool->copied();
+    int64_t start = NcUtil::ncUsecNow();
+    std::vector<NcMbuf*> msgs;
+
+    for (int l = 0; l < loops; l++)
+    {
+        NcMbuf *mbuf = pool->alloc();
+        for (int i = 0; i < npipe; i++)
+        {
+            int n = snprintf(req, sizeof(req), "get key:%06d\r\n", i);
+            mbuf->copy((uint8_t*)req, n);
+        }
+
+        while (!mbuf->empty())
+        {
+            uint8_t *pos = (uint8_t*)memchr(mbuf->getPos(), '\n', mbuf->length()) + 1;
+            NcMbuf *nbuf = copy ? mbuf->splitCopy(pool, pos) : mbuf->split(pool, pos);
+            ASSERT(nbuf != NULL);
+            msgs.push_back(mbuf);
+            mbuf = nbuf;
+        }
+        pool->free(mbuf);
+
+        for (uint32_t i = 0; i < msgs.size(); i++)
+        {
+            pool->free(msgs[i]);
+        }
+        msgs.clear();
+    }
+
+    int64_t cost = NcUtil::ncUsecNow() - start;
+    double per_req = (double)(pool->copied() - copied) / ((double)npipe * loops);
+    LOG_DEBUG("split %s pipeline %d : %.1f bytes copied/request, %.1f ns/request", 
+        copy ? "copy" : "slice", npipe, per_req, 
+        cost * 1000.0 / ((double)npipe * loops));
+
+    return per_req;
+}
+
 int main(int argc, char **argv)
 {
+    NcLogger::getInstance().init(LLOG_PVERB, "./test.logs");
+
+    NcMbufPool pool;
+    pool.init(MBUF_MIN_SIZE);
+
+    std::vector<NcMbuf*> mbufs;
+    for (int i = 0; i < 4096; i++)
+    {
+        NcMbuf *mbuf = pool.alloc();
+        ASSERT(mbuf != NULL);
+        ASSERT(mbuf->size() == MBUF_MIN_SIZE - MBUF_HSIZE);
+        mbuf->copy((uint8_t*)"get key\r\n", 9);
+        mbufs.push_back(mbuf);
+    }
+    LOG_DEBUG("slabs : %d, chunks : %d, used : %d", pool.nslab(), 
+        pool.nchunk(), pool.nused());
+    pool.dump();
+
+    NcMbuf *mbuf = mbufs[0];
+    NcMbuf *nbuf = mbuf->split(&pool, mbuf->getPos() + 4);
+    ASSERT(mbuf->length() == 4);
+    ASSERT(nbuf->length() == 5);
+    ASSERT(nbuf->isSlice());
+    mbufs.push_back(nbuf);
+
+    // nbuf是mbufs[0]的slice, chunk在nbuf释放后才回到slab
+    for (uint32_t i = 0; i < mbufs.size(); i++)
+    {
+        pool.free(mbufs[i]);
+    }
+    ASSERT(pool.nused() == 0);
+
+    // LIFO, 最近释放的chunk最先被复用
+    NcMbuf *last = pool.alloc();
+    ASSERT(last == mbuf);
+    ASSERT(last->size() == MBUF_MIN_SIZE - MBUF_HSIZE);
+    pool.free(last);
+    pool.dump();
+
+    // slice共享chunk, 引用计数归零才释放
+    mbuf = pool.alloc();
+    mbuf->copy((uint8_t*)"get a\r\nget b\r\n", 14);
+    nbuf = mbuf->split(&pool, mbuf->getPos() + 7);
+    ASSERT(mbuf->full() && mbuf->length() == 7);
+    ASSERT(nbuf->length() == 7 && nbuf->getPos() == mbuf->getLast());
+    ASSERT(nbuf->size() == MBUF_MIN_SIZE - MBUF_HSIZE - 14);
+    pool.free(mbuf);
+    ASSERT(pool.nused() == 1);
+    ASSERT(memcmp(nbuf->getPos(), "get b\r\n", 7) == 0);
+    pool.free(nbuf);
+    ASSERT(pool.nused() == 0);
+
+    // size class: 按数据大小选择最小的class
+    NcMbufPool cpool;
+    cpool.init(MBUF_SIZE);
+    ASSERT(cpool.nclass() == MBUF_NCLASS);
+    ASSERT(cpool.alloc()->dataSize() == MBUF_SIZE - MBUF_HSIZE);
+    ASSERT(cpool.alloc(0)->dataSize() == MBUF_MIN_SIZE - MBUF_HSIZE);
+    ASSERT(cpool.alloc(MBUF_MIN_SIZE)->dataSize() == MBUF_SMALL_SIZE - MBUF_HSIZE);
+    ASSERT(cpool.alloc(MBUF_SIZE)->dataSize() == MBUF_LARGE_SIZE - MBUF_HSIZE);
+    ASSERT(cpool.alloc(MBUF_MAX_SIZE)->dataSize() == MBUF_LARGE_SIZE - MBUF_HSIZE);
+
+    NcMbuf *big = cpool.alloc(100000);
+    NcMbuf *small = big->splitCopy(&cpool, big->getLast());
+    ASSERT(small->dataSize() == MBUF_MIN_SIZE - MBUF_HSIZE);
+    cpool.free(big);
+    cpool.free(small);
+    ASSERT(cpool.alloc(100000) == big);
+
+    // 100k个连接各有一个小请求: size class对比单一16K chunk
+    NcMbufPool fixed;
+    fixed.init(MBUF_SIZE);
+    std::vector<NcMbuf*> conns;
+    for (int i = 0; i < 100000; i++)
+    {
+        conns.push_back(cpool.alloc(0));
+    }
+    uint64_t classed = cpool.usedBytes();
+    for (uint32_t i = 0; i < conns.size(); i++)
+    {
+        cpool.free(conns[i]);
+    }
+    for (int i = 0; i < 100000; i++)
+    {
+        conns[i] = fixed.alloc();
+    }
+    LOG_DEBUG("100k small requests, classed : %" PRIu64 " bytes, fixed : %" 
+        PRIu64 " bytes", classed, fixed.usedBytes());
+    ASSERT(classed * 10 < fixed.usedBytes());
+    cpool.dump();
+
+    // trim: 空闲一个周期的chunk进入cold list, 物理页被回收
+    NcMbufPool tpool;
+    tpool.init(MBUF_SIZE);
+    std::vector<NcMbuf*> storm;
+    for (int i = 0; i < 1000; i++)
+    {
+        storm.push_back(tpool.alloc(MBUF_SIZE));
+    }
+    ASSERT(tpool.slab(3).nmiss() == 1000);
+    for (uint32_t i = 0; i < storm.size(); i++)
+    {
+        tpool.free(storm[i]);
+    }
+    // 第一次trim只记录, 空闲满一个周期后才回收
+    ASSERT(tpool.trim(64) == 0);
+    ASSERT(tpool.trim(64) == 936);
+    ASSERT(tpool.slab(3).nfree() == 1000);
+    ASSERT(tpool.trim(64) == 0);
+    for (int i = 0; i < 100; i++)
+    {
+        storm[i] = tpool.alloc(MBUF_SIZE);
+        storm[i]->copy((uint8_t*)"x", 1);
+    }
+    ASSERT(tpool.slab(3).nhit() == 100 && tpool.slab(3).nmiss() == 1000);
+    tpool.dump();
+
+    // arena: slab从预留的内存分配, 用完后回退到mmap
+    NcArena arena;
+    ASSERT(arena.init(4 * 1024 * 1024) == NC_OK);
+    LOG_DEBUG("arena %zu bytes backed by %s", arena.size(), arena.backingName());
+    NcMbufPool apool;
+    apool.init(MBUF_SIZE);
+    apool.setArena(&arena);
+    std::vector<NcMbuf*> abufs;
+    for (int i = 0; i < 1024; i++)
+    {
+        abufs.push_back(apool.alloc(MBUF_SIZE));
+    }
+    ASSERT(arena.contains(abufs[0]) && !arena.contains(abufs[1023]));
+    for (uint32_t i = 0; i < abufs.size(); i++)
+    {
+        apool.free(abufs[i]);
+    }
+
+    // budget: chunk按chunk size计费, 超过limit后over, 低于80%后under
+    NcBudget global, budget;
+    global.init(64 * MBUF_SIZE);
+    budget.init(0, &global);
+    NcMbufPool gpool;
+    gpool.init(MBUF_SIZE);
+    gpool.setBudget(&budget);
+    std::vector<NcMbuf*> gbufs;
+    while (!budget.over())
+    {
+        gbufs.push_back(gpool.alloc());
+    }
+    ASSERT(gbufs.size() == 64 && global.used() == 64 * MBUF_SIZE);
+    for (uint32_t i = 0; i < 12; i++)
+    {
+        gpool.free(gbufs[i]);
+    }
+    ASSERT(!budget.over() && !budget.under());
+    gpool.free(gbufs[12]);
+    ASSERT(budget.under());
+    for (uint32_t i = 13; i < gbufs.size(); i++)
+    {
+        gpool.free(gbufs[i]);
+    }
+    ASSERT(budget.used() == 0 && global.usedMax() == 64 * MBUF_SIZE);
+
+    // bytes copied per request: splitCopy vs slice
+    NcMbufPool bpool;
+    bpool.init(MBUF_SIZE);
+    int pipes[] = {1, 16, 100};
+    for (uint32_t i = 0; i < sizeof(pipes) / sizeof(pipes[0]); i++)
+    {
+        splitBench(&bpool, pipes[i], 10000, true);
+        ASSERT(splitBench(&bpool, pipes[i], 10000, false) == 0);
+    }
+    ASSERT(bpool.nused() == 0);
+    bpool.dump();
+
     return 0;
-}
\ No newline at end of file
+}
@@ -0,0 +1,216 @@
+#include <string>
+#include <arpa/inet.h>
+#include <nc_memcache_binary.h>
+#include "nc_test_util.h"
+
+static std::string packet(uint8_t magic, uint8_t op, const std::string &key,
+    uint32_t opaque, const std::string &extras = "", const std::string &value = "")
+{
+    uint8_t h[MCBIN_HEADER_SIZE];
+    memset(h, 0, sizeof(h));
+    h[0] = magic;
+    h[1] = op;
+    uint16_t keylen = htons((uint16_t)key.size());
+    uint32_t bodylen = htonl((uint32_t)(extras.size() + key.size() + value.size()));
+    opaque = htonl(opaque);
+    memcpy(h + 2, &keylen, 2);
+    h[4] = (uint8_t)extras.size();
+    memcpy(h + 8, &bodylen, 4);
+    memcpy(h + 12, &opaque, 4);
+    return std::string((char*)h, sizeof(h)) + extras + key + value;
+}
+
+static uint32_t opaqueOf(NcMsg *msg)
+{
+    NcMbuf *mbuf = msg->getMbufQueue()->front();
+    while (mbuf->empty())
+    {
+        mbuf = msg->getMbufQueue()->next(mbuf);
+    }
+    uint32_t opaque;
+    memcpy(&opaque, mbuf->getPos() + 12, 4);
+    return ntohl(opaque);
+}
+
+static void requestTest(NcContext *ctx)
+{
+    std::vector<NcMsg*> msgs;
+    std::string longkey(250, 'k'), value(3000, 'v');
+    std::string stream =
+        packet(MCBIN_REQ_MAGIC, 0x0d, "foo", 11) +
+        packet(MCBIN_REQ_MAGIC, 0x11, longkey, 12, std::string(8, '\0'), value) +
+        packet(MCBIN_REQ_MAGIC, 0x00, "bar", 13) +
+        packet(MCBIN_REQ_MAGIC, MCBIN_CMD_NOOP, "", 14) +
+        packet(MCBIN_REQ_MAGIC, MCBIN_CMD_QUIT, "", 15);
+
+    // 一次读完, 以及每次只读1字节/5字节(header和key跨mbuf, 需要repair)
+    size_t rsizes[] = {stream.size(), 1, 5};
+    for (uint32_t r = 0; r < sizeof(rsizes) / sizeof(rsizes[0]); r++)
+    {
+        ASSERT(feed(ctx, kPROTOCOL_MEMCACHED_BINARY, true, stream, rsizes[r],
+            &msgs) == NC_OK);
+        ASSERT(msgs.size() == 5);
+
+        ASSERT(NcMemcacheBinary::flags(msgs[0]) & MCBIN_OP_QUIET);
+        ASSERT(key(msgs[0], 0) == "foo");
+        ASSERT(key(msgs[1], 0) == longkey && (NcMemcacheBinary::flags(msgs[1]) & MCBIN_OP_QUIET));
+        ASSERT(!(NcMemcacheBinary::flags(msgs[2]) & MCBIN_OP_QUIET));
+        // 转发的请求opaque被换成请求id, 本地应答的noop保留原值
+        ASSERT(opaqueOf(msgs[0]) == (uint32_t)msgs[0]->m_id_);
+        ASSERT(opaqueOf(msgs[2]) == (uint32_t)msgs[2]->m_id_);
+        ASSERT(msgs[3]->m_noforward_ && opaqueOf(msgs[3]) == 14);
+        ASSERT(msgs[4]->m_quit_);
+        release(ctx, &msgs);
+    }
+
+    // magic错误, 不支持的opcode(stat), 没有key的get, extras+key超过body, key太长
+    std::string bad[] = {
+        packet(MCBIN_RSP_MAGIC, 0x00, "foo", 1),
+        packet(MCBIN_REQ_MAGIC, 0x10, "", 1),
+        packet(MCBIN_REQ_MAGIC, 0x00, "", 1),
+        packet(MCBIN_REQ_MAGIC, 0x00, "foo", 1).replace(11, 1, 1, '\x01'),
+        packet(MCBIN_REQ_MAGIC, 0x00, std::string(251, 'k'), 1),
+    };
+    for (uint32_t i = 0; i < sizeof(bad) / sizeof(bad[0]); i++)
+    {
+        ASSERT(feed(ctx, kPROTOCOL_MEMCACHED_BINARY, true, bad[i], 1, &msgs) == NC_ERROR);
+        ASSERT(msgs.back()->getResult() == kMSG_PARSE_ERROR);
+        release(ctx, &msgs);
+    }
+}
+
+static void responseTest(NcContext *ctx)
+{
+    std::vector<NcMsg*> msgs;
+    std::string stream =
+        packet(MCBIN_RSP_MAGIC, 0x0d, "foo", 21, std::string(4, '\0'), "bar") +
+        packet(MCBIN_RSP_MAGIC, 0x00, "", 22, "", std::string(5000, 'x')) +
+        packet(MCBIN_RSP_MAGIC, MCBIN_CMD_NOOP, "", 23);
+
+    size_t rsizes[] = {stream.size(), 1, 7};
+    for (uint32_t r = 0; r < sizeof(rsizes) / sizeof(rsizes[0]); r++)
+    {
+        ASSERT(feed(ctx, kPROTOCOL_MEMCACHED_BINARY, false, stream, rsizes[r],
+            &msgs) == NC_OK);
+        ASSERT(msgs.size() == 3);
+        ASSERT(opaqueOf(msgs[0]) == 21 && opaqueOf(msgs[2]) == 23);
+        ASSERT(msgs[0]->getKeys().empty());
+        release(ctx, &msgs);
+    }
+
+    ASSERT(feed(ctx, kPROTOCOL_MEMCACHED_BINARY, false, packet(MCBIN_REQ_MAGIC, 0x00, "foo", 1),
+        1, &msgs) == NC_ERROR);
+    release(ctx, &msgs);
+}
+
+/*
+ * 100个key的multi-get, 一半命中: 文本协议是一个"get k0 ... k99"请求和
+ * 50个VALUE加END的响应; 二进制协议是100个GETKQ加NOOP, 响应只有50个命中
+ * 和NOOP. 统计解析请求和响应每个key的耗时, 以及响应包的个数
+ */
+static void multigetBench(NcContext *ctx, int nkey, int loops)
+{
+    std::string treq = "get", trsp, breq, brsp;
+    for (int i = 0; i < nkey; i++)
+    {
+        std::string k = "key:" + std::to_string(i);
+        treq += " " + k;
+        breq += packet(MCBIN_REQ_MAGIC, 0x0d, k, i);
+        if (i % 2 == 0)
+        {
+            trsp += "VALUE " + k + " 0 16\r\n" + std::string(16, 'v') + "\r\n";
+            brsp += packet(MCBIN_RSP_MAGIC, 0x0d, k, i, std::string(4, '\0'), std::string(16, 'v'));
+        }
+    }
+    treq += "\r\n";
+    trsp += "END\r\n";
+    breq += packet(MCBIN_REQ_MAGIC, MCBIN_CMD_NOOP, "", nkey);
+    brsp += packet(MCBIN_RSP_MAGIC, MCBIN_CMD_NOOP, "", nkey);
+
+    NcLogger::getInstance().setLevel(LLOG_WARN);
+
+    int64_t start = NcUtil::ncPreciseUsec();
+    for (int l = 0; l < loops; l++)
+    {
+        NcMsg msg;
+        NcMbuf *mbuf = ctx->mbuf_pool.alloc(treq.size());
+        mbuf->copy((uint8_t*)treq.data(), treq.size());
+        msg.getMbufQueue()->push(mbuf);
+        msg.setPos(mbuf->getPos());
+        msg.m_request_ = 1;
+        NcMemcache::parseRequest(&msg);
+        ASSERT(msg.getResult() == kMSG_PARSE_OK && (int)msg.getKeys().size() == nkey);
+        ctx->mbuf_pool.free(mbuf);
+
+        NcMsg rsp;
+        mbuf = ctx->mbuf_pool.alloc(trsp.size());
+        mbuf->copy((uint8_t*)trsp.data(), trsp.size());
+        rsp.getMbufQueue()->push(mbuf);
+        rsp.setPos(mbuf->getPos());
+        NcMemcache::parseResponse(&rsp);
+        ASSERT(rsp.getResult() == kMSG_PARSE_OK);
+        ctx->mbuf_pool.free(mbuf);
+    }
+    int64_t text = NcUtil::ncPreciseUsec() - start;
+
+    /* 一个NcMsg复用来解析每个包, 和文本协议一样只算解析, 不算分配消息 */
+    NcMbuf *qbuf = ctx->mbuf_pool.alloc(breq.size());
+    qbuf->copy((uint8_t*)breq.data(), breq.size());
+    NcMbuf *rbuf = ctx->mbuf_pool.alloc(brsp.size());
+    rbuf->copy((uint8_t*)brsp.data(), brsp.size());
+    uint32_t nrsp = 0;
+    start = NcUtil::ncPreciseUsec();
+    for (int l = 0; l < loops; l++)
+    {
+        NcMsg msg;
+        for (uint8_t *p = qbuf->getPos(); p < qbuf->getLast(); p = msg.pos)
+        {
+            msg.reset();
+            msg.getMbufQueue()->push(qbuf);
+            msg.setPos(p);
+            msg.m_request_ = 1;
+            NcMemcacheBinary::parseRequest(&msg);
+            ASSERT(msg.getResult() == kMSG_PARSE_OK);
+            msg.getMbufQueue()->remove(qbuf);
+        }
+        /* the request rewrote the opaques in place, put them back */
+        memcpy(qbuf->getPos(), breq.data(), breq.size());
+
+        nrsp = 0;
+        for (uint8_t *p = rbuf->getPos(); p < rbuf->getLast(); p = msg.pos, nrsp++)
+        {
+            msg.reset();
+            msg.getMbufQueue()->push(rbuf);
+            msg.setPos(p);
+            NcMemcacheBinary::parseResponse(&msg);
+            ASSERT(msg.getResult() == kMSG_PARSE_OK);
+            msg.getMbufQueue()->remove(rbuf);
+        }
+        msg.reset();
+    }
+    int64_t binary = NcUtil::ncPreciseUsec() - start;
+    ctx->mbuf_pool.free(qbuf);
+    ctx->mbuf_pool.free(rbuf);
+    NcLogger::getInstance().setLevel(LLOG_PVERB);
+
+    LOG_DEBUG("%d key multi-get, 50%% hits : text %.1f ns/key, 1 response of %zu bytes; "
+        "binary %.1f ns/key, %u responses of %zu bytes", nkey,
+        text * 1000.0 / ((double)loops * nkey), trsp.size(),
+        binary * 1000.0 / ((double)loops * nkey), nrsp, brsp.size());
+}
+
+int main(int argc, char **argv)
+{
+    NcLogger::getInstance().init(LLOG_PVERB, "./test.logs");
+
+    NcContext ctx;
+    ctx.mbuf_pool.init(MBUF_SIZE);
+
+    requestTest(&ctx);
+    responseTest(&ctx);
+    ASSERT(ctx.mbuf_pool.nused() == 0);
+
+    multigetBench(&ctx, 100, 20000);
+
+    return 0;
+}
@@ -0,0 +1,152 @@
+#include <string>
+#include <nc_memcache.h>
+#include "nc_test_util.h"
+
+static void requestTest(NcContext *ctx)
+{
+    std::vector<NcMsg*> msgs;
+    std::string value(5000, 'v');
+    std::string stream =
+        "get foo\r\n"
+        "gets  a b c\r\n"
+        "set k1 0 0 5\r\nhello\r\n"
+        "add k2 1 60 0 noreply\r\n\r\n"
+        "set k3 0 0 " + std::to_string(value.size()) + "\r\n" + value + "\r\n"
+        "cas k4 0 0 3 42\r\nabc\r\n"
+        "incr n 1 noreply\r\n"
+        "delete k1\r\n"
+        "touch k2 10\r\n"
+        "quit\r\n";
+
+    // 一次读完, 以及每次只读1字节/7字节(命令行跨mbuf, 需要repair)
+    size_t rsizes[] = {stream.size(), 1, 7};
+    for (uint32_t r = 0; r < sizeof(rsizes) / sizeof(rsizes[0]); r++)
+    {
+        ASSERT(feed(ctx, kPROTOCOL_MEMCACHED, true, stream, rsizes[r], &msgs) == NC_OK);
+        ASSERT(msgs.size() == 10);
+
+        ASSERT(NcMemcache::command(msgs[0])->type == kMEMCACHE_CMD_GET);
+        ASSERT(msgs[0]->getKeys().size() == 1 && key(msgs[0], 0) == "foo");
+        ASSERT(msgs[1]->getKeys().size() == 3 && key(msgs[1], 2) == "c");
+        ASSERT(key(msgs[2], 0) == "k1" && !msgs[2]->m_noreply_);
+        ASSERT(key(msgs[3], 0) == "k2" && msgs[3]->m_noreply_);
+        ASSERT(NcMemcache::command(msgs[4])->type == kMEMCACHE_CMD_SET);
+        ASSERT(msgs[4]->getKeys().size() == 1 && key(msgs[4], 0) == "k3");
+        ASSERT(NcMemcache::command(msgs[5])->type == kMEMCACHE_CMD_CAS);
+        ASSERT(msgs[6]->m_noreply_ && key(msgs[6], 0) == "n");
+        ASSERT(!msgs[7]->m_noreply_ && !msgs[8]->m_noreply_);
+        ASSERT(msgs[9]->m_quit_);
+        release(ctx, &msgs);
+    }
+
+    // 未知命令, token个数错误, 长度不是数字, 数据后没有\r\n, noreply不在最后, key太长
+    const char *bad[] = {
+        "GET foo\r\n",
+        "get\r\n",
+        "set k 0 0\r\n",
+        "set k 0 0 x\r\nabc\r\n",
+        "set k 0 0 2\r\nabc\r\n",
+        "incr k noreply 1\r\n",
+        "quit now\r\n",
+    };
+    for (uint32_t i = 0; i < sizeof(bad) / sizeof(bad[0]); i++)
+    {
+        ASSERT(feed(ctx, kPROTOCOL_MEMCACHED, true, bad[i], 1, &msgs) == NC_ERROR);
+        ASSERT(msgs.back()->getResult() == kMSG_PARSE_ERROR);
+        release(ctx, &msgs);
+    }
+    ASSERT(feed(ctx, kPROTOCOL_MEMCACHED, true, "get " + std::string(251, 'k') + "\r\n", 64,
+        &msgs) == NC_ERROR);
+    release(ctx, &msgs);
+}
+
+static void responseTest(NcContext *ctx)
+{
+    std::vector<NcMsg*> msgs;
+    std::string stream =
+        "STORED\r\n"
+        "NOT_FOUND\r\n"
+        "42\r\n"
+        "SERVER_ERROR out of memory\r\n"
+        "END\r\n"
+        "VALUE foo 0 3\r\nbar\r\nVALUE baz 5 0 77\r\n\r\n"
+        "VALUE big 0 3000\r\n" + std::string(3000, 'x') + "\r\nEND\r\n";
+
+    size_t rsizes[] = {stream.size(), 1, 13};
+    for (uint32_t r = 0; r < sizeof(rsizes) / sizeof(rsizes[0]); r++)
+    {
+        ASSERT(feed(ctx, kPROTOCOL_MEMCACHED, false, stream, rsizes[r], &msgs) == NC_OK);
+        ASSERT(msgs.size() == 6);
+        release(ctx, &msgs);
+    }
+
+    const char *bad[] = { "VALUE foo 0\r\n", "VALUE foo 0 x\r\n", "VALUE a 0 1\r\nab\r\n" };
+    for (uint32_t i = 0; i < sizeof(bad) / sizeof(bad[0]); i++)
+    {
+        ASSERT(feed(ctx, kPROTOCOL_MEMCACHED, false, bad[i], 1, &msgs) == NC_ERROR);
+        release(ctx, &msgs);
+    }
+}
+
+/*
+ * 1MB的set按4K一次读入, payload跨越多个mbuf也不拷贝, 只有跨满mbuf的
+ * 命令行会被repair拷贝
+ */
+static void zeroCopyTest(NcContext *ctx)
+{
+    std::vector<NcMsg*> msgs;
+    std::string stream;
+    for (int i = 0; i < 4; i++)
+    {
+        stream += "set key:" + std::to_string(i) + " 0 0 1048576\r\n" +
+            std::string(1048576, 'a' + i) + "\r\n";
+    }
+
+    uint64_t copied = ctx->mbuf_pool.copied();
+    ASSERT(feed(ctx, kPROTOCOL_MEMCACHED, true, stream, 4096, &msgs) == NC_OK);
+    ASSERT(msgs.size() == 4);
+    for (int i = 0; i < 4; i++)
+    {
+        ASSERT(key(msgs[i], 0) == "key:" + std::to_string(i));
+    }
+    LOG_DEBUG("4 x 1MB set in 4K reads : %" PRIu64 " bytes copied",
+        ctx->mbuf_pool.copied() - copied);
+    ASSERT(ctx->mbuf_pool.copied() - copied < 4 * 32);
+    release(ctx, &msgs);
+}
+
+/* pipeline了npipe个命令的流 */
+static std::string pipelineStream(int npipe)
+{
+    std::string stream;
+    for (int i = 0; i < npipe; i++)
+    {
+        char k[32];
+        snprintf(k, sizeof(k), "key:%06d", i);
+        stream += i % 2 ? std::string("get ") + k + "\r\n" :
+            std::string("set ") + k + " 0 0 17\r\nvalue-value-value\r\n";
+    }
+
+    return stream;
+}
+
+int main(int argc, char **argv)
+{
+    NcLogger::getInstance().init(LLOG_PVERB, "./test.logs");
+
+    NcContext ctx;
+    ctx.mbuf_pool.init(MBUF_SIZE);
+
+    requestTest(&ctx);
+    responseTest(&ctx);
+    zeroCopyTest(&ctx);
+    ASSERT(ctx.mbuf_pool.nused() == 0);
+
+    int pipes[] = {1, 16, 256};
+    for (uint32_t i = 0; i < sizeof(pipes) / sizeof(pipes[0]); i++)
+    {
+        pipelineBench(&ctx, kPROTOCOL_MEMCACHED, pipelineStream(pipes[i]), pipes[i], 1000000);
+    }
+
+    return 0;
+}
@@ -0,0 +1,295 @@
+#include <string>
+#include <nc_mysql.h>
+#include <nc_client.h>
+#include <nc_server.h>
+#include <nc_hashkit.h>
+#include "nc_test_util.h"
+
+static std::string packet(uint8_t seq, const std::string &payload)
+{
+    std::string s;
+    s += (char)(payload.size() & 0xff);
+    s += (char)((payload.size() >> 8) & 0xff);
+    s += (char)((payload.size() >> 16) & 0xff);
+    s += (char)seq;
+    return s + payload;
+}
+
+static std::string command(uint8_t cmd, const std::string &arg = "")
+{
+    return packet(0, std::string(1, (char)cmd) + arg);
+}
+
+static std::string ok(uint8_t seq, uint16_t status)
+{
+    std::string p("\x00\x00\x00", 3);
+    p += (char)(status & 0xff);
+    p += (char)(status >> 8);
+    return packet(seq, p + std::string("\x00\x00", 2));
+}
+
+static std::string eof(uint8_t seq, uint16_t status)
+{
+    std::string p("\xfe\x00\x00", 3);
+    p += (char)(status & 0xff);
+    p += (char)(status >> 8);
+    return packet(seq, p);
+}
+
+/* 一列一行的结果集 */
+static std::string resultset(uint8_t seq, const std::string &value, uint16_t status)
+{
+    std::string rows = packet(seq, "\x01") + packet(seq + 1, "def-column") +
+        eof(seq + 2, 0);
+    std::string row;
+    row += (char)0xfd;
+    row += (char)(value.size() & 0xff);
+    row += (char)((value.size() >> 8) & 0xff);
+    row += (char)((value.size() >> 16) & 0xff);
+    row += value;
+    uint8_t s = seq + 3;
+    for (size_t off = 0; ; off += MYSQL_MAX_PAYLOAD)
+    {
+        size_t n = MIN((size_t)MYSQL_MAX_PAYLOAD, row.size() - off);
+        rows += packet(s++, row.substr(off, n));
+        if (n < MYSQL_MAX_PAYLOAD)
+        {
+            break;
+        }
+    }
+    return rows + eof(s, status);
+}
+
+static size_t length(NcMsg *msg)
+{
+    size_t n = 0;
+    NcMbufQueue *queue = msg->getMbufQueue();
+    for (NcMbuf *mbuf = queue->front(); mbuf != NULL; mbuf = queue->next(mbuf))
+    {
+        n += mbuf->length();
+    }
+    return n;
+}
+
+static void scrambleTest()
+{
+    uint8_t salt[MYSQL_SALT_LEN], out[MYSQL_SALT_LEN];
+    for (int i = 0; i < MYSQL_SALT_LEN; i++)
+    {
+        salt[i] = (uint8_t)(i + 1);
+    }
+    NcMysql::scramble(out, (const uint8_t*)"secret", 6, salt);
+
+    const uint8_t expect[MYSQL_SALT_LEN] = {
+        0xb3, 0x2b, 0xb3, 0xa5, 0x83, 0xe1, 0x34, 0x0c, 0x0a, 0x11,
+        0x08, 0xd5, 0x8b, 0x1b, 0xe4, 0x97, 0x81, 0xad, 0x8c, 0x2f,
+    };
+    ASSERT(memcmp(out, expect, sizeof(expect)) == 0);
+}
+
+static void requestTest(NcContext *ctx)
+{
+    std::vector<NcMsg*> msgs;
+    std::string big(70000, 'q');
+    std::string stream =
+        command(MYSQL_COM_QUERY, "SELECT 1") +
+        command(MYSQL_COM_PING) +
+        command(MYSQL_COM_QUERY, "INSERT INTO t VALUES ('" + big + "')") +
+        command(MYSQL_COM_STMT_PREPARE, "SELECT ?") +
+        command(MYSQL_COM_QUIT);
+
+    // 一次读完, 以及每次只读1字节/5字节(包头跨mbuf, 需要repair)
+    size_t rsizes[] = {stream.size(), 1, 5};
+    for (uint32_t r = 0; r < sizeof(rsizes) / sizeof(rsizes[0]); r++)
+    {
+        ASSERT(feed(ctx, kPROTOCOL_MYSQL, true, stream, rsizes[r], &msgs) == NC_OK);
+        ASSERT(msgs.size() == 5);
+        ASSERT(NcMysql::command(msgs[0]) == MYSQL_COM_QUERY && length(msgs[0]) == 13);
+        ASSERT(NcMysql::command(msgs[1]) == MYSQL_COM_PING);
+        ASSERT(NcMysql::command(msgs[2]) == MYSQL_COM_QUERY && length(msgs[2]) > big.size());
+        ASSERT(NcMysql::command(msgs[3]) == MYSQL_COM_STMT_PREPARE);
+        ASSERT(NcMysql::flags(msgs[3]) & MYSQL_COM_SESSION);
+        ASSERT(NcMysql::flags(msgs[4]) & MYSQL_COM_QUIT_FLAG);
+        release(ctx, &msgs);
+    }
+}
+
+/* 查询是否开始事务, 是否在session里留下状态 */
+static void filterTest(NcContext *ctx)
+{
+    NcServerPool sp(NULL);
+    sp.mysql_db = NcStringView((const uint8_t*)"shop", 4);
+    NcClientConn conn;
+    conn.m_owner_ = &sp;
+
+    struct
+    {
+        std::string req;
+        uint32_t flags;
+        bool noforward;
+    } cases[] = {
+        { command(MYSQL_COM_QUERY, "SELECT * FROM t WHERE a = 'SET'"), 0, false },
+        { command(MYSQL_COM_QUERY, "  /* BEGIN */ select @@version"), 0, false },
+        { command(MYSQL_COM_QUERY, "begin"), MYSQL_REQ_TRX, false },
+        { command(MYSQL_COM_QUERY, "START TRANSACTION READ ONLY"), MYSQL_REQ_TRX, false },
+        { command(MYSQL_COM_QUERY, "SET NAMES utf8mb4"), MYSQL_REQ_OK, true },
+        { command(MYSQL_COM_QUERY, "SET autocommit = 1"), MYSQL_REQ_OK, true },
+        { command(MYSQL_COM_QUERY, "SET autocommit = 0"), MYSQL_REQ_SESSION, false },
+        { command(MYSQL_COM_QUERY, "set session sql_mode = ''"), MYSQL_REQ_SESSION, false },
+        { command(MYSQL_COM_QUERY, "SELECT @x := 1"), MYSQL_REQ_SESSION, false },
+        { command(MYSQL_COM_QUERY, "USE other"), MYSQL_REQ_SESSION, false },
+        { command(MYSQL_COM_QUERY, "create temporary table x (a int)"), MYSQL_REQ_SESSION, false },
+        { command(MYSQL_COM_QUERY, "LOCK TABLES t WRITE"), MYSQL_REQ_SESSION, false },
+        { command(MYSQL_COM_INIT_DB, "shop"), MYSQL_REQ_OK, true },
+        { command(MYSQL_COM_INIT_DB, "other"), MYSQL_REQ_SESSION, false },
+        { command(MYSQL_COM_PING), MYSQL_REQ_OK, true },
+        { command(MYSQL_COM_CHANGE_USER, "root"), MYSQL_REQ_UNSUPPORTED, true },
+        { command(MYSQL_COM_STMT_PREPARE, "SELECT ?"), MYSQL_REQ_SESSION, false },
+        { command(MYSQL_COM_RESET_CONNECTION), MYSQL_REQ_RESET, false },
+    };
+
+    std::vector<NcMsg*> msgs;
+    conn.m_authenticated_ = 1;
+    for (uint32_t i = 0; i < sizeof(cases) / sizeof(cases[0]); i++)
+    {
+        ASSERT(feed(ctx, kPROTOCOL_MYSQL, true, cases[i].req, cases[i].req.size(),
+            &msgs) == NC_OK);
+        NcMysql::requestFilter(msgs[0], &conn);
+        ASSERT(NcMysql::decision(msgs[0]) == cases[i].flags);
+        ASSERT((msgs[0]->m_noforward_ == 1) == cases[i].noforward);
+        release(ctx, &msgs);
+    }
+
+    // 认证之前的包都是握手
+    conn.m_authenticated_ = 0;
+    ASSERT(feed(ctx, kPROTOCOL_MYSQL, true, command(MYSQL_COM_QUERY, "SELECT 1"), 64,
+        &msgs) == NC_OK);
+    NcMysql::requestFilter(msgs[0], &conn);
+    ASSERT(NcMysql::decision(msgs[0]) == MYSQL_REQ_AUTH && msgs[0]->m_noforward_);
+    release(ctx, &msgs);
+    conn.m_owner_ = NULL;
+}
+
+static void responseTest(NcContext *ctx)
+{
+    std::vector<NcMsg*> reqs, msgs;
+    std::string requests =
+        command(MYSQL_COM_QUERY, "INSERT") +
+        command(MYSQL_COM_QUERY, "SELECT") +
+        command(MYSQL_COM_QUERY, "CALL p()") +
+        command(MYSQL_COM_QUERY, "BAD") +
+        command(MYSQL_COM_STMT_PREPARE, "SELECT ?") +
+        command(MYSQL_COM_FIELD_LIST, "t") +
+        command(MYSQL_COM_QUERY, "BIG");
+    ASSERT(feed(ctx, kPROTOCOL_MYSQL, true, requests, requests.size(), &reqs) == NC_OK);
+
+    std::string prepare = packet(1, std::string("\x00\x01\x00\x00\x00\x01\x00\x01\x00\x00\x00\x00", 12)) +
+        packet(2, "def-param") + eof(3, 0) + packet(4, "def-column") + eof(5, 0);
+    std::string big(MYSQL_MAX_PAYLOAD + 100, 'v');
+    std::string stream =
+        ok(1, MYSQL_STATUS_IN_TRANS) +
+        resultset(1, "one", MYSQL_STATUS_AUTOCOMMIT) +
+        resultset(1, "a", MYSQL_STATUS_AUTOCOMMIT | MYSQL_STATUS_MORE_RESULTS) +
+        ok(6, MYSQL_STATUS_AUTOCOMMIT) +
+        packet(1, std::string("\xff\x28\x04#42000syntax", 14)) +
+        prepare +
+        packet(1, "def-field") + eof(2, 0);
+    std::string bigset = resultset(1, big, MYSQL_STATUS_AUTOCOMMIT);
+
+    // 7字节的小读只用在小的响应上, 大于MYSQL_MAX_PAYLOAD的结果集按整块和64K读
+    size_t rsizes[] = {stream.size() + bigset.size(), 7, 65536};
+    for (uint32_t r = 0; r < sizeof(rsizes) / sizeof(rsizes[0]); r++)
+    {
+        bool withbig = rsizes[r] != 7;
+        ASSERT(feed(ctx, kPROTOCOL_MYSQL, false, withbig ? stream + bigset : stream,
+            rsizes[r], &msgs, NULL, reqs) == NC_OK);
+        ASSERT(msgs.size() == (withbig ? 7 : 6));
+        ASSERT(NcMysql::status(msgs[0]) == MYSQL_STATUS_IN_TRANS);
+        ASSERT(NcMysql::status(msgs[1]) == MYSQL_STATUS_AUTOCOMMIT);
+        // 多结果集的最后一个状态
+        ASSERT(NcMysql::status(msgs[2]) == MYSQL_STATUS_AUTOCOMMIT);
+        ASSERT(NcMysql::command(msgs[3]) == 0xff);
+        ASSERT(length(msgs[4]) == prepare.size());
+        ASSERT(!withbig || length(msgs[6]) > big.size());
+        release(ctx, &msgs);
+    }
+
+    // LOAD DATA LOCAL INFILE
+    ASSERT(feed(ctx, kPROTOCOL_MYSQL, false, packet(1, "\xfb/etc/passwd"), 64, &msgs, NULL,
+        reqs) == NC_ERROR);
+    release(ctx, &msgs);
+    release(ctx, &reqs);
+}
+
+/*
+ * 连接全被pin住时getConn另开一个, 到server_max_connections为止, 之后
+ * 返回NULL(EBUSY); 有连接放开后再用它
+ */
+static void connLimitTest(NcContext *ctx)
+{
+    // 只listen不accept, connect也能完成
+    int sd = socket(AF_INET, SOCK_STREAM, 0);
+    struct sockaddr_in addr;
+    socklen_t addrlen = sizeof(addr);
+    memset(&addr, 0, sizeof(addr));
+    addr.sin_family = AF_INET;
+    addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    int status = bind(sd, (struct sockaddr*)&addr, sizeof(addr));
+    ASSERT(status == 0);
+    status = listen(sd, 16);
+    ASSERT(status == 0);
+    status = getsockname(sd, (struct sockaddr*)&addr, &addrlen);
+    ASSERT(status == 0);
+
+    char server[64];
+    snprintf(server, sizeof(server), "127.0.0.1:%d:1", ntohs(addr.sin_port));
+    NcInstance *nci = new NcInstance();
+    ctx->instance = nci;
+    NcConfPool cp;
+    cp.server_connections = 2;
+    cp.server_max_connections = 4;
+    NcServerPool *pool = makePool(ctx, &cp, {server}, kDIST_MODULA);
+    NcServer *s = pool->server[0];
+
+    std::vector<NcConn*> conns;
+    for (uint32_t i = 0; i < 4; i++)
+    {
+        NcConn *conn = s->getConn();
+        ASSERT(conn != NULL && s->nconn() == i + 1);
+        conn->m_pinned_ = conn;
+        conns.push_back(conn);
+    }
+    errno = 0;
+    ASSERT(s->getConn() == NULL && errno == EBUSY && s->nconn() == 4);
+
+    conns[1]->m_pinned_ = NULL;
+    ASSERT(s->getConn() == conns[1] && s->nconn() == 4);
+
+    for (uint32_t i = 0; i < conns.size(); i++)
+    {
+        conns[i]->m_pinned_ = NULL;
+        conns[i]->close();
+    }
+    ASSERT(s->nconn() == 0);
+    delete pool;
+    ctx->instance = NULL;
+    delete nci;
+    close(sd);
+}
+
+int main(int argc, char **argv)
+{
+    NcLogger::getInstance().init(LLOG_PVERB, "./test.logs");
+
+    NcContext ctx;
+    ctx.mbuf_pool.init(MBUF_SIZE);
+
+    scrambleTest();
+    requestTest(&ctx);
+    filterTest(&ctx);
+    responseTest(&ctx);
+    connLimitTest(&ctx);
+    ASSERT(ctx.mbuf_pool.nused() == 0);
+
+    return 0;
+}
@@ -1,5 +1,127 @@
 #include <nc_queue.h>
 #include <nc_log.h>
+#include <nc_util.h>
+#include <vector>
+
+#define BENCH_ENTRIES   100000
+
+class NcBenchNode
+{
+public:
+    int                         id;
+    NcQueueEntry<NcBenchNode>   tqe;
+};
+
+/*
+ * 100k元素的队列: push全部, 按随机顺序remove (模拟client连接断开),
+ * 再做一轮front+rotate (模拟server连接轮询), 对比std::list和侵入式队列
+ */
+static void queueBench()
+{
+    std::vector<NcBenchNode> nodes(BENCH_ENTRIES);
+    std::vector<uint32_t> order(BENCH_ENTRIES);
+    for (uint32_t i = 0; i < BENCH_ENTRIES; i++)
+    {
+        nodes[i].id = (int)i;
+        order[i] = i;
+    }
+    srandom(1);
+    for (uint32_t i = BENCH_ENTRIES - 1; i > 0; i--)
+    {
+        std::swap(order[i], order[random() % (i + 1)]);
+    }
+
+    int64_t start = NcUtil::ncUsecNow();
+    NcQueue<NcBenchNode*> lq;
+    for (uint32_t i = 0; i < BENCH_ENTRIES; i++)
+    {
+        lq.push(&nodes[i]);
+    }
+    int64_t lpush = NcUtil::ncUsecNow();
+    for (uint32_t i = 0; i < BENCH_ENTRIES; i++)
+    {
+        NcBenchNode *n = lq.front();
+        lq.pop();
+        lq.push(n);
+    }
+    int64_t lrotate = NcUtil::ncUsecNow();
+    // std::list的remove是线性扫描, 只删1/100
+    for (uint32_t i = 0; i < BENCH_ENTRIES / 100; i++)
+    {
+        lq.remove(&nodes[order[i]]);
+    }
+    int64_t lremove = NcUtil::ncUsecNow();
+
+    NcTailQueue<NcBenchNode> tq(&NcBenchNode::tqe);
+    for (uint32_t i = 0; i < BENCH_ENTRIES; i++)
+    {
+        tq.push(&nodes[i]);
+    }
+    int64_t tpush = NcUtil::ncUsecNow();
+    for (uint32_t i = 0; i < BENCH_ENTRIES; i++)
+    {
+        tq.rotate();
+    }
+    int64_t trotate = NcUtil::ncUsecNow();
+    for (uint32_t i = 0; i < BENCH_ENTRIES; i++)
+    {
+        tq.remove(&nodes[order[i]]);
+    }
+    int64_t tremove = NcUtil::ncUsecNow();
+    ASSERT(tq.empty() && tq.size() == 0);
+
+    LOG_DEBUG("std::list   : push %.1f ns, rotate %.1f ns, remove %.1f ns per op",
+        (lpush - start) * 1000.0 / BENCH_ENTRIES, 
+        (lrotate - lpush) * 1000.0 / BENCH_ENTRIES,
+        (lremove - lrotate) * 1000.0 / (BENCH_ENTRIES / 100));
+    LOG_DEBUG("NcTailQueue : push %.1f ns, rotate %.1f ns, remove %.1f ns per op",
+        (tpush - lremove) * 1000.0 / BENCH_ENTRIES, 
+        (trotate - tpush) * 1000.0 / BENCH_ENTRIES,
+        (tremove - trotate) * 1000.0 / BENCH_ENTRIES);
+}
+
+static void tailQueueTest()
+{
+    NcBenchNode nodes[4];
+    NcTailQueue<NcBenchNode> tq(&NcBenchNode::tqe);
+    for (int i = 0; i < 4; i++)
+    {
+        nodes[i].id = i;
+        tq.push(&nodes[i]);
+    }
+    ASSERT(tq.size() == 4 && tq.front() == &nodes[0] && tq.back() == &nodes[3]);
+
+    tq.remove(&nodes[2]);
+    tq.remove(&nodes[2]);   // 不在队列中, 忽略
+    ASSERT(tq.size() == 3 && tq.next(&nodes[1]) == &nodes[3]);
+
+    tq.rotate();
+    ASSERT(tq.front() == &nodes[1] && tq.back() == &nodes[0]);
+
+    int ids[] = {1, 3, 0}, i = 0;
+    for (NcTailQueue<NcBenchNode>::ConstIterator iter = tq.begin(); 
+        iter != tq.end(); iter++)
+    {
+        ASSERT((*iter)->id == ids[i++]);
+    }
+
+    ASSERT(tq.pop() == &nodes[1]);
+    ASSERT(tq.pop() == &nodes[3]);
+    ASSERT(tq.pop() == &nodes[0]);
+    ASSERT(tq.pop() == NULL && tq.empty());
+
+    // 同一个link的两个队列 (server的imsg_q/omsg_q共用s_tqe), 互不认领
+    NcTailQueue<NcBenchNode> other(&NcBenchNode::tqe);
+    other.push(&nodes[0]);
+    other.push(&nodes[1]);
+    tq.push(&nodes[2]);
+    ASSERT(!tq.contains(&nodes[0]) && other.contains(&nodes[0]));
+    ASSERT(tq.contains(&nodes[2]) && !other.contains(&nodes[2]));
+    ASSERT(!tq.contains(&nodes[3]) && !other.contains(&nodes[3]));
+    other.remove(&nodes[0]);
+    ASSERT(!other.contains(&nodes[0]) && other.size() == 1);
+    ASSERT(tq.size() == 1 && tq.back() == &nodes[2]);
+}
 
 void print(NcQueue<int> &q)
 {
@@ -39,5 +161,8 @@ int main(int argc, char **argv)
     LOG_DEBUG("begin = %p", queue.begin());
     LOG_DEBUG("end = %p", queue.end());
 
+    tailQueueTest();
+    queueBench();
+
     return 0;
 }
\ No newline at end of file
@@ -0,0 +1,172 @@
+#include <string>
+#include <nc_redis_cluster.h>
+#include <nc_server.h>
+#include <nc_hashkit.h>
+
+static uint32_t slot(const char *key)
+{
+    return NcRedisCluster::slot((const uint8_t *)key, (uint32_t)strlen(key));
+}
+
+static NcMsg* reply(NcMbufPool *pool, const std::string &data)
+{
+    NcMsg *msg = new NcMsg();
+    for (size_t off = 0; off < data.size(); )
+    {
+        NcMbuf *mbuf = pool->alloc();
+        size_t n = MIN(mbuf->size(), data.size() - off);
+        mbuf->copy((uint8_t *)data.data() + off, n);
+        msg->getMbufQueue()->push(mbuf);
+        off += n;
+    }
+    return msg;
+}
+
+static void release(NcMbufPool *pool, NcMsg *msg)
+{
+    NcMbufQueue *queue = msg->getMbufQueue();
+    while (!queue->empty())
+    {
+        NcMbuf *mbuf = queue->front();
+        queue->remove(mbuf);
+        pool->free(mbuf);
+    }
+    delete msg;
+}
+
+static std::string node(const char *host, int port, const char *id)
+{
+    char buf[128];
+    snprintf(buf, sizeof(buf), "*3\r\n$%d\r\n%s\r\n:%d\r\n$%d\r\n%s\r\n",
+        (int)strlen(host), host, port, (int)strlen(id), id);
+    return buf;
+}
+
+static std::string range(int start, int end, const std::string &master,
+    const std::string &replica = "")
+{
+    char buf[64];
+    snprintf(buf, sizeof(buf), "*%d\r\n:%d\r\n:%d\r\n", replica.empty() ? 3 : 4, start, end);
+    return buf + master + replica;
+}
+
+static void slotTest()
+{
+    NcHashUtil util;
+    ASSERT((util.crc16Hash("123456789", 9) & 0xffff) == 0x31c3);
+
+    ASSERT(slot("foo") == 12182);
+    ASSERT(slot("bar") == 5061);
+    ASSERT(slot("user1000") == 3443);
+    ASSERT(slot("") == 0);
+
+    // hash tag: 第一个非空的{...}
+    ASSERT(slot("{user1000}.following") == slot("user1000"));
+    ASSERT(slot("{user1000}.followers") == slot("user1000"));
+    ASSERT(slot("foo{bar}{zap}") == slot("bar"));
+    ASSERT(slot("foo{}{bar}") == slot("foo{}{bar}"));
+    ASSERT(slot("foo{}{bar}") != slot("bar"));
+    ASSERT(slot("foo{{bar}}zap") == slot("{bar"));
+    ASSERT(slot("foo{bar") != slot("bar"));
+}
+
+static void redirectTest()
+{
+    const char *lines[] = {
+        "-MOVED 3999 127.0.0.1:6381",
+        "-ASK 3999 10.0.0.2:7000",
+        "-MOVED 12182 :6379",
+        "-MOVED 1 ::1:6380",
+    };
+    bool ask;
+    uint32_t s;
+    NcStringView host;
+    int port;
+
+    ASSERT(NcRedisCluster::parseRedirect((const uint8_t *)lines[0], strlen(lines[0]),
+        &ask, &s, &host, &port));
+    ASSERT(!ask && s == 3999 && port == 6381);
+    ASSERT(host == NcStringView((const uint8_t *)"127.0.0.1", 9));
+
+    ASSERT(NcRedisCluster::parseRedirect((const uint8_t *)lines[1], strlen(lines[1]),
+        &ask, &s, &host, &port));
+    ASSERT(ask && s == 3999 && port == 7000);
+
+    ASSERT(NcRedisCluster::parseRedirect((const uint8_t *)lines[2], strlen(lines[2]),
+        &ask, &s, &host, &port));
+    ASSERT(s == 12182 && port == 6379 && host.empty());
+
+    ASSERT(NcRedisCluster::parseRedirect((const uint8_t *)lines[3], strlen(lines[3]),
+        &ask, &s, &host, &port));
+    ASSERT(port == 6380 && host == NcStringView((const uint8_t *)"::1", 3));
+
+    const char *bad[] = {
+        "-ERR unknown command",
+        "-MOVED 16384 127.0.0.1:6379",
+        "-MOVED abc 127.0.0.1:6379",
+        "-MOVED 1 127.0.0.1",
+        "-MOVED 1 127.0.0.1:0",
+        "-ASK 1",
+        "+MOVED 1 127.0.0.1:6379",
+    };
+    for (uint32_t i = 0; i < sizeof(bad) / sizeof(bad[0]); i++)
+    {
+        ASSERT(!NcRedisCluster::parseRedirect((const uint8_t *)bad[i], strlen(bad[i]),
+            &ask, &s, &host, &port));
+    }
+}
+
+static void loadTest(NcMbufPool *pool)
+{
+    NcServerPool sp(NULL);
+    ASSERT(sp.serverIndex((const uint8_t *)"127.0.0.1", 9, 7001) == 0);
+    NcRedisCluster::init(&sp);
+    ASSERT(sp.slots.size() == REDIS_CLUSTER_SLOTS);
+    ASSERT(sp.slots[0] == 0 && sp.slots[REDIS_CLUSTER_SLOTS - 1] == 0);
+
+    // 三个master, 一个带replica, 一个host为空(回复的server自己)
+    std::string data = "*3\r\n" +
+        range(0, 5460, node("127.0.0.1", 7001, "a"), node("127.0.0.1", 7101, "ra")) +
+        range(5461, 10922, node("127.0.0.1", 7002, "b")) +
+        range(10923, 16383, node("", 7003, "c"));
+    NcMsg *msg = reply(pool, data);
+    ASSERT(NcRedisCluster::loadSlots(msg, &sp, sp.server[0]));
+    release(pool, msg);
+
+    ASSERT(sp.server.size() == 2);
+    ASSERT(sp.serverIndex((const uint8_t *)"127.0.0.1", 9, 7002) == 1);
+    ASSERT(sp.slots[0] == 0 && sp.slots[5460] == 0);
+    ASSERT(sp.slots[5461] == 1 && sp.slots[10922] == 1);
+    ASSERT(sp.slots[10923] == 0 && sp.slots[16383] == 0);
+
+    // 出错或格式不对时不修改slot表
+    const char *bad[] = {
+        "-ERR This instance has cluster support disabled\r\n",
+        "*1\r\n*3\r\n:10\r\n:5\r\n*2\r\n$9\r\n127.0.0.1\r\n:7002\r\n",
+        "*1\r\n*3\r\n:0\r\n:16384\r\n*2\r\n$9\r\n127.0.0.1\r\n:7002\r\n",
+        "*2\r\n*3\r\n:0\r\n:1\r\n*2\r\n$9\r\n127.0.0.1\r\n:7002\r\n",
+        "*1\r\n*3\r\n:0\r\n:1\r\n*2\r\n$9\r\n127.0.0.1\r\n",
+    };
+    for (uint32_t i = 0; i < sizeof(bad) / sizeof(bad[0]); i++)
+    {
+        msg = reply(pool, bad[i]);
+        ASSERT(!NcRedisCluster::loadSlots(msg, &sp, sp.server[0]));
+        release(pool, msg);
+    }
+    ASSERT(sp.slots[0] == 0 && sp.slots[5461] == 1);
+}
+
+int main(int argc, char **argv)
+{
+    NcLogger::getInstance().init(LLOG_PVERB, "./test.logs");
+
+    NcMbufPool pool;
+    pool.init(MBUF_SIZE);
+
+    slotTest();
+    redirectTest();
+    loadTest(&pool);
+    ASSERT(pool.nused() == 0);
+
+    return 0;
+}
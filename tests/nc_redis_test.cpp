@@ -0,0 +1,135 @@
+#include <string>
+#include <nc_redis.h>
+#include "nc_test_util.h"
+
+static void requestTest(NcContext *ctx)
+{
+    std::vector<NcMsg*> msgs;
+    std::string longkey(2000, 'k'), value(5000, 'v');
+    std::string stream =
+        multibulk({"GET", "foo"}) +
+        multibulk({"mset", "a", "1", "b", "2"}) +
+        multibulk({"SET", longkey, value}) +
+        multibulk({"EVAL", "return 1", "2", "k1", "k2", "arg"}) +
+        multibulk({"DEL", "", "x"}) +
+        "mget  a b\tc\r\n" +
+        "PING\r\n" +
+        multibulk({"quit"});
+
+    // 一次读完, 以及每次只读1字节/7字节(token跨mbuf, 需要repair)
+    size_t rsizes[] = {stream.size(), 1, 7};
+    for (uint32_t r = 0; r < sizeof(rsizes) / sizeof(rsizes[0]); r++)
+    {
+        ASSERT(feed(ctx, kPROTOCOL_REDIS, true, stream, rsizes[r], &msgs) == NC_OK);
+        ASSERT(msgs.size() == 8);
+
+        ASSERT(NcRedis::command(msgs[0])->type == kREDIS_CMD_GET);
+        ASSERT(msgs[0]->getKeys().size() == 1 && key(msgs[0], 0) == "foo");
+        ASSERT(NcRedis::command(msgs[1])->type == kREDIS_CMD_MSET);
+        ASSERT(key(msgs[1], 0) == "a" && key(msgs[1], 1) == "b");
+        ASSERT(msgs[2]->getKeys().size() == 1 && key(msgs[2], 0) == longkey);
+        ASSERT(msgs[3]->getKeys().size() == 2 && key(msgs[3], 1) == "k2");
+        ASSERT(msgs[4]->getKeys().size() == 2 && key(msgs[4], 0) == "");
+        ASSERT(NcRedis::command(msgs[5])->type == kREDIS_CMD_MGET);
+        ASSERT(msgs[5]->getKeys().size() == 3 && key(msgs[5], 2) == "c");
+        ASSERT(msgs[6]->m_noforward_ && msgs[6]->getKeys().empty());
+        ASSERT(msgs[7]->m_quit_);
+        release(ctx, &msgs);
+    }
+
+    // 未知命令, 参数个数错误, numkeys超出参数个数/溢出/为空, 格式错误
+    const char *bad[] = {
+        "*1\r\n$7\r\nunknown\r\n",
+        "*3\r\n$3\r\nget\r\n$1\r\na\r\n$1\r\nb\r\n",
+        "*4\r\n$4\r\neval\r\n$1\r\nx\r\n$1\r\n3\r\n$1\r\na\r\n",
+        "*4\r\n$4\r\neval\r\n$1\r\nx\r\n$30\r\n999999999999999999999999999999\r\n$1\r\na\r\n",
+        "*4\r\n$4\r\neval\r\n$1\r\nx\r\n$0\r\n\r\n$1\r\na\r\n",
+        "*1\r\n$3\r\nget\r\n",
+        "*2\r\n$3\r\nget\r\n:1\r\n",
+        "*x\r\n",
+        "get\r\n",
+    };
+    for (uint32_t i = 0; i < sizeof(bad) / sizeof(bad[0]); i++)
+    {
+        ASSERT(feed(ctx, kPROTOCOL_REDIS, true, bad[i], 1, &msgs) == NC_ERROR);
+        ASSERT(msgs.back()->getResult() == kMSG_PARSE_ERROR);
+        release(ctx, &msgs);
+    }
+}
+
+static void responseTest(NcContext *ctx)
+{
+    std::vector<NcMsg*> msgs;
+    std::string stream =
+        "+OK\r\n"
+        "-ERR wrong type\r\n"
+        ":-42\r\n"
+        "$-1\r\n"
+        "$0\r\n\r\n" +
+        bulk(std::string(3000, 'x')) +
+        "*-1\r\n"
+        "*0\r\n"
+        "*3\r\n*2\r\n:1\r\n$3\r\nfoo\r\n*0\r\n$-1\r\n";
+
+    size_t rsizes[] = {stream.size(), 1, 13};
+    for (uint32_t r = 0; r < sizeof(rsizes) / sizeof(rsizes[0]); r++)
+    {
+        ASSERT(feed(ctx, kPROTOCOL_REDIS, false, stream, rsizes[r], &msgs) == NC_OK);
+        ASSERT(msgs.size() == 9);
+        uint32_t total = 0;
+        for (uint32_t i = 0; i < msgs.size(); i++)
+        {
+            NcMbufQueue *queue = msgs[i]->getMbufQueue();
+            for (NcMbuf *mbuf = queue->front(); mbuf != NULL; mbuf = queue->next(mbuf))
+            {
+                total += mbuf->length();
+            }
+        }
+        ASSERT(total == stream.size());
+        release(ctx, &msgs);
+    }
+
+    const char *bad[] = { "OK\r\n", "$-2\r\n", "*1\r\n$x\r\n", "$1\r\nab\r\n" };
+    for (uint32_t i = 0; i < sizeof(bad) / sizeof(bad[0]); i++)
+    {
+        ASSERT(feed(ctx, kPROTOCOL_REDIS, false, bad[i], 1, &msgs) == NC_ERROR);
+        release(ctx, &msgs);
+    }
+}
+
+/* pipeline了npipe个命令的流 */
+static std::string pipelineStream(int npipe)
+{
+    std::string stream;
+    for (int i = 0; i < npipe; i++)
+    {
+        char k[32];
+        snprintf(k, sizeof(k), "key:%06d", i);
+        stream += i % 2 ? multibulk({"GET", k}) : multibulk({"SET", k, "value-value-value"});
+    }
+
+    return stream;
+}
+
+int main(int argc, char **argv)
+{
+    NcLogger::getInstance().init(LLOG_PVERB, "./test.logs");
+
+    NcContext ctx;
+    ctx.mbuf_pool.init(MBUF_SIZE);
+
+    ASSERT(NcRedis::lookup((uint8_t*)"ZREVRANGEBYSCORE", 16) != NULL);
+    ASSERT(NcRedis::lookup((uint8_t*)"gett", 4) == NULL);
+
+    requestTest(&ctx);
+    responseTest(&ctx);
+    ASSERT(ctx.mbuf_pool.nused() == 0);
+
+    int pipes[] = {1, 16, 256};
+    for (uint32_t i = 0; i < sizeof(pipes) / sizeof(pipes[0]); i++)
+    {
+        pipelineBench(&ctx, kPROTOCOL_REDIS, pipelineStream(pipes[i]), pipes[i], 1000000);
+    }
+
+    return 0;
+}
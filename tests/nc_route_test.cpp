@@ -0,0 +1,151 @@
+#include <string>
+#include <vector>
+#include <nc_hashkit.h>
+#include <nc_message.h>
+#include "nc_test_util.h"
+
+#define NBATCH      100
+#define ROUNDS      20000
+
+/* keys of a multi-key request: ids, some tagged, a few long ones */
+static void makeKeys(std::string &data, std::vector<NcKeypos> &keys, uint32_t nkey)
+{
+    std::vector<uint32_t> offset;
+    char buf[256];
+    srandom(1);
+    for (uint32_t i = 0; i < nkey; i++)
+    {
+        int n, r = (int)(random() % 10);
+        if (r < 6)
+        {
+            n = snprintf(buf, sizeof(buf), "user:%ld", random() % 10000000);
+        }
+        else if (r < 8)
+        {
+            n = snprintf(buf, sizeof(buf), "{user%ld}:profile", random() % 100000);
+        }
+        else
+        {
+            n = snprintf(buf, sizeof(buf), "session:%08lx%08lx:%08lx%08lx\xe9",
+                random(), random(), random(), random());
+        }
+        offset.push_back((uint32_t)data.size());
+        data.append(buf, n);
+    }
+    offset.push_back((uint32_t)data.size());
+
+    uint8_t *base = (uint8_t *)&data[0];
+    for (uint32_t i = 0; i < nkey; i++)
+    {
+        keys.push_back(NcKeypos(base + offset[i], base + offset[i + 1]));
+    }
+}
+
+/* every hash, distribution and batch size routes as index() of each key */
+static void sameTest(NcContext *ctx)
+{
+    std::string data;
+    std::vector<NcKeypos> keys;
+    makeKeys(data, keys, 1000);
+
+    const int dists[] = {
+        kDIST_KETAMA, kDIST_MODULA, kDIST_JUMP, kDIST_MAGLEV, kDIST_HRW
+    };
+    const char *tags[] = { "", "{}" };
+    const uint32_t sizes[] = { 0, 1, 3, 4, 5, 33, 100, 1000 };
+
+    NcLogger::getInstance().setLevel(LLOG_NOTICE);
+
+    for (size_t d = 0; d < sizeof(dists) / sizeof(dists[0]); d++)
+    {
+        for (int type = kHASH_ONE_AT_A_TIME; type <= kHASH_WYHASH; type++)
+        {
+            for (int t = 0; t < 2; t++)
+            {
+                NcConfPool cp;
+                cp.hash = type;
+                cp.hash_tag = NcString(tags[t], (uint32_t)strlen(tags[t]));
+                NcServerPool *pool = makePool(ctx, &cp, manyServers(7), dists[d]);
+
+                for (size_t s = 0; s < sizeof(sizes) / sizeof(sizes[0]); s++)
+                {
+                    std::vector<uint32_t> idx(sizes[s] + 1, UINT32_MAX);
+                    pool->index(&keys[0], sizes[s], &idx[0]);
+                    for (uint32_t i = 0; i < sizes[s]; i++)
+                    {
+                        ASSERT(idx[i] == pool->index(keys[i].start, keys[i].length()));
+                    }
+                    ASSERT(idx[sizes[s]] == UINT32_MAX);
+                }
+
+                delete pool;
+            }
+        }
+    }
+    NcLogger::getInstance().setLevel(LLOG_PVERB);
+}
+
+static void routeBench(NcContext *ctx)
+{
+    std::string data;
+    std::vector<NcKeypos> keys;
+    makeKeys(data, keys, NBATCH);
+
+    const int hashes[] = { kHASH_FNV1A_64, kHASH_MURMUR, kHASH_XXH3_64 };
+    const char *names[] = { "fnv1a_64", "murmur", "xxh3_64" };
+    const int sizes[] = { 10, 100, 1000 };
+
+    // 不打debug日志, 和线上一样
+    NcLogger::getInstance().setLevel(LLOG_NOTICE);
+    for (size_t h = 0; h < sizeof(hashes) / sizeof(hashes[0]); h++)
+    {
+        for (size_t s = 0; s < sizeof(sizes) / sizeof(sizes[0]); s++)
+        {
+            NcConfPool cp;
+            cp.hash = hashes[h];
+            cp.hash_tag = NcString("{}", 2);
+            NcServerPool *pool = makePool(ctx, &cp, manyServers(sizes[s]), kDIST_KETAMA);
+            std::vector<uint32_t> idx(NBATCH);
+
+            int64_t start = NcUtil::ncPreciseUsec();
+            for (int r = 0; r < ROUNDS; r++)
+            {
+                for (uint32_t i = 0; i < NBATCH; i++)
+                {
+                    idx[i] = pool->index(keys[i].start, keys[i].length());
+                }
+            }
+            int64_t each = NcUtil::ncPreciseUsec() - start;
+
+            start = NcUtil::ncPreciseUsec();
+            for (int r = 0; r < ROUNDS; r++)
+            {
+                pool->index(&keys[0], NBATCH, &idx[0]);
+            }
+            int64_t batch = NcUtil::ncPreciseUsec() - start;
+
+            NcLogger::getInstance().setLevel(LLOG_PVERB);
+            LOG_DEBUG("%-8s %4d servers, %d key batches: %5.1f ns per key one by one, "
+                "%5.1f ns batched (%.1fx)", names[h], sizes[s], NBATCH,
+                1000.0 * each / ((double)NBATCH * ROUNDS),
+                1000.0 * batch / ((double)NBATCH * ROUNDS), (double)each / batch);
+            NcLogger::getInstance().setLevel(LLOG_NOTICE);
+
+            delete pool;
+        }
+    }
+    NcLogger::getInstance().setLevel(LLOG_PVERB);
+}
+
+int main(int argc, char **argv)
+{
+    NcLogger::getInstance().init(LLOG_PVERB, "./test.logs");
+
+    NcContext ctx;
+    ctx.mbuf_pool.init(MBUF_SIZE);
+
+    sameTest(&ctx);
+    routeBench(&ctx);
+
+    return 0;
+}
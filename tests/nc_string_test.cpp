@@ -1,8 +1,109 @@
-#include <nc_string.h>
+#include <malloc.h>
+#include <vector>
+#include <utility>
+#include <nc_util.h>
+#include <nc_log.h>
+
+#define NSERVER     10000
+
+struct ServerConf
+{
+    NcString pname;     /* hostname:port:weight */
+    NcString name;      /* hostname */
+};
+
+struct ServerCopy
+{
+    NcString pname;
+    NcString name;
+};
+
+struct ServerRef
+{
+    NcStringView pname;
+    NcStringView name;
+};
+
+static size_t heapUsed()
+{
+    return mallinfo2().uordblks;
+}
 
 int main(int argc, char **argv)
 {
+    NcLogger::getInstance().init(LLOG_PVERB, "./test.logs");
+
+    // 短字符串不分配内存
+    size_t heap = heapUsed();
     NcString s;
+    ASSERT(s.empty() && s.inlined() && s.c_str()[0] == '\0');
+    NcString a("127.0.0.1:22121:1");
+    NcString b(a);
+    b = a;
+    ASSERT(heapUsed() == heap);
+    ASSERT(a.inlined() && b == a && b == "127.0.0.1:22121:1");
+    ASSERT(NcString() == NcString() && !(a == "127.0.0.1"));
+
+    // 长字符串在heap上, 赋值复用已有的buffer, move直接拿走buffer
+    NcString l("/var/run/nutcracker/nutcracker-leaf.sock");
+    ASSERT(!l.inlined() && l.length() == 40);
+    const uint8_t *p = l.c_str();
+    l = a;
+    ASSERT(l.c_str() == p && l == a);
+    l = NcString("/var/run/nutcracker/nutcracker-leaf.sock");
+    p = l.c_str();
+    NcString m(std::move(l));
+    ASSERT(m.c_str() == p && l.empty() && l.inlined());
+    m = m;
+    ASSERT(m.c_str() == p && m.length() == 40);
+    m.setRaw(m.c_str() + 20);
+    ASSERT(m == "nutcracker-leaf.sock");
+
+    // view引用原字符串, 不拷贝
+    NcStringView v = a;
+    ASSERT(v.data() == a.c_str() && v.length() == a.length() && v == a);
+    ASSERT(NcString(NcStringView(a.c_str(), 9)) == "127.0.0.1");
+    ASSERT(v.compare(NcStringView(a.c_str(), 9)) > 0);
+
+    // 1万个server: conf的字符串拷贝到server vs 引用
+    std::vector<ServerConf> conf(NSERVER);
+    for (int i = 0; i < NSERVER; i++)
+    {
+        char buf[64];
+        int n = snprintf(buf, sizeof(buf), "10.%d.%d.%d:11211:1",
+            i >> 16, (i >> 8) & 0xff, i & 0xff);
+        conf[i].pname = NcString(buf, n);
+        conf[i].name = NcString(buf, n - 8);
+    }
+
+    std::vector<ServerCopy> copies(NSERVER);
+    heap = heapUsed();
+    int64_t start = NcUtil::ncUsecNow();
+    for (int i = 0; i < NSERVER; i++)
+    {
+        copies[i].pname = conf[i].pname;
+        copies[i].name = conf[i].name;
+    }
+    int64_t copy_cost = NcUtil::ncUsecNow() - start;
+    size_t copy_heap = heapUsed() - heap;
+
+    std::vector<ServerRef> refs(NSERVER);
+    heap = heapUsed();
+    start = NcUtil::ncUsecNow();
+    for (int i = 0; i < NSERVER; i++)
+    {
+        refs[i].pname = conf[i].pname;
+        refs[i].name = conf[i].name;
+    }
+    int64_t ref_cost = NcUtil::ncUsecNow() - start;
+    size_t ref_heap = heapUsed() - heap;
+
+    LOG_DEBUG("%d servers, sizeof(NcString) %zu, sizeof(NcStringView) %zu",
+        NSERVER, sizeof(NcString), sizeof(NcStringView));
+    LOG_DEBUG("copy : %" PRId64 " us, %zu heap bytes; view : %" PRId64
+        " us, %zu heap bytes", copy_cost, copy_heap, ref_cost, ref_heap);
+    ASSERT(copy_heap == 0 && ref_heap == 0);
+    ASSERT(refs[NSERVER - 1].pname == copies[NSERVER - 1].pname);
 
     return 0;
-}
\ No newline at end of file
+}
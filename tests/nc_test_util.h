@@ -0,0 +1,304 @@
+#ifndef _NC_TEST_UTIL_H_
+#define _NC_TEST_UTIL_H_
+
+#include <string>
+#include <vector>
+#include <sys/socket.h>
+#include <nc_message.h>
+#include <nc_connection.h>
+#include <nc_server.h>
+
+/*
+ * 测试用的连接: 数据写进socketpair的另一端, 由NcConn::recvMsg读入,
+ * 和线上一样经过recvChain -> NcMsg::parse -> parseDone / repairDone,
+ * 解析完成的消息收集在out里.
+ *
+ * A reply is parsed against the request at the head of the out queue, as
+ * on a server connection: expect() queues the requests replies belong to.
+ */
+class NcTestConn : public NcConn
+{
+public:
+    NcTestConn(NcContext *ctx, NcProtocolType type, bool request,
+        const NcConfHttpKey *key = NULL) : m_ctx_(ctx), m_pool_(ctx), m_type_(type),
+        m_request_(request), m_out_(NULL)
+    {
+        int sv[2];
+        int status = socketpair(AF_UNIX, SOCK_STREAM, 0, sv);
+        ASSERT(status == 0);
+        status = NcUtil::ncSetNonBlocking(sv[0]);
+        ASSERT(status == 0);
+        status = NcUtil::ncSetNonBlocking(sv[1]);
+        ASSERT(status == 0);
+        m_sd_ = sv[0];
+        m_peer_sd_ = sv[1];
+
+        // http请求按pool的http_key取路由的key
+        m_pool_.http_key = key;
+        m_owner_ = &m_pool_;
+    }
+
+    ~NcTestConn()
+    {
+        while (!m_omsg_q_.empty())
+        {
+            m_omsg_q_.pop();
+        }
+        if (m_rmsg_ != NULL)
+        {
+            release((NcMsg*)m_rmsg_);
+        }
+        ::close(m_sd_);
+        ::close(m_peer_sd_);
+    }
+
+    /* the next reply belongs to req */
+    inline void expect(NcMsg *req)
+    {
+        m_omsg_q_.push(req);
+    }
+
+    /*
+     * Write data rsize bytes at a time, each write read and parsed before
+     * the next. The messages parsed are appended to out; a message left
+     * unfinished, or failing to parse, comes last and fails the feed.
+     */
+    rstatus_t feed(const std::string &data, size_t rsize, std::vector<NcMsg*> *out)
+    {
+        rstatus_t status = NC_OK;
+        m_out_ = out;
+        for (size_t off = 0; off < data.size() && status == NC_OK; )
+        {
+            ssize_t n = ::write(m_peer_sd_, data.data() + off, MIN(rsize, data.size() - off));
+            ASSERT(n > 0 || errno == EAGAIN);
+            off += n > 0 ? (size_t)n : 0;
+            status = recvMsg();
+        }
+        m_out_ = NULL;
+
+        NcMsg *msg = (NcMsg*)m_rmsg_;
+        m_rmsg_ = NULL;
+        if (msg != NULL && msg->getMbufQueue()->empty() && status == NC_OK)
+        {
+            release(msg);
+        }
+        else if (msg != NULL)
+        {
+            out->push_back(msg);
+            status = NC_ERROR;
+        }
+
+        return status == NC_OK ? NC_OK : NC_ERROR;
+    }
+
+    inline void release(NcMsg *msg)
+    {
+        msg->freeMbuf(m_ctx_);
+        (m_ctx_->msg_pool).free(msg);
+    }
+
+    virtual void* getContext()
+    {
+        return m_ctx_;
+    }
+
+    virtual void ref(void *owner = NULL)
+    { }
+
+    virtual void unref()
+    { }
+
+    virtual bool active()
+    {
+        return false;
+    }
+
+    virtual void close()
+    { }
+
+    virtual NcMsgBase* recvNext(bool alloc)
+    {
+        if (m_rmsg_ != NULL || !alloc)
+        {
+            return m_rmsg_;
+        }
+
+        NcMsg *msg = (NcMsg*)(m_ctx_->msg_pool).alloc<NcMsg>();
+        ASSERT(msg != NULL);
+        msg->m_request_ = m_request_ ? 1 : 0;
+        msg->setProtocolType(m_type_);
+        m_rmsg_ = msg;
+        return msg;
+    }
+
+    virtual void recvDone(NcMsgBase *msg, NcMsgBase *nmsg)
+    {
+        m_out_->push_back((NcMsg*)msg);
+        m_rmsg_ = nmsg;
+        if (!m_request_ && !m_omsg_q_.empty())
+        {
+            m_omsg_q_.pop();
+        }
+    }
+
+    virtual NcMsgBase* sendNext()
+    {
+        return NULL;
+    }
+
+    virtual void sendDone(NcMsgBase *msg)
+    { }
+
+private:
+    NcContext           *m_ctx_;
+    NcServerPool        m_pool_;        /* owner, for the http route key */
+    NcProtocolType      m_type_;
+    bool                m_request_;
+    int                 m_peer_sd_;     /* the end the test writes to */
+    std::vector<NcMsg*> *m_out_;
+};
+
+/*
+ * Parse data as a client (request) or server (reply) connection would,
+ * reading at most rsize bytes at a time; key is the http route key, reqs
+ * the requests the replies belong to.
+ */
+static inline rstatus_t feed(NcContext *ctx, NcProtocolType type, bool request,
+    const std::string &data, size_t rsize, std::vector<NcMsg*> *out,
+    const NcConfHttpKey *key = NULL, const std::vector<NcMsg*> &reqs = std::vector<NcMsg*>())
+{
+    NcTestConn conn(ctx, type, request, key);
+    for (size_t i = 0; i < reqs.size(); i++)
+    {
+        conn.expect(reqs[i]);
+    }
+
+    return conn.feed(data, rsize, out);
+}
+
+/* a single complete message */
+static inline NcMsg* feedOne(NcContext *ctx, NcProtocolType type, bool request,
+    const std::string &data, size_t rsize = 1 << 30)
+{
+    std::vector<NcMsg*> out;
+    rstatus_t status = feed(ctx, type, request, data, rsize, &out);
+    ASSERT(status == NC_OK && out.size() == 1);
+    return out[0];
+}
+
+static inline void release(NcContext *ctx, NcMsg *msg)
+{
+    msg->freeMbuf(ctx);
+    (ctx->msg_pool).free(msg);
+}
+
+static inline void release(NcContext *ctx, std::vector<NcMsg*> *msgs)
+{
+    for (size_t i = 0; i < msgs->size(); i++)
+    {
+        release(ctx, (*msgs)[i]);
+    }
+    msgs->clear();
+}
+
+/* key i of a parsed request */
+static inline std::string key(NcMsg *msg, uint32_t i = 0)
+{
+    NcKeypos &k = msg->getKeys()[i];
+    return std::string((char*)k.start, k.length());
+}
+
+/* the bytes of a message, over all its mbufs */
+static inline std::string content(NcMsg *msg)
+{
+    std::string s;
+    NcMbufQueue *queue = msg->getMbufQueue();
+    for (NcMbuf *mbuf = queue->front(); mbuf != NULL; mbuf = queue->next(mbuf))
+    {
+        s.append((char*)mbuf->getPos(), mbuf->length());
+    }
+    ASSERT(s.size() == msg->m_mlen_);
+    return s;
+}
+
+/* redis bulk string, and a multibulk request of bulk strings */
+static inline std::string bulk(const std::string &s)
+{
+    char len[32];
+    snprintf(len, sizeof(len), "$%zu\r\n", s.size());
+    return len + s + "\r\n";
+}
+
+static inline std::string multibulk(const std::vector<std::string> &args)
+{
+    char n[32];
+    snprintf(n, sizeof(n), "*%zu\r\n", args.size());
+    std::string s = n;
+    for (uint32_t i = 0; i < args.size(); i++)
+    {
+        s += bulk(args[i]);
+    }
+    return s;
+}
+
+/*
+ * stream是pipeline了npipe个请求的流, 每次一次写入, 共nreq个请求, 统计每个
+ * 请求的耗时和吞吐, 包括read, 解析和split出下一个消息的开销
+ */
+static inline void pipelineBench(NcContext *ctx, NcProtocolType type,
+    const std::string &stream, int npipe, int nreq, const NcConfHttpKey *http_key = NULL)
+{
+    std::vector<NcMsg*> msgs;
+    int loops = nreq / npipe;
+    int64_t cost = 0;
+    // 关掉FUNCTION_INTO的日志, 只测读入和解析
+    NcLogger::getInstance().setLevel(LLOG_WARN);
+    for (int l = 0; l < loops; l++)
+    {
+        int64_t start = NcUtil::ncPreciseUsec();
+        rstatus_t status = feed(ctx, type, true, stream, stream.size(), &msgs, http_key);
+        cost += NcUtil::ncPreciseUsec() - start;
+        ASSERT(status == NC_OK && (int)msgs.size() == npipe);
+        release(ctx, &msgs);
+    }
+    NcLogger::getInstance().setLevel(LLOG_PVERB);
+
+    double nreqs = (double)loops * npipe;
+    LOG_DEBUG("pipeline %3d : %.1f ns/req, %.1f MB/s", npipe, cost * 1000.0 / nreqs,
+        stream.size() * (double)loops / cost);
+}
+
+/* pool of servers ("host:port:weight") as set up from a conf */
+static inline NcServerPool* makePool(NcContext *ctx, NcConfPool *cp,
+    const std::vector<std::string> &servers, int dist, bool eject = false)
+{
+    cp->distribution = dist;
+    cp->auto_eject_hosts = eject;
+    for (size_t i = 0; i < servers.size(); i++)
+    {
+        NcString value(servers[i].data(), (uint32_t)servers[i].size());
+        NcConfServer *cs = new NcConfServer();
+        rstatus_t status = cs->parse(value);
+        ASSERT(status == NC_OK);
+        cp->server.push_back(cs);
+    }
+
+    NcServerPool *pool = new NcServerPool(ctx);
+    pool->setConf(cp);
+    return pool;
+}
+
+/* n servers of weight 1, 10.x.y.z:6379 */
+static inline std::vector<std::string> manyServers(int n)
+{
+    std::vector<std::string> servers;
+    char buf[64];
+    for (int i = 0; i < n; i++)
+    {
+        snprintf(buf, sizeof(buf), "10.%d.%d.%d:6379:1", i >> 16, (i >> 8) & 0xff, i & 0xff);
+        servers.push_back(buf);
+    }
+    return servers;
+}
+
+#endif
@@ -1,7 +1,56 @@
 #include <nc_util.h>
 
+#define CLOCK_LOOPS     1000000
+
+/*
+ * 每个请求在msg reset时读两次时钟(请求和响应), 对比gettimeofday,
+ * clock_gettime和每轮事件循环只读一次的缓存时钟
+ */
+static void clockBench()
+{
+    volatile int64_t sink = 0;
+
+    int64_t start = NcUtil::ncPreciseUsec();
+    for (int i = 0; i < CLOCK_LOOPS; i++)
+    {
+        sink += NcUtil::ncUsecNow();
+    }
+    int64_t tod = NcUtil::ncPreciseUsec() - start;
+
+    start = NcUtil::ncPreciseUsec();
+    for (int i = 0; i < CLOCK_LOOPS; i++)
+    {
+        sink += NcUtil::ncPreciseUsec();
+    }
+    int64_t mono = NcUtil::ncPreciseUsec() - start;
+
+    NcUtil::ncTimeUpdate();
+    start = NcUtil::ncPreciseUsec();
+    for (int i = 0; i < CLOCK_LOOPS; i++)
+    {
+        sink += NcUtil::ncCachedUsec();
+    }
+    int64_t cached = NcUtil::ncPreciseUsec() - start;
+
+    LOG_DEBUG("clock read ns : gettimeofday %.1f, clock_gettime %.1f, cached %.1f",
+        tod * 1000.0 / CLOCK_LOOPS, mono * 1000.0 / CLOCK_LOOPS,
+        cached * 1000.0 / CLOCK_LOOPS);
+    LOG_DEBUG("per request : 2 clock reads before, 0 now (1 per loop iteration)");
+
+    // 缓存的时间只在ncTimeUpdate时前进
+    int64_t then = NcUtil::ncCachedUsec();
+    ::usleep(2000);
+    ASSERT(NcUtil::ncCachedUsec() == then);
+    ASSERT(NcUtil::ncTimeUpdate() - then >= 2000);
+    ASSERT(NcUtil::ncCachedMsec() == NcUtil::ncCachedUsec() / 1000);
+}
+
 int main(int argc, char **argv)
 {
+    NcLogger::getInstance().init(LLOG_PVERB, "./test.logs");
+
+    clockBench();
+
     NcUtil::ncDaemonize(0);
     return 0;
-}
\ No newline at end of file
+}